@@ -9,6 +9,14 @@ xchg8:
 	xchg [edx], al
 	ret
 
+global xchg16
+xchg16:
+	xor eax, eax
+	mov edx, [esp + 4]
+	mov ax, [esp + 8]
+	xchg [edx], ax
+	ret
+
 global xchg32
 xchg32:
 	xor eax, eax
@@ -24,6 +32,13 @@ lock_add32:
 	lock add [edx], eax
 	ret
 
+global lock_xadd32
+lock_xadd32:
+	mov edx, [esp + 4]
+	mov eax, [esp + 8]
+	lock xadd [edx], eax
+	ret
+
 global lock_cmpxchg32
 lock_cmpxchg32:
 	mov edx, [esp + 4]
@@ -7,6 +7,8 @@
 #define hlt() do{__asm__("hlt\n");}while(0)
 #define cli() do{__asm__("cli\n");}while(0)
 #define sti() do{__asm__("sti\n");}while(0)
+// sti takes effect after the next instruction, so no interrupt comes before hlt
+#define stiHlt() do{__asm__("sti\nhlt\n");}while(0)
 #define nop() do{__asm__("nop\n");}while(0)
 #define pause() do{__asm__("pause\n");}while(0)
 
@@ -29,8 +31,11 @@ void out8(uint16_t port, uint8_t value);
 void out16(uint16_t port, uint16_t value);
 void out32(uint16_t port, uint32_t value);
 uint8_t xchg8(volatile uint8_t *a, uint8_t b);
+uint16_t xchg16(volatile uint16_t *a, uint16_t b);
 uint32_t xchg32(volatile uint32_t *a, uint32_t b);
 void lock_add32(volatile uint32_t *a, uint32_t b);
+// return the old value of *a
+uint32_t lock_xadd32(volatile uint32_t *a, uint32_t b);
 //if(*dst != cmp)cmp = *dst
 //else *dst = src
 //return cmp
@@ -85,4 +90,6 @@ enum MSR{
 void rdmsr(enum MSR ecx, uint32_t *edx, uint32_t *eax);
 void wrmsr(enum MSR ecx, uint32_t edx, uint32_t eax);
 
+uint64_t rdtsc(void);
+
 #endif
@@ -100,3 +100,13 @@ void wrmsr(enum MSR ecx, uint32_t edx, uint32_t eax){
 	:"c"(ecx), "d"(edx), "a"(eax)
 	);
 }
+
+uint64_t rdtsc(void){
+	uint32_t edx, eax;
+	__asm__ volatile(
+	"rdtsc\n"
+	:"=d"(edx),"=a"(eax)
+	:
+	);
+	return COMBINE64(edx, eax);
+}
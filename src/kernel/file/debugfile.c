@@ -0,0 +1,191 @@
+#include"fileservice.h"
+#include"kernel.h"
+#include"memory/memory.h"
+#include"multiprocessor/spinlock.h"
+#include"multiprocessor/perfcounter.h"
+
+// read-only files generated when opened
+
+#define MAX_DEBUG_FILE_COUNT (16)
+#define DEBUG_FILE_SIZE (PAGE_SIZE * 4)
+
+static struct{
+	const char *name;
+	PrintDebugFile *print;
+}debugFile[MAX_DEBUG_FILE_COUNT];
+static int debugFileCount = 0;
+static Spinlock debugFileLock = INITIAL_SPINLOCK;
+
+typedef struct{
+	uintptr_t length;
+	char content[DEBUG_FILE_SIZE];
+}OpenedDebugFile;
+
+int addDebugFile(const char *name, PrintDebugFile *print){
+	int ok;
+	acquireLock(&debugFileLock);
+	ok = (debugFileCount < MAX_DEBUG_FILE_COUNT);
+	if(ok){
+		debugFile[debugFileCount].name = name;
+		debugFile[debugFileCount].print = print;
+		debugFileCount++;
+	}
+	releaseLock(&debugFileLock);
+	return ok;
+}
+
+static PrintDebugFile *findDebugFile(const char *name, uintptr_t nameLength){
+	PrintDebugFile *print = NULL;
+	int i;
+	acquireLock(&debugFileLock);
+	for(i = 0; i < debugFileCount; i++){
+		if((uintptr_t)strlen(debugFile[i].name) == nameLength && strncmp(debugFile[i].name, name, nameLength) == 0){
+			print = debugFile[i].print;
+			break;
+		}
+	}
+	releaseLock(&debugFileLock);
+	return print;
+}
+
+static int seekReadDebugFile(
+	RWFileRequest *rwfr, OpenedFile *of,
+	uint8_t *buffer, uint64_t offset64, uintptr_t bufferSize
+){
+	OpenedDebugFile *f = getFileInstance(of);
+	uintptr_t copySize = 0;
+	if(offset64 < f->length){
+		copySize = MIN(bufferSize, f->length - (uintptr_t)offset64);
+	}
+	memcpy(buffer, f->content + (uintptr_t)offset64, copySize);
+	completeRWFileIO(rwfr, copySize, copySize);
+	return 1;
+}
+
+static int getDebugFileParameter(FileIORequest2 *fior2, OpenedFile *of, uintptr_t parameterCode){
+	OpenedDebugFile *f = getFileInstance(of);
+	switch(parameterCode){
+	case FILE_PARAM_SIZE:
+		completeFileIO64(fior2, f->length);
+		break;
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+static void closeDebugFile(CloseFileRequest *cfr, OpenedFile *of){
+	OpenedDebugFile *f = getFileInstance(of);
+	completeCloseFile(cfr);
+	DELETE(f);
+}
+
+static int openDebugFile(OpenFileRequest *ofr, const char *fileName, uintptr_t nameLength, OpenFileMode mode){
+	EXPECT(mode.enumeration == 0);
+	PrintDebugFile *print = findDebugFile(fileName, nameLength);
+	EXPECT(print != NULL);
+	OpenedDebugFile *NEW(f);
+	EXPECT(f != NULL);
+	int length = print(f->content, DEBUG_FILE_SIZE);
+	f->length = MAX(length, 0);
+
+	FileFunctions ff = INITIAL_FILE_FUNCTIONS;
+	ff.read = seekReadByOffset;
+	ff.seekRead = seekReadDebugFile;
+	ff.getParameter = getDebugFileParameter;
+	ff.close = closeDebugFile;
+	completeOpenFile(ofr, f, &ff);
+	return 1;
+	//DELETE(f);
+	ON_ERROR;
+	ON_ERROR;
+	ON_ERROR;
+	return 0;
+}
+
+void initDebugFile(void){
+	FileNameFunctions ff = INITIAL_FILE_NAME_FUNCTIONS;
+	ff.open = openDebugFile;
+	if(addFileSystem(&ff, "debug", strlen("debug")) == 0){
+		panic("cannot register debug file system");
+	}
+	if(addDebugFile("lockstat", printSpinlockStatistics) == 0){
+		panic("cannot add lockstat debug file");
+	}
+	if(addDebugFile("counter", printPerformanceCounters) == 0 ||
+		addDebugFile("interrupt", printInterruptCounters) == 0 ||
+		addDebugFile("trace", printTraceBuffers) == 0 ||
+		addDebugFile("profile", printProfileSamples) == 0){
+		panic("cannot add performance counter debug files");
+	}
+}
+
+#undef DEBUG_FILE_SIZE
+#undef MAX_DEBUG_FILE_COUNT
+
+#ifndef NDEBUG
+
+#include"task/task.h"
+#include"task/exclusivelock.h"
+#include"multiprocessor/processorlocal.h"
+
+#define TEST_TASK_COUNT (4)
+#define TEST_LOOP_COUNT (100000)
+
+typedef struct{
+	Spinlock lock;
+	volatile uint32_t value;
+	Semaphore *done;
+}LockTest;
+
+static void lockTestTask(void *arg){
+	LockTest *t = *(LockTest**)arg;
+	int i;
+	for(i = 0; i < TEST_LOOP_COUNT; i++){
+		acquireLock(&t->lock);
+		t->value++;
+		releaseLock(&t->lock);
+	}
+	releaseSemaphore(t->done);
+	systemCall_terminate();
+}
+
+void testLockStatistics(void){
+	LockTest *NEW(t);
+	assert(t != NULL);
+	t->lock = initialSpinlock;
+	t->value = 0;
+	t->done = createSemaphore(0);
+	assert(t->done != NULL);
+	addNamedSpinlock(&t->lock, "test");
+	int i;
+	for(i = 0; i < TEST_TASK_COUNT; i++){
+		Task *task = createSharedMemoryTask(lockTestTask, &t, sizeof(t), processorLocalTask());
+		assert(task != NULL);
+		resume(task);
+	}
+	for(i = 0; i < TEST_TASK_COUNT; i++){
+		acquireSemaphore(t->done);
+	}
+	assert(t->value == TEST_TASK_COUNT * TEST_LOOP_COUNT);
+	assert(t->lock.acquireCount == TEST_TASK_COUNT * TEST_LOOP_COUNT);
+	uintptr_t file = syncOpenFile("debug:lockstat");
+	assert(file != IO_REQUEST_FAILURE);
+	char buffer[256];
+	while(1){
+		uintptr_t readSize = sizeof(buffer);
+		uintptr_t r = syncReadFile(file, buffer, &readSize);
+		assert(r != IO_REQUEST_FAILURE);
+		if(readSize == 0){
+			break;
+		}
+		printkString(buffer, readSize);
+	}
+	syncCloseFile(file);
+	systemCall_terminate();
+}
+
+#undef TEST_LOOP_COUNT
+#undef TEST_TASK_COUNT
+
+#endif
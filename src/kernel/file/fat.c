@@ -125,6 +125,16 @@ typedef struct FAT32DiskPartition{
 	char partitionName;
 	const FATBootSector *bootRecord;
 	uint32_t *fat;
+	// number of FAT entries, including the 2 reserved ones, that map to data clusters
+	uint32_t clusterCount;
+	// fatLock protects the following fields and the free entries in fat
+	// entries in a cluster chain are protected by the rwLock of the file
+	Semaphore *fatLock;
+	uint32_t nextFreeCluster;
+	// one bit for each page of fat that differs from the disk. see flushFATFiles
+	uint8_t *dirtyFATPage;
+	// read-modify-write of directory sectors
+	Semaphore *directoryLock;
 
 	struct FAT32DiskPartition **prev, *next;
 }FAT32DiskPartition;
@@ -169,8 +179,12 @@ static uint64_t clusterToLBA(const FAT32DiskPartition *dp, uint32_t cluster){
 	return dp->firstDataLBA + (cluster - 2) * (uint64_t)dp->bootRecord->sectorsPerCluster;
 }
 
+static uintptr_t getFATSize(const FATBootSector *br){
+	return br->ebr32.sectorsPerFAT32 * br->bytesPerSector;
+}
+
 static uint32_t *loadFAT32(const FATBootSector *br, const FAT32DiskPartition *dp){
-	const size_t fatSize = br->ebr32.sectorsPerFAT32 * br->bytesPerSector; // what is the actual length of fat?
+	const size_t fatSize = getFATSize(br); // what is the actual length of fat?
 	const uint64_t fatBeginLBA = dp->startLBA + br->reservedSectorCount;
 	//TODO: ahci driver accepts non-aligned buffer
 	uint32_t *fat = systemCall_allocateHeap(CEIL(fatSize, PAGE_SIZE), KERNEL_NON_CACHED_PAGE);
@@ -202,6 +216,8 @@ static uint32_t nextClusterByFAT(uint32_t cluster, const FAT32DiskPartition *dp)
 
 static int isValidCluster(uint32_t cluster, const FAT32DiskPartition *dp){
 	const uint32_t clustersPerFAT = (dp->bootRecord->ebr32.sectorsPerFAT32 * dp->bootRecord->bytesPerSector) / sizeof(dp->fat[0]);
+	if(cluster < 2) // empty file
+		return 0;
 	if(cluster >= END_OF_CLUSTER || cluster >= clustersPerFAT) // end of cluster chain
 		return 0;
 	if(dp->fat[cluster] == BAD_CLUSTER)
@@ -209,9 +225,6 @@ static int isValidCluster(uint32_t cluster, const FAT32DiskPartition *dp){
 	return 1;
 }
 
-#undef BAD_CLUSTER
-#undef END_OF_CLUSTER
-
 static uint32_t countClusterByFAT(uint32_t cluster, const FAT32DiskPartition *dp){
 	uint32_t clusterCount;
 	for(clusterCount = 0; isValidCluster(cluster, dp); clusterCount++){
@@ -220,6 +233,118 @@ static uint32_t countClusterByFAT(uint32_t cluster, const FAT32DiskPartition *dp
 	return clusterCount;
 }
 
+// the highest 4 bits of FAT32 entries are reserved
+#define FAT_ENTRY_MASK (0x0fffffff)
+#define END_OF_CHAIN (0x0fffffff)
+
+static int isFreeCluster(uint32_t cluster, const FAT32DiskPartition *dp){
+	return (dp->fat[cluster] & FAT_ENTRY_MASK) == 0;
+}
+
+// assume fatLock is acquired
+static void setFATEntry(FAT32DiskPartition *dp, uint32_t cluster, uint32_t value){
+	dp->fat[cluster] = (dp->fat[cluster] & ~FAT_ENTRY_MASK) | (value & FAT_ENTRY_MASK);
+	const uintptr_t page = (cluster * sizeof(dp->fat[0])) / PAGE_SIZE;
+	dp->dirtyFATPage[page / 8] |= (1 << (page % 8));
+}
+
+static void freeClusterChain(FAT32DiskPartition *dp, uint32_t cluster){
+	while(isValidCluster(cluster, dp)){
+		const uint32_t next = nextClusterByFAT(cluster, dp);
+		setFATEntry(dp, cluster, 0);
+		if(cluster < dp->nextFreeCluster){
+			dp->nextFreeCluster = cluster;
+		}
+		cluster = next;
+	}
+}
+
+// search from begin for the first free run of at least maxLength clusters
+// if there is no such run, return the first free cluster found
+// return 0 if the disk is full
+static uint32_t searchFreeClusters(const FAT32DiskPartition *dp, uint32_t begin, uint32_t maxLength, uint32_t *runLength){
+	uint32_t firstFree = 0, firstFreeLength = 0, runBegin = 0, length = 0;
+	uint32_t c = (begin >= 2 && begin < dp->clusterCount? begin: 2), i;
+	for(i = 2; i < dp->clusterCount; i++){
+		if(isFreeCluster(c, dp)){
+			if(length == 0){
+				runBegin = c;
+			}
+			length++;
+			if(length == maxLength){
+				*runLength = length;
+				return runBegin;
+			}
+		}
+		else{
+			if(firstFree == 0 && length != 0){
+				firstFree = runBegin;
+				firstFreeLength = length;
+			}
+			length = 0;
+		}
+		c++;
+		if(c == dp->clusterCount){
+			// a run does not wrap around the end of fat
+			if(firstFree == 0 && length != 0){
+				firstFree = runBegin;
+				firstFreeLength = length;
+			}
+			length = 0;
+			c = 2;
+		}
+	}
+	if(firstFree == 0 && length != 0){
+		firstFree = runBegin;
+		firstFreeLength = length;
+	}
+	*runLength = firstFreeLength;
+	return firstFree;
+}
+
+// allocate count clusters and append them to the chain ending at lastCluster (0 if the chain is empty)
+// the clusters are contiguous if there is a large enough free run
+// return the first allocated cluster, or 0 if the disk is full
+static uint32_t allocateClusters(FAT32DiskPartition *dp, uint32_t lastCluster, uint32_t count){
+	acquireSemaphore(dp->fatLock);
+	uint32_t first = 0, last = lastCluster, allocated = 0;
+	uint32_t begin = (lastCluster != 0? lastCluster + 1: dp->nextFreeCluster);
+	while(allocated < count){
+		uint32_t runLength;
+		uint32_t c = searchFreeClusters(dp, begin, count - allocated, &runLength);
+		if(c == 0)
+			break;
+		uint32_t i;
+		for(i = 0; i < runLength; i++){
+			setFATEntry(dp, c + i, END_OF_CHAIN);
+			if(last != 0){
+				setFATEntry(dp, last, c + i);
+			}
+			if(first == 0){
+				first = c + i;
+			}
+			last = c + i;
+		}
+		allocated += runLength;
+		begin = last + 1;
+	}
+	if(allocated < count){
+		freeClusterChain(dp, first);
+		if(lastCluster != 0){
+			setFATEntry(dp, lastCluster, END_OF_CHAIN);
+		}
+		first = 0;
+	}
+	else{
+		dp->nextFreeCluster = last + 1;
+	}
+	releaseSemaphore(dp->fatLock);
+	return first;
+}
+
+#undef BAD_CLUSTER
+#undef END_OF_CLUSTER
+
 // currently not support long file name
 #define FAT_SHORT_NAME_LENGTH (11)
 
@@ -297,10 +422,30 @@ static FAT32DiskPartition *createFATPartition(uintptr_t fileHandle, uint64_t sta
 	dp->firstDataLBA = dp->startLBA +
 		(uint64_t)br->reservedSectorCount + br->ebr32.sectorsPerFAT32 * (uint64_t)br->fatCount;
 	//printk("read fat ok\n");
+	const uint32_t sectorCount = (br->sectorCount != 0? br->sectorCount: br->SectorCount2);
+	const uint32_t dataBegin = br->reservedSectorCount + br->ebr32.sectorsPerFAT32 * br->fatCount;
+	EXPECT(sectorCount > dataBegin);
+	dp->clusterCount = MIN((sectorCount - dataBegin) / br->sectorsPerCluster + 2, getFATSize(br) / sizeof(fat[0]));
+	dp->nextFreeCluster = 2;
+	dp->fatLock = createSemaphore(1);
+	EXPECT(dp->fatLock != NULL);
+	dp->directoryLock = createSemaphore(1);
+	EXPECT(dp->directoryLock != NULL);
+	const uintptr_t fatPageCount = CEIL(getFATSize(br), PAGE_SIZE) / PAGE_SIZE;
+	dp->dirtyFATPage = allocateKernelMemory(CEIL(fatPageCount, 8) / 8);
+	EXPECT(dp->dirtyFATPage != NULL);
+	memset(dp->dirtyFATPage, 0, CEIL(fatPageCount, 8) / 8);
 	dp->prev = NULL;
 	dp->next = NULL;
 	return dp;
-	//systemCall_releaseHeap(fat);
+	//releaseKernelMemory(dp->dirtyFATPage);
+	ON_ERROR;
+	deleteSemaphore(dp->directoryLock);
+	ON_ERROR;
+	deleteSemaphore(dp->fatLock);
+	ON_ERROR;
+	ON_ERROR;
+	systemCall_releaseHeap(fat);
 	ON_ERROR;
 	ON_ERROR;
 	ON_ERROR;
@@ -314,21 +459,26 @@ static FAT32DiskPartition *createFATPartition(uintptr_t fileHandle, uint64_t sta
 
 #define FAT32_SERVICE_NAME "fat32"
 
+#define FAT_WORKER_COUNT (8)
+
 struct FAT32DiskPartitionList{
-	Task *mainTask;
+	WorkerPool *workers;
 	FAT32DiskPartition *head;
 	Spinlock lock;
-}fat32List = {NULL, NULL, INITIAL_SPINLOCK};
+	// serialize flushFATFiles, which uses writeBuffer
+	Semaphore *flushLock;
+	uint8_t *writeBuffer;
+}fat32List = {NULL, NULL, INITIAL_SPINLOCK, NULL, NULL};
 
 static FAT32DiskPartition *searchFAT32DiskPartition(const char *fileName, uintptr_t *index, uintptr_t nameLength){
 	EXPECT(nameLength == 1 || (nameLength > 1 && fileName[1] == '/'));
 	FAT32DiskPartition *f;
-	acquireLock(&fat32List.lock);
-	for(f = fat32List.head; f != NULL; f = f->next){
+	const int interruptFlag = beginRCURead();
+	for(f = RCU_READ(fat32List.head); f != NULL; f = RCU_READ(f->next)){
 		if(toupper(f->partitionName) == toupper(fileName[0]))
 			break;
 	}
-	releaseLock(&fat32List.lock);
+	endRCURead(interruptFlag);
 	EXPECT(f != NULL);
 	*index = 1;
 	return f;
@@ -339,33 +489,73 @@ static FAT32DiskPartition *searchFAT32DiskPartition(const char *fileName, uintpt
 
 static void addFAT32DiskPartition(FAT32DiskPartition *dp){
 	acquireLock(&fat32List.lock);
-	ADD_TO_DQUEUE(dp, &fat32List.head);
+	RCU_ADD_TO_DQUEUE(dp, &fat32List.head);
 	releaseLock(&fat32List.lock);
 }
 
 // FAT file
 
+// the root directory is {0, 0}
+typedef struct{
+	uint32_t parentCluster;
+	uint32_t entryIndex;
+}FATEntryLocation;
+
 typedef struct FATFile{
 	// search key
-	uint32_t beginCluster;
-	const FAT32DiskPartition *diskPartition;
+	FATEntryLocation location;
+	FAT32DiskPartition *diskPartition;
 	// lock
 	ReaderWriterLock *rwLock;
 	int referenceCount;
+	// 0 if the file has no cluster. clusters are allocated when the file is flushed
+	uint32_t beginCluster;
+	uint32_t fileSize;
+	// whole file in kernel pages, shared by all mapFAT requests. see ensureFATFileContent
+	// clusters are read from disk when they are first accessed. see loadFATClusters
+	uint8_t *content;
+	uintptr_t contentSize;
+	// one bit for each cluster of content
+	// a loaded cluster holds the file data, which is newer than the disk, and 0 after fileSize
+	// only the clusters before fileSize can be not loaded
+	// a dirty cluster is loaded and not written to disk
+	uint8_t *loadedCluster, *dirtyCluster;
+	// content replaced by a larger one; mapFAT may have returned pointers to it
+	// released with the file. the total size is less than contentSize
+	struct RetiredFATContent *retiredContent;
+	// see FILE_PARAM_VERSION and markFATFileDirty
+	uint64_t version;
+	// a dirty file holds a reference until it is flushed. see markFATFileDirty
+	int isDirty;
+	struct FATFile *nextDirty;
 
 	struct FATFile *next, **prev;
 }FATFile;
 
+struct RetiredFATContent{
+	uint8_t *content;
+	struct RetiredFATContent *next;
+};
+
+// versions are taken from one counter
+// a file gets a new version when modified. a file loaded from disk gets baseVersion,
+// which is raised to the version of every modified file when it is released
+// so a file released after modification never returns to an older version
 struct FATFileList{
 	FATFile *head;
+	FATFile *dirtyHead;
+	uint64_t versionCounter, baseVersion;
 	Spinlock lock;
-}fatFileList = {NULL, INITIAL_SPINLOCK};
+}fatFileList = {NULL, NULL, 0, 0, INITIAL_SPINLOCK};
 
-static FATFile *searchCreateFATFile(const FAT32DiskPartition *dp, uint32_t cluster, int refCnt){
+static FATFile *searchCreateFATFile(
+	FAT32DiskPartition *dp, FATEntryLocation location, const FATDirEntry *d, int refCnt
+){
 	acquireLock(&fatFileList.lock);
 	FATFile *ff;
 	for(ff = fatFileList.head; ff != NULL; ff = ff->next){
-		if(ff->beginCluster == cluster && ff->diskPartition == dp)
+		if(ff->location.parentCluster == location.parentCluster &&
+			ff->location.entryIndex == location.entryIndex && ff->diskPartition == dp)
 			break;
 	}
 	while(ff != NULL){
@@ -378,7 +568,7 @@ static FATFile *searchCreateFATFile(const FAT32DiskPartition *dp, uint32_t clust
 		releaseLock(&fatFileList.lock);
 		return NULL;
 	}
-	ff->beginCluster = cluster;
+	ff->location = location;
 	ff->rwLock = createReaderWriterLock(1);
 	if(ff->rwLock == NULL){
 		releaseLock(&fatFileList.lock);
@@ -386,6 +576,16 @@ static FATFile *searchCreateFATFile(const FAT32DiskPartition *dp, uint32_t clust
 		return NULL;
 	}
 	ff->referenceCount = refCnt;
+	ff->beginCluster = getBeginCluster(d);
+	ff->fileSize = d->fileSize;
+	ff->content = NULL;
+	ff->contentSize = 0;
+	ff->loadedCluster = NULL;
+	ff->dirtyCluster = NULL;
+	ff->retiredContent = NULL;
+	ff->version = fatFileList.baseVersion;
+	ff->isDirty = 0;
+	ff->nextDirty = NULL;
 	ff->diskPartition = dp;
 	ff->next = NULL;
 	ff->prev = NULL;
@@ -401,15 +601,64 @@ static int addFATFileReference(FATFile *ff, int refCnt){
 	int needDelete = (r == 0);
 	if(needDelete){
 		REMOVE_FROM_DQUEUE(ff);
+		fatFileList.baseVersion = MAX(fatFileList.baseVersion, ff->version);
 	}
 	releaseLock(&fatFileList.lock);
 	if(needDelete){
+		assert(ff->isDirty == 0);
+		// the pages are still referenced by the tasks mapping them
+		if(ff->content != NULL){
+			checkAndReleaseKernelPages(ff->content);
+			releaseKernelMemory(ff->loadedCluster);
+			releaseKernelMemory(ff->dirtyCluster);
+		}
+		while(ff->retiredContent != NULL){
+			struct RetiredFATContent *retired = ff->retiredContent;
+			ff->retiredContent = retired->next;
+			checkAndReleaseKernelPages(retired->content);
+			DELETE(retired);
+		}
 		deleteReaderWriterLock(ff->rwLock);
 		DELETE(ff);
 	}
 	return r;
 }
 
+static int isClusterBitSet(const uint8_t *bitmap, uintptr_t index){
+	return (bitmap[index / 8] >> (index % 8)) & 1;
+}
+
+static void setClusterBit(uint8_t *bitmap, uintptr_t index){
+	bitmap[index / 8] |= (1 << (index % 8));
+}
+
+static uintptr_t getClusterBitmapSize(uintptr_t contentSize, uintptr_t clusterSize){
+	return CEIL(contentSize / clusterSize, 8) / 8;
+}
+
+// assume the writer lock is acquired
+// the clusters in [dirtyBegin, dirtyEnd) are loaded
+static void markFATFileDirty(FATFile *ff, uint32_t dirtyBegin, uint32_t dirtyEnd){
+	if(dirtyBegin < dirtyEnd){
+		const uint32_t clusterSize = getClusterSize(ff->diskPartition);
+		uint32_t i;
+		for(i = dirtyBegin / clusterSize; i < CEIL(dirtyEnd, clusterSize) / clusterSize; i++){
+			assert(isClusterBitSet(ff->loadedCluster, i));
+			setClusterBit(ff->dirtyCluster, i);
+		}
+	}
+	acquireLock(&fatFileList.lock);
+	fatFileList.versionCounter++;
+	ff->version = fatFileList.versionCounter;
+	if(ff->isDirty == 0){
+		ff->isDirty = 1;
+		ff->referenceCount++;
+		ff->nextDirty = fatFileList.dirtyHead;
+		fatFileList.dirtyHead = ff;
+	}
+	releaseLock(&fatFileList.lock);
+}
+
 typedef struct{
 	OpenFileMode mode;
 	FATDirEntry dirEntry;
@@ -418,13 +667,13 @@ typedef struct{
 
 static OpenedFATFile *createOpenedFATFile(
 	OpenFileMode ofm,
-	const FAT32DiskPartition *dp, const FATDirEntry *dir
+	FAT32DiskPartition *dp, const FATDirEntry *dir, FATEntryLocation location
 ){
 	OpenedFATFile *NEW(f);
 	EXPECT(f != NULL);
 	f->mode = ofm;
 	f->dirEntry = (*dir);
-	f->shared = searchCreateFATFile(dp, getBeginCluster(dir), 1);
+	f->shared = searchCreateFATFile(dp, location, dir, 1);
 	EXPECT(f->shared != NULL);
 	return f;
 	//addFATFileReference(f->shared, -1);
@@ -442,13 +691,14 @@ static void deleteOpenedFATFile(OpenedFATFile *f){
 // openFAT
 
 typedef struct{
+	WorkItem work;
 	uintptr_t nameLength;
 	OpenFileMode mode;
 	OpenFileRequest *ofr;
 	char fileName[];
 }OpenFATRequest;
 
-static void openFATTask(void *p);
+static void openFATWork(void *p);
 
 static int openFAT(OpenFileRequest *ofr, const char *fileName, uintptr_t nameLength, OpenFileMode mode){
 	OpenFATRequest *ofr2 = allocateKernelMemory(sizeof(*ofr2) + nameLength);
@@ -457,11 +707,9 @@ static int openFAT(OpenFileRequest *ofr, const char *fileName, uintptr_t nameLen
 	ofr2->nameLength = nameLength;
 	ofr2->mode = mode;
 	ofr2->ofr = ofr;
-	Task *t = createSharedMemoryTask(openFATTask, &ofr2, sizeof(ofr2), fat32List.mainTask);
-	EXPECT(t != NULL);
-	resume(t);
+	initWorkItem(&ofr2->work, openFATWork, ofr2);
+	EXPECT(submitWork(fat32List.workers, &ofr2->work));
 	return 1;
-	// delete task
 	ON_ERROR;
 	DELETE(ofr2);
 	ON_ERROR;
@@ -471,6 +719,7 @@ static int openFAT(OpenFileRequest *ofr, const char *fileName, uintptr_t nameLen
 // readFAT
 
 typedef struct{
+	WorkItem work;
 	void *buffer;
 	uintptr_t inputRWSize;
 	OpenedFATFile *file;
@@ -478,30 +727,35 @@ typedef struct{
 	RWFileRequest *rwfr;
 }RWFATRequest;
 
-static void rwFATTask(void *rwfrPtr);
-
-static int seekReadFAT(
+static int submitRWFAT(
 	RWFileRequest *rwfr, OpenedFile *of,
-	uint8_t *buffer, uint64_t offset, uintptr_t readSize
+	void *buffer, uint64_t offset, uintptr_t rwSize, void (*run)(void*)
 ){
 	RWFATRequest *NEW(rwfr2);
 	EXPECT(rwfr2 != NULL);
 	rwfr2->rwfr = rwfr;
 	rwfr2->file = getFileInstance(of);
-	rwfr2->inputRWSize = readSize;
+	rwfr2->inputRWSize = rwSize;
 	rwfr2->inputOffset = (uint32_t)offset;
 	rwfr2->buffer = buffer;
-	Task *t = createSharedMemoryTask(rwFATTask, &rwfr2, sizeof(rwfr2), fat32List.mainTask);
-	EXPECT(t != NULL);
-	resume(t);
+	initWorkItem(&rwfr2->work, run, rwfr2);
+	EXPECT(submitWork(fat32List.workers, &rwfr2->work));
 	return 1;
-	// delete task
 	ON_ERROR;
 	DELETE(rwfr2);
 	ON_ERROR;
 	return 0;
 }
 
+static void rwFATWork(void *voidRWFR);
+
+static int seekReadFAT(
+	RWFileRequest *rwfr, OpenedFile *of,
+	uint8_t *buffer, uint64_t offset, uintptr_t readSize
+){
+	return submitRWFAT(rwfr, of, buffer, offset, readSize, rwFATWork);
+}
+
 static int readFAT(
 	RWFileRequest *rwfr, OpenedFile *of,
 	uint8_t *buffer, uintptr_t readSize
@@ -546,8 +800,157 @@ static uintptr_t readByFAT(
 	return 0;
 }
 
-static void rwFATTask(void *rwfrPtr){
-	RWFATRequest *rwfr = *(RWFATRequest**)rwfrPtr;
+// a file is written and mapped through one kernel allocation covering the whole file
+// so writing or mapping a file larger than 1GB fails, although reading it does not
+#define MAX_FAT_CONTENT_SIZE (0x40000000)
+
+// assume the writer lock is acquired
+// make sure that ff->content can hold size bytes without reading the file
+// the new clusters after fileSize are loaded as 0
+static int ensureFATFileContent(FATFile *ff, uint32_t size){
+	// the content has to fit in kernel linear memory
+	EXPECT(size <= MAX_FAT_CONTENT_SIZE);
+	const uintptr_t clusterSize = getClusterSize(ff->diskPartition);
+	// flushFATFiles writes whole clusters from the content
+	const uintptr_t requiredSize = MAX(CEIL(CEIL((uintptr_t)size, clusterSize), PAGE_SIZE), PAGE_SIZE);
+	if(ff->content != NULL && ff->contentSize >= requiredSize){
+		return 1;
+	}
+	const uintptr_t newSize = (ff->content == NULL? requiredSize: MAX(requiredSize, ff->contentSize * 2));
+	const uintptr_t bitmapSize = getClusterBitmapSize(newSize, clusterSize);
+	uint8_t *newContent = allocateKernelPages(newSize, KERNEL_PAGE);
+	EXPECT(newContent != NULL);
+	uint8_t *newLoaded = allocateKernelMemory(bitmapSize);
+	EXPECT(newLoaded != NULL);
+	uint8_t *newDirty = allocateKernelMemory(bitmapSize);
+	EXPECT(newDirty != NULL);
+	struct RetiredFATContent *retired = NULL;
+	if(ff->content != NULL){
+		NEW(retired);
+	}
+	EXPECT(ff->content == NULL || retired != NULL);
+	memset(newLoaded, 0, bitmapSize);
+	memset(newDirty, 0, bitmapSize);
+	if(ff->content != NULL){
+		const uintptr_t oldBitmapSize = getClusterBitmapSize(ff->contentSize, clusterSize);
+		memcpy(newContent, ff->content, ff->contentSize);
+		memcpy(newLoaded, ff->loadedCluster, oldBitmapSize);
+		memcpy(newDirty, ff->dirtyCluster, oldBitmapSize);
+		releaseKernelMemory(ff->loadedCluster);
+		releaseKernelMemory(ff->dirtyCluster);
+		// splice and map requests may still be reading the old content without the lock
+		retired->content = ff->content;
+		retired->next = ff->retiredContent;
+		ff->retiredContent = retired;
+	}
+	const uintptr_t zeroBegin = MAX(ff->contentSize, CEIL((uintptr_t)ff->fileSize, clusterSize));
+	memset(newContent + zeroBegin, 0, newSize - zeroBegin);
+	uintptr_t i;
+	for(i = zeroBegin / clusterSize; i < newSize / clusterSize; i++){
+		setClusterBit(newLoaded, i);
+	}
+	ff->content = newContent;
+	ff->contentSize = newSize;
+	ff->loadedCluster = newLoaded;
+	ff->dirtyCluster = newDirty;
+	return 1;
+
+	ON_ERROR;
+	releaseKernelMemory(newDirty);
+	ON_ERROR;
+	releaseKernelMemory(newLoaded);
+	ON_ERROR;
+	checkAndReleaseKernelPages(newContent);
+	ON_ERROR;
+	ON_ERROR;
+	return 0;
+}
+
+// assume the writer lock is acquired and ff->content covers end
+// read the clusters overlapping [begin, end) from disk if they are not loaded
+static int loadFATClusters(FATFile *ff, uint32_t begin, uint32_t end){
+	const uint32_t clusterSize = getClusterSize(ff->diskPartition);
+	const uint32_t endIndex = CEIL(end, clusterSize) / clusterSize;
+	uint32_t i = begin / clusterSize;
+	while(i < endIndex){
+		if(isClusterBitSet(ff->loadedCluster, i)){
+			i++;
+			continue;
+		}
+		uint32_t j = i + 1;
+		while(j < endIndex && isClusterBitSet(ff->loadedCluster, j) == 0){
+			j++;
+		}
+		const uint32_t readBegin = i * clusterSize;
+		const uint32_t readEnd = MIN(j * clusterSize, ff->fileSize);
+		assert(readBegin < readEnd);
+		const uintptr_t readSize = readByFAT(ff->diskPartition, ff->content + readBegin,
+			ff->beginCluster, readBegin, readEnd - readBegin);
+		if(readSize != readEnd - readBegin){
+			return 0;
+		}
+		memset(ff->content + readEnd, 0, j * clusterSize - readEnd);
+		for(; i < j; i++){
+			setClusterBit(ff->loadedCluster, i);
+		}
+	}
+	return 1;
+}
+
+// assume the reader lock is acquired and ff->content is not NULL
+// copy the loaded clusters from ff->content and read the others from disk
+static uintptr_t readFATFileContent(const FATFile *ff, uint8_t *buffer, uint32_t offset, uint32_t readSize){
+	const uint32_t clusterSize = getClusterSize(ff->diskPartition);
+	const uint32_t readEnd = offset + readSize;
+	uint32_t begin = offset;
+	while(begin < readEnd){
+		const int isLoaded = isClusterBitSet(ff->loadedCluster, begin / clusterSize);
+		uint32_t end = begin;
+		do{
+			end = FLOOR(end, clusterSize) + clusterSize;
+		}while(end < readEnd && isClusterBitSet(ff->loadedCluster, end / clusterSize) == isLoaded);
+		end = MIN(end, readEnd);
+		if(isLoaded){
+			memcpy(buffer + (begin - offset), ff->content + begin, end - begin);
+		}
+		else{
+			const uintptr_t s = readByFAT(ff->diskPartition, buffer + (begin - offset), ff->beginCluster, begin, end - begin);
+			if(s != end - begin){
+				return (begin - offset) + s;
+			}
+		}
+		begin = end;
+	}
+	return readSize;
+}
+
+// assume the writer lock is acquired
+// prepare ff->content for writing [begin, end), and for extending the file if end > fileSize
+// the clusters partly written keep the rest of their data
+static int prepareFATFileWrite(FATFile *ff, uint32_t begin, uint32_t end){
+	if(ensureFATFileContent(ff, MAX(end, ff->fileSize)) == 0){
+		return 0;
+	}
+	const uint32_t clusterSize = getClusterSize(ff->diskPartition);
+	if(begin % clusterSize != 0 && loadFATClusters(ff, begin, begin + 1) == 0){
+		return 0;
+	}
+	if(end % clusterSize != 0 && loadFATClusters(ff, end - 1, end) == 0){
+		return 0;
+	}
+	// the cluster containing the old end of file
+	if(end > ff->fileSize && loadFATClusters(ff, ff->fileSize, ff->fileSize + 1) == 0){
+		return 0;
+	}
+	uint32_t i;
+	for(i = CEIL(begin, clusterSize) / clusterSize; i < end / clusterSize; i++){
+		setClusterBit(ff->loadedCluster, i);
+	}
+	return 1;
+}
+
+static void rwFATWork(void *voidRWFR){
+	RWFATRequest *rwfr = voidRWFR;
 	OpenedFATFile *f = rwfr->file;
 	acquireReaderLock(f->shared->rwLock);
 	uintptr_t outputRWSize = 0;
@@ -578,16 +981,534 @@ static void rwFATTask(void *rwfrPtr){
 		}
 	}
 	else{
-		uint32_t readFileSize = MIN(rwfr->inputRWSize, f->dirEntry.fileSize - rwfr->inputOffset);
-		outputRWSize = readByFAT(f->shared->diskPartition,
-			rwfr->buffer, f->shared->beginCluster, offset, readFileSize);
+		const FATFile *ff = f->shared;
+		uint32_t readFileSize = (offset >= ff->fileSize? 0: MIN(rwfr->inputRWSize, ff->fileSize - offset));
+		if(ff->content != NULL){
+			outputRWSize = readFATFileContent(ff, rwfr->buffer, offset, readFileSize);
+		}
+		else{
+			outputRWSize = readByFAT(ff->diskPartition,
+				rwfr->buffer, ff->beginCluster, offset, readFileSize);
+		}
 		offset += outputRWSize;
 	}
 	releaseReaderWriterLock(f->shared->rwLock);
 
 	completeRWFileIO(rwfr->rwfr, outputRWSize, offset - rwfr->inputOffset);
 	DELETE(rwfr);
-	systemCall_terminate();
+}
+
+// writeFAT
+// data is written to ff->content and flushed by fatService or FILE_PARAM_SYNC
+// writes beyond MAX_FAT_CONTENT_SIZE fail without queuing work
+
+static void writeFATWork(void *voidRWFR);
+
+static int seekWriteFAT(
+	RWFileRequest *rwfr, OpenedFile *of,
+	const uint8_t *buffer, uint64_t offset, uintptr_t writeSize
+){
+	EXPECT(offset <= MAX_FAT_CONTENT_SIZE && writeSize <= MAX_FAT_CONTENT_SIZE - offset);
+	// writeFATWork does not modify buffer
+	return submitRWFAT(rwfr, of, (uint8_t*)buffer, offset, writeSize, writeFATWork);
+	ON_ERROR;
+	return 0;
+}
+
+static int writeFAT(
+	RWFileRequest *rwfr, OpenedFile *of,
+	const uint8_t *buffer, uintptr_t writeSize
+){
+	return seekWriteFAT(rwfr, of, buffer, getFileOffset(of), writeSize);
+}
+
+static void writeFATWork(void *voidRWFR){
+	RWFATRequest *rwfr = voidRWFR;
+	FATFile *ff = rwfr->file->shared;
+	const uint32_t writeEnd = rwfr->inputOffset + rwfr->inputRWSize;
+	uintptr_t outputRWSize = 0;
+	acquireWriterLock(ff->rwLock);
+	if(prepareFATFileWrite(ff, rwfr->inputOffset, writeEnd)){
+		memcpy(ff->content + rwfr->inputOffset, rwfr->buffer, rwfr->inputRWSize);
+		// the zeros between the old end of file and the write are also written to disk
+		const uint32_t dirtyBegin = MIN(rwfr->inputOffset, ff->fileSize);
+		ff->fileSize = MAX(writeEnd, ff->fileSize);
+		markFATFileDirty(ff, dirtyBegin, writeEnd);
+		outputRWSize = rwfr->inputRWSize;
+	}
+	releaseReaderWriterLock(ff->rwLock);
+
+	completeRWFileIO(rwfr->rwfr, outputRWSize, outputRWSize);
+	DELETE(rwfr);
+}
+
+// assume the writer lock is acquired
+static int setFATFileSize(FATFile *ff, uint32_t newSize){
+	if(newSize > ff->fileSize){
+		if(prepareFATFileWrite(ff, newSize, newSize) == 0){
+			return 0;
+		}
+		markFATFileDirty(ff, ff->fileSize, newSize);
+	}
+	else if(newSize < ff->fileSize){
+		if(ff->content != NULL){
+			// a cluster which is not loaded reads at most fileSize bytes from disk. see loadFATClusters
+			memset(ff->content + newSize, 0, ff->fileSize - newSize);
+			const uint32_t clusterSize = getClusterSize(ff->diskPartition);
+			uint32_t i;
+			for(i = CEIL(newSize, clusterSize) / clusterSize; i < CEIL(ff->fileSize, clusterSize) / clusterSize; i++){
+				setClusterBit(ff->loadedCluster, i);
+			}
+		}
+		markFATFileDirty(ff, 0, 0);
+	}
+	ff->fileSize = newSize;
+	return 1;
+}
+
+// flush
+// the clusters of dirty files are allocated here, so that each file is contiguous if possible
+// then the data and FAT are sorted by disk position and written in batches of FAT_WRITE_BATCH_PAGES pages
+
+#define FAT_WRITE_BATCH_PAGES (16)
+
+typedef struct{
+	const FAT32DiskPartition *diskPartition;
+	uint64_t position;
+	const uint8_t *source;
+	uintptr_t size;
+}DiskExtent;
+
+typedef struct{
+	DiskExtent *extent;
+	uintptr_t count, maxCount;
+}DiskExtentArray;
+
+static int appendDiskExtent(DiskExtentArray *a,
+	const FAT32DiskPartition *dp, uint64_t position, const uint8_t *source, uintptr_t size){
+	if(a->count == a->maxCount){
+		const uintptr_t newMaxCount = MAX(a->maxCount * 2, 64);
+		DiskExtent *NEW_ARRAY(newExtent, newMaxCount);
+		if(newExtent == NULL){
+			return 0;
+		}
+		if(a->extent != NULL){
+			memcpy(newExtent, a->extent, a->count * sizeof(a->extent[0]));
+			DELETE(a->extent);
+		}
+		a->extent = newExtent;
+		a->maxCount = newMaxCount;
+	}
+	DiskExtent *e = a->extent + a->count;
+	e->diskPartition = dp;
+	e->position = position;
+	e->source = source;
+	e->size = size;
+	a->count++;
+	return 1;
+}
+
+static int isExtentBefore(const DiskExtent *e1, const DiskExtent *e2){
+	if(e1->diskPartition != e2->diskPartition){
+		return ((uintptr_t)e1->diskPartition) < ((uintptr_t)e2->diskPartition);
+	}
+	return e1->position < e2->position;
+}
+
+static void siftDownDiskExtent(DiskExtent *extent, uintptr_t i, uintptr_t count){
+	while(1){
+		uintptr_t last = i, c;
+		for(c = 2 * i + 1; c <= 2 * i + 2 && c < count; c++){
+			if(isExtentBefore(extent + last, extent + c)){
+				last = c;
+			}
+		}
+		if(last == i){
+			break;
+		}
+		const DiskExtent e = extent[i];
+		extent[i] = extent[last];
+		extent[last] = e;
+		i = last;
+	}
+}
+
+// heap sort; a flush may have one extent for each dirty cluster of a large file
+static void sortDiskExtents(DiskExtentArray *a){
+	uintptr_t i;
+	for(i = a->count / 2; i > 0; i--){
+		siftDownDiskExtent(a->extent, i - 1, a->count);
+	}
+	for(i = a->count; i > 1; i--){
+		const DiskExtent e = a->extent[0];
+		a->extent[0] = a->extent[i - 1];
+		a->extent[i - 1] = e;
+		siftDownDiskExtent(a->extent, 0, i - 1);
+	}
+}
+
+// the disk driver accepts at most one page in a request
+// so adjacent extents are merged into pages and FAT_WRITE_BATCH_PAGES requests are pending at the same time
+typedef struct{
+	uint8_t *buffer;
+	uintptr_t pendingIO[FAT_WRITE_BATCH_PAGES];
+	uintptr_t pendingSize[FAT_WRITE_BATCH_PAGES];
+	int pendingCount;
+	// the page being filled
+	const FAT32DiskPartition *diskPartition;
+	uint64_t position;
+	uintptr_t size;
+	int ok;
+}DiskWriteBatch;
+
+static void waitDiskWriteBatch(DiskWriteBatch *b){
+	int i;
+	for(i = 0; i < b->pendingCount; i++){
+		uintptr_t writeSize;
+		if(systemCall_waitIOReturn(b->pendingIO[i], 1, &writeSize) != b->pendingIO[i] ||
+			writeSize != b->pendingSize[i]){
+			b->ok = 0;
+		}
+	}
+	b->pendingCount = 0;
+}
+
+static void issueDiskWriteBatch(DiskWriteBatch *b){
+	if(b->size == 0){
+		return;
+	}
+	uintptr_t r = systemCall_seekWriteFile(b->diskPartition->diskFileHandle,
+		b->buffer + b->pendingCount * PAGE_SIZE, b->position, b->size);
+	if(r == IO_REQUEST_FAILURE){
+		b->ok = 0;
+	}
+	else{
+		b->pendingIO[b->pendingCount] = r;
+		b->pendingSize[b->pendingCount] = b->size;
+		b->pendingCount++;
+	}
+	b->size = 0;
+	if(b->pendingCount == FAT_WRITE_BATCH_PAGES){
+		waitDiskWriteBatch(b);
+	}
+}
+
+static void addDiskWriteBatch(DiskWriteBatch *b, const DiskExtent *e){
+	uint64_t position = e->position;
+	const uint8_t *source = e->source;
+	uintptr_t size = e->size;
+	while(size > 0){
+		if(b->size != 0 &&
+			(b->diskPartition != e->diskPartition || b->position + b->size != position || b->size == PAGE_SIZE)){
+			issueDiskWriteBatch(b);
+		}
+		if(b->size == 0){
+			b->diskPartition = e->diskPartition;
+			b->position = position;
+		}
+		const uintptr_t copySize = MIN(size, PAGE_SIZE - b->size);
+		memcpy(b->buffer + b->pendingCount * PAGE_SIZE + b->size, source, copySize);
+		b->size += copySize;
+		position += copySize;
+		source += copySize;
+		size -= copySize;
+	}
+}
+
+// buffer is FAT_WRITE_BATCH_PAGES pages in the heap of fatService
+static int writeDiskExtents(DiskExtentArray *a, uint8_t *buffer){
+	sortDiskExtents(a);
+	DiskWriteBatch b;
+	b.buffer = buffer;
+	b.pendingCount = 0;
+	b.diskPartition = NULL;
+	b.position = 0;
+	b.size = 0;
+	b.ok = 1;
+	uintptr_t i;
+	for(i = 0; i < a->count; i++){
+		addDiskWriteBatch(&b, a->extent + i);
+	}
+	issueDiskWriteBatch(&b);
+	waitDiskWriteBatch(&b);
+	return b.ok;
+}
+
+// assume the writer lock is acquired
+// allocate or free clusters so that the chain fits fileSize
+static int resizeClusterChain(FATFile *ff){
+	FAT32DiskPartition *dp = ff->diskPartition;
+	const uint32_t clusterSize = getClusterSize(dp);
+	// fileSize + clusterSize may overflow
+	const uint32_t requiredCount = ff->fileSize / clusterSize + (ff->fileSize % clusterSize != 0? 1: 0);
+	uint32_t count = 0, last = 0, c = ff->beginCluster;
+	while(count < requiredCount && isValidCluster(c, dp)){
+		last = c;
+		count++;
+		c = nextClusterByFAT(c, dp);
+	}
+	if(count == requiredCount){
+		if(isValidCluster(c, dp)){
+			acquireSemaphore(dp->fatLock);
+			if(last == 0){
+				ff->beginCluster = 0;
+			}
+			else{
+				setFATEntry(dp, last, END_OF_CHAIN);
+			}
+			freeClusterChain(dp, c);
+			releaseSemaphore(dp->fatLock);
+		}
+		return 1;
+	}
+	const uint32_t first = allocateClusters(dp, last, requiredCount - count);
+	if(first == 0){
+		return 0;
+	}
+	if(last == 0){
+		ff->beginCluster = first;
+	}
+	return 1;
+}
+
+// assume the writer lock is acquired and ff->content is not NULL
+static int appendDirtyClusters(DiskExtentArray *a, FATFile *ff){
+	const FAT32DiskPartition *dp = ff->diskPartition;
+	const uint32_t clusterSize = getClusterSize(dp);
+	uint32_t offset = 0, i = 0, c = ff->beginCluster;
+	while(offset < ff->fileSize && isValidCluster(c, dp)){
+		if(isClusterBitSet(ff->dirtyCluster, i)){
+			if(appendDiskExtent(a, dp, clusterToLBA(dp, c) * dp->sectorSize, ff->content + offset, clusterSize) == 0){
+				return 0;
+			}
+		}
+		offset += clusterSize;
+		i++;
+		c = nextClusterByFAT(c, dp);
+	}
+	return 1;
+}
+
+static void markFATPagesDirty(FAT32DiskPartition *dp, const DiskExtentArray *a){
+	const uint8_t *fatBegin = (const uint8_t*)dp->fat;
+	uintptr_t i;
+	acquireSemaphore(dp->fatLock);
+	for(i = 0; i < a->count; i++){
+		const DiskExtent *e = a->extent + i;
+		if(e->diskPartition == dp && e->source >= fatBegin && e->source < fatBegin + getFATSize(dp->bootRecord)){
+			const uintptr_t page = (e->source - fatBegin) / PAGE_SIZE;
+			dp->dirtyFATPage[page / 8] |= (1 << (page % 8));
+		}
+	}
+	releaseSemaphore(dp->fatLock);
+}
+
+// write each dirty page of fat to all copies of FAT, or the active one if mirroring is disabled
+static int appendDirtyFATPages(DiskExtentArray *a, FAT32DiskPartition *dp){
+	const FATBootSector *br = dp->bootRecord;
+	const uintptr_t fatSize = getFATSize(br);
+	const int mirrorFAT = ((br->ebr32.flags & 0x80) == 0);
+	const uintptr_t fatPageCount = CEIL(fatSize, PAGE_SIZE) / PAGE_SIZE;
+	int ok = 1;
+	uintptr_t p;
+	acquireSemaphore(dp->fatLock);
+	for(p = 0; p < fatPageCount; p++){
+		if((dp->dirtyFATPage[p / 8] & (1 << (p % 8))) == 0){
+			continue;
+		}
+		unsigned i;
+		for(i = 0; i < br->fatCount; i++){
+			if(mirrorFAT == 0 && i != (br->ebr32.flags & 0x0f)){
+				continue;
+			}
+			const uint64_t fatLBA = dp->startLBA + br->reservedSectorCount + i * (uint64_t)br->ebr32.sectorsPerFAT32;
+			ok = appendDiskExtent(a, dp, fatLBA * dp->sectorSize + p * PAGE_SIZE,
+				((const uint8_t*)dp->fat) + p * PAGE_SIZE, MIN(PAGE_SIZE, fatSize - p * PAGE_SIZE));
+			if(ok == 0){
+				break;
+			}
+		}
+		if(ok == 0){
+			break;
+		}
+		dp->dirtyFATPage[p / 8] &= ~(1 << (p % 8));
+	}
+	releaseSemaphore(dp->fatLock);
+	return ok;
+}
+
+// return the disk position of the sector containing the directory entry
+static int getDirEntryPosition(const FAT32DiskPartition *dp, FATEntryLocation location, uint64_t *position){
+	const uint32_t clusterSize = getClusterSize(dp);
+	const uint32_t offset = location.entryIndex * sizeof(FATDirEntry);
+	uint32_t c = location.parentCluster, i;
+	for(i = 0; i < offset / clusterSize && isValidCluster(c, dp); i++){
+		c = nextClusterByFAT(c, dp);
+	}
+	if(isValidCluster(c, dp) == 0){
+		return 0;
+	}
+	*position = clusterToLBA(dp, c) * dp->sectorSize + FLOOR(offset % clusterSize, dp->sectorSize);
+	return 1;
+}
+
+// sectorBuffer is in the heap of fatService
+static int updateFATDirEntry(FATFile *ff, uint8_t *sectorBuffer){
+	if(ff->location.parentCluster == 0){ // root directory
+		return 1;
+	}
+	FAT32DiskPartition *dp = ff->diskPartition;
+	uint64_t position;
+	EXPECT(getDirEntryPosition(dp, ff->location, &position));
+	acquireSemaphore(dp->directoryLock);
+	uintptr_t rwSize = dp->sectorSize;
+	uintptr_t r = syncSeekReadFile(dp->diskFileHandle, sectorBuffer, position, &rwSize);
+	int ok = (r != IO_REQUEST_FAILURE && rwSize == dp->sectorSize);
+	if(ok){
+		FATDirEntry *d = (FATDirEntry*)(sectorBuffer + (ff->location.entryIndex * sizeof(FATDirEntry)) % dp->sectorSize);
+		d->clusterLow = (ff->beginCluster & 0xffff);
+		d->clusterHigh = ((ff->beginCluster >> 16) & 0xffff);
+		d->fileSize = ff->fileSize;
+		d->attribute |= FAT_ARCHIVE;
+		r = syncSeekWriteFile(dp->diskFileHandle, sectorBuffer, position, &rwSize);
+		ok = (r != IO_REQUEST_FAILURE && rwSize == dp->sectorSize);
+	}
+	releaseSemaphore(dp->directoryLock);
+	return ok;
+	ON_ERROR;
+	return 0;
+}
+
+// flush all dirty files
+// the writer locks of the files are held until they are written
+static int flushFATFiles(void){
+	acquireSemaphore(fat32List.flushLock);
+	acquireLock(&fatFileList.lock);
+	FATFile *dirtyHead = fatFileList.dirtyHead;
+	fatFileList.dirtyHead = NULL;
+	releaseLock(&fatFileList.lock);
+
+	DiskExtentArray a = {NULL, 0, 0};
+	int ok = 1;
+	FATFile *ff;
+	for(ff = dirtyHead; ff != NULL; ff = ff->nextDirty){
+		acquireWriterLock(ff->rwLock);
+		if(ok){
+			ok = resizeClusterChain(ff);
+		}
+		if(ok && ff->content != NULL){
+			ok = appendDirtyClusters(&a, ff);
+		}
+	}
+	for(ff = dirtyHead; ok && ff != NULL; ff = ff->nextDirty){
+		ok = appendDirtyFATPages(&a, ff->diskPartition);
+	}
+	if(ok){
+		ok = writeDiskExtents(&a, fat32List.writeBuffer);
+	}
+	for(ff = dirtyHead; ok && ff != NULL; ff = ff->nextDirty){
+		ok = updateFATDirEntry(ff, fat32List.writeBuffer);
+	}
+	if(ok == 0){
+		printk("warning: failed to flush FAT files\n");
+		for(ff = dirtyHead; ff != NULL; ff = ff->nextDirty){
+			markFATPagesDirty(ff->diskPartition, &a);
+		}
+	}
+	if(a.extent != NULL){
+		DELETE(a.extent);
+	}
+	FATFile *nextDirty;
+	for(ff = dirtyHead; ff != NULL; ff = nextDirty){
+		nextDirty = ff->nextDirty;
+		// if failed, keep the file dirty and try again later
+		acquireLock(&fatFileList.lock);
+		if(ok){
+			ff->isDirty = 0;
+			ff->nextDirty = NULL;
+		}
+		else{
+			ff->nextDirty = fatFileList.dirtyHead;
+			fatFileList.dirtyHead = ff;
+		}
+		releaseLock(&fatFileList.lock);
+		if(ok && ff->content != NULL){
+			memset(ff->dirtyCluster, 0, getClusterBitmapSize(ff->contentSize, getClusterSize(ff->diskPartition)));
+		}
+		releaseReaderWriterLock(ff->rwLock);
+		if(ok){
+			addFATFileReference(ff, -1);
+		}
+	}
+	releaseSemaphore(fat32List.flushLock);
+	return ok;
+}
+
+// mapFAT
+
+typedef struct{
+	WorkItem work;
+	OpenedFATFile *file;
+	uint32_t position;
+	uintptr_t size;
+	FileIORequest2 *fior2;
+}MapFATRequest;
+
+static void mapFATWork(void *voidMFR);
+
+// the kernel pages of the file are allocated when it is mapped for the first time
+// only the pages covered by each request are read from disk
+// if the file grows by writeFAT after it is mapped, the content moves to larger pages
+// and the mapped pages keep the data at the time of growth
+static int mapFAT(FileIORequest2 *fior2, OpenedFile *of, uint64_t position, uintptr_t size){
+	OpenedFATFile *f = getFileInstance(of);
+	EXPECT(position < f->shared->fileSize && size != 0);
+	MapFATRequest *NEW(mfr);
+	EXPECT(mfr != NULL);
+	mfr->fior2 = fior2;
+	mfr->file = f;
+	mfr->position = (uint32_t)position;
+	mfr->size = size;
+	initWorkItem(&mfr->work, mapFATWork, mfr);
+	EXPECT(submitWork(fat32List.workers, &mfr->work));
+	return 1;
+	ON_ERROR;
+	DELETE(mfr);
+	ON_ERROR;
+	ON_ERROR;
+	return 0;
+}
+
+// return the content holding the file data in the pages of [position, position + *size)
+// *size is reduced to the end of file
+static const uint8_t *loadFATFileContent(OpenedFATFile *f, uint32_t position, uintptr_t *size){
+	FATFile *ff = f->shared;
+	const uint8_t *content = NULL;
+	acquireWriterLock(ff->rwLock);
+	if(position < ff->fileSize){
+		*size = MIN(*size, ff->fileSize - position);
+		// the whole pages are mapped to user space
+		const uint32_t loadBegin = FLOOR(position, PAGE_SIZE);
+		const uint32_t loadEnd = MIN(CEIL(position + *size, PAGE_SIZE), ff->fileSize);
+		if(ensureFATFileContent(ff, ff->fileSize) && loadFATClusters(ff, loadBegin, loadEnd)){
+			content = ff->content;
+		}
+	}
+	releaseReaderWriterLock(ff->rwLock);
+	return content;
+}
+
+static void mapFATWork(void *voidMFR){
+	MapFATRequest *mfr = voidMFR;
+	uintptr_t mapSize = mfr->size;
+	const uint8_t *content = loadFATFileContent(mfr->file, mfr->position, &mapSize);
+	if(content == NULL){
+		completeMapFileIO(mfr->fior2, NULL, 0);
+	}
+	else{
+		completeMapFileIO(mfr->fior2, content + mfr->position, mapSize);
+	}
+	DELETE(mfr);
 }
 
 // sizeOfFAT
@@ -596,7 +1517,15 @@ static int getFATParameter(FileIORequest2 *fior2, OpenedFile *of, uintptr_t para
 	OpenedFATFile *f = getFileInstance(of);
 	switch(parameterCode){
 	case FILE_PARAM_SIZE:
-		completeFileIO64(fior2, f->dirEntry.fileSize);
+		completeFileIO64(fior2, f->shared->fileSize);
+		break;
+	case FILE_PARAM_VERSION:
+		{
+			acquireLock(&fatFileList.lock);
+			const uint64_t version = f->shared->version;
+			releaseLock(&fatFileList.lock);
+			completeFileIO64(fior2, version);
+		}
 		break;
 	default:
 		return 0;
@@ -604,8 +1533,60 @@ static int getFATParameter(FileIORequest2 *fior2, OpenedFile *of, uintptr_t para
 	return 1;
 }
 
+typedef struct{
+	WorkItem work;
+	OpenedFATFile *file;
+	uintptr_t parameterCode;
+	uint64_t value;
+	FileIORequest2 *fior2;
+}SetFATParameterRequest;
+
+static void setFATParameterWork(void *voidSPR){
+	SetFATParameterRequest *spr = voidSPR;
+	FATFile *ff = spr->file->shared;
+	int ok;
+	switch(spr->parameterCode){
+	case FILE_PARAM_SIZE:
+		acquireWriterLock(ff->rwLock);
+		ok = setFATFileSize(ff, (uint32_t)spr->value);
+		releaseReaderWriterLock(ff->rwLock);
+		break;
+	case FILE_PARAM_SYNC:
+		ok = flushFATFiles();
+		break;
+	default:
+		ok = 0;
+		assert(0);
+	}
+	if(ok == 0){
+		printk("warning: failed to set FAT file parameter %x\n", spr->parameterCode);
+	}
+	completeFileIO0(spr->fior2);
+	DELETE(spr);
+}
+
+static int setFATParameter(FileIORequest2 *fior2, OpenedFile *of, uintptr_t parameterCode, uint64_t value){
+	OpenedFATFile *f = getFileInstance(of);
+	EXPECT((parameterCode == FILE_PARAM_SIZE && value <= MAX_FAT_CONTENT_SIZE) || parameterCode == FILE_PARAM_SYNC);
+	SetFATParameterRequest *NEW(spr);
+	EXPECT(spr != NULL);
+	spr->file = f;
+	spr->parameterCode = parameterCode;
+	spr->value = value;
+	spr->fior2 = fior2;
+	initWorkItem(&spr->work, setFATParameterWork, spr);
+	EXPECT(submitWork(fat32List.workers, &spr->work));
+	return 1;
+	ON_ERROR;
+	DELETE(spr);
+	ON_ERROR;
+	ON_ERROR;
+	return 0;
+}
+
 // closeFAT
 
+// a dirty file is flushed by fatService after it is closed
 static void closeFAT(CloseFileRequest *cfr, OpenedFile *of){
 	OpenedFATFile *f = getFileInstance(of);
 	// assume there are pending io request. see file.c
@@ -613,10 +1594,48 @@ static void closeFAT(CloseFileRequest *cfr, OpenedFile *of){
 	deleteOpenedFATFile(f);
 }
 
-static int nextLevelDirectory(FATDirEntry *d, const FAT32DiskPartition *dp,
-	const char *name, uintptr_t length){
-	FATFile *ff = searchCreateFATFile(dp, getBeginCluster(d), 1);
+// add an entry in the first empty slot
+static FATDirEntry *addDirEntry(FATDirEntry *dir, uintptr_t dirLength, const char *name, uintptr_t length){
+	char formattedName[FAT_SHORT_NAME_LENGTH];
+	if(toFATFileName(formattedName, name, length) == 0){
+		return NULL;
+	}
+	unsigned p;
+	for(p = 0; p < dirLength; p++){
+		if(isEndOfDirEntry(&dir[p]) || isEmptyDirEntry(&dir[p])){
+			MEMSET0(&dir[p]);
+			memcpy(dir[p].fileName, formattedName, FAT_SHORT_NAME_LENGTH);
+			dir[p].attribute = FAT_ARCHIVE;
+			return &dir[p];
+		}
+	}
+	return NULL;
+}
+
+// write the sector containing newEntry. dir is the whole directory beginning at dirCluster
+static int writeDirEntrySector(const FAT32DiskPartition *dp, uint32_t dirCluster,
+	const FATDirEntry *dir, const FATDirEntry *newEntry){
+	const FATEntryLocation location = {dirCluster, newEntry - dir};
+	uint64_t position;
+	EXPECT(getDirEntryPosition(dp, location, &position));
+	const uintptr_t sectorOffset = FLOOR(location.entryIndex * sizeof(FATDirEntry), dp->sectorSize);
+	uintptr_t writeSize = dp->sectorSize;
+	uintptr_t r = syncSeekWriteFile(dp->diskFileHandle, ((const uint8_t*)dir) + sectorOffset, position, &writeSize);
+	EXPECT(r != IO_REQUEST_FAILURE && writeSize == dp->sectorSize);
+	return 1;
+	ON_ERROR;
+	ON_ERROR;
+	return 0;
+}
+
+// location is the location of d
+static int nextLevelDirectory(FATDirEntry *d, FATEntryLocation *location, FAT32DiskPartition *dp,
+	const char *name, uintptr_t length, int createFile){
+	FATFile *ff = searchCreateFATFile(dp, *location, d, 1);
 	EXPECT(ff != NULL);
+	if(createFile){
+		acquireSemaphore(dp->directoryLock);
+	}
 	acquireReaderLock(ff->rwLock);
 	const uint32_t clusterCount = countClusterByFAT(ff->beginCluster, dp);
 	const uint32_t allocateSize = clusterCount * dp->bootRecord->sectorsPerCluster * dp->sectorSize;
@@ -630,8 +1649,20 @@ static int nextLevelDirectory(FATDirEntry *d, const FAT32DiskPartition *dp,
 	EXPECT(readSize == allocateSize);
 	FATDirEntry *newDirEntry = searchDirectory(dirEntry,
 		allocateSize / sizeof(FATDirEntry), name, length);
+	if(newDirEntry == NULL && createFile){
+		// IMPROVE: allocate a new cluster if the directory is full
+		newDirEntry = addDirEntry(dirEntry, allocateSize / sizeof(FATDirEntry), name, length);
+		if(newDirEntry != NULL && writeDirEntrySector(dp, ff->beginCluster, dirEntry, newDirEntry) == 0){
+			newDirEntry = NULL;
+		}
+	}
 	EXPECT(newDirEntry != NULL);
+	if(createFile){
+		releaseSemaphore(dp->directoryLock);
+	}
 	*d = *newDirEntry;
+	location->parentCluster = ff->beginCluster;
+	location->entryIndex = newDirEntry - dirEntry;
 	systemCall_releaseHeap(dirEntry);
 	addFATFileReference(ff, -1);
 	return 1;
@@ -640,18 +1671,23 @@ static int nextLevelDirectory(FATDirEntry *d, const FAT32DiskPartition *dp,
 	ON_ERROR;
 	systemCall_releaseHeap(dirEntry);
 	ON_ERROR;
+	if(createFile){
+		releaseSemaphore(dp->directoryLock);
+	}
 	addFATFileReference(ff, -1);
 	ON_ERROR;
 	return 0;
 }
 
-static void openFATTask(void *p){
-	OpenFATRequest *ofr = *(OpenFATRequest**)p;
+static void openFATWork(void *p){
+	OpenFATRequest *ofr = p;
 	uintptr_t nameIndex = 0;
 	FAT32DiskPartition *dp = searchFAT32DiskPartition(ofr->fileName, &nameIndex, ofr->nameLength);
 	EXPECT(dp != NULL);
+	EXPECT(ofr->mode.writable || (ofr->mode.createFile == 0 && ofr->mode.truncate == 0));
 
 	FATDirEntry d;
+	FATEntryLocation location = {0, 0};
 	initRootDirEntry(&d, dp->bootRecord->ebr32.rootCluster);
 	int ok = 1;
 	while(ok){
@@ -666,40 +1702,63 @@ static void openFATTask(void *p){
 			ok = 0;
 			break;
 		}
-		ok = nextLevelDirectory(&d, dp, ofr->fileName + nameIndex, nextNameIndex - nameIndex);
+		const int isLastName = (indexOfNot(ofr->fileName, nextNameIndex, ofr->nameLength, '/') == ofr->nameLength);
+		ok = nextLevelDirectory(&d, &location, dp, ofr->fileName + nameIndex, nextNameIndex - nameIndex,
+			isLastName && ofr->mode.createFile);
 		nameIndex = nextNameIndex;
 	}
 	// if open in enumeration mode, the file has to be a directory
 	// if not in enumeration, what is the size of the directory?
 	EXPECT(ok && (ofr->mode.enumeration == 0 || (d.attribute & FAT_DIRECTORY) != 0));
+	// directories are not writable
+	EXPECT(ofr->mode.writable == 0 || ((d.attribute & (FAT_DIRECTORY | FAT_READ_ONLY)) == 0));
 
 	FileFunctions ff = INITIAL_FILE_FUNCTIONS;
 	ff.read = readFAT;
-	if(ofr->mode.enumeration == 0){
+	if(ofr->mode.enumeration == 0 && (d.attribute & FAT_DIRECTORY) == 0){
 		ff.seekRead = seekReadFAT;
+		ff.mapFile = mapFAT;
+	}
+	if(ofr->mode.writable){
+		ff.write = writeFAT;
+		ff.seekWrite = seekWriteFAT;
+		ff.setParameter = setFATParameter;
 	}
 	ff.getParameter = getFATParameter;
 	ff.close = closeFAT;
-	OpenedFATFile *file = createOpenedFATFile(ofr->mode, dp, &d);
+	OpenedFATFile *file = createOpenedFATFile(ofr->mode, dp, &d, location);
 	EXPECT(file != NULL);
+	if(ofr->mode.truncate){
+		acquireWriterLock(file->shared->rwLock);
+		setFATFileSize(file->shared, 0);
+		releaseReaderWriterLock(file->shared->rwLock);
+	}
 
 	completeOpenFile(ofr->ofr, file, &ff);
 	DELETE(ofr);
-
-	systemCall_terminate();
+	return;
 
 	//deleteOpenedFATFile(file);
 	ON_ERROR;
 	ON_ERROR;
 	ON_ERROR;
+	ON_ERROR;
+	ON_ERROR;
 	failOpenFile(ofr->ofr);
 	//printk("open FAT failed\n");
 	DELETE(ofr);
-	systemCall_terminate();
 }
 
+#define FAT_FLUSH_INTERVAL (1000)
+
 void fatService(void){
-	fat32List.mainTask = processorLocalTask();
+	fat32List.workers = createWorkerPool(FAT_WORKER_COUNT, processorLocalTask());
+	fat32List.flushLock = createSemaphore(1);
+	fat32List.writeBuffer = systemCall_allocateHeap(FAT_WRITE_BATCH_PAGES * PAGE_SIZE, KERNEL_NON_CACHED_PAGE);
+	if(fat32List.workers == NULL || fat32List.flushLock == NULL || fat32List.writeBuffer == NULL){
+		printk("cannot create FAT worker pool\n");
+		systemCall_terminate();
+	}
 	//slab = createUserSlabManager();
 	uintptr_t enumDiskPartition = syncEnumerateFile(resourceTypeToFileName(RESOURCE_DISK_PARTITION));
 	if(enumDiskPartition == IO_REQUEST_FAILURE){
@@ -718,6 +1777,7 @@ void fatService(void){
 		uintptr_t r = enumNextDiskPartition(enumDiskPartition, MBR_FAT32, &fe);
 		assert(r == sizeof(fe));
 		OpenFileMode ofm = OPEN_FILE_MODE_0;
+		ofm.writable = 1;
 		uintptr_t diskFile = syncOpenFileN(fe.name, fe.nameLength, ofm);
 		if(diskFile == IO_REQUEST_FAILURE){
 			printk("warning: failed to open disk\n");
@@ -731,7 +1791,8 @@ void fatService(void){
 	}
 	printk("too many fat systems\n");
 	while(1){
-		sleep(1000);
+		sleep(FAT_FLUSH_INTERVAL);
+		flushFATFiles();
 	}
 	panic("cannot initialize FAT32 service");
 }
@@ -810,4 +1871,97 @@ void testFAT(void){
 	testFATDir("fat:C/");
 	systemCall_terminate();
 }
+#define TEST_FAT_WRITE_SIZE (64)
+#define TEST_FAT_WRITE_COUNT (1024)
+#define TEST_FAT_SYNC_WRITE_COUNT (128)
+
+static uint8_t testFATWriteValue(uintptr_t i){
+	return (uint8_t)(i * 7 + i / 251);
+}
+
+// small writes are buffered and flushed by one FILE_PARAM_SYNC,
+// compared to flushing after each write
+void testFATWrite(void){
+	const char *fileName = "fat:C/FATWRITE.TXT";
+	uintptr_t f = IO_REQUEST_FAILURE, r, i, j;
+	OpenFileMode m = OPEN_FILE_MODE_0;
+	m.writable = 1;
+	m.createFile = 1;
+	m.truncate = 1;
+	int a;
+	for(a = 3; a > 0 && f == IO_REQUEST_FAILURE; a--){
+		sleep(1000);
+		f = syncOpenFileN(fileName, strlen(fileName), m);
+	}
+	assert(f != IO_REQUEST_FAILURE);
+	uint8_t buffer[TEST_FAT_WRITE_SIZE];
+	const uint64_t t0 = getClockNanosecond();
+	for(i = 0; i < TEST_FAT_WRITE_COUNT; i++){
+		for(j = 0; j < TEST_FAT_WRITE_SIZE; j++){
+			buffer[j] = testFATWriteValue(i * TEST_FAT_WRITE_SIZE + j);
+		}
+		uintptr_t s = TEST_FAT_WRITE_SIZE;
+		r = syncWriteFile(f, buffer, &s);
+		assert(r == f && s == TEST_FAT_WRITE_SIZE);
+	}
+	const uint64_t t1 = getClockNanosecond();
+	r = syncSetFileParameter(f, FILE_PARAM_SYNC, 0);
+	assert(r == f);
+	const uint64_t t2 = getClockNanosecond();
+	printk("fat write-back: %u writes in %u us, sync in %u us\n", TEST_FAT_WRITE_COUNT,
+		(uint32_t)((t1 - t0) / 1000), (uint32_t)((t2 - t1) / 1000));
+	r = syncCloseFile(f);
+	assert(r == f);
+	// read the file from disk after it is closed and flushed
+	m.createFile = 0;
+	m.truncate = 0;
+	f = syncOpenFileN(fileName, strlen(fileName), m);
+	assert(f != IO_REQUEST_FAILURE);
+	uint64_t fileSize;
+	r = syncSizeOfFile(f, &fileSize);
+	assert(r == f && fileSize == TEST_FAT_WRITE_SIZE * TEST_FAT_WRITE_COUNT);
+	for(i = 0; i < TEST_FAT_WRITE_COUNT; i += 37){
+		uintptr_t s = TEST_FAT_WRITE_SIZE;
+		r = syncSeekReadFile(f, buffer, i * TEST_FAT_WRITE_SIZE, &s);
+		assert(r == f && s == TEST_FAT_WRITE_SIZE);
+		for(j = 0; j < TEST_FAT_WRITE_SIZE; j++){
+			assert(buffer[j] == testFATWriteValue(i * TEST_FAT_WRITE_SIZE + j));
+		}
+	}
+	// a small write loads only the clusters around it; the rest is still read from disk
+	const uintptr_t middle = TEST_FAT_WRITE_SIZE * TEST_FAT_WRITE_COUNT / 2 + 3;
+	buffer[0] = (uint8_t)~testFATWriteValue(middle);
+	uintptr_t writeSize = 1;
+	r = syncSeekWriteFile(f, buffer, middle, &writeSize);
+	assert(r == f && writeSize == 1);
+	for(i = 0; i < TEST_FAT_WRITE_COUNT; i += 37){
+		const uintptr_t offset = (i == 0? middle - TEST_FAT_WRITE_SIZE / 2: i * TEST_FAT_WRITE_SIZE);
+		uintptr_t s = TEST_FAT_WRITE_SIZE;
+		r = syncSeekReadFile(f, buffer, offset, &s);
+		assert(r == f && s == TEST_FAT_WRITE_SIZE);
+		for(j = 0; j < TEST_FAT_WRITE_SIZE; j++){
+			const uint8_t v = testFATWriteValue(offset + j);
+			assert(buffer[j] == (offset + j == middle? (uint8_t)~v: v));
+		}
+	}
+	// truncate and flush after each write
+	r = syncSetFileParameter(f, FILE_PARAM_SIZE, 0);
+	assert(r == f);
+	const uint64_t t3 = getClockNanosecond();
+	for(i = 0; i < TEST_FAT_SYNC_WRITE_COUNT; i++){
+		uintptr_t s = TEST_FAT_WRITE_SIZE;
+		r = syncSeekWriteFile(f, buffer, i * TEST_FAT_WRITE_SIZE, &s);
+		assert(r == f && s == TEST_FAT_WRITE_SIZE);
+		r = syncSetFileParameter(f, FILE_PARAM_SYNC, 0);
+		assert(r == f);
+	}
+	const uint64_t t4 = getClockNanosecond();
+	printk("fat write-through: %u writes in %u us\n", TEST_FAT_SYNC_WRITE_COUNT, (uint32_t)((t4 - t3) / 1000));
+	r = syncSizeOfFile(f, &fileSize);
+	assert(r == f && fileSize == TEST_FAT_WRITE_SIZE * TEST_FAT_SYNC_WRITE_COUNT);
+	r = syncCloseFile(f);
+	assert(r == f);
+	printk("test fat write ok\n");
+	systemCall_terminate();
+}
 #endif
@@ -113,12 +113,58 @@ void deleteFIFOList(FIFOList *fifo){
 	DELETE(fifo);
 }
 */
+// byte stream mode
+
+typedef struct PipeBuffer{
+	uint8_t *buffer;
+	uintptr_t capacity, begin, dataLength;
+}PipeBuffer;
+
+#define PIPE_BUFFER_SIZE (16 * PAGE_SIZE)
+
+static int initPipeBuffer(PipeBuffer *p, uintptr_t capacity){
+	p->buffer = allocateKernelPages(capacity, KERNEL_PAGE);
+	if(p->buffer == NULL){
+		return 0;
+	}
+	p->capacity = capacity;
+	p->begin = 0;
+	p->dataLength = 0;
+	return 1;
+}
+
+static void destroyPipeBuffer(PipeBuffer *p){
+	checkAndReleaseKernelPages(p->buffer);
+}
+
+static uintptr_t writePipeBuffer_noLock(PipeBuffer *p, const uint8_t *buffer, uintptr_t bufferSize){
+	const uintptr_t size = MIN(bufferSize, p->capacity - p->dataLength);
+	const uintptr_t end = (p->begin + p->dataLength) % p->capacity;
+	const uintptr_t size1 = MIN(size, p->capacity - end);
+	memcpy(p->buffer + end, buffer, size1);
+	memcpy(p->buffer, buffer + size1, size - size1);
+	p->dataLength += size;
+	return size;
+}
+
+static uintptr_t readPipeBuffer_noLock(PipeBuffer *p, uint8_t *buffer, uintptr_t bufferSize){
+	const uintptr_t size = MIN(bufferSize, p->dataLength);
+	const uintptr_t size1 = MIN(size, p->capacity - p->begin);
+	memcpy(buffer, p->buffer + p->begin, size1);
+	memcpy(buffer + size1, p->buffer, size - size1);
+	p->begin = (p->begin + size) % p->capacity;
+	p->dataLength -= size;
+	return size;
+}
+
 // file interface
 
 typedef struct RWFIFORequest{
 	RWFileRequest *rwfr;
 	uint8_t *buffer;
 	uintptr_t bufferSize;
+	// bytes written to pipe
+	uintptr_t transferSize;
 
 	Spinlock *fifoLock;
 	struct RWFIFORequest *next, **prev;
@@ -126,9 +172,13 @@ typedef struct RWFIFORequest{
 
 static RWFIFORequest *createRWFIFORequest(RWFileRequest *rwfr, uint8_t *buffer, uintptr_t bufferSize){
 	RWFIFORequest *NEW(r);
+	if(r == NULL){
+		return NULL;
+	}
 	r->rwfr = rwfr;
 	r->buffer = buffer;
 	r->bufferSize = bufferSize;
+	r->transferSize = 0;
 	r->fifoLock = NULL;
 	r->next = NULL;
 	r->prev = NULL;
@@ -144,12 +194,17 @@ typedef struct FIFOFile{
 	Spinlock lock;
 	struct FIFOList headTail;
 	RWFIFORequest *pendingRead; // TODO: move to OpenedFile
+	// pipe
+	int isPipe;
+	int isNonBlockingWrite;
+	PipeBuffer pipe;
+	RWFIFORequest *pendingWrite;
 }FIFOFile;
 
 #define HAS_FIFO_REQUEST_NO_LOCK(F) ((F)->pendingRead != NULL)
 
-static RWFIFORequest *popFIFORequest_noLock(FIFOFile *fifo){
-	RWFIFORequest *r = fifo->pendingRead;
+static RWFIFORequest *popFIFORequest_noLock(RWFIFORequest **queue){
+	RWFIFORequest *r = *queue;
 	assert(r != NULL);
 	setRWFileIONotCancellable(r->rwfr);
 	r->fifoLock = NULL;
@@ -157,7 +212,7 @@ static RWFIFORequest *popFIFORequest_noLock(FIFOFile *fifo){
 	return r;
 }
 
-static void cancelReadFIFO(void *arg){
+static void cancelRWFIFO(void *arg){
 	RWFIFORequest *r = arg;
 	acquireLock(r->fifoLock);
 	REMOVE_FROM_DQUEUE(r);
@@ -165,21 +220,61 @@ static void cancelReadFIFO(void *arg){
 	deleteRWFIFORequest(r);
 }
 
-static void pushRWFIFORequest_noLock(FIFOFile *fifo, RWFIFORequest *r){
+// requests are served in arrival order, so append to the tail
+static void pushRWFIFORequest_noLock(FIFOFile *fifo, RWFIFORequest **queue, RWFIFORequest *r){
 	r->fifoLock = &fifo->lock;
-	ADD_TO_DQUEUE(r, &fifo->pendingRead);
-	setRWFileIOCancellable(r->rwfr, r, cancelReadFIFO);
+	while(*queue != NULL){
+		queue = &(*queue)->next;
+	}
+	ADD_TO_DQUEUE(r, queue);
+	setRWFileIOCancellable(r->rwfr, r, cancelRWFIFO);
+}
+
+// move data from pending writes to the ring, and from the ring to pending reads
+static void processPipe(FIFOFile *fifo){
+	while(1){
+		RWFIFORequest *r = NULL;
+		uintptr_t completeSize = 0;
+		int progress = 0;
+		acquireLock(&fifo->lock);
+		if(fifo->pendingWrite != NULL && fifo->pipe.dataLength < fifo->pipe.capacity){
+			RWFIFORequest *w = fifo->pendingWrite;
+			w->transferSize += writePipeBuffer_noLock(&fifo->pipe,
+				w->buffer + w->transferSize, w->bufferSize - w->transferSize);
+			if(w->transferSize == w->bufferSize){
+				r = popFIFORequest_noLock(&fifo->pendingWrite);
+				completeSize = r->bufferSize;
+			}
+			progress = 1;
+		}
+		else if(fifo->pendingRead != NULL && fifo->pipe.dataLength > 0){
+			r = popFIFORequest_noLock(&fifo->pendingRead);
+			completeSize = readPipeBuffer_noLock(&fifo->pipe, r->buffer, r->bufferSize);
+			progress = 1;
+		}
+		releaseLock(&fifo->lock);
+		if(r != NULL){
+			completeRWFileIO(r->rwfr, completeSize, 0);
+			deleteRWFIFORequest(r);
+		}
+		if(progress == 0){
+			break;
+		}
+	}
 }
 
-// return 1 if operation succeed
 static void processFIFO(FIFOFile *fifo){
+	if(fifo->isPipe){
+		processPipe(fifo);
+		return;
+	}
 	while(1){
 		FIFOElement *e = NULL;
 		RWFIFORequest *r = NULL;
 		acquireLock(&fifo->lock);
 		if(hasFIFOElement_noLock(&fifo->headTail) && HAS_FIFO_REQUEST_NO_LOCK(fifo)){
 			e = popFIFOElement_noLock(&fifo->headTail);
-			r = popFIFORequest_noLock(fifo);
+			r = popFIFORequest_noLock(&fifo->pendingRead);
 		}
 		releaseLock(&fifo->lock);
 		if(e == NULL || r == NULL){
@@ -197,7 +292,7 @@ static int readFIFOFile(RWFileRequest *rwfr, OpenedFile *of, uint8_t *buffer, ui
 	RWFIFORequest *r = createRWFIFORequest(rwfr, buffer, bufferSize);
 	EXPECT(r != NULL);
 	acquireLock(&fifo->lock);
-	pushRWFIFORequest_noLock(fifo, r);
+	pushRWFIFORequest_noLock(fifo, &fifo->pendingRead, r);
 	releaseLock(&fifo->lock);
 	processFIFO(fifo);
 	return 1;
@@ -206,6 +301,18 @@ static int readFIFOFile(RWFileRequest *rwfr, OpenedFile *of, uint8_t *buffer, ui
 }
 
 int directWriteFIFOFile(FIFOFile *fifo, const uint8_t *buffer, uintptr_t bufferSize){
+	if(fifo->isPipe){
+		// all or nothing
+		int ok = 0;
+		acquireLock(&fifo->lock);
+		if(fifo->pendingWrite == NULL && fifo->pipe.capacity - fifo->pipe.dataLength >= bufferSize){
+			writePipeBuffer_noLock(&fifo->pipe, buffer, bufferSize);
+			ok = 1;
+		}
+		releaseLock(&fifo->lock);
+		processPipe(fifo);
+		return ok;
+	}
 	FIFOElement *e = createFIFOElement(buffer, bufferSize);
 	EXPECT(e != NULL);
 	acquireLock(&fifo->lock);
@@ -217,8 +324,36 @@ int directWriteFIFOFile(FIFOFile *fifo, const uint8_t *buffer, uintptr_t bufferS
 	return 0;
 }
 
+// a non-blocking write completes with the size that fits in the pipe
+// a blocking write completes when all data is in the pipe
+static int writePipeFile(RWFileRequest *rwfr, FIFOFile *fifo, const uint8_t *buffer, uintptr_t bufferSize){
+	if(fifo->isNonBlockingWrite){
+		uintptr_t writeSize = 0;
+		acquireLock(&fifo->lock);
+		if(fifo->pendingWrite == NULL){
+			writeSize = writePipeBuffer_noLock(&fifo->pipe, buffer, bufferSize);
+		}
+		releaseLock(&fifo->lock);
+		completeRWFileIO(rwfr, writeSize, 0);
+		processPipe(fifo);
+		return 1;
+	}
+	RWFIFORequest *r = createRWFIFORequest(rwfr, (uint8_t*)buffer, bufferSize);
+	EXPECT(r != NULL);
+	acquireLock(&fifo->lock);
+	pushRWFIFORequest_noLock(fifo, &fifo->pendingWrite, r);
+	releaseLock(&fifo->lock);
+	processPipe(fifo);
+	return 1;
+	ON_ERROR;
+	return 0;
+}
+
 static int writeFIFOFile(RWFileRequest *rwfr, OpenedFile *of, const uint8_t *buffer, uintptr_t bufferSize){
 	FIFOFile *fifo = getFileInstance(of);
+	if(fifo->isPipe){
+		return writePipeFile(rwfr, fifo, buffer, bufferSize);
+	}
 	int ok = directWriteFIFOFile(fifo, buffer, bufferSize);
 	if(ok){
 		completeRWFileIO(rwfr, bufferSize, 0);
@@ -227,11 +362,28 @@ static int writeFIFOFile(RWFileRequest *rwfr, OpenedFile *of, const uint8_t *buf
 }
 
 static int getFIFOFileParam(FileIORequest2 *r2, OpenedFile *of, uintptr_t parameterCode){
+	FIFOFile *fifo = getFileInstance(of);
 	if(parameterCode == FILE_PARAM_FILE_INSTANCE){
-		FIFOFile *fifo = getFileInstance(of);
 		completeFileIO64(r2, (uint64_t)(uintptr_t)fifo);
 		return 1;
 	}
+	if(parameterCode == FILE_PARAM_SIZE && fifo->isPipe){
+		acquireLock(&fifo->lock);
+		uintptr_t dataLength = fifo->pipe.dataLength;
+		releaseLock(&fifo->lock);
+		completeFileIO64(r2, dataLength);
+		return 1;
+	}
+	return 0;
+}
+
+static int setFIFOFileParam(FileIORequest2 *r2, OpenedFile *of, uintptr_t parameterCode, uint64_t value){
+	FIFOFile *fifo = getFileInstance(of);
+	if(parameterCode == FILE_PARAM_NON_BLOCKING_WRITE && fifo->isPipe){
+		fifo->isNonBlockingWrite = (value != 0);
+		completeFileIO0(r2);
+		return 1;
+	}
 	return 0;
 }
 
@@ -249,30 +401,44 @@ static void closeFIFOFile(CloseFileRequest *cfr, OpenedFile *of){
 		}
 		deleteFIFOElement(e);
 	}
-	assert(HAS_FIFO_REQUEST_NO_LOCK(fifo) == 0);
+	assert(HAS_FIFO_REQUEST_NO_LOCK(fifo) == 0 && fifo->pendingWrite == NULL);
+	if(fifo->isPipe){
+		destroyPipeBuffer(&fifo->pipe);
+	}
 	completeCloseFile(cfr);
 	DELETE(fifo);
 }
 
 static int openFIFOFile(
 	OpenFileRequest *ofr,
-	__attribute__((__unused__)) const char *fileName, uintptr_t nameLength,
+	const char *fileName, uintptr_t nameLength,
 	__attribute__((__unused__)) OpenFileMode ofm
 ){
-	if(nameLength != 0){
+	const int isPipe = isStringEqual(fileName, nameLength, "pipe", strlen("pipe"));
+	if(nameLength != 0 && isPipe == 0){
 		return 0;
 	}
 	struct FIFOFile *NEW(fifo);
+	EXPECT(fifo != NULL);
 	fifo->lock = initialSpinlock;
 	fifo->headTail = initialFIFOList;
 	fifo->pendingRead = NULL;
+	fifo->isPipe = isPipe;
+	fifo->isNonBlockingWrite = 0;
+	fifo->pendingWrite = NULL;
+	EXPECT(isPipe == 0 || initPipeBuffer(&fifo->pipe, PIPE_BUFFER_SIZE));
 	FileFunctions ff = INITIAL_FILE_FUNCTIONS;
 	ff.read = readFIFOFile;
 	ff.write = writeFIFOFile;
 	ff.getParameter = getFIFOFileParam;
+	ff.setParameter = setFIFOFileParam;
 	ff.close = closeFIFOFile;
 	completeOpenFile(ofr, fifo, &ff);
 	return 1;
+	ON_ERROR;
+	DELETE(fifo);
+	ON_ERROR;
+	return 0;
 }
 
 void initFIFOFile(void){
@@ -287,6 +453,10 @@ uintptr_t syncOpenFIFOFile(void){
 	return syncOpenFileN("fifo:", strlen("fifo:"), OPEN_FILE_MODE_0);
 }
 
+uintptr_t syncOpenPipeFile(void){
+	return syncOpenFileN("fifo:pipe", strlen("fifo:pipe"), OPEN_FILE_MODE_0);
+}
+
 FIFOFile *syncGetFIFOFile(uintptr_t handle){
 	uint64_t r = 0;
 	if(syncGetFileParameter(handle, FILE_PARAM_FILE_INSTANCE, &r) == IO_REQUEST_FAILURE){
@@ -416,4 +586,223 @@ void testFIFOFile(void){
 	systemCall_terminate();
 }
 
+#define TEST_PIPE_SIZE (4 << 20)
+
+static void testWritePipe(void *arg){
+	const uintptr_t f = *(uintptr_t*)arg;
+	static uint8_t buffer[3000];
+	uintptr_t offset = 0, r;
+	while(offset < TEST_PIPE_SIZE){
+		uintptr_t s = MIN(sizeof(buffer), TEST_PIPE_SIZE - offset), i;
+		for(i = 0; i < s; i++){
+			buffer[i] = (uint8_t)((offset + i) * 13);
+		}
+		r = syncWriteFile(f, buffer, &s);
+		assert(r != IO_REQUEST_FAILURE && s == MIN(sizeof(buffer), TEST_PIPE_SIZE - offset));
+		offset += s;
+	}
+	systemCall_terminate();
+}
+
+// one task writes 4MB in small blocking writes and the other reads in large buffers
+void testPipeFile(void){
+	int ok = waitForFirstResource("fifo", RESOURCE_FILE_SYSTEM, matchName);
+	assert(ok);
+	uintptr_t f = syncOpenPipeFile();
+	assert(f != IO_REQUEST_FAILURE);
+	const uint64_t t0 = getClockNanosecond();
+	Task *t = createSharedMemoryTask(testWritePipe, &f, sizeof(f), processorLocalTask());
+	assert(t != NULL);
+	resume(t);
+	static uint8_t buffer[8192];
+	uintptr_t offset = 0, readCount = 0, r;
+	while(offset < TEST_PIPE_SIZE){
+		uintptr_t s = sizeof(buffer), i;
+		r = syncReadFile(f, buffer, &s);
+		assert(r != IO_REQUEST_FAILURE && s > 0);
+		for(i = 0; i < s; i++){
+			assert(buffer[i] == (uint8_t)((offset + i) * 13));
+		}
+		offset += s;
+		readCount++;
+	}
+	const uint64_t t1 = getClockNanosecond();
+	printk("pipe: %u bytes in %u reads, %u us\n", offset, readCount, (uint32_t)((t1 - t0) / 1000));
+	// non-blocking write stops at capacity
+	r = syncSetFileParameter(f, FILE_PARAM_NON_BLOCKING_WRITE, 1);
+	assert(r != IO_REQUEST_FAILURE);
+	uintptr_t total = 0;
+	while(1){
+		uintptr_t s = sizeof(buffer);
+		r = syncWriteFile(f, buffer, &s);
+		assert(r != IO_REQUEST_FAILURE);
+		if(s == 0){
+			break;
+		}
+		total += s;
+	}
+	uint64_t size;
+	r = syncGetFileParameter(f, FILE_PARAM_SIZE, &size);
+	assert(r != IO_REQUEST_FAILURE && size == total && total == PIPE_BUFFER_SIZE);
+	r = syncCloseFile(f);
+	assert(r != IO_REQUEST_FAILURE);
+	printk("test pipe file ok\n");
+	systemCall_terminate();
+}
+
+#define TEST_ORDER_SIZE (PIPE_BUFFER_SIZE + PIPE_BUFFER_SIZE / 2)
+
+static uint8_t testOrderByte(uintptr_t writer, uintptr_t i){
+	return (uint8_t)(writer == 0? i * 13: ~(i * 13));
+}
+
+struct PipeOrderArg{
+	uintptr_t fileHandle;
+	volatile int submitted;
+};
+
+// both writes are larger than the pipe, so the second one is pending while the first is partly transferred
+static void testWritePipeOrder(void *voidArg){
+	struct PipeOrderArg *arg = *(struct PipeOrderArg**)voidArg;
+	static uint8_t buffer[2][TEST_ORDER_SIZE];
+	uintptr_t w, i, io[2];
+	for(w = 0; w < 2; w++){
+		for(i = 0; i < TEST_ORDER_SIZE; i++){
+			buffer[w][i] = testOrderByte(w, i);
+		}
+		io[w] = systemCall_writeFile(arg->fileHandle, buffer[w], TEST_ORDER_SIZE);
+		assert(io[w] != IO_REQUEST_FAILURE);
+	}
+	arg->submitted = 1;
+	uintptr_t s;
+	uintptr_t r = systemCall_waitIOReturn(io[1], 1, &s);
+	assert(r == io[1] && s == TEST_ORDER_SIZE);
+	// the first write is no longer pending
+	int ok = systemCall_cancelIO(io[0]);
+	assert(ok == 0);
+	r = systemCall_waitIOReturn(io[0], 1, &s);
+	assert(r == io[0] && s == TEST_ORDER_SIZE);
+	systemCall_terminate();
+}
+
+// two blocking writes to a pipe complete in order and their data does not interleave
+void testPipeOrder(void){
+	int ok = waitForFirstResource("fifo", RESOURCE_FILE_SYSTEM, matchName);
+	assert(ok);
+	struct PipeOrderArg arg = {syncOpenPipeFile(), 0}, *argAddress = &arg;
+	assert(arg.fileHandle != IO_REQUEST_FAILURE);
+	Task *t = createSharedMemoryTask(testWritePipeOrder, &argAddress, sizeof(argAddress), processorLocalTask());
+	assert(t != NULL);
+	resume(t);
+	while(arg.submitted == 0){
+		sleep(1);
+	}
+	static uint8_t buffer[8192];
+	uintptr_t offset = 0, r;
+	while(offset < TEST_ORDER_SIZE * 2){
+		uintptr_t s = sizeof(buffer), i;
+		r = syncReadFile(arg.fileHandle, buffer, &s);
+		assert(r != IO_REQUEST_FAILURE && s > 0);
+		for(i = 0; i < s; i++){
+			const uintptr_t o = offset + i;
+			assert(buffer[i] == testOrderByte(o / TEST_ORDER_SIZE, o % TEST_ORDER_SIZE));
+		}
+		offset += s;
+	}
+	r = syncCloseFile(arg.fileHandle);
+	assert(r != IO_REQUEST_FAILURE);
+	printk("test pipe order ok\n");
+	systemCall_terminate();
+}
+
+#undef TEST_ORDER_SIZE
+
+struct DrainPipeArg{
+	uintptr_t fileHandle;
+	volatile int done;
+};
+
+static void testDrainPipe(void *voidArg){
+	struct DrainPipeArg *arg = *(struct DrainPipeArg**)voidArg;
+	static uint8_t buffer[8192];
+	uintptr_t offset = 0, r;
+	while(offset < TEST_PIPE_SIZE){
+		uintptr_t s = sizeof(buffer), i;
+		r = syncReadFile(arg->fileHandle, buffer, &s);
+		assert(r != IO_REQUEST_FAILURE && s > 0);
+		for(i = 0; i < s; i++){
+			assert(buffer[i] == (uint8_t)((offset + i) * 13));
+		}
+		offset += s;
+	}
+	arg->done = 1;
+	systemCall_terminate();
+}
+
+// splice a kernel file to a pipe, then compare copying between pipes through a user buffer with splicing
+void testSpliceFile(void){
+	int ok = waitForFirstResource("fifo", RESOURCE_FILE_SYSTEM, matchName);
+	assert(ok);
+	static uint8_t buffer[8192], buffer2[8192];
+	uintptr_t kf = syncOpenFile("kernelfs:testfile.txt");
+	assert(kf != IO_REQUEST_FAILURE);
+	uint64_t fileSize;
+	uintptr_t r = syncSizeOfFile(kf, &fileSize);
+	assert(r != IO_REQUEST_FAILURE && fileSize <= sizeof(buffer));
+	uintptr_t pipe = syncOpenPipeFile();
+	assert(pipe != IO_REQUEST_FAILURE);
+	r = systemCall_spliceFile(pipe, kf, 1 << 20);
+	assert(r == fileSize);
+	r = systemCall_spliceFile(pipe, kf, 1);
+	assert(r == 0);
+	uintptr_t s = sizeof(buffer), s2 = sizeof(buffer2);
+	r = syncReadFile(pipe, buffer, &s);
+	assert(r != IO_REQUEST_FAILURE && s == fileSize);
+	r = syncSeekReadFile(kf, buffer2, 0, &s2);
+	assert(r != IO_REQUEST_FAILURE && s2 == fileSize && isStringEqual((const char*)buffer, s, (const char*)buffer2, s2));
+	syncCloseFile(pipe);
+	syncCloseFile(kf);
+
+	int useSplice;
+	for(useSplice = 0; useSplice < 2; useSplice++){
+		uintptr_t p1 = syncOpenPipeFile(), p2 = syncOpenPipeFile();
+		assert(p1 != IO_REQUEST_FAILURE && p2 != IO_REQUEST_FAILURE);
+		struct DrainPipeArg drain = {p2, 0}, *drainAddress = &drain;
+		const uint64_t t0 = getClockNanosecond();
+		Task *t = createSharedMemoryTask(testWritePipe, &p1, sizeof(p1), processorLocalTask());
+		assert(t != NULL);
+		resume(t);
+		t = createSharedMemoryTask(testDrainPipe, &drainAddress, sizeof(drainAddress), processorLocalTask());
+		assert(t != NULL);
+		resume(t);
+		uintptr_t moveSize = 0;
+		while(moveSize < TEST_PIPE_SIZE){
+			if(useSplice){
+				s = systemCall_spliceFile(p2, p1, TEST_PIPE_SIZE - moveSize);
+				assert(s != IO_REQUEST_FAILURE && s > 0);
+			}
+			else{
+				s = MIN(sizeof(buffer), TEST_PIPE_SIZE - moveSize);
+				r = syncReadFile(p1, buffer, &s);
+				assert(r != IO_REQUEST_FAILURE);
+				r = syncWriteFile(p2, buffer, &s);
+				assert(r != IO_REQUEST_FAILURE);
+			}
+			moveSize += s;
+		}
+		while(drain.done == 0){
+			sleep(1);
+		}
+		const uint64_t t1 = getClockNanosecond();
+		printk("%s: %u bytes in %u us\n", (useSplice? "splice": "read & write"),
+			moveSize, (uint32_t)((t1 - t0) / 1000));
+		syncCloseFile(p1);
+		syncCloseFile(p2);
+	}
+	printk("test splice file ok\n");
+	systemCall_terminate();
+}
+
+#undef TEST_PIPE_SIZE
+
 #endif
@@ -5,6 +5,7 @@
 #include"kernel.h"
 #include"fileservice.h"
 #include"task/task.h"
+#include"task/exclusivelock.h"
 #include"resource/resource.h"
 
 // disk driver
@@ -144,7 +145,7 @@ int addFileSystem(const FileNameFunctions *fileNameFunctions, const char *name,
 	fs->nameLength = nameLength;
 	fs->fileNameFunctions = *fileNameFunctions;
 	acquireLock(&fsList.lock);
-	ADD_TO_DQUEUE(fs, &fsList.head);
+	RCU_ADD_TO_DQUEUE(fs, &fsList.head);
 	releaseLock(&fsList.lock);
 	FileEnumeration fe;
 	initFileEnumeration(&fe, name, nameLength);
@@ -160,15 +161,16 @@ int addFileSystem(const FileNameFunctions *fileNameFunctions, const char *name,
 	return 0;
 }
 
+// FileSystem is never deleted
 static FileSystem *searchFileSystem(const char *name, uintptr_t nameLength){
-	acquireLock(&fsList.lock);
+	const int interruptFlag = beginRCURead();
 	FileSystem *fs;
-	for(fs = fsList.head; fs != NULL; fs = fs->next){
+	for(fs = RCU_READ(fsList.head); fs != NULL; fs = RCU_READ(fs->next)){
 		if(isStringEqual(fs->name, fs->nameLength, name, nameLength)){
 			break;
 		}
 	}
-	releaseLock(&fsList.lock);
+	endRCURead(interruptFlag);
 	return fs;
 }
 
@@ -360,6 +362,21 @@ static void *mapBufferToKernel(const void *buffer, uintptr_t size){
 	return (void*)(pageOffset + ((uintptr_t)mappedPage));
 }
 
+// the pages are shared with kernel; see acceptMapFileIO
+static void *mapKernelBufferToUser(const void *buffer, uintptr_t size){
+	uintptr_t pageOffset, pageBegin;
+	size_t pageSize;
+	void *mappedPage;
+	bufferToPageRange((uintptr_t)buffer, size, &pageBegin, &pageOffset, &pageSize);
+	mappedPage = checkAndMapExistingPages(
+		getTaskLinearMemory(processorLocalTask()), kernelLinear,
+		pageBegin, pageSize, USER_READ_ONLY_PAGE, 0);
+	if(mappedPage == NULL){
+		return NULL;
+	}
+	return (void*)(pageOffset + ((uintptr_t)mappedPage));
+}
+
 /*
 static PhysicalAddressArray *reserveBufferPages(void *buffer, uintptr_t bufferSize, uintptr_t *bufferOffset){
 	uintptr_t pageBegin, pageSize;
@@ -387,6 +404,8 @@ struct FileIORequest{
 struct RWFileRequest{
 	int isWrite: 1;
 	int updateOffset: 1;
+	// see spliceFile
+	int isKernelBuffer: 1;
 	void *mappedBuffer;
 	struct FileIORequest fior;
 	uintptr_t returnValues[1];
@@ -435,12 +454,13 @@ static void cancelDeleteFileIO(void *instance){
 
 static int acceptDeleteFileIO(void *instance, uintptr_t *returnValue){
 	struct FileIORequest *r0 = instance;
+	// acceptFileIO may modify returnValues. see acceptMapFileIO
+	r0->acceptFileIO(r0->acceptCancelArg);
 	int r = r0->returnCount, i;
 	for(i = 0; i < r; i++){
 		returnValue[i] = r0->returnValues[i];
 	}
 
-	r0->acceptFileIO(r0->acceptCancelArg);
 	DELETE(r0->instance);
 	return r;
 }
@@ -508,7 +528,9 @@ void completeFileIO0(FileIORequest2 *r0){
 static void beforeDeleteRWFileIO(void *instance){
 	RWFileRequest *rwfr = instance;
 	assert(rwfr->mappedBuffer != NULL);
-	unmapKernelBuffer(rwfr->mappedBuffer);
+	if(rwfr->isKernelBuffer == 0){
+		unmapKernelBuffer(rwfr->mappedBuffer);
+	}
 	rwfr->mappedBuffer = NULL;
 }
 
@@ -532,6 +554,25 @@ void completeFileIO64(FileIORequest2 *r2, uint64_t v0){
 	completeFileIO2(r2, LOW64(v0), HIGH64(v0));
 }
 
+void completeMapFileIO(FileIORequest2 *r2, const void *kernelAddress, uintptr_t mapSize){
+	completeFileIO2(r2, (uintptr_t)kernelAddress, mapSize);
+}
+
+// accept is called by the task waiting for the request
+// replace the kernel address with the address in its linear memory
+static void acceptMapFileIO(void *instance){
+	struct FileIORequest *fior = instance;
+	assert(fior->returnCount == 2);
+	void *mappedAddress = NULL;
+	if(fior->returnValues[1] != 0){
+		mappedAddress = mapKernelBufferToUser((const void*)fior->returnValues[0], fior->returnValues[1]);
+	}
+	if(mappedAddress == NULL){
+		fior->returnValues[1] = 0;
+	}
+	fior->returnValues[0] = (uintptr_t)mappedAddress;
+}
+
 static void beforeDeleteOpenFileIO(void *instance){
 	OpenFileRequest *ofr = instance;
 	unmapKernelBuffer(ofr->mappedBuffer);
@@ -603,6 +644,7 @@ static RWFileRequest *createRWFileIO(
 	initFileIO(&rwfr->fior, rwfr, file, beforeDeleteRWFileIO);
 	rwfr->isWrite = doWrite;
 	rwfr->updateOffset = updateOffset;
+	rwfr->isKernelBuffer = 0;
 	// see beforeDeleteRWFileIO
 	rwfr->mappedBuffer =  mapBufferToKernel((const void*)notMappedBuffer, size);
 	EXPECT(rwfr->mappedBuffer != NULL);
@@ -623,6 +665,15 @@ static FileIORequest2 *createFileIO2(OpenedFile *file){
 	return r2;
 }
 
+static FileIORequest2 *createMapFileIO(OpenedFile *file){
+	FileIORequest2 *r2 = createFileIO2(file);
+	if(r2 == NULL)
+		return NULL;
+	// acceptCancelArg = &r2->fior
+	r2->fior.acceptFileIO = acceptMapFileIO;
+	return r2;
+}
+
 static CloseFileRequest *initCloseFileIO(CloseFileRequest *cfr, OpenedFile *file){
 	initFileIO(&cfr->cfior, cfr, file, defaultBeforeDeleteFileIO);
 	return cfr;
@@ -694,6 +745,9 @@ int dummyGetParameter(_UNUSED FileIORequest2 *fior2, _UNUSED OpenedFile *of, _UN
 int dummySetParameter(_UNUSED FileIORequest2 *fior2, _UNUSED OpenedFile *of, _UNUSED uintptr_t parameterCode, _UNUSED uint64_t value){
 	return 0;
 }
+int dummyMapFile(_UNUSED FileIORequest2 *fior2, _UNUSED OpenedFile *of, _UNUSED uint64_t position, _UNUSED uintptr_t size){
+	return 0;
+}
 void dummyClose(_UNUSED CloseFileRequest *cfr, _UNUSED OpenedFile *of){
 	panic("dummyClose");
 }
@@ -844,6 +898,19 @@ static IORequest *dispatchFileHandleCommand(const InterruptParam *p){
 			fior = &r2->fior;
 		}
 		break;
+	case SYSCALL_MAP_FILE:
+		r2 = createMapFileIO(of);
+		if(r2 != NULL){
+			pendFileIO(&r2->fior);
+			int ok = f->mapFile(r2, of,
+				COMBINE64(SYSTEM_CALL_ARGUMENT_3(p), SYSTEM_CALL_ARGUMENT_2(p)), SYSTEM_CALL_ARGUMENT_1(p));
+			if(!ok){
+				cancelFailedFileIO(&r2->fior);
+				break;
+			}
+			fior = &r2->fior;
+		}
+		break;
 	default:
 		fior = NULL;
 	}
@@ -858,6 +925,137 @@ static IORequest *dispatchFileHandleCommand(const InterruptParam *p){
 
 #undef NULL_OR
 
+// splice
+
+// wait for a request pended by this task and return the first value
+static uintptr_t waitKernelFileIO(struct FileIORequest *fior, uintptr_t *returnValues){
+	IORequest *ior = &fior->ior;
+	waitIO(ior);
+	// the request is deleted in acceptDeleteFileIO
+	ior->accept(ior->instance, returnValues);
+	return returnValues[0];
+}
+
+// buffer is in kernel linear memory and is not mapped again
+static uintptr_t syncKernelRWFile(OpenedFile *of, int isWrite, uint8_t *buffer, uintptr_t size){
+	EXPECT(addFileIOCount(of, 1));
+	RWFileRequest *NEW(rwfr);
+	EXPECT(rwfr != NULL);
+	initFileIO(&rwfr->fior, rwfr, of, beforeDeleteRWFileIO);
+	rwfr->isWrite = isWrite;
+	rwfr->updateOffset = 1;
+	rwfr->isKernelBuffer = 1;
+	rwfr->mappedBuffer = buffer;
+	pendFileIO(&rwfr->fior);
+	int ok = (isWrite?
+		of->fileFunctions.write(rwfr, of, buffer, size):
+		of->fileFunctions.read(rwfr, of, buffer, size));
+	if(!ok){
+		cancelFailedFileIO(&rwfr->fior);
+		return IO_REQUEST_FAILURE;
+	}
+	uintptr_t returnValues[1];
+	return waitKernelFileIO(&rwfr->fior, returnValues);
+	ON_ERROR;
+	addFileIOCount(of, -1);
+	ON_ERROR;
+	return IO_REQUEST_FAILURE;
+}
+
+// return the mapped size, or 0 if the file cannot be mapped
+// the address is in kernel linear memory; it is valid until the file is closed
+static uintptr_t syncKernelMapFile(OpenedFile *of, uint64_t position, uintptr_t size, const uint8_t **address){
+	EXPECT(addFileIOCount(of, 1));
+	// not createMapFileIO, which maps the pages to the calling task
+	FileIORequest2 *r2 = createFileIO2(of);
+	EXPECT(r2 != NULL);
+	pendFileIO(&r2->fior);
+	if(of->fileFunctions.mapFile(r2, of, position, size) == 0){
+		cancelFailedFileIO(&r2->fior);
+		return 0;
+	}
+	uintptr_t returnValues[2];
+	*address = (const uint8_t*)waitKernelFileIO(&r2->fior, returnValues);
+	return (*address == NULL? 0: returnValues[1]);
+	ON_ERROR;
+	addFileIOCount(of, -1);
+	ON_ERROR;
+	return 0;
+}
+
+#define SPLICE_BUFFER_SIZE (16 * PAGE_SIZE)
+
+// if the source can be mapped (kernel files and FAT files), the destination reads the cached pages directly
+// otherwise, the data is read to a kernel buffer instead of a user buffer
+static uintptr_t spliceFile(OpenedFile *dst, OpenedFile *src, uintptr_t size){
+	const int isMappable = (src->fileFunctions.mapFile != dummyMapFile);
+	uint8_t *buffer = NULL;
+	uintptr_t spliceSize = 0;
+	while(spliceSize < size){
+		const uintptr_t chunkSize = MIN(size - spliceSize, SPLICE_BUFFER_SIZE);
+		const uint8_t *data;
+		uintptr_t dataSize;
+		if(isMappable){
+			dataSize = syncKernelMapFile(src, getFileOffset(src), chunkSize, &data);
+		}
+		else{
+			if(buffer == NULL){
+				buffer = allocateKernelPages(SPLICE_BUFFER_SIZE, KERNEL_PAGE);
+				if(buffer == NULL){
+					break;
+				}
+			}
+			dataSize = syncKernelRWFile(src, 0, buffer, chunkSize);
+			data = buffer;
+		}
+		if(dataSize == 0 || dataSize == IO_REQUEST_FAILURE){
+			break;
+		}
+		// a non-blocking destination may accept part of the data
+		uintptr_t writeSize = 0;
+		while(writeSize < dataSize){
+			uintptr_t s = syncKernelRWFile(dst, 1, (uint8_t*)data + writeSize, dataSize - writeSize);
+			if(s == 0 || s == IO_REQUEST_FAILURE){
+				break;
+			}
+			writeSize += s;
+		}
+		if(isMappable){
+			addFileOffset(src, writeSize);
+		}
+		spliceSize += writeSize;
+		if(writeSize < dataSize){
+			break;
+		}
+	}
+	if(buffer != NULL){
+		checkAndReleaseKernelPages(buffer);
+	}
+	return spliceSize;
+}
+
+#undef SPLICE_BUFFER_SIZE
+
+// arg0 = destination handle; arg1 = source handle; arg2 = size
+// return the number of bytes moved
+static void spliceFileHandler(InterruptParam *p){
+	sti();
+	OpenFileManager *ofm = getOpenFileManager(processorLocalTask());
+	OpenedFile *dst = searchOpenFileList(ofm, SYSTEM_CALL_ARGUMENT_0(p), 0);
+	EXPECT(dst != NULL);
+	OpenedFile *src = searchOpenFileList(ofm, SYSTEM_CALL_ARGUMENT_1(p), 0);
+	EXPECT(src != NULL);
+	SYSTEM_CALL_RETURN_VALUE_0(p) = spliceFile(dst, src, SYSTEM_CALL_ARGUMENT_2(p));
+	// undo addIOCount in searchOpenFileList
+	addFileIOCount(src, -1);
+	addFileIOCount(dst, -1);
+	return;
+	ON_ERROR;
+	addFileIOCount(dst, -1);
+	ON_ERROR;
+	SYSTEM_CALL_RETURN_VALUE_0(p) = IO_REQUEST_FAILURE;
+}
+
 void initFileEnumeration(FileEnumeration *fileEnum, const char *name, uintptr_t nameLength){
 	fileEnum->nameLength = nameLength;
 	memcpy(fileEnum->name, name, sizeof(name[0]) * fileEnum->nameLength);
@@ -926,8 +1124,10 @@ void initFile(SystemCallTable *s){
 	registerSystemCall(s, SYSCALL_CLOSE_FILE, FileHandleCommandHandler, 1);
 	registerSystemCall(s, SYSCALL_READ_FILE, FileHandleCommandHandler, 2);
 	registerSystemCall(s, SYSCALL_WRITE_FILE, FileHandleCommandHandler, 3);
+	registerSystemCall(s, SYSCALL_MAP_FILE, FileHandleCommandHandler, 4);
 	registerSystemCall(s, SYSCALL_SEEK_READ_FILE, FileHandleCommandHandler, 5);
 	registerSystemCall(s, SYSCALL_SEEK_WRITE_FILE, FileHandleCommandHandler, 6);
 	registerSystemCall(s, SYSCALL_GET_FILE_PARAMETER, FileHandleCommandHandler, 7);
 	registerSystemCall(s, SYSCALL_SET_FILE_PARAMETER, FileHandleCommandHandler, 8);
+	registerSystemCall(s, SYSCALL_SPLICE_FILE, spliceFileHandler, 0);
 }
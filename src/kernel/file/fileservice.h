@@ -45,6 +45,9 @@ void completeFileIO0(FileIORequest2 *r0);
 void completeFileIO1(FileIORequest2 *r1, uintptr_t v0);
 void completeFileIO2(FileIORequest2 *r2, uintptr_t v0, uintptr_t v1);
 void completeFileIO64(FileIORequest2 *r2, uint64_t v0);
+// kernelAddress is in kernel linear memory and will be mapped read-only to the calling task
+// if mapSize == 0, the request fails
+void completeMapFileIO(FileIORequest2 *r2, const void *kernelAddress, uintptr_t mapSize);
 void failOpenFile(OpenFileRequest *r1);
 void completeOpenFile(OpenFileRequest *r1, void *instance, const FileFunctions *ff);
 void completeCloseFile(CloseFileRequest* r0);
@@ -66,6 +69,7 @@ struct FileFunctions{
 	int (*seekWrite)(RWFileRequest *rwfr, OpenedFile *of, const uint8_t *buffer, uint64_t position, uintptr_t bufferSize);
 	int (*getParameter)(FileIORequest2 *fior2, OpenedFile *of, uintptr_t parameterCode);
 	int (*setParameter)(FileIORequest2 *fior2, OpenedFile *of, uintptr_t parameterCode, uint64_t value);
+	int (*mapFile)(FileIORequest2 *fior2, OpenedFile *of, uint64_t position, uintptr_t size);
 	void (*close)(CloseFileRequest *cfr, OpenedFile *of);
 };
 
@@ -76,6 +80,7 @@ int dummySeekRead(RWFileRequest *rwfr, OpenedFile *of, uint8_t *buffer, uint64_t
 int dummySeekWrite(RWFileRequest *rwfr, OpenedFile *of, const uint8_t *buffer, uint64_t position, uintptr_t bufferSize);
 int dummyGetParameter(FileIORequest2 *fior2, OpenedFile *of, uintptr_t parameterCode);
 int dummySetParameter(FileIORequest2 *fior2, OpenedFile *of, uintptr_t parameterCode, uint64_t value);
+int dummyMapFile(FileIORequest2 *fior2, OpenedFile *of, uint64_t position, uintptr_t size);
 void dummyClose(CloseFileRequest *cfr, OpenedFile *of);
 
 int seekReadByOffset(RWFileRequest *rwfr, OpenedFile *of, uint8_t *buffer, uintptr_t bufferSize);
@@ -83,7 +88,7 @@ int seekWriteByOffset(RWFileRequest *rwfr, OpenedFile *of, const uint8_t *buffer
 
 // use macro to check number of arguments
 #define INITIAL_FILE_FUNCTIONS \
-	{dummyRead, dummyWrite, dummySeekRead, dummySeekWrite, dummyGetParameter, dummySetParameter, dummyClose}
+	{dummyRead, dummyWrite, dummySeekRead, dummySeekWrite, dummyGetParameter, dummySetParameter, dummyMapFile, dummyClose}
 
 typedef struct OpenFileManager OpenFileManager;
 
@@ -100,16 +105,31 @@ void closeAllOpenFileRequest(OpenFileManager *ofm);
 
 // FAT32
 void fatService(void);
+void testFATWrite(void);
 
 // kernel file
 void initKernelFile(void);
 
+// debug file
+// print at most bufferSize characters and return the length
+typedef int PrintDebugFile(char *buffer, uintptr_t bufferSize);
+// name is not copied
+int addDebugFile(const char *name, PrintDebugFile *print);
+void initDebugFile(void);
+void testLockStatistics(void);
+
 // FIFO with file system call
 void initFIFOFile(void);
 typedef struct FIFOFile FIFOFile;
 // open/close/write are non-blocking; read is blocking
 uintptr_t syncOpenFIFOFile(void);
+// byte stream with a fixed capacity. reads return as much as is buffered
+// writes wait until all data is buffered, or return the written size if FILE_PARAM_NON_BLOCKING_WRITE is set
+uintptr_t syncOpenPipeFile(void);
 FIFOFile *syncGetFIFOFile(uintptr_t fileHandle);
 int directWriteFIFOFile(FIFOFile *fifo, const uint8_t *buffer, uintptr_t bufferSize);
+void testPipeFile(void);
+void testPipeOrder(void);
+void testSpliceFile(void);
 
 #endif
@@ -6,6 +6,7 @@
 #include"interrupt/systemcalltable.h"
 #include"multiprocessor/processorlocal.h"
 #include"multiprocessor/spinlock.h"
+#include"assembly/assembly.h"
 #include"blob.h"
 
 typedef struct{
@@ -32,6 +33,42 @@ static int seekReadKFS(
 	return 1;
 }
 
+// blobs are not page-aligned in the kernel image, so mapping them in place would expose the data around them
+// each blob is copied to its own pages when it is mapped for the first time. the copies are never released
+static uint8_t *volatile *blobPages = NULL;
+
+static const uint8_t *getBLOBPages(const BLOBAddress *blob){
+	const int i = blob - blobList;
+	uint8_t *pages = blobPages[i];
+	if(pages != NULL){
+		return pages;
+	}
+	const uintptr_t blobSize = blob->end - blob->begin;
+	pages = allocateKernelPages(CEIL(MAX(blobSize, 1), PAGE_SIZE), KERNEL_PAGE);
+	if(pages == NULL){
+		return NULL;
+	}
+	memcpy(pages, (const void*)blob->begin, blobSize);
+	memset(pages + blobSize, 0, CEIL(MAX(blobSize, 1), PAGE_SIZE) - blobSize);
+	if(lock_cmpxchg32((volatile uint32_t*)&blobPages[i], (uint32_t)NULL, (uint32_t)pages) != (uint32_t)NULL){
+		checkAndReleaseKernelPages(pages);
+	}
+	return blobPages[i];
+}
+
+static int mapKFS(FileIORequest2 *fior2, OpenedFile *of, uint64_t offset64, uintptr_t size){
+	OpenedBLOBFile *f = getFileInstance(of);
+
+	uintptr_t mapSize = computeCopySize(f, offset64, size);
+	if(mapSize == 0)
+		return 0;
+	const uint8_t *pages = getBLOBPages(f->blob);
+	if(pages == NULL)
+		return 0;
+	completeMapFileIO(fior2, pages + ((uintptr_t)offset64), mapSize);
+	return 1;
+}
+
 static int enumReadKFS(RWFileRequest *fior1, OpenedFile *of, uint8_t *buffer, uintptr_t bufferSize){
 	if(bufferSize < sizeof(FileEnumeration))
 		return IO_REQUEST_FAILURE;
@@ -110,6 +147,7 @@ static int openKFS(OpenFileRequest *fior, const char *fileName, uintptr_t length
 		func.read = seekReadByOffset;
 		func.seekRead = seekReadKFS;
 		func.getParameter = getKFSParameter;
+		func.mapFile = mapKFS;
 	}
 	else{
 		func.read = enumReadKFS;
@@ -129,6 +167,12 @@ void initKernelFile(void){
 	kfDirectory.begin = (uintptr_t)blobList;
 	kfDirectory.end = (uintptr_t)(blobList + blobCount);
 
+	NEW_ARRAY(blobPages, MAX(blobCount, 1));
+	if(blobPages == NULL){
+		panic("cannot initialize kernel file system\n");
+	}
+	memset((void*)blobPages, 0, MAX(blobCount, 1) * sizeof(*blobPages));
+
 	FileNameFunctions ff = INITIAL_FILE_NAME_FUNCTIONS;
 	ff.open = openKFS;
 	int ok = addFileSystem(&ff, "kernelfs", strlen("kernelfs"));
@@ -214,6 +258,21 @@ void testKFS(void){
 			assert(0);
 		}
 	}
+	// map
+	const char *mappedFile;
+	uintptr_t mapSize = 10000;
+	r = syncMapFile(file, 3, (void**)&mappedFile, &mapSize);
+	assert(r == file && mapSize == sizeLow - 3);
+	char x3[8];
+	MEMSET0(x3);
+	uintptr_t readCount3 = 7;
+	r = syncSeekReadFile(file, x3, 3, &readCount3);
+	assert(r == file && strncmp(x3, mappedFile, readCount3) == 0);
+	r = unmapFile(mappedFile);
+	assert(r);
+	mapSize = 1;
+	r = syncMapFile(file, sizeLow, (void**)&mappedFile, &mapSize);
+	assert(r == IO_REQUEST_FAILURE);
 	// close
 	r = systemCall_closeFile(file);
 	assert(r != IO_REQUEST_FAILURE);
@@ -136,6 +136,11 @@ struct LAPIC{
 	InterruptVector *spuriousVector;
 	InterruptVector *timerVector;
 	InterruptVector *errorVector;
+
+	// LAPIC timer count of a tick
+	uint32_t timerInitialCount;
+	// see apic_setTimerOneShot
+	uint32_t oneShotCount, oneShotFirstCount;
 };
 
 
@@ -204,7 +209,8 @@ void testAndResetLAPICTimer(LAPIC *lapic, PIC *pic){
 		lastResult = testLAPICTimerFrequency(lapic->linearBase, TIMER_FREQUENCY / FREQ_DIV, pic);
 	}
 	// kprintf("LAPIC timer frequency = %u kHz\n", (cnt / 1000) * FREQ_DIV);
-	*timer_initialCnt = lastResult / (TIMER_FREQUENCY / FREQ_DIV);
+	lapic->timerInitialCount = lastResult / (TIMER_FREQUENCY / FREQ_DIV);
+	*timer_initialCnt = lapic->timerInitialCount;
 	#undef FREQ_DIV
 	*lvt_timer = oldLVT_TIMER;
 }
@@ -213,6 +219,46 @@ void resetLAPICTimer(LAPIC *lapic){
 	testAndResetLAPICTimer(lapic, NULL);
 }
 
+// the one-shot count begins with the rest of current tick, so that the timer interrupt keeps the same phase
+uint32_t apic_setTimerOneShot(PIC *pic, uint32_t ticks){
+	LAPIC *lapic = pic->apic->lapic;
+	MemoryMappedRegister
+	lvt_timer = (MemoryMappedRegister)(lapic->linearBase + LVT_TIMER_VECTOR),
+	timer_initialCnt = (MemoryMappedRegister)(lapic->linearBase + TIMER_INITIAL_COUNT),
+	timer_currentCnt = (MemoryMappedRegister)(lapic->linearBase + TIMER_CURRENT_COUNT);
+	assert(ticks > 0);
+	const uint32_t tickCount = lapic->timerInitialCount;
+	uint32_t firstCount = *timer_currentCnt;
+	if(firstCount == 0 || firstCount > tickCount){
+		firstCount = tickCount;
+	}
+	ticks = MIN(ticks, (0xffffffff - firstCount) / tickCount + 1);
+	lapic->oneShotFirstCount = firstCount;
+	lapic->oneShotCount = firstCount + (ticks - 1) * tickCount;
+	// bit 19~17 = 00: one-shot
+	*lvt_timer = ((*lvt_timer) & (~0x00060000));
+	*timer_initialCnt = lapic->oneShotCount;
+	return ticks;
+}
+
+// return the number of ticks passed since apic_setTimerOneShot, rounded to the nearest
+uint32_t apic_setTimerPeriodic(PIC *pic){
+	LAPIC *lapic = pic->apic->lapic;
+	MemoryMappedRegister
+	lvt_timer = (MemoryMappedRegister)(lapic->linearBase + LVT_TIMER_VECTOR),
+	timer_initialCnt = (MemoryMappedRegister)(lapic->linearBase + TIMER_INITIAL_COUNT),
+	timer_currentCnt = (MemoryMappedRegister)(lapic->linearBase + TIMER_CURRENT_COUNT);
+	const uint32_t tickCount = lapic->timerInitialCount;
+	const uint32_t passedCount = lapic->oneShotCount - (*timer_currentCnt);
+	// bit 19~17 = 01: periodic
+	*lvt_timer = (((*lvt_timer) & (~0x00060000)) | 0x00020000);
+	*timer_initialCnt = tickCount;
+	if(passedCount + tickCount / 2 < lapic->oneShotFirstCount){
+		return 0;
+	}
+	return 1 + (passedCount + tickCount / 2 - lapic->oneShotFirstCount) / tickCount;
+}
+
 void interprocessorINIT(LAPIC *lapic, uint32_t targetLAPICID){
 	deliverIPI(lapic->linearBase, targetLAPICID, INIT, NONE, 0);
 }
@@ -225,6 +271,10 @@ void apic_interruptAllOther(PIC *pic, InterruptVector *vector){
 	deliverIPI(pic->apic->lapic->linearBase, 0, FIXED, ALL_EXCLUDING_SELF, toChar(vector));
 }
 
+void apic_interruptProcessor(PIC *pic, PIC *target, InterruptVector *vector){
+	deliverIPI(pic->apic->lapic->linearBase, getLAPICID(target->apic->lapic), FIXED, NONE, toChar(vector));
+}
+
 // linear address of APIC_BASE
 #define LAPIC_PHYSICAL_BASE ((uintptr_t)0xfee00000)
 #define LAPIC_MAPPING_SIZE (PAGE_SIZE)
@@ -265,6 +315,9 @@ LAPIC *initLocalAPIC(InterruptTable *t){
 	}
 	lapic->linearBase = apicLinearBase;
 	lapic->lapicID = getMemoryMappedLAPICID();
+	lapic->timerInitialCount = 0;
+	lapic->oneShotCount = 0;
+	lapic->oneShotFirstCount = 0;
 
 	static InterruptVector *spuriousVector;
 	if(lapic->isBSP){
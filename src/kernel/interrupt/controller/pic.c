@@ -18,7 +18,9 @@ static void wakeupOtherProcessors(LAPIC *lapic, IOAPIC *ioapic/*, TimerEventList
 	initialESP[0] = 0x7000;
 	int e = 1;
 	int iter;
-	for(iter = 0; iter < 3; iter++){
+	// INIT, 10 ms, STARTUP, 200 us, STARTUP. see Intel MultiProcessor Specification B.4
+	// the started processors are synchronized in initMultiprocessor
+	for(iter = 0; iter < 4; iter++){
 		int i;
 		for(i = 0; i < n; i++){
 			uint32_t target = getLAPICIDByIndex(ioapic, i);
@@ -33,18 +35,15 @@ static void wakeupOtherProcessors(LAPIC *lapic, IOAPIC *ioapic/*, TimerEventList
 			if(iter == 1){
 				interprocessorINIT(lapic, target);
 			}
-			if(iter == 2){
+			if(iter >= 2){
 				interprocessorSTARTUP(lapic, target, 0x7000);
 			}
 		}
 		if(iter == 1){
-			int t;
-			sti();
-			// sleep TIMER_FREQUENCY / 5 = 250 milliseconds
-			for(t = 0; t < DIV_CEIL(TIMER_FREQUENCY, 4); t++){
-				hlt();
-			}
-			cli();
+			waitTimer8254(10000);
+		}
+		if(iter == 2){
+			waitTimer8254(200);
 		}
 	}
 }
@@ -86,6 +85,9 @@ PIC *createPIC(InterruptTable *t){
 	apic->this.setPICMask = apic_setPICMask;
 	apic->this.irqToVector = apic_irqToVector;
 	apic->this.interruptAllOther = apic_interruptAllOther;
+	apic->this.interruptProcessor = apic_interruptProcessor;
+	apic->this.setTimerOneShot = apic_setTimerOneShot;
+	apic->this.setTimerPeriodic = apic_setTimerPeriodic;
 	apic->lapic = lapic;
 	// apic->ioapic
 	if(isBSP(lapic)){
@@ -102,6 +104,7 @@ PIC *createPIC(InterruptTable *t){
 void initLocalTimer(PIC *pic, InterruptTable *t, TimerEventList *timer){
 	if(isAPICSupported() == 0){
 		setTimer8254Frequency(TIMER_FREQUENCY);
+		initClock(pic);
 		if(addTimerHandler(timer, pic->irqToVector(pic, TIMER_IRQ)) == 0){
 			panic("cannot initialize timer interrupt handler");
 		}
@@ -110,12 +113,15 @@ void initLocalTimer(PIC *pic, InterruptTable *t, TimerEventList *timer){
 	}
 	if(isBSP(pic->apic->lapic)){
 		setTimer8254Frequency(TIMER_FREQUENCY);
+		initClock(pic);
 		testAndResetLAPICTimer(pic->apic->lapic, pic);
 		setTimerHandler(timer, getTimerVector(pic->apic->lapic));
+		initIdleTimer(pic, t);
 	}
 	else{
 		resetLAPICTimer(pic->apic->lapic);
 		setTimerHandler(timer, getTimerVector(pic->apic->lapic));
+		initIdleTimer(pic, t);
 	}
 	initMultiprocessor(isBSP(pic->apic->lapic), t, pic->apic->lapic, pic->apic->ioapic); // TODO: move elsewhere
 }
@@ -15,6 +15,13 @@ typedef struct InterruptController{
 	void (*setPICMask)(struct InterruptController *pic, enum IRQ irq, int setMask);
 	void (*endOfInterrupt)(InterruptParam *p);
 	void (*interruptAllOther)(struct InterruptController *pic, InterruptVector *vector);
+	// target is the controller of another processor
+	void (*interruptProcessor)(struct InterruptController *pic, struct InterruptController *target, InterruptVector *vector);
+	// NULL if the local timer does not support one-shot mode
+	// return the number of ticks actually set
+	uint32_t (*setTimerOneShot)(struct InterruptController *pic, uint32_t ticks);
+	// return the number of ticks passed since setTimerOneShot
+	uint32_t (*setTimerPeriodic)(struct InterruptController *pic);
 }PIC;
 
 typedef struct InterruptTable InterruptTable;
@@ -83,6 +83,13 @@ static void pic8259_interruptAllOther(
 ){
 }
 
+static void pic8259_interruptProcessor(
+	__attribute__((__unused__)) struct InterruptController *pic,
+	__attribute__((__unused__)) struct InterruptController *target,
+	__attribute__((__unused__)) InterruptVector *vector
+){
+}
+
 PIC8259 *initPIC8259(InterruptTable *t){
 	PIC8259 *NEW(pic);
 	pic->this.pic8259 = pic;
@@ -91,6 +98,9 @@ PIC8259 *initPIC8259(InterruptTable *t){
 	pic->this.irqToVector = pic8259_irqToVector;
 	pic->this.setPICMask = pic8259_setPICMask;
 	pic->this.interruptAllOther = pic8259_interruptAllOther;
+	pic->this.interruptProcessor = pic8259_interruptProcessor;
+	pic->this.setTimerOneShot = NULL;
+	pic->this.setTimerPeriodic = NULL;
 
 	pic->interruptTable = t;
 	pic->vectorBase = registerIRQs(t, 0, 16);
@@ -35,6 +35,9 @@ void resetLAPICTimer(LAPIC *lapic);
 void interprocessorINIT(LAPIC *lapic, uint32_t targetLAPICID);
 void interprocessorSTARTUP(LAPIC *lapic, uint32_t targetLAPICID, uintptr_t entryAddress);
 void apic_interruptAllOther(PIC *pic, InterruptVector *vector);
+void apic_interruptProcessor(PIC *pic, PIC *target, InterruptVector *vector);
+uint32_t apic_setTimerOneShot(PIC *pic, uint32_t ticks);
+uint32_t apic_setTimerPeriodic(PIC *pic);
 
 void apic_endOfInterrupt(InterruptParam *p);
 
@@ -2,6 +2,9 @@
 #include"interrupt.h"
 #include"internalinterrupt.h"
 #include"multiprocessor/processorlocal.h"
+#include"multiprocessor/perfcounter.h"
+#include"memory/memory.h"
+#include"task/task.h"
 #include"kernel.h"
 #include"common.h"
 
@@ -118,7 +121,26 @@ static void generalProtectionHandler(InterruptParam *p){
 	}
 }
 
+// error code bit 1: 0 = read; 1 = write
+// error code bit 2: 0 = supervisor mode; 1 = user mode
+#define PAGE_FAULT_WRITE (1 << 1)
+#define PAGE_FAULT_USER (1 << 2)
+
 static void pageFaultHandler(InterruptParam *p){
+	uintptr_t address = getCR2();
+	addCounter(COUNTER_PAGE_FAULT, 1);
+	TRACE(TRACE_PAGE_FAULT, address, p->errorCode);
+	// committing a user page may sleep in cloneLinearBlocks or send INVLPG to the other processors,
+	// so the kernel must not access user space with interrupt disabled
+	if(address < USER_LINEAR_END && p->eflags.bit.interrupt){
+		PageAttribute access = ((p->errorCode & PAGE_FAULT_WRITE)? WRITABLE_PAGE_FLAG: 0) |
+			((p->errorCode & PAGE_FAULT_USER)? USER_PAGE_FLAG: 0);
+		sti();
+		// see reservePages and cloneLinearBlocks
+		if(checkAndCommitPage(getTaskLinearMemory(processorLocalTask()), (void*)address, access)){
+			return;
+		}
+	}
 	printk("page fault: CR0 = %x CR2 = %x CR3 = %x\n", getCR0(), getCR2(), getCR3());
 	defaultInterruptHandler(p);
 }
@@ -10,6 +10,7 @@
 #include"memory/memory.h"
 #include"task/task.h"
 #include"multiprocessor/spinlock.h"
+#include"multiprocessor/perfcounter.h"
 
 static_assert((SPURIOUS_INTERRUPT & 0xf) == 0xf);
 
@@ -88,6 +89,7 @@ static void chainedInterruptHandler(InterruptParam *p){
 	assert(p->argument = 0xffffffff);
 	InterruptVector *v = p->vector;
 	struct InterruptHandlerChain *c;
+	countInterrupt(toChar(v));
 	acquireLock(&v->lock);
 	int noHandler = (v->handlerChain == NULL);
 	int handledCount = 0;
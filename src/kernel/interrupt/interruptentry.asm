@@ -41,6 +41,7 @@ entry%[n]:
 %endrep
 
 generalEntry:
+	cld ; user may set DF; kernel memcpy and memset use rep movs and rep stos
 	push ecx
 	push edx
 	push ebx
@@ -2,6 +2,7 @@
 #include"common.h"
 #include"handler.h"
 #include"multiprocessor/spinlock.h"
+#include"multiprocessor/perfcounter.h"
 #include"memory/memory.h"
 #include"systemcalltable.h"
 
@@ -140,20 +141,30 @@ static int queryService(SystemCallTable *systemCallTable, const char *name){
 	return SERVICE_NOT_EXISTING;
 }
 
+int invokeSystemCall(SystemCallTable *s, InterruptParam *p){
+	if(p->regs.eax >= NUMBER_OF_SYSTEM_CALLS){
+		return 0;
+	}
+	struct SystemCallEntry *e = s->entry + p->regs.eax;
+	if(e->call == NULL){
+		return 0;
+	}
+	uintptr_t oldArgument = p->argument;
+	p->argument = e->argument;
+	e->call(p);
+	p->argument = oldArgument;
+	return 1;
+}
+
 static void systemCallHandler(InterruptParam *p){
 	assert(p->regs.eax < NUMBER_OF_SYSTEM_CALLS);
+	addCounter(COUNTER_SYSTEM_CALL, 1);
+	TRACE(TRACE_SYSTEM_CALL, p->regs.eax, 0);
 	SystemCallTable *s = (SystemCallTable*)p->argument;
-	struct SystemCallEntry *e = s->entry + p->regs.eax;
-	if(e->call == NULL){
+	if(invokeSystemCall(s, p) == 0){
 		printk("warning: unregistered system call: %d\n",p->regs.eax);
 		defaultInterruptHandler(p);
 	}
-	else{
-		uintptr_t oldArgument = p->argument;
-		p->argument = e->argument;
-		e->call(p);
-		p->argument = oldArgument;
-	}
 	sti();
 }
 /*
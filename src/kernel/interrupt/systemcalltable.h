@@ -31,6 +31,9 @@ void registerSystemCall(
 	SystemCallFunction func,
 	uintptr_t arg
 );
+// call the registered function of SYSTEM_CALL_NUMBER(p) as if p is from int instruction
+// return 0 if the system call is not registered
+int invokeSystemCall(SystemCallTable *s, InterruptParam *p);
 // runtime registration system call
 enum ServiceNameError{
 	INVALID_NAME = -1024,
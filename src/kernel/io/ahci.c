@@ -887,20 +887,29 @@ static AHCIInterruptArgument *initAHCI(AHCIManager *am, const PCIConfigRegisters
 
 // file interface
 
-static int seekReadAHCI(RWFileRequest *rwfr, OpenedFile *of, uint8_t *buffer, uint64_t position, uintptr_t bufferSize){
+static int seekRWAHCI(
+	RWFileRequest *rwfr, OpenedFile *of,
+	uint8_t *buffer, uint64_t position, uintptr_t bufferSize, char isWrite
+){
 	// TODO: allow multiple pages/physical regions
 	HBAPortIndex index;
 	index.value = (uintptr_t)getFileInstance(of);
 	AHCIInterruptArgument *hba = searchHBAByPortIndex(&ahciManager, index);
 	EXPECT(hba != NULL);
-	const uint64_t diskSize = hba->port[index.portIndex].desc.sectorCount * hba->port[index.portIndex].desc.sectorSize;
+	const uintptr_t sectorSize = hba->port[index.portIndex].desc.sectorSize;
+	const uint64_t diskSize = hba->port[index.portIndex].desc.sectorCount * sectorSize;
 	EXPECT(bufferSize <= diskSize && position <= diskSize - bufferSize);
+	// writing part of a sector requires reading it first
+	EXPECT(isWrite == 0 || (position % sectorSize == 0 && bufferSize % sectorSize == 0));
 	DiskRequest *dr = createRWDiskRequest(
-		(0? DMA_WRITE_EXT: DMA_READ_EXT), rwfr,
+		(isWrite? DMA_WRITE_EXT: DMA_READ_EXT), rwfr,
 		buffer, bufferSize, position,
-		hba, index.portIndex, 0
+		hba, index.portIndex, isWrite
 	);
 	EXPECT(dr != NULL);
+	if(isWrite && hasSeparateSectorBuffer(dr)){
+		memcpy(diskLinearBuffer(dr), buffer, bufferSize);
+	}
 	// send DiskRequest
 	//setRWFileIOFunctions(rwfr, dr, cancelRWAHCI);
 	acquireLock(dr->lock);
@@ -915,9 +924,19 @@ static int seekReadAHCI(RWFileRequest *rwfr, OpenedFile *of, uint8_t *buffer, ui
 	ON_ERROR;
 	ON_ERROR;
 	ON_ERROR;
+	ON_ERROR;
 	return 0;
 }
 
+static int seekReadAHCI(RWFileRequest *rwfr, OpenedFile *of, uint8_t *buffer, uint64_t position, uintptr_t bufferSize){
+	return seekRWAHCI(rwfr, of, buffer, position, bufferSize, 0);
+}
+
+static int seekWriteAHCI(RWFileRequest *rwfr, OpenedFile *of, const uint8_t *buffer, uint64_t position, uintptr_t bufferSize){
+	// the buffer is only read if isWrite = 1
+	return seekRWAHCI(rwfr, of, (uint8_t*)buffer, position, bufferSize, 1);
+}
+
 static void closeAHCI(CloseFileRequest *cfr, __attribute__((__unused__)) OpenedFile *of){
 	completeCloseFile(cfr);
 	// do not delete of->instance
@@ -925,7 +944,7 @@ static void closeAHCI(CloseFileRequest *cfr, __attribute__((__unused__)) OpenedF
 
 static int openAHCI(
 	OpenFileRequest *ofr,
-	const char *fileName, uintptr_t length, __attribute__((__unused__)) OpenFileMode mode
+	const char *fileName, uintptr_t length, OpenFileMode mode
 ){
 	uintptr_t index;
 	if(snscanf(fileName, length, "%x", &index) != 1){
@@ -937,22 +956,16 @@ static int openAHCI(
 	}
 	FileFunctions ff = INITIAL_FILE_FUNCTIONS;
 	ff.seekRead = seekReadAHCI;
-	//if(mode.writable){
-	//	ff.write = seekWriteAHCI;
-	//}
+	if(mode.writable){
+		ff.seekWrite = seekWriteAHCI;
+	}
 	ff.close = closeAHCI;
 	completeOpenFile(ofr, (void*)index, &ff);
 	return 1;
 }
 
-/*
-static IORequest *seekWriteAHCI(OpenFileRequest *ofr, const uint8_t *buffer, uint64_t position, uintptr_t bufferSize){
-
-}
-*/
-
 static void completeDiskRequest(DiskRequest *dr){
-	if(hasSeparateSectorBuffer(dr)){
+	if(hasSeparateSectorBuffer(dr) && dr->isWrite == 0){
 		memcpy(dr->inputBuffer, diskLinearBuffer(dr), dr->inputSize);
 	}
 	if(dr->command == IDENTIFY_DEVICE){
@@ -976,11 +989,8 @@ static void completeDiskRequestTask(__attribute__((__unused__)) void *arg){
 
 void ahciDriver(void){
 	const char *driverName = "ahci";
+	// started after PCI driver; see initService
 	// 0x01: mass storage; 0x06: SATA; 01: AHCI >= 1.0
-	if(waitForFirstResource("pci", RESOURCE_FILE_SYSTEM, matchName) == 0){
-		printk("cannot find PCI driver\n");
-		systemCall_terminate();
-	}
 	uintptr_t enumPCI = enumeratePCI(0x01060100, 0xffffff00);
 	assert(enumPCI != IO_REQUEST_FAILURE);
 
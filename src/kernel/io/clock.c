@@ -0,0 +1,104 @@
+#include"ioservice.h"
+#include"io.h"
+#include"common.h"
+#include"kernel.h"
+#include"memory/memory.h"
+#include"memory/memory_private.h"
+#include"interrupt/handler.h"
+#include"interrupt/controller/pic.h"
+#include"assembly/assembly.h"
+
+static TimePage *timePage = NULL;
+static PhysicalAddress timePagePhysical = {INVALID_PAGE_ADDRESS};
+
+static volatile uint32_t calibrateTicks;
+static int calibrateHandler(__attribute__((__unused__)) const InterruptParam *p){
+	calibrateTicks++;
+	return 1;
+}
+
+// count TSC in 100 ms of the timer IRQ
+static uint64_t testTSCFrequency(PIC *pic){
+	#define FREQ_DIV (10)
+	static_assert(TIMER_FREQUENCY % FREQ_DIV == 0);
+	InterruptVector *timerVector = pic->irqToVector(pic, TIMER_IRQ);
+	if(addHandler(timerVector, calibrateHandler, 0) == 0){
+		panic("cannot initialize TSC clock");
+	}
+	pic->setPICMask(pic, TIMER_IRQ, 0);
+	calibrateTicks = 0;
+	sti();
+	while(calibrateTicks < 2){
+		hlt();
+	}
+	calibrateTicks = 0;
+	uint64_t tsc1 = rdtsc();
+	while(calibrateTicks < TIMER_FREQUENCY / FREQ_DIV){
+		hlt();
+	}
+	uint64_t tsc2 = rdtsc();
+	removeHandler(timerVector, calibrateHandler, 0);
+	cli();
+	pic->setPICMask(pic, TIMER_IRQ, 1);
+	return (tsc2 - tsc1) * FREQ_DIV;
+	#undef FREQ_DIV
+}
+
+void initClock(PIC *pic){
+	timePage = allocateZeroedKernelPages(PAGE_SIZE, KERNEL_PAGE);
+	if(timePage == NULL){
+		panic("cannot allocate time page");
+	}
+	timePagePhysical = checkAndTranslatePage(kernelLinear, timePage);
+	const uint64_t frequency = testTSCFrequency(pic);
+	// choose the largest shift that multiplier fits in 32 bits
+	uint32_t shift = 32;
+	while(shift > 0 && (((uint64_t)1000000000) << shift) / frequency > 0xffffffff){
+		shift--;
+	}
+	timePage->multiplier = (uint32_t)((((uint64_t)1000000000) << shift) / frequency);
+	timePage->shift = shift;
+	timePage->tscFrequency = frequency;
+	timePage->baseTSC = rdtsc();
+	printk("TSC frequency = %u kHz\n", (uint32_t)(frequency / 1000));
+}
+
+uint64_t getClockNanosecond(void){
+	return readTimePage(timePage);
+}
+
+const TimePage *getKernelTimePage(void){
+	return timePage;
+}
+
+int mapTimePage(PageManager *p, uintptr_t linearAddress){
+	assert(timePage != NULL);
+	return _mapPage_LP(p, kernelLinear->physical, (void*)linearAddress, timePagePhysical, PAGE_SIZE, USER_READ_ONLY_PAGE);
+}
+
+void unmapTimePage(PageManager *p, uintptr_t linearAddress){
+	_unmapPage_LP(p, kernelLinear->physical, (void*)linearAddress, PAGE_SIZE);
+}
+
+#ifndef NDEBUG
+
+void testClock(void){
+	const TimePage *tp = systemCall_getTimePage();
+	assert(tp == getKernelTimePage());
+	uint64_t t0 = getClockNanosecond(), prev = t0;
+	int i;
+	for(i = 0; i < 100000; i++){
+		uint64_t t = getClockNanosecond();
+		assert(t >= prev);
+		prev = t;
+	}
+	const uint64_t s0 = systemCall_getTime();
+	sleep(2000);
+	const uint64_t t1 = getClockNanosecond();
+	const uint64_t s1 = systemCall_getTime();
+	printk("clock test: 100000 reads in %u ns; sleep(2000) = %u us; CMOS seconds = %u\n",
+		(uint32_t)(prev - t0), (uint32_t)((t1 - prev) / 1000), (uint32_t)(s1 - s0));
+	systemCall_terminate();
+}
+
+#endif
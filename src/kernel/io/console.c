@@ -8,6 +8,7 @@
 #include"resource/resource.h"
 #include"multiprocessor/spinlock.h"
 #include"multiprocessor/processorlocal.h"
+#include"multiprocessor/perfcounter.h"
 #include"assembly/assembly.h"
 #include"interrupt/handler.h"
 #include"interrupt/systemcalltable.h"
@@ -143,10 +144,251 @@ static int printString(ConsoleDisplay *cd, const char *s, size_t length){
 	return a;
 }
 
+// kernel log
+// printk appends to the ring of the current processor without locking
+// kernelLogService moves the rings to sinkBuffer and writes it to the display and COM1 in the background
+
+#define LOG_RING_SIZE (16384)
+#define SINK_BUFFER_SIZE (16384)
+// at most this many bytes are copied out of sinkBuffer in one lock section
+#define LOG_FLUSH_SIZE (128)
+#define LOG_FLUSH_INTERVAL (10)
+
+typedef struct LogRing{
+	volatile uint32_t writeCount, readCount;
+	// written by the processor of the ring
+	volatile uint32_t droppedSize;
+	// written by moveLogRings_noLock
+	uint32_t reportedDroppedSize;
+	char buffer[LOG_RING_SIZE];
+}LogRing;
+
+static LogRing *volatile logRing[MAX_PROCESSOR_COUNT];
+static volatile int isLogRingEnabled = 0;
+// messages in output order, waiting for writeSinkBuffer
+static char sinkBuffer[SINK_BUFFER_SIZE];
+static uint32_t sinkWriteCount = 0, sinkReadCount = 0;
+// serialize access to sinkBuffer and the reader side of the rings
+// COM1 is polled without this lock
+static Spinlock logFlushLock = INITIAL_SPINLOCK;
+// getProcessorIndex() + 2 of the processor writing sinkBuffer, or 0
+// getProcessorIndex returns -1 before the processor is initialized
+static volatile uint32_t sinkWriter = 0;
+
+#define LOG_BARRIER() __asm__ volatile("":::"memory")
+
+static void writeLogSinks(const char *s, size_t length){
+	printString(&kernelDisplay, s, length);
+	writeSerialPort(s, length);
+}
+
+// if the ring is full, the message is dropped
+static void appendLogRing(LogRing *r, const char *s, size_t length){
+	const uint32_t w = r->writeCount;
+	if(length > LOG_RING_SIZE - (w - r->readCount)){
+		r->droppedSize += length;
+		return;
+	}
+	const uint32_t begin = w % LOG_RING_SIZE;
+	const uint32_t length1 = MIN(length, LOG_RING_SIZE - begin);
+	memcpy(r->buffer + begin, s, length1);
+	memcpy(r->buffer, s + length1, length - length1);
+	LOG_BARRIER();
+	r->writeCount = w + length;
+}
+
+// assume logFlushLock acquired
+// return number of bytes appended
+static uint32_t appendSinkBuffer_noLock(const char *s, uint32_t length){
+	length = MIN(length, SINK_BUFFER_SIZE - (sinkWriteCount - sinkReadCount));
+	const uint32_t begin = sinkWriteCount % SINK_BUFFER_SIZE;
+	const uint32_t length1 = MIN(length, SINK_BUFFER_SIZE - begin);
+	memcpy(sinkBuffer + begin, s, length1);
+	memcpy(sinkBuffer, s + length1, length - length1);
+	sinkWriteCount += length;
+	return length;
+}
+
+// assume logFlushLock acquired
+// return number of bytes copied to buffer
+static uint32_t takeSinkBuffer_noLock(char *buffer, uint32_t bufferSize){
+	const uint32_t length = MIN(sinkWriteCount - sinkReadCount, bufferSize);
+	const uint32_t begin = sinkReadCount % SINK_BUFFER_SIZE;
+	const uint32_t length1 = MIN(length, SINK_BUFFER_SIZE - begin);
+	memcpy(buffer, sinkBuffer + begin, length1);
+	memcpy(buffer + length1, sinkBuffer, length - length1);
+	sinkReadCount += length;
+	return length;
+}
+
+// assume logFlushLock acquired
+// move as much of the rings as sinkBuffer can hold, starting from a different ring each time
+// return 1 if all rings are empty
+static int moveLogRings_noLock(void){
+	static int firstRing = 0;
+	int isEmpty = 1;
+	int n;
+	for(n = 0; n < MAX_PROCESSOR_COUNT; n++){
+		LogRing *r = logRing[(firstRing + n) % MAX_PROCESSOR_COUNT];
+		if(r == NULL){
+			continue;
+		}
+		const uint32_t droppedSize = r->droppedSize;
+		if(droppedSize != r->reportedDroppedSize){
+			char message[64];
+			int length = snprintf(message, sizeof(message), "\n(%u bytes of log dropped)\n", droppedSize - r->reportedDroppedSize);
+			if((uint32_t)length > SINK_BUFFER_SIZE - (sinkWriteCount - sinkReadCount)){
+				isEmpty = 0;
+				continue;
+			}
+			appendSinkBuffer_noLock(message, length);
+			r->reportedDroppedSize = droppedSize;
+		}
+		const uint32_t readCount = r->readCount;
+		const uint32_t length = r->writeCount - readCount;
+		LOG_BARRIER();
+		const uint32_t begin = readCount % LOG_RING_SIZE;
+		const uint32_t length1 = MIN(length, LOG_RING_SIZE - begin);
+		uint32_t moveSize = appendSinkBuffer_noLock(r->buffer + begin, length1);
+		if(moveSize == length1){
+			moveSize += appendSinkBuffer_noLock(r->buffer, length - length1);
+		}
+		LOG_BARRIER();
+		r->readCount = readCount + moveSize;
+		if(moveSize != length){
+			isEmpty = 0;
+		}
+	}
+	firstRing = (firstRing + 1) % MAX_PROCESSOR_COUNT;
+	return isEmpty;
+}
+
+#undef LOG_BARRIER
+
+static uint32_t sinkWriterID(void){
+	return (uint32_t)(getProcessorIndex() + 2);
+}
+
+// only one processor writes sinkBuffer at a time, so the output keeps the order in sinkBuffer
+// if another processor is writing, it also writes the data appended by the caller
+// return number of bytes written, or 0 if the caller is not the writer
+static uintptr_t writeSinkBuffer(void){
+	uintptr_t writeSize = 0;
+	while(lock_cmpxchg32(&sinkWriter, 0, sinkWriterID()) == 0){
+		while(1){
+			char buffer[LOG_FLUSH_SIZE];
+			acquireLock(&logFlushLock);
+			const uint32_t length = takeSinkBuffer_noLock(buffer, sizeof(buffer));
+			releaseLock(&logFlushLock);
+			if(length == 0){
+				break;
+			}
+			writeLogSinks(buffer, length);
+			writeSize += length;
+		}
+		sinkWriter = 0;
+		// the data appended before sinkWriter is cleared may have seen a busy writer
+		acquireLock(&logFlushLock);
+		const int isEmpty = (sinkWriteCount == sinkReadCount);
+		releaseLock(&logFlushLock);
+		if(isEmpty){
+			break;
+		}
+	}
+	return writeSize;
+}
+
+// write the earlier printk messages of all rings and then s
+// interrupts are enabled while polling COM1 if the caller enabled them
 int printkString(const char *s, size_t length){
-	return printString(&kernelDisplay, s, length);
+	size_t offset = 0;
+	while(1){
+		acquireLock(&logFlushLock);
+		if(moveLogRings_noLock()){
+			offset += appendSinkBuffer_noLock(s + offset, length - offset);
+		}
+		releaseLock(&logFlushLock);
+		uintptr_t writeSize = writeSinkBuffer();
+		if(offset == length){
+			break;
+		}
+		// the caller interrupted the writer of sinkBuffer, so waiting for sinkBuffer would never end
+		if(writeSize == 0 && getEFlags().bit.interrupt == 0 && sinkWriter == sinkWriterID()){
+			writeLogSinks(s + offset, length - offset);
+			break;
+		}
+		pause();
+	}
+	return length;
 }
 
+int writeKernelLog(const char *s, size_t length){
+	if(isLogRingEnabled){
+		EFlags eflags = getEFlags();
+		cli();
+		const int i = getProcessorIndex();
+		LogRing *r = (i < 0? NULL: logRing[i]);
+		if(r != NULL){
+			appendLogRing(r, s, length);
+		}
+		if(eflags.bit.interrupt){
+			sti();
+		}
+		if(r != NULL){
+			return length;
+		}
+	}
+	return printkString(s, length);
+}
+
+void stopKernelLogRing(void){
+	isLogRingEnabled = 0;
+	// do not acquire logFlushLock or wait for sinkWriter, which may be held by the halting processor
+	int isEmpty;
+	do{
+		isEmpty = moveLogRings_noLock();
+		char buffer[LOG_FLUSH_SIZE];
+		uint32_t length;
+		while((length = takeSinkBuffer_noLock(buffer, sizeof(buffer))) != 0){
+			writeLogSinks(buffer, length);
+		}
+	}while(isEmpty == 0);
+}
+
+void kernelLogService(void){
+	setTaskWeight(processorLocalTask(), MIN_TASK_WEIGHT);
+	isLogRingEnabled = 1;
+	while(1){
+		// processors may start after this service
+		uint32_t i;
+		for(i = 0; i < getProcessorCount(); i++){
+			if(logRing[i] != NULL){
+				continue;
+			}
+			LogRing *r = allocateKernelPages(CEIL(sizeof(*r), PAGE_SIZE), KERNEL_PAGE);
+			if(r == NULL){
+				break;
+			}
+			r->writeCount = 0;
+			r->readCount = 0;
+			r->droppedSize = 0;
+			r->reportedDroppedSize = 0;
+			logRing[i] = r;
+		}
+		acquireLock(&logFlushLock);
+		moveLogRings_noLock();
+		releaseLock(&logFlushLock);
+		if(writeSinkBuffer() == 0){
+			sleep(LOG_FLUSH_INTERVAL);
+		}
+	}
+}
+
+#undef LOG_FLUSH_INTERVAL
+#undef LOG_FLUSH_SIZE
+#undef SINK_BUFFER_SIZE
+#undef LOG_RING_SIZE
+
 void initKernelConsole(void){
 	ConsoleDisplay *cd = &kernelDisplay;
 	PhysicalAddress defaultTextVideoAddress = {DEFAULT_TEXT_VIDEO_ADDRESS};
@@ -161,6 +403,7 @@ void initKernelConsole(void){
 		KERNEL_NON_CACHED_PAGE
 	);*/
 	cd->lock = initialSpinlock;
+	initSerialPort();
 	updateVideoAddress(cd);
 	updateCursor(cd);
 	int c = 0;
@@ -306,7 +549,7 @@ static uintptr_t runCommand(const char *cmdLine, uintptr_t length){
 	}
 	//TODO: arguments
 	uintptr_t programNameLength = cmdLine - programName;
-	Task *t = createUserTaskFromELF(programName, programNameLength, 3);
+	Task *t = createUserTaskFromELF(programName, programNameLength, FAIR_SHARE_PRIORITY);
 	if(t == NULL){
 		printk("failed to start task\n");
 	}
@@ -314,6 +557,38 @@ static uintptr_t runCommand(const char *cmdLine, uintptr_t length){
 	return (uintptr_t)t;
 }
 
+// toggle a tracepoint; see debug:trace
+static uintptr_t traceCommand(const char *cmdLine, uintptr_t length){
+	const char *name = nextArgument(&cmdLine, &length);
+	if(name == NULL){
+		printk("missing tracepoint name\n");
+		return 0;
+	}
+	uintptr_t nameLength = cmdLine - name;
+	int enabled = isTracepointNameEnabled(name, nameLength);
+	if(enabled < 0){
+		printk("unknown tracepoint\n");
+		return 0;
+	}
+	if(enableTracepoint(name, nameLength, !enabled) == 0){
+		printk("cannot allocate trace buffers\n");
+		return 0;
+	}
+	printk("tracepoint %s\n", (enabled? "disabled": "enabled"));
+	return 1;
+}
+
+// toggle the sampling profiler; see debug:profile and profile.elf
+static uintptr_t profileCommand(__attribute__((__unused__)) const char *cmdLine, __attribute__((__unused__)) uintptr_t length){
+	const int enabled = isProfilerEnabled;
+	if(enableProfiler(!enabled) == 0){
+		printk("cannot allocate profile buffers\n");
+		return 0;
+	}
+	printk("profiler %s\n", (enabled? "disabled": "enabled"));
+	return 1;
+}
+
 static void parseCommand(const char *cmdLine, uintptr_t length){
 	const struct{
 		const char *string;
@@ -325,7 +600,9 @@ static void parseCommand(const char *cmdLine, uintptr_t length){
 		{"write", writeCommand},
 		{"close", closeCommand},
 		{"dir", dirCommand},
-		{"run", runCommand}
+		{"run", runCommand},
+		{"trace", traceCommand},
+		{"profile", profileCommand}
 	};
 
 	const char *arg = nextArgument(&cmdLine, &length);
@@ -507,13 +784,14 @@ static void kernelConsoleLoop(ConsoleCommandLine *cmd){
 		printk("cannot allocate memory for kernel console\n");
 		systemCall_terminate();
 	}
-	waitForFirstResource("ps2", RESOURCE_FILE_SYSTEM, matchName);
+	// ps2 is a dependency in initService
 	uintptr_t kb = syncOpenFile("ps2:keyboard");
 	if(kb == IO_REQUEST_FAILURE){
 		printk("cannot open PS/2 keyboard\n");
 		systemCall_terminate();
 	}
 	struct KeyboardState kbState = {0};
+	finishBootTrace("console ready", strlen("console ready"));
 
 	while(1){
 		KeyboardEvent ke;
@@ -648,4 +926,49 @@ void testDelayEcho(void){
 	systemCall_terminate();
 }
 
+// print from every processor at the same time and report the average time of printk
+#define TEST_LOG_COUNT (200)
+
+typedef struct{
+	volatile uint32_t doneCount;
+	volatile uint32_t totalNanosecond;
+}KernelLogTest;
+
+static void testKernelLogTask(void *voidArg){
+	KernelLogTest *t = *(KernelLogTest**)voidArg;
+	const uint64_t t0 = getClockNanosecond();
+	int i;
+	for(i = 0; i < TEST_LOG_COUNT; i++){
+		printk("log test %d of processor %d\n", i, getProcessorIndex());
+	}
+	const uint64_t t1 = getClockNanosecond();
+	lock_add32(&t->totalNanosecond, (uint32_t)(t1 - t0));
+	lock_add32(&t->doneCount, 1);
+	systemCall_terminate();
+}
+
+void testKernelLog(void){
+	KernelLogTest *NEW(t);
+	assert(t != NULL);
+	t->doneCount = 0;
+	t->totalNanosecond = 0;
+	const uint32_t processorCount = getProcessorCount();
+	uint32_t i;
+	for(i = 0; i < processorCount; i++){
+		Task *task = createSharedMemoryTask(testKernelLogTask, &t, sizeof(t), processorLocalTask());
+		assert(task != NULL);
+		int ok = setTaskAffinity(task, ((uint32_t)1) << i);
+		assert(ok);
+		resume(task);
+	}
+	while(t->doneCount != processorCount){
+		sleep(10);
+	}
+	printk("printk: %u ns on average\n", t->totalNanosecond / (processorCount * TEST_LOG_COUNT));
+	DELETE(t);
+	systemCall_terminate();
+}
+
+#undef TEST_LOG_COUNT
+
 #endif
@@ -17,6 +17,21 @@ uintptr_t getDataLength(FIFO *fifo);
 FIFO *createFIFO(uintptr_t maxLength, uintptr_t elementSize);
 void deleteFIFO(FIFO *fifo);
 
+// lock-free FIFO for one writer and one reader
+typedef struct SPSCFIFO SPSCFIFO;
+// return 1 if written, 0 if full
+int writeSPSCFIFO(SPSCFIFO *fifo, const void *data);
+// read at most maxCount elements. return the number of elements read
+uintptr_t readSPSCFIFONonBlock(SPSCFIFO *fifo, void *data, uintptr_t maxCount);
+// wait until at least one element is readable
+uintptr_t readSPSCFIFO(SPSCFIFO *fifo, void *data, uintptr_t maxCount);
+SPSCFIFO *createSPSCFIFO(uintptr_t length, uintptr_t elementSize);
+void deleteSPSCFIFO(SPSCFIFO *fifo);
+#ifndef NDEBUG
+void testSPSCFIFO(void);
+void testSPSCFIFOStress(void);
+#endif
+
 // see fifofile.c
 /*
 typedef struct FIFOList FIFOList;
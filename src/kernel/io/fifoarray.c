@@ -133,3 +133,224 @@ void deleteFIFO(FIFO *fifo){
 	DELETE(fifo->buffer);
 	DELETE(fifo);
 }
+
+// single producer, single consumer
+// the producer only writes writeCount and the consumer only writes readCount
+struct SPSCFIFO{
+	volatile uintptr_t writeCount, readCount;
+	uintptr_t bufferLength, elmtSize;
+	uint8_t *buffer;
+	// released when the FIFO changes from empty to non-empty
+	Semaphore *semaphore;
+};
+
+#define SPSC_BARRIER() __asm__ volatile("":::"memory")
+// x86 may move a load before an earlier store; i586 has no mfence
+#define SPSC_FULL_BARRIER() __asm__ volatile("lock addl $0, (%%esp)":::"memory", "cc")
+
+static uint8_t *spscBufferLocation(SPSCFIFO *fifo, uintptr_t index){
+	return fifo->buffer + fifo->elmtSize * (index & (fifo->bufferLength - 1));
+}
+
+int writeSPSCFIFO(SPSCFIFO *fifo, const void *data){
+	const uintptr_t w = fifo->writeCount;
+	const uintptr_t r = fifo->readCount;
+	if(w - r >= fifo->bufferLength){
+		return 0;
+	}
+	memcpy(spscBufferLocation(fifo, w), data, fifo->elmtSize);
+	SPSC_BARRIER();
+	fifo->writeCount = w + 1;
+	// pairs with the barrier in readSPSCFIFO
+	// either the consumer sees the new writeCount or the producer sees the final readCount
+	SPSC_FULL_BARRIER();
+	// if the consumer saw w == readCount, readCount is still w
+	if(fifo->readCount == w){
+		releaseSemaphore(fifo->semaphore);
+	}
+	return 1;
+}
+
+uintptr_t readSPSCFIFONonBlock(SPSCFIFO *fifo, void *data, uintptr_t maxCount){
+	const uintptr_t r = fifo->readCount;
+	const uintptr_t w = fifo->writeCount;
+	SPSC_BARRIER();
+	uintptr_t n = MIN(w - r, maxCount), i;
+	for(i = 0; i < n; i++){
+		memcpy(((uint8_t*)data) + fifo->elmtSize * i, spscBufferLocation(fifo, r + i), fifo->elmtSize);
+	}
+	SPSC_BARRIER();
+	fifo->readCount = r + n;
+	return n;
+}
+
+uintptr_t readSPSCFIFO(SPSCFIFO *fifo, void *data, uintptr_t maxCount){
+	assert(maxCount > 0);
+	while(1){
+		uintptr_t n = readSPSCFIFONonBlock(fifo, data, maxCount);
+		if(n != 0){
+			return n;
+		}
+		// order the last store to readCount before loading writeCount
+		SPSC_FULL_BARRIER();
+		if(fifo->writeCount != fifo->readCount){
+			continue;
+		}
+		// the semaphore may have been released for data that is already read
+		acquireSemaphore(fifo->semaphore);
+	}
+}
+
+#undef SPSC_FULL_BARRIER
+#undef SPSC_BARRIER
+
+SPSCFIFO *createSPSCFIFO(uintptr_t length, uintptr_t elementSize){
+	assert((length & (length - 1)) == 0);
+	SPSCFIFO *NEW(fifo);
+	EXPECT(fifo != NULL);
+	NEW_ARRAY(fifo->buffer, length * elementSize);
+	EXPECT(fifo->buffer != NULL);
+	fifo->writeCount = 0;
+	fifo->readCount = 0;
+	fifo->bufferLength = length;
+	fifo->elmtSize = elementSize;
+	fifo->semaphore = createSemaphore(0);
+	EXPECT(fifo->semaphore != NULL);
+	return fifo;
+	//deleteSemaphore(fifo->semaphore);
+	ON_ERROR;
+	DELETE(fifo->buffer);
+	ON_ERROR;
+	DELETE(fifo);
+	ON_ERROR;
+	return NULL;
+}
+
+void deleteSPSCFIFO(SPSCFIFO *fifo){
+	deleteSemaphore(fifo->semaphore);
+	DELETE(fifo->buffer);
+	DELETE(fifo);
+}
+
+#ifndef NDEBUG
+#include"io/ioservice.h"
+#include"task/task.h"
+#include"assembly/assembly.h"
+#include"multiprocessor/processorlocal.h"
+
+#define TEST_FIFO_COUNT (1 << 18)
+
+typedef struct{
+	int isSPSC;
+	FIFO *fifo;
+	SPSCFIFO *spscFIFO;
+}FIFOTest;
+
+static void testFIFOWriter(void *voidArg){
+	FIFOTest *t = *(FIFOTest**)voidArg;
+	uintptr_t i;
+	for(i = 0; i < TEST_FIFO_COUNT; i++){
+		if(t->isSPSC){
+			while(writeSPSCFIFO(t->spscFIFO, &i) == 0){
+				pause();
+			}
+		}
+		else{
+			while(writeFIFO(t->fifo, &i) == 0){
+				pause();
+			}
+		}
+	}
+	systemCall_terminate();
+}
+
+// one task writes sequential numbers and this task reads them in batches
+void testSPSCFIFO(void){
+	FIFOTest *NEW(t);
+	assert(t != NULL);
+	t->fifo = createFIFO(256, sizeof(uintptr_t));
+	t->spscFIFO = createSPSCFIFO(256, sizeof(uintptr_t));
+	assert(t->fifo != NULL && t->spscFIFO != NULL);
+	for(t->isSPSC = 0; t->isSPSC < 2; t->isSPSC++){
+		const uint64_t t0 = getClockNanosecond();
+		Task *task = createSharedMemoryTask(testFIFOWriter, &t, sizeof(t), processorLocalTask());
+		assert(task != NULL);
+		resume(task);
+		uintptr_t expected = 0;
+		while(expected < TEST_FIFO_COUNT){
+			uintptr_t data[16], n, i;
+			if(t->isSPSC){
+				n = readSPSCFIFO(t->spscFIFO, data, LENGTH_OF(data));
+			}
+			else{
+				readFIFO(t->fifo, data);
+				n = 1;
+			}
+			for(i = 0; i < n; i++){
+				assert(data[i] == expected);
+				expected++;
+			}
+		}
+		const uint64_t t1 = getClockNanosecond();
+		printk("%s: %u elements in %u us\n", (t->isSPSC? "SPSC FIFO": "FIFO"),
+			TEST_FIFO_COUNT, (uint32_t)((t1 - t0) / 1000));
+	}
+	assert(readSPSCFIFONonBlock(t->spscFIFO, NULL, 0) == 0);
+	deleteSPSCFIFO(t->spscFIFO);
+	deleteFIFO(t->fifo);
+	DELETE(t);
+	printk("test SPSC FIFO ok\n");
+	systemCall_terminate();
+}
+
+#define TEST_SPSC_STRESS_COUNT (1 << 16)
+
+// the producer writes one element at a time so that the consumer often sleeps on an empty FIFO
+// a lost wakeup hangs this test
+static void testSPSCStressWriter(void *voidArg){
+	SPSCFIFO *fifo = *(SPSCFIFO**)voidArg;
+	systemCall_setTaskAffinity(2);
+	uintptr_t i;
+	for(i = 0; i < TEST_SPSC_STRESS_COUNT; i++){
+		while(writeSPSCFIFO(fifo, &i) == 0){
+			pause();
+		}
+		uintptr_t delay;
+		for(delay = (i * 7) % 64; delay > 0; delay--){
+			pause();
+		}
+	}
+	systemCall_terminate();
+}
+
+void testSPSCFIFOStress(void){
+	if(getProcessorCount() < 2){
+		printk("SPSC FIFO stress test needs 2 processors\n");
+		systemCall_terminate();
+	}
+	systemCall_setTaskAffinity(1);
+	SPSCFIFO *fifo = createSPSCFIFO(4, sizeof(uintptr_t));
+	assert(fifo != NULL);
+	Task *task = createSharedMemoryTask(testSPSCStressWriter, &fifo, sizeof(fifo), processorLocalTask());
+	assert(task != NULL);
+	resume(task);
+	uintptr_t expected = 0;
+	while(expected < TEST_SPSC_STRESS_COUNT){
+		uintptr_t data[4], n, i;
+		n = readSPSCFIFO(fifo, data, LENGTH_OF(data));
+		for(i = 0; i < n; i++){
+			assert(data[i] == expected);
+			expected++;
+		}
+	}
+	// wait for the writer to terminate
+	sleep(100);
+	deleteSPSCFIFO(fifo);
+	systemCall_setTaskAffinity(ANY_PROCESSOR_AFFINITY);
+	printk("test SPSC FIFO stress ok\n");
+	systemCall_terminate();
+}
+
+#undef TEST_SPSC_STRESS_COUNT
+#undef TEST_FIFO_COUNT
+#endif
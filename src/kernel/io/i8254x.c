@@ -1,6 +1,7 @@
 #include"network/ethernet.h"
 #include"task/task.h"
 #include"multiprocessor/processorlocal.h"
+#include"multiprocessor/perfcounter.h"
 #include"interrupt/controller/pic.h"
 #include"task/exclusivelock.h"
 #include"file/fileservice.h"
@@ -747,7 +748,7 @@ static void dropI8254xReadBuffer(I8254xReader *reader, uintptr_t addTail){
 	uintptr_t readerDiff = (q->bufferCount + reader->bufferIndex - q->bufferTail) % q->bufferCount;
 	if(readerDiff < addTail){
 		reader->bufferIndex = newBufferTail;
-		// printk("warning: i8254x dropped received frames\n");
+		addCounter(COUNTER_PACKET_DROP, addTail - readerDiff);
 	}
 }
 
@@ -1088,11 +1089,8 @@ static int openI8254x(OpenFileRequest *ofr, const char *name, uintptr_t nameLeng
 	return 1;
 }
 
+// started after PCI driver; see initService
 void i8254xDriver(void){
-	if(waitForFirstResource("pci", RESOURCE_FILE_SYSTEM, matchName) == 0){
-		printk("failed to find PCI driver\n");
-		systemCall_terminate();
-	}
 	uintptr_t pci = enumeratePCI(0x02000000, 0xffffff00);
 	if(pci == IO_REQUEST_FAILURE){
 		printk("failed to enum PCI\n");
@@ -6,6 +6,7 @@
 #include"io.h"
 
 typedef struct IORequest IORequest;
+typedef struct IORing IORing;
 typedef void CancelIO(void *instance);
 typedef int AcceptIO(void *instance, uintptr_t *returnValues);
 typedef struct Task Task;
@@ -27,6 +28,9 @@ struct IORequest{
 	// initIORequest(), cancel() and accept() are always invoked by its own task;
 	// IO may be handled by different task.
 	// handling and cancel() may run concurrently.
+	// if the request is submitted by IORing, accept() is invoked when its task enters the ring
+	IORing *ring;
+	uintptr_t ringUserData;
 };
 void pendIO(IORequest *ior);
 IORequest *waitAnyIO(void);
@@ -48,12 +52,31 @@ void initIORequest(
 	CancelIO *cancelIO,
 	AcceptIO *acceptIO
 );
+// return 0 if ior has completed before attached; the caller should call postIORingCompletion
+int attachIORing(IORequest *ior, IORing *r, uintptr_t userData);
+
+// ioring.c
+// called by completeIO; the request is accepted later by the task owning the ring
+void postIORingCompletion(IORequest *ior);
+// the request was cancelled without completion
+void cancelIORingRequest(IORing *r);
+// wait for any completion posted after the last wait
+void waitIORingCompletion(IORing *r);
+// wait for all submitted requests and release the rings
+void deleteIORing(IORing *r);
+typedef struct SystemCallTable SystemCallTable;
+void initIORing(SystemCallTable *s);
+void testIORing(void);
+// see taskmanager.c
+void testCloneIORing(void);
 
 // timer8254.c
 void setTimer8254Frequency(unsigned frequency);
 // interval in milliseconds
 void setTimer8254OneShot(unsigned interval);
 uint16_t readTimer8254Count(void);
+// busy-wait without interrupt; usable before the timer is initialized
+void waitTimer8254(unsigned microsecond);
 
 // timer.c
 typedef struct InterruptParam InterruptParam;
@@ -66,8 +89,34 @@ TimerEventList *createTimer(void);
 void setTimerHandler(TimerEventList *tel, InterruptVector *v);
 // for IRQ timer
 int addTimerHandler(TimerEventList *tel, InterruptVector *v);
-typedef struct SystemCallTable SystemCallTable;
 void initTimer(SystemCallTable *systemCallTable);
+void testTimerWheel(void);
+void testIdleTimer(void);
+void testIdleEmptyTimer(void);
+typedef struct InterruptTable InterruptTable;
+typedef struct InterruptController PIC;
+// called by every processor supporting one-shot timer, after setProcessorLocal
+void initIdleTimer(PIC *pic, InterruptTable *t);
+// called by idle loop with interrupt disabled
+// switch to one-shot timer until the next timer event if there is no ready task
+void startIdleTimer(void);
+// switch back to periodic timer after waking up and enable interrupt
+void stopIdleTimer(void);
+// interrupt the processor in one-shot mode to schedule new ready tasks
+void wakeupIdleProcessor(int processorIndex);
+
+// clock.c
+// calibrate TSC with timer IRQ
+void initClock(PIC *pic);
+// nanoseconds since initClock
+uint64_t getClockNanosecond(void);
+typedef struct TimePage TimePage;
+const TimePage *getKernelTimePage(void);
+typedef struct PageManager PageManager;
+// map the time page as read-only
+int mapTimePage(PageManager *p, uintptr_t linearAddress);
+void unmapTimePage(PageManager *p, uintptr_t linearAddress);
+void testClock(void);
 
 // cmos.c
 void initCMOS(PIC *pic, SystemCallTable *s);
@@ -75,6 +124,16 @@ void initCMOS(PIC *pic, SystemCallTable *s);
 //console.h
 void initKernelConsole(void);
 void kernelConsoleService(void);
+// copy the per-processor log rings to the display and COM1
+void kernelLogService(void);
+void testKernelLog(void);
+// print the rings and write later messages directly
+void stopKernelLogRing(void);
+
+// serial.c
+void initSerialPort(void);
+// do nothing if COM1 does not exist
+void writeSerialPort(const char *s, size_t length);
 
 // video.c
 void vbeDriver(void);
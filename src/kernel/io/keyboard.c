@@ -109,7 +109,9 @@ static void writeData(uint16_t port, uint8_t data){
 }
 
 typedef struct{
-	FIFO *intFIFO, *kbFIFO, *mouseFIFO;
+	// IO APIC delivers both IRQs to the same processor, so ps2Handler is the only writer
+	SPSCFIFO *intFIFO;
+	FIFO *kbFIFO, *mouseFIFO;
 }PS2FIFO;
 
 // ps2Handler -> ps2Driver -> keyboardInput ->syscall_keyboard
@@ -125,7 +127,7 @@ static int ps2Handler(const InterruptParam *p){
 	if(d.status & READABLE_FLAG){
 		d.data = readData();
 		PS2FIFO *ps2 = (PS2FIFO*)(p->argument);
-		writeFIFO(ps2->intFIFO, &d);
+		writeSPSCFIFO(ps2->intFIFO, &d);
 	}
 	return 1;
 }
@@ -273,7 +275,7 @@ static void initPS2Driver(PIC* pic){
 	initMouse();
 	initKeyboard();
 
-	ps2.intFIFO = createFIFO(64, sizeof(PS2Data));
+	ps2.intFIFO = createSPSCFIFO(64, sizeof(PS2Data));
 	ps2.kbFIFO = createFIFO(32, sizeof(KeyboardEvent));
 	ps2.mouseFIFO = createFIFO(64, sizeof(MouseEvent));
 	//ps2.sysFIFO = createFIFO(128, sizeof(MouseEvent));
@@ -291,13 +293,15 @@ static void initPS2Driver(PIC* pic){
 void ps2Driver(void){
 	initPS2Driver(processorLocalPIC());
 	while(1){
-		PS2Data d;
-		readFIFO(ps2.intFIFO, &d);
-		if(d.status & DATA_FROM_MOUSE_FLAG){
-			mouseInput(d.data, ps2.mouseFIFO);
-		}
-		else{
-			keyboardInput(d.data, ps2.kbFIFO);
+		PS2Data d[16];
+		uintptr_t n = readSPSCFIFO(ps2.intFIFO, d, LENGTH_OF(d)), i;
+		for(i = 0; i < n; i++){
+			if(d[i].status & DATA_FROM_MOUSE_FLAG){
+				mouseInput(d[i].data, ps2.mouseFIFO);
+			}
+			else{
+				keyboardInput(d[i].data, ps2.kbFIFO);
+			}
 		}
 	}
 }
@@ -351,29 +351,30 @@ static void deleteDataLinkDevice(DataLinkDevice *d){
 	DELETE(d);
 }
 */
+// the lock serializes writers; DataLinkDevice is never deleted
 static void addDataLinkDevice(DataLinkDeviceList *dlList, DataLinkDevice *d){
 	acquireLock(&dlList->lock);
-	ADD_TO_DQUEUE(d, &dlList->head);
+	RCU_ADD_TO_DQUEUE(d, &dlList->head);
 	releaseLock(&dlList->lock);
 }
 
 static DataLinkDevice *searchDeviceByName(DataLinkDeviceList *devList, const char *name, uintptr_t nameLength){
-	acquireLock(&devList->lock);
+	const int interruptFlag = beginRCURead();
 	DataLinkDevice *d;
-	for(d= devList->head; d != NULL; d = d->next){
+	for(d = RCU_READ(devList->head); d != NULL; d = RCU_READ(d->next)){
 		if(isStringEqual(d->fileEnumeration.name, d->fileEnumeration.nameLength, name, nameLength)){
 			break;
 		}
 	}
-	releaseLock(&devList->lock);
+	endRCURead(interruptFlag);
 	return d;
 }
 
 static DataLinkDevice *searchDeviceByRoutingTable(DataLinkDeviceList *devList, __attribute__((__unused__)) IPV4Address address){
-	acquireLock(&devList->lock);
+	const int interruptFlag = beginRCURead();
 	DataLinkDevice *d;
 	// TODO:
-	for(d = devList->head; d != NULL; d = d->next){
+	for(d = RCU_READ(devList->head); d != NULL; d = RCU_READ(d->next)){
 		int ok = 1;
 		// (d->ipConfig.bindingAddress.value & d->ipConfig.subnetMask.value) ==
 		// (address.value & d->ipConfig.subnetMask.value);
@@ -381,7 +382,7 @@ static DataLinkDevice *searchDeviceByRoutingTable(DataLinkDeviceList *devList, _
 			break;
 		}
 	}
-	releaseLock(&devList->lock);
+	endRCURead(interruptFlag);
 	return d;
 }
 
@@ -545,35 +546,37 @@ static int validateIPV4Packet(const IPV4Header *packet, uintptr_t readSize/*TODO
 }
 
 typedef struct IPFIFO{
-	FIFO *fifo;
+	// one ipDeviceReader for each device writes to the FIFO
+	Spinlock writerLock;
+	SPSCFIFO *fifo;
 	struct IPFIFO **prev, *next;
 }IPFIFO;
 
+// ipDeviceReader reads the list in RCU read sections
 struct IPFIFOList{
-	Semaphore *semaphore;
+	Spinlock writerLock;
 	IPFIFO *head;
 };
 
 static int initIPFIFOList(struct IPFIFOList *ifl){
-	ifl->semaphore = createSemaphore(1);
-	if(ifl->semaphore == NULL){
-		return 0;
-	}
+	ifl->writerLock = initialSpinlock;
 	ifl->head = NULL;
 
 	return 1;
 }
 
 static void addToIPFIFOList(struct IPFIFOList *ifl, IPFIFO *ipf){
-	acquireSemaphore(ifl->semaphore);
-	ADD_TO_DQUEUE(ipf, &ifl->head);
-	releaseSemaphore(ifl->semaphore);
+	acquireLock(&ifl->writerLock);
+	RCU_ADD_TO_DQUEUE(ipf, &ifl->head);
+	releaseLock(&ifl->writerLock);
 }
 
 static void removeFromIPFIFOList(struct IPFIFOList *ifl, IPFIFO *ipf){
-	acquireSemaphore(ifl->semaphore);
-	REMOVE_FROM_DQUEUE(ipf);
-	releaseSemaphore(ifl->semaphore);
+	acquireLock(&ifl->writerLock);
+	RCU_REMOVE_FROM_DQUEUE(ipf);
+	releaseLock(&ifl->writerLock);
+	synchronizeRCU();
+	ipf->next = NULL;
 }
 
 struct QueuedPacket{
@@ -586,7 +589,8 @@ struct QueuedPacket{
 static IPFIFO *createIPFIFO(uintptr_t maxLength){
 	IPFIFO *NEW(ipf);
 	EXPECT(ipf != NULL);
-	ipf->fifo = createFIFO(maxLength, sizeof(QueuedPacket*));
+	ipf->writerLock = initialSpinlock;
+	ipf->fifo = createSPSCFIFO(maxLength, sizeof(QueuedPacket*));
 	EXPECT(ipf->fifo != NULL);
 	ipf->prev = NULL;
 	ipf->next = NULL;
@@ -623,27 +627,29 @@ void addQueuedPacketRef(QueuedPacket *p, int n){
 	}
 }
 
-static void overwriteIPFIFO(IPFIFO *f, QueuedPacket *p){
-	QueuedPacket *dropped = NULL;
-	addQueuedPacketRef(p, 1);
-	if(overwriteFIFO(f->fifo, &p, &dropped) == 0){
-		addQueuedPacketRef(dropped, -1);
+// drop the new packet if the FIFO is full
+// the caller holds a reference of p, so the memory is never released here
+static void writeIPFIFO(IPFIFO *f, QueuedPacket *p){
+	addReference(&p->referenceCount, 1);
+	acquireLock(&f->writerLock);
+	int ok = writeSPSCFIFO(f->fifo, &p);
+	releaseLock(&f->writerLock);
+	if(ok == 0){
+		addReference(&p->referenceCount, -1);
 	}
 }
 
-static QueuedPacket *readIPFIFO(IPFIFO *f){
-	QueuedPacket *r;
-	readFIFO(f->fifo, &r);
-	return r;
+static uintptr_t readIPFIFO(IPFIFO *f, QueuedPacket **p, uintptr_t maxCount){
+	return readSPSCFIFO(f->fifo, p, maxCount);
 }
 
 static void deleteIPFIFO(IPFIFO *ipf){
 	assert(IS_IN_DQUEUE(ipf) == 0);
 	QueuedPacket *p;
-	while(readFIFONonBlock(ipf->fifo, &p) != 0){
+	while(readSPSCFIFONonBlock(ipf->fifo, &p, 1) != 0){
 		addQueuedPacketRef(p, -1);
 	}
-	deleteFIFO(ipf->fifo);
+	deleteSPSCFIFO(ipf->fifo);
 	DELETE(ipf);
 }
 
@@ -694,13 +700,13 @@ static void ipDeviceReader(void *voidArg){
 			continue;
 		}
 		addQueuedPacketRef(qp, 1);
-		acquireSemaphore(ipFIFOList->semaphore);
+		const int interruptFlag = beginRCURead();
 		IPFIFO *ipf;
-		for(ipf = ipFIFOList->head; ipf != NULL; ipf = ipf->next){
+		for(ipf = RCU_READ(ipFIFOList->head); ipf != NULL; ipf = RCU_READ(ipf->next)){
 			// IMPROVE: check socket's IP address, device name... here
-			overwriteIPFIFO(ipf, qp);
+			writeIPFIFO(ipf, qp);
 		}
-		releaseSemaphore(ipFIFOList->semaphore);
+		endRCURead(interruptFlag);
 		addQueuedPacketRef(qp, -1);
 	}
 	releaseKernelMemory(packet);
@@ -766,16 +772,17 @@ static void receiveIPTask(void *voidArg){
 	struct IPFIFOList *const ipFIFOList = &ipService.readFIFOList;
 	EXPECT(ipFIFO != NULL);
 	addToIPFIFOList(ipFIFOList, ipFIFO);
-	while(1){
-		// wait for a valid IPv4 packet
-		QueuedPacket *qp = readIPFIFO(ipFIFO);
-		int continueFlag = 1;
-		if(filterQueuedPacket(ips, qp)){
-			continueFlag = ips->receivePacket(ips, qp);
-		}
-		addQueuedPacketRef(qp, -1);
-		if(continueFlag == 0){
-			break;
+	int continueFlag = 1;
+	while(continueFlag){
+		// wait for valid IPv4 packets
+		QueuedPacket *qp[8];
+		const uintptr_t n = readIPFIFO(ipFIFO, qp, LENGTH_OF(qp));
+		uintptr_t i;
+		for(i = 0; i < n; i++){
+			if(continueFlag && filterQueuedPacket(ips, qp[i])){
+				continueFlag = ips->receivePacket(ips, qp[i]);
+			}
+			addQueuedPacketRef(qp[i], -1);
 		}
 	}
 	removeFromIPFIFOList(ipFIFOList, ipFIFO);
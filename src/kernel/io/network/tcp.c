@@ -326,9 +326,8 @@ static int initTCPReceiveWindow(TCPReceiveWindow *rw, uintptr_t windowSize){
 	rw->windowSize = windowSize;
 	rw->reachFinish = 0;
 	rw->sequenceFinish = 0;
-	NEW_ARRAY(rw->buffer, windowSize);
+	rw->buffer = allocateZeroedKernelPages(CEIL(windowSize * sizeof(*rw->buffer), PAGE_SIZE), KERNEL_PAGE);
 	EXPECT(rw->buffer != NULL);
-	memset(rw->buffer, 0, windowSize * (sizeof(*rw->buffer)));
 
 	MEMSET0(rw->tail);
 	rw->tail->next = NULL;
@@ -336,7 +335,7 @@ static int initTCPReceiveWindow(TCPReceiveWindow *rw, uintptr_t windowSize){
 	rw->head = NULL;
 	ADD_TO_DQUEUE(rw->tail, &rw->head);
 	return 1;
-	DELETE(rw->buffer);
+	checkAndReleaseKernelPages(rw->buffer);
 	ON_ERROR;
 	return 0;
 }
@@ -0,0 +1,78 @@
+#include"kernel.h"
+#include"ioservice.h"
+#include"assembly/assembly.h"
+
+// COM1 without interrupts; used by the kernel log
+
+#define COM1_PORT (0x3f8)
+
+typedef enum{
+	SERIAL_DATA = 0,
+	SERIAL_INTERRUPT_ENABLE = 1,
+	SERIAL_DIVISOR_LOW = 0,
+	SERIAL_DIVISOR_HIGH = 1,
+	SERIAL_FIFO_CONTROL = 2,
+	SERIAL_LINE_CONTROL = 3,
+	SERIAL_MODEM_CONTROL = 4,
+	SERIAL_LINE_STATUS = 5,
+	SERIAL_SCRATCH = 7
+}SerialRegister;
+
+typedef enum{
+	SERIAL_LINE_DIVISOR_LATCH = (1 << 7),
+	SERIAL_LINE_8N1 = 0x03
+}SerialLineControl;
+
+typedef enum{
+	SERIAL_STATUS_TRANSMIT_EMPTY = (1 << 5)
+}SerialLineStatus;
+
+// give up a character if the port is not ready after this many polls
+#define MAX_SERIAL_POLL_COUNT (100000)
+
+static int isSerialPortPresent = 0;
+
+void initSerialPort(void){
+	// the scratch register does not exist if there is no UART
+	out8(COM1_PORT + SERIAL_SCRATCH, 0x5a);
+	if(in8(COM1_PORT + SERIAL_SCRATCH) != 0x5a){
+		return;
+	}
+	out8(COM1_PORT + SERIAL_INTERRUPT_ENABLE, 0x00);
+	// 115200 baud
+	out8(COM1_PORT + SERIAL_LINE_CONTROL, SERIAL_LINE_DIVISOR_LATCH);
+	out8(COM1_PORT + SERIAL_DIVISOR_LOW, 1);
+	out8(COM1_PORT + SERIAL_DIVISOR_HIGH, 0);
+	out8(COM1_PORT + SERIAL_LINE_CONTROL, SERIAL_LINE_8N1);
+	// enable and clear FIFO, 14-byte threshold
+	out8(COM1_PORT + SERIAL_FIFO_CONTROL, 0xc7);
+	// DTR and RTS
+	out8(COM1_PORT + SERIAL_MODEM_CONTROL, 0x03);
+	isSerialPortPresent = 1;
+}
+
+static void writeSerialChar(uint8_t c){
+	int i;
+	for(i = 0; i < MAX_SERIAL_POLL_COUNT; i++){
+		if(in8(COM1_PORT + SERIAL_LINE_STATUS) & SERIAL_STATUS_TRANSMIT_EMPTY){
+			out8(COM1_PORT + SERIAL_DATA, c);
+			return;
+		}
+		pause();
+	}
+}
+
+void writeSerialPort(const char *s, size_t length){
+	if(isSerialPortPresent == 0){
+		return;
+	}
+	size_t i;
+	for(i = 0; i < length; i++){
+		if(s[i] == '\n'){
+			writeSerialChar('\r');
+		}
+		writeSerialChar(s[i]);
+	}
+}
+
+#undef MAX_SERIAL_POLL_COUNT
@@ -3,6 +3,7 @@
 #include"task/task.h"
 #include"multiprocessor/processorlocal.h"
 #include"multiprocessor/spinlock.h"
+#include"multiprocessor/perfcounter.h"
 #include"memory/memory.h"
 #include"common.h"
 #include"kernel.h"
@@ -12,7 +13,7 @@
 
 typedef struct TimerEvent{
 	IORequest ior;
-	uint64_t countdownTicks;
+	uint64_t expireTick;
 	// period = 0 for one-shot timer
 	uint64_t tickPeriod;
 	volatile int isSentToTask;
@@ -20,10 +21,20 @@ typedef struct TimerEvent{
 	struct TimerEvent **prev, *next;
 }TimerEvent;
 
+// hierarchical timing wheel
+// an event is put in the level of the highest 6-bit group in which expireTick differs from currentTick
+// and moved to lower levels when currentTick reaches the group
+#define WHEEL_SLOT_BITS (6)
+#define WHEEL_SLOT_COUNT (1 << WHEEL_SLOT_BITS)
+#define WHEEL_LEVEL_COUNT ((64 + WHEEL_SLOT_BITS - 1) / WHEEL_SLOT_BITS)
+
 struct TimerEventList{
 	Spinlock lock;
 	uint64_t currentTick;
-	TimerEvent *head;
+	// 0 if the timer is periodic
+	// otherwise, the timer interrupt comes after idleTicks and handles currentTick + idleTicks - 1
+	uint32_t idleTicks;
+	TimerEvent *slot[WHEEL_LEVEL_COUNT][WHEEL_SLOT_COUNT];
 };
 
 static void cancelTimerEvent(void *instance){
@@ -57,7 +68,7 @@ static TimerEvent *createTimerEvent(uint64_t periodTicks){
 		return NULL;
 	}
 	initIORequest(&te->ior, te, cancelTimerEvent, acceptTimerEvent);
-	te->countdownTicks = 0;
+	te->expireTick = 0;
 	te->tickPeriod = periodTicks;
 	te->isSentToTask = 0;
 	te->lock = NULL;
@@ -66,20 +77,40 @@ static TimerEvent *createTimerEvent(uint64_t periodTicks){
 	return te;
 }
 
-#define COUNTDOWN_TICK_MODULAR (((uint64_t)1) << 50)
+#define MAX_WAIT_TICKS (((uint64_t)1) << 50)
+
+// see startIdleTimer
+static volatile uint32_t idleProcessorCount = 0;
+static InterruptVector *wakeupVector = NULL;
+// indexed by getProcessorIndex
+static PIC *idleProcessorPIC[MAX_PROCESSOR_COUNT];
+static volatile uint32_t timerInterruptCount = 0;
+
+// avoid 64-bit builtins that need libgcc
+static int highestBit64(uint64_t v){
+	return (HIGH64(v) != 0? 32 + 31 - __builtin_clz(HIGH64(v)): 31 - __builtin_clz(LOW64(v)));
+}
+
+static int lowestBit64(uint64_t v){
+	return (LOW64(v) != 0? __builtin_ctz(LOW64(v)): 32 + __builtin_ctz(HIGH64(v)));
+}
+
+static TimerEvent **getWheelSlot(TimerEventList *tel, uint64_t expireTick){
+	uint64_t diff = (expireTick ^ tel->currentTick);
+	int level = (diff == 0? 0: highestBit64(diff) / WHEEL_SLOT_BITS);
+	return &tel->slot[level][(expireTick >> (level * WHEEL_SLOT_BITS)) % WHEEL_SLOT_COUNT];
+}
+
+static void insertTimerEvent_noLock(TimerEventList *tel, TimerEvent *te){
+	TimerEvent **s = getWheelSlot(tel, te->expireTick);
+	ADD_TO_DQUEUE(te, s);
+}
 
 static void addTimerEvent_noLock(TimerEventList* tel, uint64_t waitTicks, TimerEvent *te){
-	TimerEvent **i;
-	for(i = &tel->head; *i != NULL; i = &(*i)->next){
-		uint64_t waitTicks2 = ((*i)->countdownTicks + COUNTDOWN_TICK_MODULAR - tel->currentTick) % COUNTDOWN_TICK_MODULAR;
-		if(waitTicks <= waitTicks2){
-			break;
-		}
-	}
-	te->countdownTicks = (tel->currentTick + waitTicks) % COUNTDOWN_TICK_MODULAR;
+	te->expireTick = tel->currentTick + waitTicks;
 	te->isSentToTask = 0;
 	te->lock = &(tel->lock);
-	ADD_TO_DQUEUE(te, i);
+	insertTimerEvent_noLock(tel, te);
 }
 
 static void addTimerEvent(TimerEventList* tel, uint64_t waitTicks, TimerEvent *te){
@@ -94,7 +125,7 @@ static void setAlarmHandler(InterruptParam *p){
 	// not check overflow
 	uint64_t tick = (millisecond * TIMER_FREQUENCY) / 1000;
 
-	EXPECT(tick < COUNTDOWN_TICK_MODULAR);
+	EXPECT(tick < MAX_WAIT_TICKS);
 	if(tick == 0){
 		tick++;
 	}
@@ -111,32 +142,89 @@ static void setAlarmHandler(InterruptParam *p){
 	SYSTEM_CALL_RETURN_VALUE_0(p) = IO_REQUEST_FAILURE;
 }
 
-static void handleTimerEvents(TimerEventList *tel){
-	acquireLock(&tel->lock);
-	TimerEvent **prev = &(tel->head);
-	while(1){
-		TimerEvent *curr = *prev;
-		if(curr == NULL)
-			break;
-		if(curr->countdownTicks != tel->currentTick)
-			break;
+// move the events in the slot to lower levels
+static void cascadeTimerEvents_noLock(TimerEventList *tel, int level){
+	TimerEvent **s = &tel->slot[level][(tel->currentTick >> (level * WHEEL_SLOT_BITS)) % WHEEL_SLOT_COUNT];
+	while(*s != NULL){
+		TimerEvent *curr = *s;
 		REMOVE_FROM_DQUEUE(curr);
-		if(curr->isSentToTask == 0){
-			curr->isSentToTask = 1;
-			completeIO(&curr->ior);
-		}
-#ifndef NDEBUG
-		else{
-			assert(curr->tickPeriod > 0);
-			printk("warning: skip periodic timer event\n");
+		insertTimerEvent_noLock(tel, curr);
+	}
+}
+
+// call expire() on every event that expires at currentTick, then increase currentTick
+static void tickTimerEventList_noLock(TimerEventList *tel, void (*expire)(TimerEventList*, TimerEvent*)){
+	const uint64_t t = tel->currentTick;
+	if(t != 0){
+		int level = MIN(lowestBit64(t) / WHEEL_SLOT_BITS, WHEEL_LEVEL_COUNT - 1);
+		for(; level > 0; level--){
+			cascadeTimerEvents_noLock(tel, level);
 		}
-#endif
-		if(curr->tickPeriod > 0){
-			// IMPROVE: addTimerEventList()
-			addTimerEvent_noLock(tel, curr->tickPeriod, curr);
+	}
+	// the events in the slot expire exactly at t
+	// periodic events are inserted into other slots because tickPeriod > 0
+	TimerEvent **s = &tel->slot[0][t % WHEEL_SLOT_COUNT];
+	while(*s != NULL){
+		TimerEvent *curr = *s;
+		assert(curr->expireTick == t);
+		REMOVE_FROM_DQUEUE(curr);
+		expire(tel, curr);
+	}
+	tel->currentTick = t + 1;
+}
+
+static void sendTimerEvent(TimerEventList *tel, TimerEvent *curr){
+	// one-shot events submitted by IORing are deleted in completeIO
+	const uint64_t tickPeriod = curr->tickPeriod;
+	if(curr->isSentToTask == 0){
+		curr->isSentToTask = 1;
+		completeIO(&curr->ior);
+	}
+	else{
+		assert(tickPeriod > 0);
+		addCounter(COUNTER_TIMER_EVENT_SKIP, 1);
+	}
+	if(tickPeriod > 0){
+		addTimerEvent_noLock(tel, curr->tickPeriod, curr);
+	}
+}
+
+// number of ticks from currentTick to the first tick having events in level 0 or to cascade
+static uint64_t getNextEventTicks_noLock(TimerEventList *tel){
+	const uint64_t t = tel->currentTick;
+	int level;
+	for(level = 0; level < WHEEL_LEVEL_COUNT; level++){
+		const int shift = level * WHEEL_SLOT_BITS;
+		const int digit = (t >> shift) % WHEEL_SLOT_COUNT;
+		int s;
+		// events in higher levels expire after the next cascade
+		for(s = (level == 0? digit: digit + 1); s < WHEEL_SLOT_COUNT; s++){
+			if(tel->slot[level][s] != NULL){
+				return ((t >> shift) - digit + s) * (((uint64_t)1) << shift) - t;
+			}
 		}
 	}
-	tel->currentTick = (tel->currentTick + 1) % COUNTDOWN_TICK_MODULAR;
+	return 0xffffffffffffffffull;
+}
+
+// assume interrupt disabled
+static void stopIdleTimer_noLock(TimerEventList *tel, uint32_t maxPassedTicks){
+	if(tel->idleTicks == 0){
+		return;
+	}
+	PIC *pic = processorLocalPIC();
+	uint32_t passedTicks = pic->setTimerPeriodic(pic);
+	tel->currentTick += MIN(passedTicks, maxPassedTicks);
+	tel->idleTicks = 0;
+	lock_add32(&idleProcessorCount, -1);
+}
+
+static void handleTimerEvents(TimerEventList *tel){
+	acquireLock(&tel->lock);
+	lock_add32(&timerInterruptCount, 1);
+	// the one-shot timer expires
+	stopIdleTimer_noLock(tel, tel->idleTicks - 1);
+	tickTimerEventList_noLock(tel, sendTimerEvent);
 	releaseLock(&tel->lock);
 }
 
@@ -148,16 +236,77 @@ static int chainedTimerHandler(const InterruptParam *p){
 
 static void timerHandler(InterruptParam *p){
 	// kprintf("interrupt #%d (timer), arg = %x\n", toChar(p.vector), p.argument);
+	countInterrupt(toChar(p->vector));
+	SAMPLE_PROFILE(p->eip, p->cs);
 	processorLocalPIC()->endOfInterrupt(p);
 	chainedTimerHandler(p);
 	//sti()
 }
 
+void startIdleTimer(void){
+	assert(getEFlags().bit.interrupt == 0);
+	TimerEventList *tel = processorLocalTimer();
+	PIC *pic = processorLocalPIC();
+	if(pic->setTimerOneShot == NULL || hasReadyTask()){
+		return;
+	}
+	acquireLock(&tel->lock);
+	assert(tel->idleTicks == 0);
+	uint64_t nextTicks = getNextEventTicks_noLock(tel);
+	if(nextTicks > 0){
+		// interrupt at the end of tick (currentTick + nextTicks - 1)
+		// if the wheel is empty, nextTicks is 0xffffffffffffffff and the processor sleeps until woken up
+		tel->idleTicks = pic->setTimerOneShot(pic, (uint32_t)MIN(nextTicks, 0xfffffffe) + 1);
+		lock_add32(&idleProcessorCount, 1);
+	}
+	releaseLock(&tel->lock);
+}
+
+void stopIdleTimer(void){
+	// the idle task may be moved to another processor if interrupt is enabled
+	cli();
+	TimerEventList *tel = processorLocalTimer();
+	acquireLock(&tel->lock);
+	// do not skip the tick having events
+	stopIdleTimer_noLock(tel, tel->idleTicks - 1);
+	releaseLock(&tel->lock);
+	sti();
+}
+
+static void wakeupHandler(InterruptParam *p){
+	processorLocalPIC()->endOfInterrupt(p);
+	// return to the idle loop, see stopIdleTimer
+}
+
+void wakeupIdleProcessor(int processorIndex){
+	PIC *target = idleProcessorPIC[processorIndex];
+	if(wakeupVector == NULL || target == NULL || ATOMIC_READ_32(&idleProcessorCount) == 0){
+		return;
+	}
+	PIC *pic = processorLocalPIC();
+	pic->interruptProcessor(pic, target, wakeupVector);
+}
+
+void initIdleTimer(PIC *pic, InterruptTable *t){
+	// the bootstrap processor initializes before starting the others
+	if(wakeupVector == NULL){
+		wakeupVector = registerGeneralInterrupt(t, wakeupHandler, 0);
+	}
+	const int i = getProcessorIndex();
+	assert(i >= 0);
+	idleProcessorPIC[i] = pic;
+}
+
 TimerEventList *createTimer(){
 	TimerEventList *NEW(tel);
+	if(tel == NULL){
+		return NULL;
+	}
 	tel->lock = initialSpinlock;
+	addNamedSpinlock(&tel->lock, "timer");
 	tel->currentTick = 0;
-	tel->head = NULL;
+	tel->idleTicks = 0;
+	memset(tel->slot, 0, sizeof(tel->slot));
 	return tel;
 }
 
@@ -172,3 +321,96 @@ int addTimerHandler(TimerEventList *tel, InterruptVector *v){
 void initTimer(SystemCallTable *systemCallTable){
 	registerSystemCall(systemCallTable, SYSCALL_SET_ALARM, setAlarmHandler, 0);
 }
+
+#ifndef NDEBUG
+
+#define TEST_EVENT_COUNT (10000)
+#define TEST_MAX_WAIT (1 << 17)
+
+static uint32_t testExpireCount;
+
+static void checkTestTimerEvent(TimerEventList *tel, TimerEvent *te){
+	assert(te->expireTick == tel->currentTick);
+	testExpireCount++;
+	if(te->tickPeriod > 0){
+		te->tickPeriod = 0;
+		addTimerEvent_noLock(tel, TEST_MAX_WAIT / 2, te);
+	}
+}
+
+// 10000 concurrent events on a private wheel, starting near a 2^24 tick boundary to exercise cascading
+// a quarter of the events are cancelled and another quarter are periodic and fire twice
+void testTimerWheel(void){
+	TimerEventList *tel = createTimer();
+	TimerEvent *NEW_ARRAY(te, TEST_EVENT_COUNT);
+	assert(tel != NULL && te != NULL);
+	const uint64_t startTime = processorLocalTimer()->currentTick;
+	int r;
+	for(r = 0; r < 4; r++){
+		tel->currentTick = (((uint64_t)1) << 24) - TEST_MAX_WAIT / 4 + r * 12345;
+		const uint64_t startTick = tel->currentTick;
+		uint32_t i, random = 2463534242u + r;
+		for(i = 0; i < TEST_EVENT_COUNT; i++){
+			random ^= (random << 13);
+			random ^= (random >> 17);
+			random ^= (random << 5);
+			te[i].tickPeriod = (i % 4 == 1? 1: 0);
+			te[i].prev = NULL;
+			te[i].next = NULL;
+			addTimerEvent_noLock(tel, random % (TEST_MAX_WAIT - 1) + 1, te + i);
+		}
+		for(i = 0; i < TEST_EVENT_COUNT; i += 4){
+			REMOVE_FROM_DQUEUE(te + i);
+		}
+		testExpireCount = 0;
+		while(tel->currentTick != startTick + TEST_MAX_WAIT * 2){
+			tickTimerEventList_noLock(tel, checkTestTimerEvent);
+		}
+		// cancelled events and the second expiration of periodic events
+		assert(testExpireCount == TEST_EVENT_COUNT - TEST_EVENT_COUNT / 4 + TEST_EVENT_COUNT / 4);
+		for(i = 0; i < TEST_EVENT_COUNT; i++){
+			assert(IS_IN_DQUEUE(te + i) == 0);
+		}
+	}
+	const uint64_t endTime = processorLocalTimer()->currentTick;
+	printk("timer wheel test: %u events * 4 rounds, %u ticks each, in %u ms\n",
+		TEST_EVENT_COUNT, TEST_MAX_WAIT * 2, (uint32_t)((endTime - startTime) * 1000 / TIMER_FREQUENCY));
+	releaseKernelMemory(te);
+	DELETE(tel);
+	systemCall_terminate();
+}
+
+#undef TEST_MAX_WAIT
+#undef TEST_EVENT_COUNT
+
+void testIdleTimer(void){
+	const unsigned seconds = 5;
+	const uint32_t count0 = timerInterruptCount;
+	sleep(seconds * 1000);
+	const uint32_t count1 = timerInterruptCount;
+	printk("timer interrupts in %u seconds: %u (periodic: %u)\n",
+		seconds, count1 - count0, seconds * TIMER_FREQUENCY * processorLocalPIC()->numberOfProcessors);
+	systemCall_terminate();
+}
+
+// idle the other processors with empty timer wheels and check that they return to periodic ticks
+void testIdleEmptyTimer(void){
+	const uint32_t count = getProcessorCount();
+	uint32_t i;
+	for(i = 1; i < count; i++){
+		systemCall_setTaskAffinity(1);
+		sleep(200);
+		systemCall_setTaskAffinity(((uint32_t)1) << i);
+		assert(getProcessorIndex() == (int)i);
+		TimerEventList *tel = processorLocalTimer();
+		const uint64_t tick0 = tel->currentTick;
+		const uint64_t t0 = getClockNanosecond();
+		while(getClockNanosecond() - t0 < 100 * 1000000ull);
+		assert(tel->currentTick - tick0 >= TIMER_FREQUENCY / 20);
+	}
+	systemCall_setTaskAffinity(ANY_PROCESSOR_AFFINITY);
+	printk("test idle empty timer ok\n");
+	systemCall_terminate();
+}
+
+#endif
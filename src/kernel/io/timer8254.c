@@ -7,7 +7,9 @@
 
 enum{
 	TIMER_COMMAND = 0x43,
-	TIMER_DATA0 = 0x40
+	TIMER_DATA0 = 0x40,
+	TIMER_DATA2 = 0x42,
+	TIMER_GATE = 0x61 // bit 0: channel 2 gate; bit 1: speaker; bit 5: channel 2 output
 };
 
 #define TIMER_8254_FREQUENCY (1193182)
@@ -51,3 +53,25 @@ uint16_t readTimer8254Count(void){
 	uint8_t hi = in8(TIMER_DATA0);
 	return lo + (((uint16_t)hi) << 8);
 }
+
+// channel 2 does not raise interrupts, so the system timer on channel 0 is not affected
+void waitTimer8254(unsigned microsecond){
+	while(microsecond > 0){
+		const unsigned waitTime = MIN(microsecond, 50000);
+		const unsigned ticks = MAX((TIMER_8254_FREQUENCY * (uint64_t)waitTime) / 1000000, 1);
+		// enable gate and disable speaker
+		out8(TIMER_GATE, (in8(TIMER_GATE) & 0xfc) | 0x01);
+		/*
+		channel = 10
+		low and high bit = 11
+		operating mode = 0
+		BCD mode = 0
+		*/
+		out8(TIMER_COMMAND, 0xb0);
+		out8(TIMER_DATA2, ticks & 255);
+		out8(TIMER_DATA2, (ticks / 256) & 255);
+		// the output becomes high at terminal count
+		while((in8(TIMER_GATE) & 0x20) == 0);
+		microsecond -= waitTime;
+	}
+}
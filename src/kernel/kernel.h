@@ -2,6 +2,12 @@
 
 // see console.c
 int printkString(const char *s, size_t length);
+// used by printk; append to the log ring of the processor
+int writeKernelLog(const char *s, size_t length);
+// see main.c; record the time of an event during boot
+void traceBootEvent(const char *name, uintptr_t nameLength);
+// record the last event and print the trace; later events are ignored
+void finishBootTrace(const char *name, uintptr_t nameLength);
 
 int snprintf(char *str, size_t len, const char *format, ...);
 int printk(const char *format, ...);
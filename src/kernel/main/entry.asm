@@ -121,7 +121,7 @@ loadpage:
 	mov cr4, eax
 	mov cr3, esi
 	mov eax, cr0
-	or eax, 0x80000000 ; paging=1
+	or eax, 0x80010000 ; paging=1, write protect=1 (see cloneLinearBlocks)
 	mov cr0, eax
 	; load GDT at linear address
 	cmp BYTE [init_flag], 0
@@ -18,44 +18,98 @@ SystemGlobal global;
 static void builtInService(void){
 	initKernelFile();
 	initFIFOFile();
+	initDebugFile();
 	systemCall_terminate();
 }
 
-static void initService(void){
-	void (*services[])(void) = {
-		builtInService,
-		ps2Driver,
-		//vbeDriver,
-		kernelConsoleService,
-		pciDriver,
-		ahciDriver,
-		i8254xDriver,
-		fatService,
-		internetService,
-#ifndef NDEBUG
-		//testResource,
-		//testKFS,
-		//testAHCI,
-		//testPCI,
-		//testFAT,
-		//testFIFOFile,
-		//testI8254xTransmit2
-		//testI8254xTransmit,
-		//testI8254xReceive,
-		//testMemoryTask,
-		//testIPFileName,
-		//testTCPClient,
-		//testTCPServer,
-		//testCountDays,
-		//testCreateThread,
-		//testTimer,
-		//testRWLock
-#endif
-	};
+// boot trace; the time is measured in TSC because the clock is not initialized yet
+// kernel entry, services created and the final event, one event for each processor,
+// and the resources registered during boot
+#define MAX_BOOT_RESOURCE_EVENT_COUNT (64)
+#define BOOT_TRACE_LENGTH (3 + MAX_PROCESSOR_COUNT + MAX_BOOT_RESOURCE_EVENT_COUNT)
+#define BOOT_TRACE_NAME_LENGTH (24)
+static struct{
+	volatile uint32_t count;
+	volatile int isFinished;
+	struct{
+		uint64_t tsc;
+		char name[BOOT_TRACE_NAME_LENGTH];
+	}event[BOOT_TRACE_LENGTH];
+}bootTrace;
+
+static void writeBootEvent(uint32_t i, uint64_t tsc, const char *name, uintptr_t nameLength){
+	nameLength = MIN(nameLength, BOOT_TRACE_NAME_LENGTH - 1);
+	strncpy(bootTrace.event[i].name, name, nameLength);
+	bootTrace.event[i].name[nameLength] = '\0';
+	bootTrace.event[i].tsc = tsc;
+}
+
+void traceBootEvent(const char *name, uintptr_t nameLength){
+	const uint64_t tsc = rdtsc();
+	if(bootTrace.isFinished){
+		return;
+	}
+	const uint32_t i = lock_xadd32(&bootTrace.count, 1);
+	// the last entry is reserved for finishBootTrace
+	if(i >= BOOT_TRACE_LENGTH - 1){
+		return;
+	}
+	writeBootEvent(i, tsc, name, nameLength);
+}
+
+void finishBootTrace(const char *name, uintptr_t nameLength){
+	const uint64_t tsc = rdtsc();
+	bootTrace.isFinished = 1;
+	const uint32_t lastCount = lock_xadd32(&bootTrace.count, 1);
+	const uint32_t count = MIN(lastCount, BOOT_TRACE_LENGTH - 1);
+	writeBootEvent(count, tsc, name, nameLength);
+	const uint64_t ticksPerMicrosecond = MAX(getKernelTimePage()->tscFrequency / 1000000, 1);
+	printk("boot trace (ms since kernel entry):\n");
+	uint32_t i;
+	for(i = 0; i <= count; i++){
+		const uint32_t t = (uint32_t)((bootTrace.event[i].tsc - bootTrace.event[0].tsc) / ticksPerMicrosecond);
+		printk("%u.%03u %s\n", t / 1000, t % 1000, bootTrace.event[i].name);
+	}
+	if(lastCount != count){
+		printk("%u boot events dropped\n", lastCount - count);
+	}
+}
+
+// the service is started after the resources in dependency are available
+// so the services without dependency are initialized in parallel
+#define MAX_SERVICE_DEPENDENCY_COUNT (2)
+typedef struct{
+	void (*entry)(void);
+	const char *name;
+	struct{
+		ResourceType type;
+		const char *name; // NULL if unused
+	}dependency[MAX_SERVICE_DEPENDENCY_COUNT];
+}ServiceDescription;
+#define NO_DEPENDENCY {{RESOURCE_UNKNOWN, NULL}}
+
+static void serviceLoader(void *voidService){
+	const ServiceDescription *s = voidService;
+	if(initUserLinearBlockManager(PAGE_SIZE, PAGE_SIZE) == 0){
+		printk("warning: cannot initialize service %s\n", s->name);
+		terminateCurrentTask();
+	}
+	int i;
+	for(i = 0; i < MAX_SERVICE_DEPENDENCY_COUNT && s->dependency[i].name != NULL; i++){
+		if(waitForFirstResource(s->dependency[i].name, s->dependency[i].type, matchName) == 0){
+			printk("warning: service %s cannot find %s\n", s->name, s->dependency[i].name);
+			terminateCurrentTask();
+		}
+	}
+	s->entry();
+	printk("warning: service %s did not terminate by systemCall_terminate()\n", s->name);
+	terminateCurrentTask();
+}
+
+static void startServices(const ServiceDescription *services, unsigned int serviceCount, int priority){
 	unsigned int i;
-	Task *t;
-	for(i = 0; i < LENGTH_OF(services); i++){
-		t = createTaskWithoutLoader(services[i], 1);
+	for(i = 0; i < serviceCount; i++){
+		Task *t = createTaskAndMemorySpace(serviceLoader, (void*)(services + i), sizeof(services[i]), priority);
 		if(t == NULL){
 			panic("cannot create service");
 		}
@@ -63,12 +117,76 @@ static void initService(void){
 	}
 }
 
+static void initService(void){
+	// interrupt bottom halves
+	const ServiceDescription drivers[] = {
+		{builtInService, "builtin", NO_DEPENDENCY},
+		{ps2Driver, "ps2", NO_DEPENDENCY},
+		//{vbeDriver, "vbe", NO_DEPENDENCY},
+		{pciDriver, "pci", NO_DEPENDENCY},
+		{ahciDriver, "ahci", {{RESOURCE_FILE_SYSTEM, "pci"}}},
+		{i8254xDriver, "8254x", {{RESOURCE_FILE_SYSTEM, "pci"}}}
+	};
+	const ServiceDescription services[] = {
+		{kernelLogService, "kernellog", NO_DEPENDENCY},
+		{kernelConsoleService, "console", {{RESOURCE_FILE_SYSTEM, "ps2"}}},
+		{fatService, "fat", NO_DEPENDENCY},
+		{internetService, "internet", NO_DEPENDENCY},
+#ifndef NDEBUG
+		//{testResource, "testResource", NO_DEPENDENCY},
+		//{testKFS, "testKFS", NO_DEPENDENCY},
+		//{testAHCI, "testAHCI", NO_DEPENDENCY},
+		//{testPCI, "testPCI", NO_DEPENDENCY},
+		//{testFAT, "testFAT", NO_DEPENDENCY},
+		//{testFIFOFile, "testFIFOFile", NO_DEPENDENCY},
+		//{testI8254xTransmit2, "testI8254xTransmit2", NO_DEPENDENCY},
+		//{testI8254xTransmit, "testI8254xTransmit", NO_DEPENDENCY},
+		//{testI8254xReceive, "testI8254xReceive", NO_DEPENDENCY},
+		//{testMemoryTask, "testMemoryTask", NO_DEPENDENCY},
+		//{testIPFileName, "testIPFileName", NO_DEPENDENCY},
+		//{testTCPClient, "testTCPClient", NO_DEPENDENCY},
+		//{testTCPServer, "testTCPServer", NO_DEPENDENCY},
+		//{testCountDays, "testCountDays", NO_DEPENDENCY},
+		//{testCreateThread, "testCreateThread", NO_DEPENDENCY},
+		//{testTimer, "testTimer", NO_DEPENDENCY},
+		//{testRWLock, "testRWLock", NO_DEPENDENCY},
+		//{testMemoryManagerThroughput, "testMemoryManagerThroughput", NO_DEPENDENCY},
+		//{testTimerWheel, "testTimerWheel", NO_DEPENDENCY},
+		//{testIdleTimer, "testIdleTimer", NO_DEPENDENCY},
+		//{testIdleEmptyTimer, "testIdleEmptyTimer", NO_DEPENDENCY},
+		//{testClock, "testClock", NO_DEPENDENCY},
+		//{testWorkerPool, "testWorkerPool", NO_DEPENDENCY},
+		//{testIORing, "testIORing", NO_DEPENDENCY},
+		//{testCloneIORing, "testCloneIORing", NO_DEPENDENCY},
+		//{testLockStatistics, "testLockStatistics", NO_DEPENDENCY},
+		//{testUserMutex, "testUserMutex", NO_DEPENDENCY},
+		//{testFairScheduler, "testFairScheduler", NO_DEPENDENCY},
+		//{testTaskAffinity, "testTaskAffinity", NO_DEPENDENCY},
+		//{testRCU, "testRCU", NO_DEPENDENCY},
+		//{testMemoryFunctions, "testMemoryFunctions", NO_DEPENDENCY},
+		//{testSPSCFIFO, "testSPSCFIFO", NO_DEPENDENCY},
+		//{testSPSCFIFOStress, "testSPSCFIFOStress", NO_DEPENDENCY},
+		//{testPipeFile, "testPipeFile", NO_DEPENDENCY},
+		//{testPipeOrder, "testPipeOrder", NO_DEPENDENCY},
+		//{testSpliceFile, "testSpliceFile", NO_DEPENDENCY},
+		//{testKernelLog, "testKernelLog", NO_DEPENDENCY},
+		//{testFATWrite, "testFATWrite", NO_DEPENDENCY},
+		//{testELFImage, "testELFImage", NO_DEPENDENCY},
+		//{testPerformanceCounter, "testPerformanceCounter", NO_DEPENDENCY},
+#endif
+	};
+	startServices(drivers, LENGTH_OF(drivers), 1);
+	startServices(services, LENGTH_OF(services), FAIR_SHARE_PRIORITY);
+	traceBootEvent("services created", strlen("services created"));
+}
+
 void c_entry(void);
 void c_entry(void){
 	static volatile int first = 1;
 	int isBSP = first;
 	first = 0;
 	if(isBSP){
+		traceBootEvent("kernel entry", strlen("kernel entry"));
 		// 1. memory
 		initKernelMemory();
 		// 2. printk
@@ -107,10 +225,18 @@ void c_entry(void){
 	PIC *pic = createPIC(global.idt);
 	// 8. processorLocal
 	TimerEventList *timer = createTimer();
-	setProcessorLocal(pic, gdt, taskManager, timer);
+	if(timer == NULL){
+		panic("cannot create timer");
+	}
+	ProcessorMemory *processorMemory = createProcessorMemory();
+	if(processorMemory == NULL){
+		panic("cannot create processor memory cache");
+	}
+	setProcessorLocal(pic, gdt, taskManager, timer, processorMemory);
 	// 9. file
 	if(isBSP){
 		initFile(global.syscallTable);
+		initIORing(global.syscallTable);
 		initWaitableResource();
 	}
 	// 10. driver
@@ -121,11 +247,19 @@ void c_entry(void){
 	initLocalTimer(pic, global.idt, timer);
 	//printk("kernel memory usage: %u\n", getAllocatedSize());
 	printk("CPU #%d is ready...\n", getMemoryMappedLAPICID());
+	traceBootEvent("processor ready", strlen("processor ready"));
 	sti();
 	if(isBSP){
 		initService();
 	}
+	// clear free pages before halting
 	while(1){
-		hlt();
+		if(fillZeroedPagePool() != 0){
+			continue;
+		}
+		cli();
+		startIdleTimer();
+		stiHlt();
+		stopIdleTimer();
 	}
 }
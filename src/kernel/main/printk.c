@@ -1,6 +1,7 @@
 #include"common.h"
 #include"kernel.h"
 #include"assembly/assembly.h"
+#include"io/ioservice.h"
 
 #define UNSIGNED_TO_STRING(NAME, T) \
 static int NAME##ToString(char *str, unsigned T number, unsigned base){\
@@ -285,9 +286,12 @@ int snprintf(char *str, size_t len, const char *format, ...){
 	return printCount;
 }
 
+// format into a local buffer and write to the kernel log once per buffer
 int printk(const char *format, ...){
 	va_list argList;
 	va_start(argList, format);
+	char message[128];
+	int messageLength = 0;
 	int printCount = 0;
 	while(*format != '\0'){
 		struct PrintfBuffer bufferPtr;
@@ -296,9 +300,22 @@ int printk(const char *format, ...){
 			printCount = -1;
 			break;
 		}
-		printkString(bufferPtr.buffer, bufferLength);
+		int i = 0;
+		while(i < bufferLength){
+			int copyLength = MIN(bufferLength - i, (int)sizeof(message) - messageLength);
+			memcpy(message + messageLength, bufferPtr.buffer + i, copyLength);
+			messageLength += copyLength;
+			i += copyLength;
+			if(messageLength == (int)sizeof(message)){
+				writeKernelLog(message, messageLength);
+				messageLength = 0;
+			}
+		}
 		printCount += bufferLength;
 	}
+	if(messageLength > 0){
+		writeKernelLog(message, messageLength);
+	}
 	va_end(argList);
 	return printCount;
 }
@@ -499,6 +516,7 @@ int sscanf(const char *str, const char *format, ...){
 }
 
 void printAndHalt(const char *condition, const char *file, int line){
+	stopKernelLogRing();
 	printk("failure: %s %s %d", condition, file, line);
 	// if the console does not display, use vm debugger to watch registers
 	cli();
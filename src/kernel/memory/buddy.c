@@ -88,16 +88,31 @@ size_t ceilAllocateOrder(size_t s){
 	return i;
 }
 
+static_assert(MAX_BLOCK_ORDER - MIN_BLOCK_ORDER < 32);
+
+static void addFreeBlock(MemoryBlockManager *m, MemoryBlock *b){
+	const int i = b->sizeOrder - MIN_BLOCK_ORDER;
+	ADD_TO_DQUEUE(b, &m->freeBlock[i]);
+	m->freeBlockMask |= (((uint32_t)1) << i);
+}
+
+static void removeFreeBlock(MemoryBlockManager *m, MemoryBlock *b){
+	const int i = b->sizeOrder - MIN_BLOCK_ORDER;
+	REMOVE_FROM_DQUEUE(b);
+	if(m->freeBlock[i] == NULL){
+		m->freeBlockMask &= ~(((uint32_t)1) << i);
+	}
+}
+
 static MemoryBlock *findFreeBlock(MemoryBlockManager *m, size_t minOrder){
-	size_t o;
-	for(o = minOrder; 1; o++){
-		if(o > MAX_BLOCK_ORDER){
-			return NULL;
-		}
-		if(m->freeBlock[o - MIN_BLOCK_ORDER] != NULL){
-			return m->freeBlock[o - MIN_BLOCK_ORDER];
-		}
+	const uint32_t mask = (m->freeBlockMask >> (minOrder - MIN_BLOCK_ORDER));
+	if(mask == 0){
+		return NULL;
 	}
+	// lowest non-empty order
+	const size_t o = minOrder + __builtin_ctz(mask);
+	assert(o <= MAX_BLOCK_ORDER && m->freeBlock[o - MIN_BLOCK_ORDER] != NULL);
+	return m->freeBlock[o - MIN_BLOCK_ORDER];
 }
 
 int isAddressInRange(MemoryBlockManager *m, uintptr_t address){
@@ -134,14 +149,14 @@ MemoryBlock *allocateBlock_noLock(MemoryBlockManager *m, size_t size, size_t spl
 	for(s = 0; s < splitBlockCount; s++){
 		MemoryBlock *const b = indexToBlock(m, blockBegin + s * (splitSize / MIN_BLOCK_SIZE));
 		assert(IS_IN_DQUEUE(b));
-		REMOVE_FROM_DQUEUE(b);
+		removeFreeBlock(m, b);
 		while(b->sizeOrder != so){
 			// split b and get buddy
 			b->sizeOrder--;
 			MemoryBlock *b2 = getBuddy(m, b);
 			assert(b2 != NULL && ((uintptr_t)b2) > ((uintptr_t)b));
 			assert(IS_IN_DQUEUE(b2) == 0 && b2->sizeOrder == b->sizeOrder);
-			ADD_TO_DQUEUE(b2, &m->freeBlock[b2->sizeOrder - MIN_BLOCK_ORDER]);
+			addFreeBlock(m, b2);
 		}
 	}
 	m->freeSize -= splitBlockCount * splitSize;
@@ -161,7 +176,7 @@ void releaseBlock_noLock(MemoryBlockManager *m, MemoryBlock *b){
 		}
 		// merge
 		//printk("%d %d\n",buddy->sizeOrder, b->sizeOrder);
-		REMOVE_FROM_DQUEUE(buddy);
+		removeFreeBlock(m, buddy);
 #ifndef NDEBUG
 			uintptr_t a1 = blockToAddress(m, b), a2 = blockToAddress(m, buddy);
 			assert((a1 > a2? a1 - a2: a2 - a1) == (uintptr_t)(1 << b->sizeOrder));
@@ -169,7 +184,27 @@ void releaseBlock_noLock(MemoryBlockManager *m, MemoryBlock *b){
 		b = (((uintptr_t)b) < ((uintptr_t)buddy)? b: buddy);
 		b->sizeOrder++;
 	}
-	ADD_TO_DQUEUE(b, &m->freeBlock[b->sizeOrder - MIN_BLOCK_ORDER]);
+	addFreeBlock(m, b);
+}
+
+void fillBlockCache_noLock(MemoryBlockManager *m, MemoryBlockCache *c, int count){
+	assert(count <= MEMORY_BLOCK_CACHE_SIZE);
+	while(c->count < count){
+		MemoryBlock *b = allocateBlock_noLock(m, MIN_BLOCK_SIZE, MIN_BLOCK_SIZE);
+		if(b == NULL){
+			break;
+		}
+		c->block[c->count] = b;
+		c->count++;
+	}
+}
+
+void flushBlockCache_noLock(MemoryBlockManager *m, MemoryBlockCache *c, int count){
+	assert(count >= 0);
+	while(c->count > count){
+		c->count--;
+		releaseBlock_noLock(m, c->block[c->count]);
+	}
 }
 
 size_t getFreeBlockSize(MemoryBlockManager *m){
@@ -186,6 +221,7 @@ void resetBlockArray(MemoryBlockManager *bm, int initialBlockCount, InitMemoryBl
 	for(i = 0; i <= MAX_BLOCK_ORDER - MIN_BLOCK_ORDER; i++){
 		bm->freeBlock[i] = NULL;
 	}
+	bm->freeBlockMask = 0;
 }
 
 static int evaluateBlockCount(uintptr_t beginAddr, uintptr_t endAddr){
@@ -17,6 +17,8 @@ typedef struct MemoryBlockManager{
 	size_t blockStructOffset;
 	int blockCount;
 	size_t freeSize;
+	// bit i is set if freeBlock[i] != NULL
+	uint32_t freeBlockMask;
 	MemoryBlock *freeBlock[MAX_BLOCK_ORDER - MIN_BLOCK_ORDER + 1];
 
 	uint8_t blockArray[0];
@@ -44,6 +46,11 @@ int isAddressInRange(MemoryBlockManager *m, uintptr_t address);
 MemoryBlock *allocateBlock_noLock(MemoryBlockManager *m, size_t size, size_t splitSize);
 void releaseBlock_noLock(MemoryBlockManager *m, MemoryBlock *b);
 
+// allocate MIN_BLOCK_SIZE blocks until c has count blocks
+void fillBlockCache_noLock(MemoryBlockManager *m, MemoryBlockCache *c, int count);
+// release the blocks in c until c has count blocks
+void flushBlockCache_noLock(MemoryBlockManager *m, MemoryBlockCache *c, int count);
+
 typedef void(*InitMemoryBlockFunction)(void*);
 
 void resetBlockArray(MemoryBlockManager *bm, int initialBlockCount, InitMemoryBlockFunction initBlockFunc);
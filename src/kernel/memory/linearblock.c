@@ -1,6 +1,9 @@
 #include"memory_private.h"
 #include"kernel.h"
 #include"buddy.h"
+#include"assembly/assembly.h"
+#include"multiprocessor/processorlocal.h"
+#include"task/exclusivelock.h"
 
 enum MemoryBlockStatus{
 	MEMORY_FREE_OR_COVERED = 1, // maybe free
@@ -18,6 +21,8 @@ static_assert(sizeof(LinearMemoryBlock) == 20);
 
 struct LinearMemoryBlockManager{
 	int initialBlockCount, maxBlockCount;
+	// see cloneLinearBlocks
+	volatile int isCloning;
 	MemoryBlockManager b;
 };
 static_assert(MEMBER_OFFSET(LinearMemoryBlockManager, b.blockArray) == sizeof(LinearMemoryBlockManager));
@@ -54,6 +59,7 @@ LinearMemoryBlockManager *createLinearBlockManager(
 		initLinearMemoryBlock
 	);
 	bm->initialBlockCount = bm->b.blockCount;
+	bm->isCloning = 0;
 	bm->maxBlockCount = (maxEndAddr - beginAddr) / MIN_BLOCK_SIZE;
 
 	if(getMaxLinearBlockManagerSize(bm) > manageSize){
@@ -174,11 +180,109 @@ static int extendLinearBlock_noLock(LinearMemoryManager *m, int exCount){
 	return bm->b.blockCount >= newBlockCount;
 }
 
+// tasks waiting for any cloneLinearBlocks to finish
+// every waiter is counted in cloneWaiterCount and acquires cloneDone once
+static Spinlock cloneWaitLock = INITIAL_SPINLOCK;
+static int cloneWaiterCount = 0;
+static Semaphore *volatile cloneDone = NULL;
+
+// the block manager and the pages do not change while another task is cloning them
+// the caller sleeps until cloneLinearBlocks finishes, so it must not disable interrupt
+// see pageFaultHandler
+static void acquireNotCloningLock(LinearMemoryBlockManager *bm){
+	while(1){
+		acquireLock(&bm->b.lock);
+		if(bm->isCloning == 0){
+			return;
+		}
+		// register before releasing bm->b.lock, so that finishCloning cannot miss it
+		acquireLock(&cloneWaitLock);
+		cloneWaiterCount++;
+		releaseLock(&cloneWaitLock);
+		releaseLock(&bm->b.lock);
+		acquireSemaphore(cloneDone);
+	}
+}
+
+// per-processor cache of kernel MIN_BLOCK_SIZE blocks. see ProcessorMemory
+// the cached blocks are MEMORY_LOCKED, so they are neither using nor releasable
+// assume interrupt disabled
+static MemoryBlockCache *getLinearBlockCache(LinearMemoryBlockManager *bm){
+	ProcessorMemory *pm = processorLocalMemory();
+	if(pm == NULL || pm->kernelLinear != bm){
+		return NULL;
+	}
+	return &pm->kernelLinearCache;
+}
+
+static LinearMemoryBlock *allocateCachedBlock(LinearMemoryBlockManager *bm){
+	LinearMemoryBlock *lmb = NULL;
+	EFlags eflags = getEFlags();
+	cli();
+	MemoryBlockCache *c = getLinearBlockCache(bm);
+	if(c != NULL){
+		if(c->count == 0){
+			acquireLock(&bm->b.lock);
+			fillBlockCache_noLock(&bm->b, c, MEMORY_BLOCK_CACHE_SIZE / 2);
+			int i;
+			for(i = 0; i < c->count; i++){
+				LinearMemoryBlock *lmb2 = blockToElement(&bm->b, c->block[i]);
+				assert(lmb2->status == MEMORY_FREE_OR_COVERED);
+				lmb2->status = MEMORY_LOCKED;
+			}
+			releaseLock(&bm->b.lock);
+		}
+		if(c->count > 0){
+			c->count--;
+			lmb = blockToElement(&bm->b, c->block[c->count]);
+		}
+	}
+	if(eflags.bit.interrupt){
+		sti();
+	}
+	return lmb;
+}
+
+// lmb->status is MEMORY_USING or MEMORY_LOCKED
+static int releaseCachedBlock(LinearMemoryBlockManager *bm, LinearMemoryBlock *lmb){
+	if(lmb->block.sizeOrder != MIN_BLOCK_ORDER){
+		return 0;
+	}
+	EFlags eflags = getEFlags();
+	cli();
+	MemoryBlockCache *c = getLinearBlockCache(bm);
+	if(c != NULL){
+		if(c->count == MEMORY_BLOCK_CACHE_SIZE){
+			acquireLock(&bm->b.lock);
+			int i;
+			for(i = MEMORY_BLOCK_CACHE_SIZE / 2; i < c->count; i++){
+				((LinearMemoryBlock*)blockToElement(&bm->b, c->block[i]))->status = MEMORY_FREE_OR_COVERED;
+			}
+			flushBlockCache_noLock(&bm->b, c, MEMORY_BLOCK_CACHE_SIZE / 2);
+			releaseLock(&bm->b.lock);
+		}
+		lmb->status = MEMORY_LOCKED;
+		c->block[c->count] = &lmb->block;
+		c->count++;
+	}
+	if(eflags.bit.interrupt){
+		sti();
+	}
+	return c != NULL;
+}
+
 uintptr_t allocateLinearBlock(LinearMemoryManager *m, size_t size){
 	LinearMemoryBlockManager *bm = m->linear;
 	LinearMemoryBlock *lmb;
 	MemoryBlock *block;
-	acquireLock(&bm->b.lock);
+	if(size <= MIN_BLOCK_SIZE){
+		lmb = allocateCachedBlock(bm);
+		if(lmb != NULL){
+			lmb->mappedSize = size;
+			return elementToAddress(&bm->b, lmb);
+		}
+	}
+	acquireNotCloningLock(bm);
 	block = allocateBlock_noLock(&bm->b, size, size);
 	if(block != NULL){ // ok
 		goto allocate_return;
@@ -213,7 +317,7 @@ uintptr_t allocateLinearBlock(LinearMemoryManager *m, size_t size){
 
 void commitAllocatingLinearBlock(LinearMemoryManager *m, uintptr_t linearAddress){
 	LinearMemoryBlockManager *bm = m->linear;
-	acquireLock(&bm->b.lock);
+	acquireNotCloningLock(bm);
 	LinearMemoryBlock *lmb = addressToElement(&bm->b, linearAddress);
 	assert(lmb->status == MEMORY_LOCKED);
 	lmb->status = MEMORY_USING;
@@ -221,8 +325,11 @@ void commitAllocatingLinearBlock(LinearMemoryManager *m, uintptr_t linearAddress
 }
 
 void releaseLinearBlock(LinearMemoryBlockManager *m, uintptr_t address){
-	acquireLock(&m->b.lock);
 	LinearMemoryBlock *lmb = addressToElement(&m->b, address);
+	if(releaseCachedBlock(m, lmb)){
+		return;
+	}
+	acquireNotCloningLock(m);
 	assert(lmb->status == MEMORY_USING || lmb->status == MEMORY_LOCKED);
 	lmb->status = MEMORY_FREE_OR_COVERED;
 	releaseBlock_noLock(&m->b, &lmb->block);
@@ -232,7 +339,7 @@ void releaseLinearBlock(LinearMemoryBlockManager *m, uintptr_t address){
 int checkAndReleaseLinearBlock(LinearMemoryManager *m, uintptr_t linearAddress){
 	LinearMemoryBlockManager *bm = m->linear;
 	int r;
-	acquireLock(&bm->b.lock);
+	acquireNotCloningLock(bm);
 	r = isAddressInRange(&bm->b, linearAddress);
 	if(r == 0){
 		goto release_return;
@@ -249,7 +356,10 @@ int checkAndReleaseLinearBlock(LinearMemoryManager *m, uintptr_t linearAddress){
 
 	_unmapPage(m->page, m->physical, (void*)linearAddress, s);
 
-	acquireLock(&bm->b.lock);
+	if(releaseCachedBlock(bm, lmb)){
+		return 1;
+	}
+	acquireNotCloningLock(bm);
 	assert(lmb->status == MEMORY_LOCKED);
 	lmb->status = MEMORY_FREE_OR_COVERED;
 	releaseBlock_noLock(&bm->b, &lmb->block);
@@ -290,11 +400,19 @@ static PhysicalAddress checkAndTranslateBlock(
 	}
 	LinearMemoryBlockManager *bm = m->linear;
 	PhysicalAddress p = {INVALID_PAGE_ADDRESS};
-	acquireLock(&bm->b.lock);
+	int r = 0;
+	acquireNotCloningLock(bm);
 	if(isAddressInRange(&bm->b, linearAddress) == 0)
 		goto translate_return;
 	if(isUsingBlock_noLock(bm, linearAddress) == 0)
 		goto translate_return;
+	// the physical page may be written through another mapping, so do not share copy-on-write page
+	r = _commitPage(m->page, m->physical, linearAddress, WRITABLE_PAGE_FLAG);
+	if(r == 0){
+		r = _commitPage(m->page, m->physical, linearAddress, 0);
+	}
+	if(r == 0)
+		goto translate_return;
 	p = _translatePage(m->page, linearAddress, hasAttribute);
 	assert(p.value != INVALID_PAGE_ADDRESS);
 	if(doReserve){
@@ -303,6 +421,9 @@ static PhysicalAddress checkAndTranslateBlock(
 	}
 	translate_return:
 	releaseLock(&bm->b.lock);
+	if(r == 2){
+		_flushPage(m->page, FLOOR(linearAddress, PAGE_SIZE), PAGE_SIZE);
+	}
 	return p;
 }
 
@@ -313,3 +434,108 @@ PhysicalAddress checkAndTranslatePage(LinearMemoryManager *m, void *linearAddres
 PhysicalAddress checkAndReservePage(LinearMemoryManager *m, void *linearAddress, PageAttribute hasAttribute){
 	return checkAndTranslateBlock(m, (uintptr_t)linearAddress, hasAttribute, 1);
 }
+
+int checkAndCommitPage(LinearMemoryManager *m, void *linearAddress, PageAttribute access){
+	LinearMemoryBlockManager *bm = m->linear;
+	if(bm == NULL){
+		return 0;
+	}
+	int r = 0;
+	acquireNotCloningLock(bm);
+	if(isAddressInRange(&bm->b, (uintptr_t)linearAddress) == 0)
+		goto commit_return;
+	if(isUsingBlock_noLock(bm, (uintptr_t)linearAddress) == 0)
+		goto commit_return;
+	r = _commitPage(m->page, m->physical, (uintptr_t)linearAddress, access);
+	commit_return:
+	releaseLock(&bm->b.lock);
+	if(r == 2){
+		_flushPage(m->page, FLOOR((uintptr_t)linearAddress, PAGE_SIZE), PAGE_SIZE);
+	}
+	return r != 0;
+}
+
+static int initCloneWait(void){
+	if(cloneDone != NULL){
+		return 1;
+	}
+	Semaphore *s = createSemaphore(0);
+	if(s == NULL){
+		return 0;
+	}
+	if(lock_cmpxchg32((volatile uint32_t*)&cloneDone, (uint32_t)NULL, (uint32_t)s) != (uint32_t)NULL){
+		deleteSemaphore(s);
+	}
+	return 1;
+}
+
+static void finishCloning(LinearMemoryBlockManager *bm){
+	acquireLock(&bm->b.lock);
+	bm->isCloning = 0;
+	releaseLock(&bm->b.lock);
+	acquireLock(&cloneWaitLock);
+	int waiterCount = cloneWaiterCount;
+	cloneWaiterCount = 0;
+	releaseLock(&cloneWaitLock);
+	// the waiters of other block managers check their isCloning again
+	for(; waiterCount > 0; waiterCount--){
+		releaseSemaphore(cloneDone);
+	}
+}
+
+// share the using blocks of src with dst and copy the block manager
+// the blocks being allocated or released are not cloned. see resetClonedLinearBlockManager
+// isCloning makes the other tasks sleep in acquireNotCloningLock, so the walk runs without bm->b.lock
+// until the TLB shootdown completes, other processors may still write the shared pages through stale entries,
+// so the pages are not copied or unshared in the meantime
+int cloneLinearBlocks(PageManager *dst, LinearMemoryManager *src){
+	LinearMemoryBlockManager *bm = src->linear;
+	if(initCloneWait() == 0){
+		return 0;
+	}
+	acquireNotCloningLock(bm);
+	bm->isCloning = 1;
+	releaseLock(&bm->b.lock);
+	int ok = 1;
+	int i = 0;
+	while(ok && i < bm->b.blockCount){
+		LinearMemoryBlock *lmb = (LinearMemoryBlock*)indexToElement(&bm->b, i);
+		if(lmb->status == MEMORY_USING){
+			ok = _clonePage_L(dst, src->page, src->physical,
+				blockToAddress(&bm->b, &lmb->block), lmb->mappedSize, 0);
+		}
+		// see releaseAllLinearBlocks
+		i += (1 << lmb->block.sizeOrder) / MIN_BLOCK_SIZE;
+	}
+	// the block manager is written by kernel with lock, so it cannot be copy-on-write
+	const uintptr_t manageEnd = CEIL((uintptr_t)indexToElement(&bm->b, bm->b.blockCount), PAGE_SIZE);
+	if(ok){
+		ok = _clonePage_L(dst, src->page, src->physical,
+			(uintptr_t)bm, manageEnd - (uintptr_t)bm, 1);
+	}
+	// writable pages in src have become read-only
+	_flushPage(src->page, (uintptr_t)bm->b.beginAddress, (uintptr_t)bm - (uintptr_t)bm->b.beginAddress);
+	finishCloning(bm);
+	if(ok == 0){
+		_releaseClonedPages(dst, src->physical);
+	}
+	return ok;
+}
+
+// see cloneLinearBlocks
+void resetClonedLinearBlockManager(LinearMemoryBlockManager *m){
+	m->b.lock = initialSpinlock;
+	m->isCloning = 0;
+	// see getBuddy
+	acquireLock(&m->b.lock);
+	int i = 0;
+	while(i < m->b.blockCount){
+		LinearMemoryBlock *lmb = (LinearMemoryBlock*)indexToElement(&m->b, i);
+		i += (1 << lmb->block.sizeOrder) / MIN_BLOCK_SIZE;
+		if(lmb->status == MEMORY_LOCKED){
+			lmb->status = MEMORY_FREE_OR_COVERED;
+			releaseBlock_noLock(&m->b, &lmb->block);
+		}
+	}
+	releaseLock(&m->b.lock);
+}
@@ -14,6 +14,9 @@ typedef struct PhysicalMemoryBlockManager PhysicalMemoryBlockManager;
 // page
 #define PAGE_SIZE (4096)
 #define INVALID_PAGE_ADDRESS ((uintptr_t)0xffffffff)
+// kernel-only attribute for user pages shared with a kernel object, such as IORing
+// a cloned user space gets a demand-zero page instead of sharing or copying it. see _clonePage_L
+#define NOT_CLONED_PAGE_FLAG (1 << 8)
 typedef struct PageManager PageManager;
 extern PageManager *kernelPageManager;
 
@@ -48,10 +51,40 @@ int _mapPage_LP(
 	PageAttribute attribute
 );
 
+// same as _mapPage_LP; attribute must be writable
+// the pages are mapped read-only and copied on the first write
+int _mapCopyOnWritePage_LP(
+	PageManager *p, PhysicalMemoryBlockManager *physical,
+	void *linearAddress, PhysicalAddress physicalAddress, size_t size,
+	PageAttribute attribute
+);
+
+// same as _mapPage_L; the pages are cleared
+int _mapZeroedPage_L(
+	PageManager *p, PhysicalMemoryBlockManager *physical,
+	void *linearAddress, size_t size,
+	PageAttribute attribute
+);
+
+// mark the pages as demand-zero without allocating physical memory
+int _reservePage_L(
+	PageManager *p, PhysicalMemoryBlockManager *physical,
+	void *linearAddress, size_t size,
+	PageAttribute attribute
+);
+
 void _unmapPage(PageManager *p, PhysicalMemoryBlockManager *physical, void *linearAddress, size_t size);
 #define _unmapPage_L _unmapPage
 #define _unmapPage_LP _unmapPage
 
+// caches of cleared physical pages and free blocks. see setProcessorLocal
+typedef struct ProcessorMemory ProcessorMemory;
+ProcessorMemory *createProcessorMemory(void);
+// clear one page and add it to the pool of current processor
+// return 0 if the pool is full or no memory is available
+// called by idle processors; must sti
+int fillZeroedPagePool(void);
+
 // kernel linear memory
 void initKernelMemory(void);
 typedef struct LinearMemoryManager LinearMemoryManager;
@@ -112,6 +145,15 @@ int isKernelLinearAddress(uintptr_t address);
 void *allocatePages(LinearMemoryManager *m, size_t size, PageAttribute attriute);
 void *allocateContiguousPages(LinearMemoryManager *m, size_t size, PageAttribute attriute);
 void *allocateKernelPages(size_t size, PageAttribute attribute);
+// same as allocatePages; the pages are cleared
+void *allocateZeroedPages(LinearMemoryManager *m, size_t size, PageAttribute attribute);
+void *allocateZeroedKernelPages(size_t size, PageAttribute attribute);
+// allocate new linear memory; physical pages are allocated and cleared on page fault
+void *reservePages(LinearMemoryManager *m, size_t size, PageAttribute attribute);
+// allocate the physical page if linearAddress is in a reserved block
+// copy the physical page if access has WRITABLE_PAGE_FLAG and the page is copy-on-write
+// return 1 if the page is present and has the access flags
+int checkAndCommitPage(LinearMemoryManager *m, void *linearAddress, PageAttribute access);
 //void releasePages(LinearMemoryManager *m, void *linearAddress);
 //void releaseKernelPages(void *linearAddress);
 int checkAndReleasePages(LinearMemoryManager *m, void *linearAddress);
@@ -126,6 +168,8 @@ void testMemoryManager(void);
 void testMemoryManager2(void);
 void testMemoryManager3(void);
 void testMemoryManager4(void);
+void testMemoryManagerThroughput(void);
+void testMemoryFunctions(void);
 void testMemoryTask(void);
 void testCreateThread(void *arg);
 #endif
@@ -20,9 +20,11 @@ size_t getFreePhysicalBlockSize(PhysicalMemoryBlockManager *m);
 
 // change reference count from 0 to 1
 uintptr_t allocatePhysicalBlock(PhysicalMemoryBlockManager *m, size_t size, size_t splitSize);
-// if referenceCount == MAX_REFERENCE_COUNT, do not increase it and return 0
+// if referenceCount == 0 or MAX_REFERENCE_COUNT, do not increase it and return 0
 // otherwise, increase and return 1
 int addPhysicalBlockReference(PhysicalMemoryBlockManager *m, uintptr_t address);
+// return MAX_REFERENCE_COUNT if address is out of range
+uint32_t getPhysicalBlockReference(PhysicalMemoryBlockManager *m, uintptr_t address);
 // subtract referenceCount and return the new value
 // if the new value == 0, release the block
 void releasePhysicalBlock(PhysicalMemoryBlockManager *m, uintptr_t address);
@@ -58,6 +60,10 @@ void commitAllocatingLinearBlock(LinearMemoryManager *m, uintptr_t linearAddress
 // release linear blocks, pages, and physical blocks
 int checkAndReleaseLinearBlock(LinearMemoryManager *m, uintptr_t linearAddress);
 void releaseAllLinearBlocks(LinearMemoryManager *m);
+// share the using pages of src with dst; copy-on-write if writable
+int cloneLinearBlocks(PageManager *dst, LinearMemoryManager *src);
+// called in the address space of dst
+void resetClonedLinearBlockManager(LinearMemoryBlockManager *m);
 
 // 4K~1G
 // block is always aligned to MIN_BLOCK_SIZE
@@ -70,6 +76,17 @@ void releaseAllLinearBlocks(LinearMemoryManager *m);
 PageManager *initKernelPageTable(uintptr_t manageBase, uintptr_t *manageBegin, uintptr_t manageEnd);
 
 PhysicalAddress _translatePage(PageManager *p, uintptr_t linearAddress, PageAttribute hasAtribute);
+void initTemporaryPage(uintptr_t linearAddress);
+// allocate demand-zero page and copy copy-on-write page if access has WRITABLE_PAGE_FLAG
+// return 0 if the page is not present or does not have the access flags
+// return 1 if ok; return 2 if the physical page is changed and the caller has to call _flushPage
+int _commitPage(PageManager *p, PhysicalMemoryBlockManager *physical, uintptr_t linearAddress, PageAttribute access);
+void _flushPage(PageManager *p, uintptr_t linearAddress, size_t size);
+int _clonePage_L(
+	PageManager *dst, PageManager *src, PhysicalMemoryBlockManager *physical,
+	uintptr_t linearAddress, size_t size, int doCopy
+);
+void _releaseClonedPages(PageManager *dst, PhysicalMemoryBlockManager *physical);
 
 // linear + physical + page
 struct LinearMemoryManager{
@@ -78,6 +95,34 @@ struct LinearMemoryManager{
 	PageManager *page;
 };
 
+// memorymanager.c
+// caches of each processor; accessed only by the processor with interrupt disabled
+#define ZEROED_PAGE_POOL_SIZE (32)
+typedef struct{
+	int count;
+	PhysicalAddress page[ZEROED_PAGE_POOL_SIZE];
+}ZeroedPagePool;
+
+#define MEMORY_BLOCK_CACHE_SIZE (16)
+typedef struct MemoryBlockCache{
+	int count;
+	struct MemoryBlock *block[MEMORY_BLOCK_CACHE_SIZE];
+}MemoryBlockCache;
+
+struct ProcessorMemory{
+	// the managers which the caches belong to
+	PhysicalMemoryBlockManager *physical;
+	LinearMemoryBlockManager *kernelLinear;
+	// see fillZeroedPagePool
+	ZeroedPagePool zeroedPagePool;
+	// blocks of MIN_BLOCK_SIZE removed from the free lists. see fillBlockCache_noLock
+	MemoryBlockCache physicalCache;
+	MemoryBlockCache kernelLinearCache;
+	// see mapTemporaryPage
+	uintptr_t tempPage;
+	int tempPageInterruptFlag;
+};
+
 // slab.c (linear memory)
 SlabManager *createKernelSlabManager(void);
 
@@ -3,6 +3,7 @@
 #include"memory.h"
 #include"assembly/assembly.h"
 #include"multiprocessor/spinlock.h"
+#include"multiprocessor/perfcounter.h"
 #include"memory_private.h"
 
 // BIOS address range functions
@@ -57,6 +58,7 @@ static SlabManager *kernelSlab = NULL;
 
 void *allocateKernelMemory(size_t size){
 	assert(kernelSlab != NULL);
+	addCounter(COUNTER_SLAB_ALLOCATION, 1);
 	return allocateSlab(kernelSlab, size);
 }
 
@@ -223,16 +225,30 @@ void *mapReservedPages(LinearMemoryManager *lm, const PhysicalAddressArray *pa,
 	return NULL;
 }
 */
-static void *_allocatePages(LinearMemoryManager *m, size_t size, int contiguous, PageAttribute attribute){
+enum AllocatePagesMode{
+	NONCONTIGUOUS_PAGES,
+	CONTIGUOUS_PAGES,
+	ZEROED_PAGES,
+	DEMAND_ZERO_PAGES
+};
+
+static void *_allocatePages(LinearMemoryManager *m, size_t size, enum AllocatePagesMode mode, PageAttribute attribute){
 	// linear
 	uintptr_t linearAddress = allocateLinearBlock(m, size);
 	EXPECT(linearAddress != INVALID_PAGE_ADDRESS);
 	// physical
 	int ok;
-	if(contiguous){
+	switch(mode){
+	case CONTIGUOUS_PAGES:
 		ok = _mapContiguousPage_L(m->page, m->physical, (void*)linearAddress, size, attribute);
-	}
-	else{
+		break;
+	case ZEROED_PAGES:
+		ok = _mapZeroedPage_L(m->page, m->physical, (void*)linearAddress, size, attribute);
+		break;
+	case DEMAND_ZERO_PAGES:
+		ok = _reservePage_L(m->page, m->physical, (void*)linearAddress, size, attribute);
+		break;
+	default:
 		ok = _mapPage_L(m->page, m->physical, (void*)linearAddress, size, attribute);
 	}
 	EXPECT(ok);
@@ -247,17 +263,49 @@ static void *_allocatePages(LinearMemoryManager *m, size_t size, int contiguous,
 }
 
 void *allocatePages(LinearMemoryManager *m, size_t size, PageAttribute attribute){
-	return _allocatePages(m, size, 0, attribute);
+	return _allocatePages(m, size, NONCONTIGUOUS_PAGES, attribute);
 }
 
 void *allocateContiguousPages(LinearMemoryManager *m, size_t size, PageAttribute attribute){
-	return _allocatePages(m, size, 1, attribute);
+	return _allocatePages(m, size, CONTIGUOUS_PAGES, attribute);
+}
+
+void *allocateZeroedPages(LinearMemoryManager *m, size_t size, PageAttribute attribute){
+	return _allocatePages(m, size, ZEROED_PAGES, attribute);
+}
+
+void *reservePages(LinearMemoryManager *m, size_t size, PageAttribute attribute){
+	return _allocatePages(m, size, DEMAND_ZERO_PAGES, attribute);
 }
 
 void *allocateKernelPages(size_t size, PageAttribute attribute){
 	return allocatePages(kernelLinear, size, attribute);
 }
 
+void *allocateZeroedKernelPages(size_t size, PageAttribute attribute){
+	return allocateZeroedPages(kernelLinear, size, attribute);
+}
+
+ProcessorMemory *createProcessorMemory(void){
+	ProcessorMemory *NEW(pm);
+	if(pm == NULL){
+		return NULL;
+	}
+	pm->physical = kernelLinear->physical;
+	pm->kernelLinear = kernelLinear->linear;
+	pm->zeroedPagePool.count = 0;
+	pm->physicalCache.count = 0;
+	pm->kernelLinearCache.count = 0;
+	pm->tempPage = allocateLinearBlock(kernelLinear, PAGE_SIZE);
+	if(pm->tempPage == INVALID_PAGE_ADDRESS){
+		DELETE(pm);
+		return NULL;
+	}
+	commitAllocatingLinearBlock(kernelLinear, pm->tempPage);
+	pm->tempPageInterruptFlag = 0;
+	return pm;
+}
+
 /*
 void releasePages(LinearMemoryManager *m, void *linearAddress){
 	size_t s = getAllocatedBlockSize(m->linear, (uintptr_t)linearAddress);
@@ -381,6 +429,12 @@ void initKernelMemory(void){
 		reservedBase, &reservedBegin, reservedEnd,
 		KERNEL_LINEAR_BEGIN, KERNEL_LINEAR_END
 	);
+	uintptr_t tempPage = allocateLinearBlock(kernelLinear, PAGE_SIZE);
+	if(tempPage == INVALID_PAGE_ADDRESS){
+		panic("cannot allocate temporary page");
+	}
+	commitAllocatingLinearBlock(kernelLinear, tempPage);
+	initTemporaryPage(tempPage);
 	kernelSlab = createKernelSlabManager();
 }
 
@@ -499,4 +553,165 @@ void testMemoryManager4(void){
 }
 
 #undef TEST_N
+
+#include"io.h"
+#include"task/task.h"
+#include"multiprocessor/processorlocal.h"
+
+typedef struct{
+	volatile int stop;
+	int allocatePhysical;
+	volatile uint32_t allocateCount;
+	volatile uint32_t stoppedTaskCount;
+}ThroughputTest;
+
+static void allocatePagesTask(void *arg){
+	ThroughputTest *t = *(ThroughputTest**)arg;
+	uint32_t n = 0;
+	while(t->stop == 0){
+		void *p[8];
+		PhysicalAddress pa[LENGTH_OF(p)];
+		unsigned i;
+		for(i = 0; i < LENGTH_OF(p); i++){
+			if(t->allocatePhysical){
+				pa[i].value = allocatePhysicalBlock(kernelLinear->physical, PAGE_SIZE, PAGE_SIZE);
+			}
+			else{
+				p[i] = allocateKernelPages(PAGE_SIZE, KERNEL_PAGE);
+			}
+		}
+		for(i = 0; i < LENGTH_OF(p); i++){
+			if(t->allocatePhysical){
+				if(pa[i].value == INVALID_PAGE_ADDRESS)
+					continue;
+				releasePhysicalBlock(kernelLinear->physical, pa[i].value);
+			}
+			else{
+				if(p[i] == NULL)
+					continue;
+				checkAndReleaseKernelPages(p[i]);
+			}
+			n++;
+		}
+	}
+	lock_add32(&t->allocateCount, n);
+	lock_add32(&t->stoppedTaskCount, 1);
+	systemCall_terminate();
+}
+
+// run 1~8 tasks allocating and releasing one page for 1 second
+// the tasks are distributed to idle processors
+void testMemoryManagerThroughput(void){
+	ThroughputTest *NEW(t);
+	assert(t != NULL);
+	int allocatePhysical;
+	for(allocatePhysical = 0; allocatePhysical < 2; allocatePhysical++){
+		uint32_t taskCount;
+		for(taskCount = 1; taskCount <= 8; taskCount++){
+			t->stop = 0;
+			t->allocatePhysical = allocatePhysical;
+			t->allocateCount = 0;
+			t->stoppedTaskCount = 0;
+			uint32_t i;
+			for(i = 0; i < taskCount; i++){
+				Task *task = createSharedMemoryTask(allocatePagesTask, &t, sizeof(t), processorLocalTask());
+				assert(task != NULL);
+				resume(task);
+			}
+			sleep(1000);
+			t->stop = 1;
+			while(t->stoppedTaskCount != taskCount){
+				sleep(10);
+			}
+			printk("%s throughput (%u tasks): %u per second\n",
+				(allocatePhysical? "physical block": "kernel page"), taskCount, t->allocateCount);
+		}
+	}
+	DELETE(t);
+	systemCall_terminate();
+}
+#include"io/ioservice.h"
+
+static void copyBytes(uint8_t *dst, const uint8_t *src, size_t size){
+	size_t i;
+	for(i = 0; i < size; i++){
+		dst[i] = src[i];
+	}
+}
+
+static void checkCopyAndSet(uint8_t *src, uint8_t *dst, size_t bufferSize){
+	size_t size, srcOffset, dstOffset, i;
+	for(i = 0; i < bufferSize; i++){
+		src[i] = (uint8_t)(i * 7 + 1);
+	}
+	for(size = 0; size + 8 <= bufferSize; size++){
+		for(srcOffset = 0; srcOffset < 8; srcOffset++){
+			for(dstOffset = 0; dstOffset < 8; dstOffset++){
+				memset(dst, 0xcc, bufferSize);
+				void *r = memcpy(dst + dstOffset, src + srcOffset, size);
+				assert(r == dst + dstOffset);
+				for(i = 0; i < bufferSize; i++){
+					const int inRange = (i >= dstOffset && i < dstOffset + size);
+					assert(dst[i] == (inRange? src[i - dstOffset + srcOffset]: 0xcc));
+				}
+			}
+		}
+		for(dstOffset = 0; dstOffset < 8; dstOffset++){
+			memset(dst, 0xcc, bufferSize);
+			memset_volatile(dst + dstOffset, 0x5a, size);
+			for(i = 0; i < bufferSize; i++){
+				const int inRange = (i >= dstOffset && i < dstOffset + size);
+				assert(dst[i] == (inRange? 0x5a: 0xcc));
+			}
+		}
+	}
+}
+
+// MB/s of copying size bytes repeatedly, until totalSize bytes are copied
+static uint32_t measureCopyBandwidth(void (*copy)(uint8_t*, const uint8_t*, size_t),
+	uint8_t *dst, const uint8_t *src, size_t size, size_t totalSize){
+	const uint32_t repeatCount = totalSize / size;
+	uint32_t r;
+	const uint64_t t0 = getClockNanosecond();
+	for(r = 0; r < repeatCount; r++){
+		copy(dst, src, size);
+	}
+	const uint64_t t1 = getClockNanosecond();
+	const uint64_t ns = (t1 > t0? t1 - t0: 1);
+	// bytes per nanosecond * 1000 = MB per second
+	return (uint32_t)(((uint64_t)repeatCount * size * 1000) / ns);
+}
+
+static void copyByMemcpy(uint8_t *dst, const uint8_t *src, size_t size){
+	memcpy(dst, src, size);
+}
+
+static void copyBySetting(uint8_t *dst, __attribute__((__unused__)) const uint8_t *src, size_t size){
+	memset(dst, 0x5a, size);
+}
+
+// compare memcpy and memset with every offset modulo 8, then print the bandwidth of aligned and unaligned copies
+void testMemoryFunctions(void){
+	const size_t bufferSize = (1 << 20) + PAGE_SIZE;
+	uint8_t *src = allocateKernelPages(bufferSize, KERNEL_PAGE);
+	uint8_t *dst = allocateKernelPages(bufferSize, KERNEL_PAGE);
+	assert(src != NULL && dst != NULL);
+	checkCopyAndSet(src, dst, 300);
+	printk("test memcpy and memset ok\n");
+	const size_t sizes[] = {64, 1024, 4096, 65536, 1 << 20};
+	unsigned i, misaligned;
+	for(i = 0; i < LENGTH_OF(sizes); i++){
+		for(misaligned = 0; misaligned < 2; misaligned++){
+			const size_t totalSize = 64 << 20;
+			printk("%u bytes%s: memcpy %u MB/s, byte loop %u MB/s, memset %u MB/s\n",
+				sizes[i], (misaligned? " (misaligned)": ""),
+				measureCopyBandwidth(copyByMemcpy, dst + misaligned, src, sizes[i], totalSize),
+				measureCopyBandwidth(copyBytes, dst + misaligned, src, sizes[i], totalSize),
+				measureCopyBandwidth(copyBySetting, dst + misaligned, src, sizes[i], totalSize));
+		}
+	}
+	checkAndReleaseKernelPages(src);
+	checkAndReleaseKernelPages(dst);
+	systemCall_terminate();
+}
 #endif
@@ -7,6 +7,7 @@
 #include"interrupt/controller/pic.h"
 #include"multiprocessor/spinlock.h"
 #include"multiprocessor/processorlocal.h"
+#include"multiprocessor/perfcounter.h"
 
 #define PAGE_TABLE_LENGTH (1024)
 
@@ -20,7 +21,7 @@ typedef struct{
 	uint8_t dirty: 1;
 	uint8_t zero: 1;
 	uint8_t global: 1;
-	uint8_t unused: 3; // available for OS; unused
+	uint8_t osFlags: 3; // available for OS; see enum PageOSFlag
 	uint8_t address0_4: 4;
 	uint16_t address4_20: 16;
 }PageTableEntry;
@@ -30,6 +31,12 @@ typedef struct PageTable{
 
 #define PAGE_TABLE_REGION_SIZE (PAGE_SIZE * PAGE_TABLE_LENGTH)
 
+enum PageOSFlag{
+	DEMAND_ZERO_PAGE = 1, // not present; allocate and clear a page on first access
+	COPY_ON_WRITE_PAGE = 2, // present and read-only; copy the page on first write
+	NOT_CLONED_PAGE = 3 // present; see NOT_CLONED_PAGE_FLAG
+};
+
 #define PAGE_DIRECTORY_LENGTH (1024)
 
 typedef struct{
@@ -161,7 +168,7 @@ static void setPTE(
 	pte.dirty = 0;
 	pte.zero = 0;
 	pte.global = 0;//(type & GLOBAL_PAGE_FLAG? 1: 0);
-	pte.unused = 0;
+	pte.osFlags = (attribute & NOT_CLONED_PAGE_FLAG? NOT_CLONED_PAGE: 0);
 	setPTEAddress(&pte, physicalAddress);
 	(*targetPTE) = pte;
 }
@@ -175,6 +182,24 @@ static void invalidatePTE(volatile PageTableEntry *targetPTE){
 	(*targetPTE) = pte;
 }
 
+// the PTE is not present and the page is allocated when it is accessed
+static void setDemandZeroPTE(volatile PageTableEntry *targetPTE, PageAttribute attribute){
+	PageTableEntry pte;
+	MEMSET0(&pte);
+	pte.writable = (attribute & WRITABLE_PAGE_FLAG? 1: 0);
+	pte.userAccessible = (attribute & USER_PAGE_FLAG? 1: 0);
+	pte.cacheDisabled = (attribute & NON_CACHED_PAGE_FLAG? 1: 0);
+	pte.osFlags = DEMAND_ZERO_PAGE;
+	(*targetPTE) = pte;
+}
+
+static PageAttribute getDemandZeroPTEAttribute(volatile PageTableEntry *e){
+	return PRESENT_PAGE_FLAG |
+		(e->writable? WRITABLE_PAGE_FLAG: 0) |
+		(e->userAccessible? USER_PAGE_FLAG: 0) |
+		(e->cacheDisabled? NON_CACHED_PAGE_FLAG: 0);
+}
+
 static int isPDEPresent(volatile PageDirectoryEntry *e){
 	return e->present;
 }
@@ -183,6 +208,14 @@ static int isPTEPresent(volatile PageTableEntry *e){
 	return e->present;
 }
 
+static int isPTEDemandZero(volatile PageTableEntry *e){
+	return e->present == 0 && e->osFlags == DEMAND_ZERO_PAGE;
+}
+
+static int isPTECopyOnWrite(volatile PageTableEntry *e){
+	return e->present == 1 && e->osFlags == COPY_ON_WRITE_PAGE;
+}
+
 // kernel page table
 
 // if external == 1, deleteWhenEmpty has to be 0 and presentCount is ignored
@@ -268,23 +301,28 @@ PhysicalAddress _translatePage(PageManager *p, uintptr_t linearAddress, PageAttr
 	assert(isPDEPresent(pdeByLinearAddress(p, linearAddress)));
 	PageTable *pt = ptByLinearAddress(p, linearAddress);
 	volatile PageTableEntry *pte = pteByLinearAddress(pt, linearAddress);
-	if(andPTEFlags(pte, hasAttribute) != (uint32_t)hasAttribute){
+	if(isPTEPresent(pte) == 0 || andPTEFlags(pte, hasAttribute) != (uint32_t)hasAttribute){
 		PhysicalAddress invalid = {INVALID_PAGE_ADDRESS};
 		return invalid;
 	}
 	return getPTEAddress(pte);
 }
 
-// return 1 if success, 0 if error
-// if physical == NULL, it is a recursive call to map a PageTable to its belonging PageTableSet.
-// In this case, we assume PD is present.
 static int setPage(
 	PageManager *p,
 	PhysicalMemoryBlockManager *physical,
 	uintptr_t linearAddress, PhysicalAddress physicalAddress,
 	PageAttribute attribute
+);
+
+// return NULL if error
+// if physical == NULL, it is a recursive call to map a PageTable to its belonging PageTableSet.
+// In this case, we assume PD is present.
+static PageTable *preparePageTable(
+	PageManager *p,
+	PhysicalMemoryBlockManager *physical,
+	uintptr_t linearAddress
 ){
-	assert((physicalAddress.value & 4095) == 0 && (linearAddress & 4095) == 0);
 	volatile PageDirectoryEntry *pde = pdeByLinearAddress(p, linearAddress);
 	Spinlock *lock = pdLockByLinearAddress(p, linearAddress);
 	PageTable *pt_linear = ptByLinearAddress(p, linearAddress);
@@ -321,12 +359,27 @@ static int setPage(
 	}
 	assert(pdeOK == 0 || pdeOK == 1);
 	if(pdeOK == 0){
-		return 0;
+		return NULL;
 	}
 	assert((((uintptr_t)pt_linear) & 4095) == 0);
 	//if(pt_attribute->external == 0){
 	//	pt_attribute->presentCount++;
 	//}
+	return pt_linear;
+}
+
+// return 1 if success, 0 if error
+static int setPage(
+	PageManager *p,
+	PhysicalMemoryBlockManager *physical,
+	uintptr_t linearAddress, PhysicalAddress physicalAddress,
+	PageAttribute attribute
+){
+	assert((physicalAddress.value & 4095) == 0 && (linearAddress & 4095) == 0);
+	PageTable *pt_linear = preparePageTable(p, physical, linearAddress);
+	if(pt_linear == NULL){
+		return 0;
+	}
 	// page is protected by linear memory manager, so do not lock PTE
 	volatile PageTableEntry *pte = pteByLinearAddress(pt_linear, linearAddress);
 	//assert(isPTEPresent(pte) == 0);
@@ -344,6 +397,10 @@ static void invalidatePage(
 	assert(isPDEPresent(pdeByLinearAddress(p, linear)));
 	int i2 = PT_INDEX(linear);
 	PageTable *pt_linear = ptByLinearAddress(p, linear);
+	// not accessed yet; see releaseInvalidatedPage
+	if(isPTEDemandZero(pt_linear->entry + i2)){
+		return;
+	}
 	assert(isPTEPresent(pt_linear->entry + i2));
 	invalidatePTE(pt_linear->entry + i2);
 	// invalidate PDE if the PD is empty
@@ -358,11 +415,13 @@ static void releaseInvalidatedPage(
 	PageTable *pt_linear = ptByLinearAddress(p, linear);
 	//Spinlock *pdLock = pdLockByLinearAddress(p, linear);
 	//PageTableAttribute *pt_attribute = linearAddressOfPageTableAttribute(p ,linear);
-#ifndef NDEBUG
 	int i2 = PT_INDEX(linear);
 	assert(isPDEPresent(pdeByLinearAddress(p, linear)));
 	assert(isPTEPresent(pt_linear->entry + i2) == 0);
-#endif
+	if(isPTEDemandZero(pt_linear->entry + i2)){
+		pt_linear->entry[i2].osFlags = 0;
+		return;
+	}
 	PhysicalAddress page_physical = getPTEAddress(pt_linear->entry + i2);
 	releasePhysicalBlock(physical, page_physical.value);
 	/* release PageTable and set PD
@@ -536,6 +595,7 @@ static InterruptVector *invlpgVector = NULL;
 static void (*sendINVLPG)(uint32_t cr3, uintptr_t linearAddress, size_t size) = sendINVLPG_disabled;
 
 static void invlpgHandler(InterruptParam *p){
+	countInterrupt(toChar(p->vector));
 	if(args.isGlobal || args.cr3 == getCR3()){
 		invlpgOrSetCR3(args.linearAddress, args.size);
 	}
@@ -548,6 +608,8 @@ static void sendINVLPG_enabled(uint32_t cr3, uintptr_t linearAddress, size_t siz
 	static Spinlock lock = INITIAL_SPINLOCK;
 	// disabling interrupt during sendINVLPG may result in deadlock
 	assert(getEFlags().bit.interrupt == 1);
+	addCounter(COUNTER_TLB_SHOOTDOWN, 1);
+	TRACE(TRACE_TLB_SHOOTDOWN, linearAddress, size);
 	acquireLock(&lock);
 	{
 		PIC *pic = processorLocalPIC();
@@ -695,16 +757,23 @@ static int map1Page_LP(
 	return 0;
 }
 
-int _mapPage_L(
+static PhysicalAddress allocatePhysicalPage(PhysicalMemoryBlockManager *physical){
+	PhysicalAddress p_addr = {allocatePhysicalBlock(physical, PAGE_SIZE, PAGE_SIZE)};
+	return p_addr;
+}
+
+static PhysicalAddress allocateZeroedPhysicalPage(PhysicalMemoryBlockManager *physical);
+
+static int mapNewPage_L(
 	PageManager *p, PhysicalMemoryBlockManager *physical,
 	void *linearAddress, size_t size,
-	PageAttribute attribute
+	PageAttribute attribute, PhysicalAddress (*allocatePage)(PhysicalMemoryBlockManager*)
 ){
 	assert(size % PAGE_SIZE == 0);
 	uintptr_t l_addr = (uintptr_t)linearAddress;
 	size_t s;
 	for(s = 0; s < size; s += PAGE_SIZE){
-		PhysicalAddress p_addr = {allocatePhysicalBlock(physical, PAGE_SIZE, PAGE_SIZE)};
+		PhysicalAddress p_addr = allocatePage(physical);
 		if(p_addr.value == INVALID_PAGE_ADDRESS){
 			break;
 		}
@@ -722,6 +791,22 @@ int _mapPage_L(
 	return 0;
 }
 
+int _mapPage_L(
+	PageManager *p, PhysicalMemoryBlockManager *physical,
+	void *linearAddress, size_t size,
+	PageAttribute attribute
+){
+	return mapNewPage_L(p, physical, linearAddress, size, attribute, allocatePhysicalPage);
+}
+
+int _mapZeroedPage_L(
+	PageManager *p, PhysicalMemoryBlockManager *physical,
+	void *linearAddress, size_t size,
+	PageAttribute attribute
+){
+	return mapNewPage_L(p, physical, linearAddress, size, attribute, allocateZeroedPhysicalPage);
+}
+
 int _mapContiguousPage_L(
 	PageManager *p, PhysicalMemoryBlockManager *physical,
 	void *linearAddress, size_t size,
@@ -770,3 +855,336 @@ int _mapPage_LP(
 	_unmapPage_LP(p, physical, linearAddress, s);
 	return 0;
 }
+
+int _mapCopyOnWritePage_LP(
+	PageManager *p, PhysicalMemoryBlockManager *physical,
+	void *linearAddress, PhysicalAddress physicalAddress, size_t size,
+	PageAttribute attribute
+){
+	assert(attribute & WRITABLE_PAGE_FLAG);
+	int ok = _mapPage_LP(p, physical, linearAddress, physicalAddress, size,
+		(PageAttribute)(attribute & ~WRITABLE_PAGE_FLAG));
+	if(ok == 0){
+		return 0;
+	}
+	// see _commitPage
+	size_t s;
+	for(s = 0; s < size; s += PAGE_SIZE){
+		const uintptr_t l = ((uintptr_t)linearAddress) + s;
+		pteByLinearAddress(ptByLinearAddress(p, l), l)->osFlags = COPY_ON_WRITE_PAGE;
+	}
+	return 1;
+}
+
+// the pages are allocated in _commitPage
+int _reservePage_L(
+	PageManager *p, PhysicalMemoryBlockManager *physical,
+	void *linearAddress, size_t size,
+	PageAttribute attribute
+){
+	assert(size % PAGE_SIZE == 0);
+	uintptr_t l_addr = (uintptr_t)linearAddress;
+	size_t s;
+	for(s = 0; s < size; s += PAGE_SIZE){
+		PageTable *pt_linear = preparePageTable(p, physical, l_addr + s);
+		if(pt_linear == NULL){
+			break;
+		}
+		setDemandZeroPTE(pteByLinearAddress(pt_linear, l_addr + s), attribute);
+	}
+	EXPECT(s >= size);
+	return 1;
+
+	ON_ERROR;
+	_unmapPage_L(p, physical, linearAddress, s);
+	return 0;
+}
+
+// kernel pages to access physical pages not mapped in kernel linear memory
+// each processor maps its own page in ProcessorMemory with interrupt disabled
+// the boot page is shared by the processors which have not set their ProcessorMemory
+static struct{
+	Spinlock lock;
+	uintptr_t linear;
+	int interruptFlag;
+}bootTempPage = {INITIAL_SPINLOCK, 0, 0};
+
+void initTemporaryPage(uintptr_t linearAddress){
+	assert(bootTempPage.linear == 0 && linearAddress % PAGE_SIZE == 0);
+	bootTempPage.linear = linearAddress;
+}
+
+static void *mapTemporaryPage(PhysicalAddress physicalAddress){
+	const int interruptFlag = getEFlags().bit.interrupt;
+	cli();
+	ProcessorMemory *pm = processorLocalMemory();
+	uintptr_t linear;
+	if(pm == NULL){
+		assert(bootTempPage.linear != 0);
+		acquireLock(&bootTempPage.lock);
+		bootTempPage.interruptFlag = interruptFlag;
+		linear = bootTempPage.linear;
+	}
+	else{
+		pm->tempPageInterruptFlag = interruptFlag;
+		linear = pm->tempPage;
+	}
+	int ok = setPage(kernelPageManager, NULL, linear, physicalAddress, KERNEL_PAGE);
+	assert(ok);
+	// other processors do not access the page, so do not sendINVLPG
+	invlpgOrSetCR3(linear, PAGE_SIZE);
+	return (void*)linear;
+}
+
+static void unmapTemporaryPage(void *page){
+	int interruptFlag;
+	if((uintptr_t)page == bootTempPage.linear){
+		interruptFlag = bootTempPage.interruptFlag;
+		releaseLock(&bootTempPage.lock);
+	}
+	else{
+		interruptFlag = processorLocalMemory()->tempPageInterruptFlag;
+	}
+	if(interruptFlag){
+		sti();
+	}
+}
+
+static void clearPhysicalPage(PhysicalAddress physicalAddress){
+	void *page = mapTemporaryPage(physicalAddress);
+	memset(page, 0, PAGE_SIZE);
+	unmapTemporaryPage(page);
+}
+
+// pool of cleared physical pages, filled by idle processors. see ProcessorMemory
+static PhysicalAddress popZeroedPage(PhysicalMemoryBlockManager *physical){
+	PhysicalAddress p_addr = {INVALID_PAGE_ADDRESS};
+	EFlags eflags = getEFlags();
+	if(eflags.bit.interrupt){
+		cli();
+	}
+	ProcessorMemory *pm = processorLocalMemory();
+	if(pm != NULL && pm->physical == physical && pm->zeroedPagePool.count > 0){
+		ZeroedPagePool *pool = &pm->zeroedPagePool;
+		pool->count--;
+		p_addr = pool->page[pool->count];
+	}
+	if(eflags.bit.interrupt){
+		sti();
+	}
+	return p_addr;
+}
+
+static PhysicalAddress allocateZeroedPhysicalPage(PhysicalMemoryBlockManager *physical){
+	PhysicalAddress p_addr = popZeroedPage(physical);
+	if(p_addr.value != INVALID_PAGE_ADDRESS){
+		return p_addr;
+	}
+	p_addr = allocatePhysicalPage(physical);
+	if(p_addr.value != INVALID_PAGE_ADDRESS){
+		clearPhysicalPage(p_addr);
+	}
+	return p_addr;
+}
+
+int fillZeroedPagePool(void){
+	assert(getEFlags().bit.interrupt);
+	cli();
+	ProcessorMemory *pm = processorLocalMemory();
+	PhysicalMemoryBlockManager *physical = (pm == NULL? NULL: pm->physical);
+	int isFull = (pm == NULL || pm->zeroedPagePool.count == ZEROED_PAGE_POOL_SIZE);
+	sti();
+	if(isFull){
+		return 0;
+	}
+	PhysicalAddress p_addr = allocatePhysicalPage(physical);
+	if(p_addr.value == INVALID_PAGE_ADDRESS){
+		return 0;
+	}
+	clearPhysicalPage(p_addr);
+	// the task may have been moved to another processor
+	cli();
+	pm = processorLocalMemory();
+	int ok = (pm != NULL && pm->physical == physical && pm->zeroedPagePool.count < ZEROED_PAGE_POOL_SIZE);
+	if(ok){
+		ZeroedPagePool *pool = &pm->zeroedPagePool;
+		pool->page[pool->count] = p_addr;
+		pool->count++;
+	}
+	sti();
+	if(!ok){
+		releasePhysicalBlock(physical, p_addr.value);
+	}
+	return ok;
+}
+
+// copy from linearAddress in current page table
+static PhysicalAddress copyToNewPhysicalPage(PhysicalMemoryBlockManager *physical, uintptr_t linearAddress){
+	PhysicalAddress p_addr = {allocatePhysicalBlock(physical, PAGE_SIZE, PAGE_SIZE)};
+	if(p_addr.value != INVALID_PAGE_ADDRESS){
+		void *page = mapTemporaryPage(p_addr);
+		memcpy(page, (void*)linearAddress, PAGE_SIZE);
+		unmapTemporaryPage(page);
+	}
+	return p_addr;
+}
+
+// assume the linear memory manager has checked and locked the block
+int _commitPage(PageManager *p, PhysicalMemoryBlockManager *physical, uintptr_t linearAddress, PageAttribute access){
+	linearAddress = FLOOR(linearAddress, PAGE_SIZE);
+	if(isPDEPresent(pdeByLinearAddress(p, linearAddress)) == 0){
+		return 0;
+	}
+	volatile PageTableEntry *pte = pteByLinearAddress(ptByLinearAddress(p, linearAddress), linearAddress);
+	if(isPTEDemandZero(pte)){
+		PhysicalAddress p_addr = allocateZeroedPhysicalPage(physical);
+		if(p_addr.value == INVALID_PAGE_ADDRESS){
+			return 0;
+		}
+		// not necessary to invlpg when changing present flag from 0 to 1
+		setPTE(pte, getDemandZeroPTEAttribute(pte), p_addr);
+	}
+	if(isPTEPresent(pte) == 0){
+		return 0;
+	}
+	int r = 1;
+	if((access & WRITABLE_PAGE_FLAG) && isPTECopyOnWrite(pte)){
+		PageTableEntry newPTE = *pte;
+		PhysicalAddress oldAddress = getPTEAddress(pte);
+		// the other sharing page tables have released the page
+		if(getPhysicalBlockReference(physical, oldAddress.value) > 1){
+			assert(getCR3() == toCR3(p));
+			PhysicalAddress newAddress = copyToNewPhysicalPage(physical, linearAddress);
+			if(newAddress.value == INVALID_PAGE_ADDRESS){
+				return 0;
+			}
+			setPTEAddress(&newPTE, newAddress);
+			releasePhysicalBlock(physical, oldAddress.value);
+			r = 2;
+		}
+		// not necessary to invlpg when adding writable flag
+		newPTE.writable = 1;
+		newPTE.osFlags = 0;
+		(*pte) = newPTE;
+	}
+	if(andPTEFlags(pte, access) != (uint32_t)access){
+		return 0;
+	}
+	return r;
+}
+
+void _flushPage(PageManager *p, uintptr_t linearAddress, size_t size){
+	// the other processors running p may keep stale entries, so they must be flushed before returning
+	// sendINVLPG_enabled waits for them and requires interrupts
+	assert(getEFlags().bit.interrupt || sendINVLPG == sendINVLPG_disabled);
+	sendINVLPG(p->physicalPD.value, linearAddress, size);
+}
+
+// dst is created by createAndMapUserPageTable and not yet unmapUserPageTableSet
+// return the physical address of the page table in dst
+static PhysicalAddress prepareClonedPageTable(
+	PageManager *dst, PhysicalMemoryBlockManager *physical, uintptr_t linearAddress
+){
+	volatile PageDirectoryEntry *pde = pdeByLinearAddress(dst, linearAddress);
+	if(isPDEPresent(pde)){
+		return getPDEAddress(pde);
+	}
+	PhysicalAddress pt_physical = {allocatePhysicalBlock(physical, sizeof(PageTable), sizeof(PageTable))};
+	if(pt_physical.value == INVALID_PAGE_ADDRESS){
+		return pt_physical;
+	}
+	assert(sizeof(PageTable) == PAGE_SIZE);
+	clearPhysicalPage(pt_physical);
+	setPDE(pde, USER_WRITABLE_PAGE, pt_physical);
+	// see setPage; dst->pageInUserSpace is in the reserved range
+	uintptr_t pt_user = (uintptr_t)(dst->pageInUserSpace->pt + (PD_INDEX(linearAddress) + dst->pdIndexBase) % PAGE_DIRECTORY_LENGTH);
+	setPTE(pteByLinearAddress(ptByLinearAddress(dst, pt_user), pt_user), KERNEL_PAGE, pt_physical);
+	return pt_physical;
+}
+
+// src is the current page table
+// if doCopy == 0, share the present pages with dst and change the writable pages to copy-on-write
+// if doCopy == 1, copy the present pages to new physical pages
+int _clonePage_L(
+	PageManager *dst, PageManager *src, PhysicalMemoryBlockManager *physical,
+	uintptr_t linearAddress, size_t size, int doCopy
+){
+	assert(linearAddress % PAGE_SIZE == 0 && size % PAGE_SIZE == 0);
+	assert(getCR3() == toCR3(src) && linearAddress + size <= KERNEL_LINEAR_BEGIN);
+	assert(linearAddress >= dst->reservedEnd || linearAddress + size <= dst->reservedBase);
+	size_t s;
+	for(s = 0; s < size; s += PAGE_SIZE){
+		const uintptr_t l = linearAddress + s;
+		if(isPDEPresent(pdeByLinearAddress(src, l)) == 0){
+			continue;
+		}
+		volatile PageTableEntry *srcPTE = pteByLinearAddress(ptByLinearAddress(src, l), l);
+		PageTableEntry pte = *srcPTE;
+		if(isPTEPresent(&pte) && pte.osFlags == NOT_CLONED_PAGE){
+			// the kernel keeps writing the physical page, so src must not become copy-on-write
+			setDemandZeroPTE(&pte, getDemandZeroPTEAttribute(&pte));
+		}
+		else if(isPTEPresent(&pte)){
+			if(doCopy){
+				PhysicalAddress p_addr = copyToNewPhysicalPage(physical, l);
+				if(p_addr.value == INVALID_PAGE_ADDRESS){
+					break;
+				}
+				setPTEAddress(&pte, p_addr);
+			}
+			else{
+				if(addPhysicalBlockReference(physical, getPTEAddress(&pte).value) == 0){
+					break;
+				}
+				if(pte.writable){
+					pte.writable = 0;
+					pte.osFlags = COPY_ON_WRITE_PAGE;
+					(*srcPTE) = pte;
+				}
+			}
+		}
+		else if(isPTEDemandZero(&pte) == 0){
+			continue;
+		}
+		pte.accessed = 0;
+		pte.dirty = 0;
+		PhysicalAddress pt_physical = prepareClonedPageTable(dst, physical, l);
+		if(pt_physical.value == INVALID_PAGE_ADDRESS){
+			if(isPTEPresent(&pte)){
+				releasePhysicalBlock(physical, getPTEAddress(&pte).value);
+			}
+			break;
+		}
+		PageTable *pt = mapTemporaryPage(pt_physical);
+		pt->entry[PT_INDEX(l)] = pte;
+		unmapTemporaryPage(pt);
+	}
+	return s >= size;
+}
+
+// release the pages mapped by _clonePage_L
+// dst is not yet unmapUserPageTableSet
+void _releaseClonedPages(PageManager *dst, PhysicalMemoryBlockManager *physical){
+	const int kPDBegin = PD_INDEX(KERNEL_LINEAR_BEGIN);
+	int i1;
+	for(i1 = 0; i1 < kPDBegin; i1++){
+		volatile PageDirectoryEntry *pde = dst->page->pd.entry + i1;
+		if(isPDEPresent(pde) == 0){
+			continue;
+		}
+		PageTable *pt = mapTemporaryPage(getPDEAddress(pde));
+		int i2;
+		for(i2 = 0; i2 < PAGE_TABLE_LENGTH; i2++){
+			const uintptr_t l = ((uintptr_t)i1) * PAGE_TABLE_REGION_SIZE + ((uintptr_t)i2) * PAGE_SIZE;
+			// see initPageManagerPT
+			if(l >= dst->reservedBase && l < dst->reservedEnd){
+				continue;
+			}
+			if(isPTEPresent(pt->entry + i2)){
+				releasePhysicalBlock(physical, getPTEAddress(pt->entry + i2).value);
+			}
+		}
+		unmapTemporaryPage(pt);
+	}
+	// the page tables are released in invalidatePageTable
+}
@@ -1,8 +1,11 @@
 #include"buddy.h"
 #include"kernel.h"
+#include"assembly/assembly.h"
+#include"multiprocessor/processorlocal.h"
 
 typedef struct PhysicalMemoryBlock{
-	uint32_t referenceCount;
+	// atomic; the lock is required only when the count changes from or to 0
+	volatile uint32_t referenceCount;
 	MemoryBlock block;
 }PhysicalMemoryBlock;
 
@@ -11,6 +14,8 @@ static_assert(sizeof(PhysicalMemoryBlock) == 16);
 #define MAX_REFERENCE_COUNT ((uint32_t)0xffffffff)
 
 struct PhysicalMemoryBlockManager{
+	// total size of the blocks in the caches of all processors. see ProcessorMemory
+	volatile uint32_t cachedSize;
 	MemoryBlockManager b;
 };
 
@@ -35,9 +40,11 @@ PhysicalMemoryBlockManager *createPhysicalMemoryBlockManager(
 		beginAddr, initEndAddr,
 		initPhysicalMemoryBlock
 	);
+	pm->cachedSize = 0;
 	if(getPhysicalBlockManagerSize(pm) >= manageSize){
 		panic("cannot initialize physical memory manager");
 	}
+	addNamedSpinlock(&pm->b.lock, "physical memory");
 	return pm;
 }
 
@@ -49,13 +56,88 @@ int getPhysicalBlockCount(PhysicalMemoryBlockManager *m){
 	return m->b.blockCount;
 }
 
+// the cached blocks are free, although only their processors can allocate them
 size_t getFreePhysicalBlockSize(PhysicalMemoryBlockManager *m){
-	return m->b.freeSize;
+	return m->b.freeSize + m->cachedSize;
+}
+
+// per-processor cache of MIN_BLOCK_SIZE blocks. see ProcessorMemory
+// assume interrupt disabled
+static MemoryBlockCache *getPhysicalBlockCache(PhysicalMemoryBlockManager *m){
+	ProcessorMemory *pm = processorLocalMemory();
+	if(pm == NULL || pm->physical != m){
+		return NULL;
+	}
+	return &pm->physicalCache;
+}
+
+static MemoryBlock *allocateCachedBlock(PhysicalMemoryBlockManager *m){
+	MemoryBlock *b = NULL;
+	EFlags eflags = getEFlags();
+	cli();
+	MemoryBlockCache *c = getPhysicalBlockCache(m);
+	if(c != NULL){
+		if(c->count == 0){
+			acquireLock(&m->b.lock);
+			fillBlockCache_noLock(&m->b, c, MEMORY_BLOCK_CACHE_SIZE / 2);
+			lock_add32(&m->cachedSize, c->count * MIN_BLOCK_SIZE);
+			releaseLock(&m->b.lock);
+		}
+		if(c->count > 0){
+			c->count--;
+			b = c->block[c->count];
+			lock_add32(&m->cachedSize, -MIN_BLOCK_SIZE);
+		}
+	}
+	if(eflags.bit.interrupt){
+		sti();
+	}
+	return b;
+}
+
+static int releaseCachedBlock(PhysicalMemoryBlockManager *m, MemoryBlock *b){
+	if(b->sizeOrder != MIN_BLOCK_ORDER){
+		return 0;
+	}
+	EFlags eflags = getEFlags();
+	cli();
+	MemoryBlockCache *c = getPhysicalBlockCache(m);
+	if(c != NULL){
+		if(c->count == MEMORY_BLOCK_CACHE_SIZE){
+			acquireLock(&m->b.lock);
+			lock_add32(&m->cachedSize, -(c->count - MEMORY_BLOCK_CACHE_SIZE / 2) * MIN_BLOCK_SIZE);
+			flushBlockCache_noLock(&m->b, c, MEMORY_BLOCK_CACHE_SIZE / 2);
+			releaseLock(&m->b.lock);
+		}
+		c->block[c->count] = b;
+		c->count++;
+		lock_add32(&m->cachedSize, MIN_BLOCK_SIZE);
+	}
+	if(eflags.bit.interrupt){
+		sti();
+	}
+	return c != NULL;
 }
 
 uintptr_t allocatePhysicalBlock(PhysicalMemoryBlockManager *m, size_t size, size_t splitSize){
+	if(size == MIN_BLOCK_SIZE){
+		MemoryBlock *b = allocateCachedBlock(m);
+		if(b != NULL){
+			PhysicalMemoryBlock *pmb = blockToElement(&m->b, b);
+			assert(pmb->referenceCount == 0);
+			ATOMIC_WRITE_32(&pmb->referenceCount, 1);
+			return blockToAddress(&m->b, b);
+		}
+	}
 	acquireLock(&m->b.lock);
 	MemoryBlock *b = allocateBlock_noLock(&m->b, size, splitSize);
+	// the blocks cached by this processor may merge with their buddies
+	MemoryBlockCache *c = (b == NULL? getPhysicalBlockCache(m): NULL);
+	if(c != NULL && c->count > 0){
+		lock_add32(&m->cachedSize, -c->count * MIN_BLOCK_SIZE);
+		flushBlockCache_noLock(&m->b, c, 0);
+		b = allocateBlock_noLock(&m->b, size, splitSize);
+	}
 	uintptr_t a;
 	if(b == NULL){
 		a = INVALID_PAGE_ADDRESS;
@@ -73,35 +155,54 @@ uintptr_t allocatePhysicalBlock(PhysicalMemoryBlockManager *m, size_t size, size
 	return a;
 }
 
+// the block array of physical memory manager is not extended, so isAddressInRange does not need lock
 int addPhysicalBlockReference(PhysicalMemoryBlockManager *m, uintptr_t address){
-	int ok;
-	acquireLock(&m->b.lock);
 	// allow out of range
-	if(isAddressInRange(&m->b, address)){
-		PhysicalMemoryBlock *pmb = addressToElement(&m->b, address);
-		// if the block is covered by a larger one, the assertion fails
-		assert(pmb->referenceCount > 0);
-		ok = (pmb->referenceCount < MAX_REFERENCE_COUNT);
-		if(ok){
-			pmb->referenceCount++;
+	if(isAddressInRange(&m->b, address) == 0){
+		return 1;
+	}
+	PhysicalMemoryBlock *pmb = addressToElement(&m->b, address);
+	while(1){
+		uint32_t r = pmb->referenceCount;
+		// the block is being released or covered by a larger one
+		// releasePhysicalBlock may have passed 0, so do not revive it
+		if(r == 0){
+			return 0;
+		}
+		if(r == MAX_REFERENCE_COUNT){
+			return 0;
+		}
+		if(lock_cmpxchg32(&pmb->referenceCount, r, r + 1) == r){
+			return 1;
 		}
 	}
-	else{
-		ok = 1;
+}
+
+uint32_t getPhysicalBlockReference(PhysicalMemoryBlockManager *m, uintptr_t address){
+	if(isAddressInRange(&m->b, address) == 0){
+		return MAX_REFERENCE_COUNT;
 	}
-	releaseLock(&m->b.lock);
-	return ok;
+	PhysicalMemoryBlock *pmb = addressToElement(&m->b, address);
+	return ATOMIC_READ_32(&pmb->referenceCount);
 }
 
 void releasePhysicalBlock(PhysicalMemoryBlockManager *m, uintptr_t address){
-	acquireLock(&m->b.lock);
-	if(isAddressInRange(&m->b, address)){
-		PhysicalMemoryBlock *pmb = addressToElement(&m->b, address);
-		assert(pmb->referenceCount > 0);
-		pmb->referenceCount--;
-		if(pmb->referenceCount == 0){
-			releaseBlock_noLock(&m->b, &pmb->block);
-		}
+	if(isAddressInRange(&m->b, address) == 0){
+		return;
+	}
+	PhysicalMemoryBlock *pmb = addressToElement(&m->b, address);
+	uint32_t r;
+	do{
+		r = pmb->referenceCount;
+		assert(r > 0);
+	}while(lock_cmpxchg32(&pmb->referenceCount, r, r - 1) != r);
+	if(r != 1){
+		return;
 	}
+	if(releaseCachedBlock(m, &pmb->block)){
+		return;
+	}
+	acquireLock(&m->b.lock);
+	releaseBlock_noLock(&m->b, &pmb->block);
 	releaseLock(&m->b.lock);
 }
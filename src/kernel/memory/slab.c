@@ -190,7 +190,11 @@ static SlabManager *createSlabManager(
 }
 
 SlabManager *createKernelSlabManager(void){
-	return createSlabManager(allocateKernelPages, checkAndReleaseKernelPages, KERNEL_PAGE);
+	SlabManager *m = createSlabManager(allocateKernelPages, checkAndReleaseKernelPages, KERNEL_PAGE);
+	if(m != NULL){
+		addNamedSpinlock(&m->lock, "kernel slab");
+	}
+	return m;
 }
 SlabManager *createUserSlabManager(void){
 	return createSlabManager(systemCall_allocateHeap, systemCall_releaseHeap, USER_WRITABLE_PAGE);
@@ -0,0 +1,323 @@
+#include"perfcounter.h"
+#include"kernel.h"
+#include"assembly/assembly.h"
+#include"memory/memory.h"
+#include"task/task.h"
+#include"io/ioservice.h"
+#include"io.h"
+#include"multiprocessor/spinlock.h"
+#include"multiprocessor/processorlocal.h"
+
+// every processor writes only its own slot with interrupts disabled, so no lock is needed
+// readers may see a slightly stale total
+
+#define NUMBER_OF_VECTORS (256)
+
+typedef struct{
+	uint32_t counter[NUMBER_OF_COUNTERS];
+	uint32_t interrupt[NUMBER_OF_VECTORS];
+}__attribute__((aligned(64))) ProcessorCounter;
+
+static ProcessorCounter processorCounter[MAX_PROCESSOR_COUNT];
+
+static const char *const counterName[NUMBER_OF_COUNTERS] = {
+	"syscall",
+	"taskswitch",
+	"pagefault",
+	"iocompletion",
+	"slab",
+	"tlbshootdown",
+	"packetdrop",
+	"timerskip"
+};
+
+static ProcessorCounter *disableAndGetCounter(EFlags *eflags){
+	*eflags = getEFlags();
+	cli();
+	const int i = getProcessorIndex();
+	return (i < 0? NULL: processorCounter + i);
+}
+
+static void restoreInterrupt(EFlags eflags){
+	if(eflags.bit.interrupt){
+		sti();
+	}
+}
+
+void addCounter(PerformanceCounter c, uint32_t value){
+	EFlags eflags;
+	ProcessorCounter *pc = disableAndGetCounter(&eflags);
+	if(pc != NULL){
+		pc->counter[c] += value;
+	}
+	restoreInterrupt(eflags);
+}
+
+void countInterrupt(uint8_t vector){
+	EFlags eflags;
+	ProcessorCounter *pc = disableAndGetCounter(&eflags);
+	if(pc != NULL){
+		pc->interrupt[vector]++;
+	}
+	restoreInterrupt(eflags);
+}
+
+int printPerformanceCounters(char *buffer, uintptr_t bufferSize){
+	const uint32_t processorCount = getProcessorCount();
+	int length = 0;
+	int c;
+	for(c = 0; c < NUMBER_OF_COUNTERS && (uintptr_t)length < bufferSize; c++){
+		uint32_t total = 0, p;
+		for(p = 0; p < processorCount; p++){
+			total += processorCounter[p].counter[c];
+		}
+		length += snprintf(buffer + length, bufferSize - length, "%s: %u (", counterName[c], total);
+		for(p = 0; p < processorCount; p++){
+			length += snprintf(buffer + length, bufferSize - length, (p == 0? "%u": " %u"),
+				processorCounter[p].counter[c]);
+		}
+		length += snprintf(buffer + length, bufferSize - length, ")\n");
+	}
+	return length;
+}
+
+int printInterruptCounters(char *buffer, uintptr_t bufferSize){
+	const uint32_t processorCount = getProcessorCount();
+	int length = 0;
+	int v;
+	for(v = 0; v < NUMBER_OF_VECTORS && (uintptr_t)length < bufferSize; v++){
+		uint32_t total = 0, p;
+		for(p = 0; p < processorCount; p++){
+			total += processorCounter[p].interrupt[v];
+		}
+		if(total == 0){
+			continue;
+		}
+		length += snprintf(buffer + length, bufferSize - length, "%x: %u (", v, total);
+		for(p = 0; p < processorCount; p++){
+			length += snprintf(buffer + length, bufferSize - length, (p == 0? "%u": " %u"),
+				processorCounter[p].interrupt[v]);
+		}
+		length += snprintf(buffer + length, bufferSize - length, ")\n");
+	}
+	return length;
+}
+
+#undef NUMBER_OF_VECTORS
+
+// tracepoint
+
+// each processor keeps the last TRACE_BUFFER_LENGTH records
+#define TRACE_BUFFER_LENGTH (256)
+
+typedef struct{
+	uint64_t tsc;
+	Tracepoint tracepoint;
+	uintptr_t arg0, arg1;
+}TraceRecord;
+
+typedef struct{
+	uint32_t count;
+	TraceRecord record[TRACE_BUFFER_LENGTH];
+}TraceBuffer;
+
+// allocated when any tracepoint is enabled for the first time and never released
+static TraceBuffer *volatile traceBuffer[MAX_PROCESSOR_COUNT];
+
+volatile uint8_t isTracepointEnabled[NUMBER_OF_TRACEPOINTS];
+
+static const char *const tracepointName[NUMBER_OF_TRACEPOINTS] = {
+	"syscall",
+	"taskswitch",
+	"pagefault",
+	"iocompletion",
+	"tlbshootdown"
+};
+
+void recordTrace(Tracepoint t, uintptr_t arg0, uintptr_t arg1){
+	const EFlags eflags = getEFlags();
+	cli();
+	const int i = getProcessorIndex();
+	TraceBuffer *b = (i < 0? NULL: traceBuffer[i]);
+	if(b != NULL){
+		TraceRecord *r = b->record + b->count % TRACE_BUFFER_LENGTH;
+		r->tsc = rdtsc();
+		r->tracepoint = t;
+		r->arg0 = arg0;
+		r->arg1 = arg1;
+		b->count++;
+	}
+	restoreInterrupt(eflags);
+}
+
+// allocate cleared buffers for the processors not having one
+static int allocateProcessorBuffers(void *volatile *buffer, size_t size){
+	const uint32_t processorCount = getProcessorCount();
+	uint32_t p;
+	for(p = 0; p < processorCount; p++){
+		if(buffer[p] != NULL){
+			continue;
+		}
+		void *b = allocateZeroedKernelPages(CEIL(size, PAGE_SIZE), KERNEL_PAGE);
+		if(b == NULL){
+			return 0;
+		}
+		if(lock_cmpxchg32((volatile uint32_t*)&buffer[p], (uint32_t)NULL, (uint32_t)b) != (uint32_t)NULL){
+			checkAndReleaseKernelPages(b);
+		}
+	}
+	return 1;
+}
+
+static int findTracepoint(const char *name, uintptr_t nameLength){
+	int t;
+	for(t = 0; t < NUMBER_OF_TRACEPOINTS; t++){
+		if((uintptr_t)strlen(tracepointName[t]) == nameLength && strncmp(tracepointName[t], name, nameLength) == 0){
+			return t;
+		}
+	}
+	return -1;
+}
+
+int enableTracepoint(const char *name, uintptr_t nameLength, int enable){
+	const int t = findTracepoint(name, nameLength);
+	if(t < 0){
+		return 0;
+	}
+	if(enable && allocateProcessorBuffers((void *volatile*)traceBuffer, sizeof(TraceBuffer)) == 0){
+		return 0;
+	}
+	isTracepointEnabled[t] = (enable? 1: 0);
+	return 1;
+}
+
+int isTracepointNameEnabled(const char *name, uintptr_t nameLength){
+	const int t = findTracepoint(name, nameLength);
+	if(t < 0){
+		return -1;
+	}
+	return isTracepointEnabled[t];
+}
+
+int printTraceBuffers(char *buffer, uintptr_t bufferSize){
+	const TimePage *tp = getKernelTimePage();
+	const uint32_t processorCount = getProcessorCount();
+	int length = 0;
+	uint32_t p;
+	for(p = 0; p < processorCount && (uintptr_t)length < bufferSize; p++){
+		const TraceBuffer *b = traceBuffer[p];
+		if(b == NULL){
+			continue;
+		}
+		const uint32_t count = b->count;
+		const uint32_t recordCount = MIN(count, TRACE_BUFFER_LENGTH);
+		length += snprintf(buffer + length, bufferSize - length, "processor %u: %u records\n", p, count);
+		uint32_t r;
+		for(r = count - recordCount; r != count && (uintptr_t)length < bufferSize; r++){
+			const TraceRecord *tr = b->record + r % TRACE_BUFFER_LENGTH;
+			const uint64_t nanosecond = tscToNanosecond(tp, tr->tsc);
+			length += snprintf(buffer + length, bufferSize - length, "%llu %s %x %x\n",
+				nanosecond / 1000, tracepointName[tr->tracepoint], tr->arg0, tr->arg1);
+		}
+	}
+	return length;
+}
+
+#undef TRACE_BUFFER_LENGTH
+
+// sampling profiler
+
+#define PROFILE_BUFFER_LENGTH (256)
+
+typedef struct{
+	uint32_t count;
+	// written by printProfileSamples
+	uint32_t readCount;
+	ProfileSample sample[PROFILE_BUFFER_LENGTH];
+}ProfileBuffer;
+
+static ProfileBuffer *volatile profileBuffer[MAX_PROCESSOR_COUNT];
+static Spinlock profileReadLock = INITIAL_SPINLOCK;
+
+volatile uint8_t isProfilerEnabled = 0;
+
+// called in timer interrupt
+void recordProfileSample(uint32_t eip, uint32_t cs){
+	assert(getEFlags().bit.interrupt == 0);
+	const int i = getProcessorIndex();
+	ProfileBuffer *b = (i < 0? NULL: profileBuffer[i]);
+	if(b == NULL){
+		return;
+	}
+	ProfileSample *s = b->sample + b->count % PROFILE_BUFFER_LENGTH;
+	s->eip = eip;
+	s->cs = cs;
+	s->task = (uint32_t)processorLocalTask();
+	s->processorIndex = i;
+	b->count++;
+}
+
+int enableProfiler(int enable){
+	if(enable && allocateProcessorBuffers((void *volatile*)profileBuffer, sizeof(ProfileBuffer)) == 0){
+		return 0;
+	}
+	isProfilerEnabled = (enable? 1: 0);
+	return 1;
+}
+
+int printProfileSamples(char *buffer, uintptr_t bufferSize){
+	const uint32_t processorCount = getProcessorCount();
+	const uintptr_t maxSampleCount = bufferSize / sizeof(ProfileSample);
+	ProfileSample *const sample = (ProfileSample*)buffer;
+	uintptr_t sampleCount = 0;
+	uint32_t p;
+	acquireLock(&profileReadLock);
+	for(p = 0; p < processorCount; p++){
+		ProfileBuffer *b = profileBuffer[p];
+		if(b == NULL){
+			continue;
+		}
+		const uint32_t count = b->count;
+		// older samples have been overwritten
+		uint32_t r = (count - b->readCount > PROFILE_BUFFER_LENGTH? count - PROFILE_BUFFER_LENGTH: b->readCount);
+		for(; r != count && sampleCount < maxSampleCount; r++){
+			sample[sampleCount] = b->sample[r % PROFILE_BUFFER_LENGTH];
+			sampleCount++;
+		}
+		b->readCount = r;
+	}
+	releaseLock(&profileReadLock);
+	return sampleCount * sizeof(ProfileSample);
+}
+
+#undef PROFILE_BUFFER_LENGTH
+
+#ifndef NDEBUG
+
+#include"file/fileservice.h"
+
+void testPerformanceCounter(void){
+	const char *const fileName[3] = {"debug:counter", "debug:interrupt", "debug:trace"};
+	char buffer[256];
+	int i;
+	int ok = enableTracepoint("syscall", strlen("syscall"), 1);
+	assert(ok && isTracepointNameEnabled("syscall", strlen("syscall")) == 1);
+	assert(isTracepointNameEnabled("nothing", strlen("nothing")) == -1);
+	for(i = 0; i < 3; i++){
+		uintptr_t handle = syncOpenFileN(fileName[i], strlen(fileName[i]), OPEN_FILE_MODE_0);
+		assert(handle != IO_REQUEST_FAILURE);
+		uintptr_t readSize = sizeof(buffer) - 1;
+		uintptr_t r = syncReadFile(handle, buffer, &readSize);
+		assert(r == handle);
+		buffer[readSize] = '\0';
+		printk("%s\n%s\n", fileName[i], buffer);
+		r = syncCloseFile(handle);
+		assert(r == handle);
+	}
+	ok = enableTracepoint("syscall", strlen("syscall"), 0);
+	assert(ok && isTracepointNameEnabled("syscall", strlen("syscall")) == 0);
+	printk("test performance counter ok\n");
+	systemCall_terminate();
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef PERFCOUNTER_H_INCLUDED
+#define PERFCOUNTER_H_INCLUDED
+
+#include<std.h>
+
+// per-processor event counters; see debug:counter
+typedef enum PerformanceCounter{
+	COUNTER_SYSTEM_CALL,
+	COUNTER_TASK_SWITCH,
+	COUNTER_PAGE_FAULT,
+	COUNTER_IO_COMPLETION,
+	COUNTER_SLAB_ALLOCATION,
+	COUNTER_TLB_SHOOTDOWN,
+	COUNTER_PACKET_DROP,
+	COUNTER_TIMER_EVENT_SKIP,
+	NUMBER_OF_COUNTERS
+}PerformanceCounter;
+
+void addCounter(PerformanceCounter c, uint32_t value);
+// see debug:interrupt
+void countInterrupt(uint8_t vector);
+
+// static tracepoints; see debug:trace
+typedef enum Tracepoint{
+	TRACE_SYSTEM_CALL, // system call number
+	TRACE_TASK_SWITCH, // old task, new task
+	TRACE_PAGE_FAULT, // linear address, error code
+	TRACE_IO_COMPLETION, // IORequest
+	TRACE_TLB_SHOOTDOWN, // linear address, size
+	NUMBER_OF_TRACEPOINTS
+}Tracepoint;
+
+extern volatile uint8_t isTracepointEnabled[NUMBER_OF_TRACEPOINTS];
+void recordTrace(Tracepoint t, uintptr_t arg0, uintptr_t arg1);
+// a disabled tracepoint costs one load and one branch
+#define TRACE(T, ARG0, ARG1) do{\
+	if(isTracepointEnabled[(T)]){\
+		recordTrace((T), (uintptr_t)(ARG0), (uintptr_t)(ARG1));\
+	}\
+}while(0)
+// return 0 if the name is not found or the trace buffers cannot be allocated
+int enableTracepoint(const char *name, uintptr_t nameLength, int enable);
+// return -1 if the name is not found
+int isTracepointNameEnabled(const char *name, uintptr_t nameLength);
+
+// sampling profiler; the interrupted eip and cs are recorded on each local timer interrupt
+extern volatile uint8_t isProfilerEnabled;
+void recordProfileSample(uint32_t eip, uint32_t cs);
+#define SAMPLE_PROFILE(EIP, CS) do{\
+	if(isProfilerEnabled){\
+		recordProfileSample((EIP), (CS));\
+	}\
+}while(0)
+// return 0 if the sample buffers cannot be allocated
+int enableProfiler(int enable);
+
+// see addDebugFile
+int printPerformanceCounters(char *buffer, uintptr_t bufferSize);
+int printInterruptCounters(char *buffer, uintptr_t bufferSize);
+int printTraceBuffers(char *buffer, uintptr_t bufferSize);
+// binary ProfileSample records; the returned samples are removed from the buffers
+int printProfileSamples(char *buffer, uintptr_t bufferSize);
+void testPerformanceCounter(void);
+
+#endif
@@ -9,6 +9,7 @@ typedef struct ProcessorLocal{
 	struct InterruptController *pic;
 	struct TaskManager *taskManager;
 	TimerEventList *timer;
+	ProcessorMemory *memory;
 }ProcessorLocal;
 
 // see pic.c
@@ -32,15 +33,20 @@ GET_PROCESSOR_LOCAL(SegmentTable*, GDT, getProcessorLocal()->gdt)
 GET_PROCESSOR_LOCAL(TaskManager*, TaskManager, getProcessorLocal()->taskManager)
 GET_PROCESSOR_LOCAL(Task*, Task, currentTask(getProcessorLocal()->taskManager))
 GET_PROCESSOR_LOCAL(TimerEventList*, Timer, getProcessorLocal()->timer)
+// memory may be allocated before initProcessorLocal
+GET_PROCESSOR_LOCAL(ProcessorMemory*, Memory,
+	(getProcessorLocal == NULL? NULL: getProcessorLocal()->memory))
 
 static ProcessorLocal *lapicToProcLocal = NULL;
 
-void setProcessorLocal(PIC *pic, SegmentTable *gdt, TaskManager *taskManager, TimerEventList *timer){
+void setProcessorLocal(PIC *pic, SegmentTable *gdt, TaskManager *taskManager, TimerEventList *timer,
+	ProcessorMemory *memory){
 	ProcessorLocal *local = getProcessorLocal();
 	local->pic = pic;
 	local->gdt = gdt;
 	local->taskManager = taskManager;
 	local->timer = timer;
+	local->memory = memory;
 }
 
 static ProcessorLocal *getProcessorLocalByLAPIC(void){
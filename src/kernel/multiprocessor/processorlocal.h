@@ -5,15 +5,19 @@ typedef struct InterruptController PIC;
 typedef struct TaskManager TaskManager;
 typedef struct Task Task;
 typedef struct TimerEventList TimerEventList;
+typedef struct ProcessorMemory ProcessorMemory;
 // processorlocal.c
 struct InterruptController *processorLocalPIC(void);
 SegmentTable *processorLocalGDT(void);
 TaskManager *processorLocalTaskManager(void);
 Task *processorLocalTask(void);
 TimerEventList *processorLocalTimer(void);
+// return NULL before setProcessorLocal
+ProcessorMemory *processorLocalMemory(void);
 
 void initProcessorLocal(uint32_t maxProcessorCount);
-void setProcessorLocal(PIC *pic, SegmentTable *gdt, TaskManager *taskManager, TimerEventList *timer);
+void setProcessorLocal(PIC *pic, SegmentTable *gdt, TaskManager *taskManager, TimerEventList *timer,
+	ProcessorMemory *memory);
 
 // see pic.c
 uint32_t getMemoryMappedLAPICID(void);
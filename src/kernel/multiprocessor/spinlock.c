@@ -4,55 +4,110 @@
 #include"assembly/assembly.h"
 #include"spinlock.h"
 
-#define NOT_ACQUIRABLE (0)
-#define ACQUIRABLE (1)
-#define IGNORED (2)
-
 const Spinlock initialSpinlock = INITIAL_SPINLOCK;
 const Spinlock nullSpinlock = NULL_SPINLOCK;
 
+#define NOW_SERVING(T) ((uint16_t)((T) & 0xffff))
+#define NEXT_TICKET(T) ((uint16_t)((T) >> 16))
+
 int isAcquirable(Spinlock *spinlock){
-	if(spinlock->acquirable == IGNORED)
+	if(spinlock->isNull)
 		return 1;
-	return spinlock->acquirable != NOT_ACQUIRABLE;
+	const uint32_t t = spinlock->ticket;
+	return NOW_SERVING(t) == NEXT_TICKET(t);
 }
 
+// interrupt is disabled while holding a ticket
+// because an interrupt handler on the same processor cannot get a ticket before this one
+// if the caller enabled interrupt, it waits with interrupt enabled until the lock is released, and then takes a ticket
 int acquireLock(Spinlock *spinlock){
-	if(spinlock->acquirable == IGNORED){
+	if(spinlock->isNull){
 		return 0;
 	}
 	unsigned interruptEnabled = getEFlags().bit.interrupt;
-
 	int tryCount = 0;
-	while(1){
-		cli();
-		int acquired = xchg8(&spinlock->acquirable, NOT_ACQUIRABLE);
-		if(acquired == ACQUIRABLE){
-			spinlock->interruptFlag = interruptEnabled;
-			return tryCount;
+	uint32_t spinCount = 0;
+	if(interruptEnabled){
+		while(isAcquirable(spinlock) == 0){
+			tryCount++;
+			pause();
+			spinCount++;
 		}
-		if(interruptEnabled){
-			sti();
+	}
+	cli();
+	const uint16_t myTicket = NEXT_TICKET(lock_xadd32(&spinlock->ticket, 1 << 16));
+	while(1){
+		// wait in proportion to the number of waiters ahead to reduce cache line traffic
+		const uint16_t distance = myTicket - spinlock->nowServing;
+		if(distance == 0){
+			break;
 		}
-		do{
-			tryCount++;
+		tryCount++;
+		uint16_t i;
+		for(i = 0; i < distance; i++){
 			pause();
-		}while(spinlock->acquirable == NOT_ACQUIRABLE);
+		}
+		spinCount += distance;
+	}
+	spinlock->interruptFlag = interruptEnabled;
+	spinlock->acquireCount++;
+	if(tryCount != 0){
+		spinlock->contendedCount++;
+		spinlock->spinCount += spinCount;
 	}
+	return tryCount;
 }
 
 void releaseLock(Spinlock *spinlock){
-	if(spinlock->acquirable == IGNORED){
+	if(spinlock->isNull){
 		return;
 	}
-	assert(spinlock->acquirable == NOT_ACQUIRABLE);
+	assert(isAcquirable(spinlock) == 0);
 	assert(getEFlags().bit.interrupt == 0);
 	int interruptEnabled = spinlock->interruptFlag;
-	xchg8(&spinlock->acquirable, ACQUIRABLE);
+	xchg16(&spinlock->nowServing, spinlock->nowServing + 1);
 	if(interruptEnabled){
 		sti();
 	}
 }
+
+#undef NOW_SERVING
+#undef NEXT_TICKET
+
+#define MAX_NAMED_SPINLOCK_COUNT (32)
+
+static struct{
+	Spinlock *volatile lock;
+	const char *name;
+}namedSpinlock[MAX_NAMED_SPINLOCK_COUNT];
+static volatile uint32_t namedSpinlockCount = 0;
+
+void addNamedSpinlock(Spinlock *spinlock, const char *name){
+	uint32_t i = lock_xadd32(&namedSpinlockCount, 1);
+	if(i >= MAX_NAMED_SPINLOCK_COUNT){
+		return;
+	}
+	namedSpinlock[i].name = name;
+	namedSpinlock[i].lock = spinlock;
+}
+
+int printSpinlockStatistics(char *buffer, uintptr_t bufferSize){
+	int length = 0;
+	const uint32_t count = MIN(namedSpinlockCount, MAX_NAMED_SPINLOCK_COUNT);
+	uint32_t i;
+	for(i = 0; i < count && (uintptr_t)length < bufferSize; i++){
+		const Spinlock *s = namedSpinlock[i].lock;
+		if(s == NULL){
+			continue;
+		}
+		length += snprintf(buffer + length, bufferSize - length, "%s: acquire %u contended %u spin %u\n",
+			namedSpinlock[i].name, s->acquireCount, s->contendedCount, s->spinCount);
+	}
+	return length;
+}
+
+#undef MAX_NAMED_SPINLOCK_COUNT
+
 /*
 #ifndef NDEBUG
 void testSpinlock(void){
@@ -5,20 +5,39 @@
 
 // spinlock
 
+// ticket lock; waiters acquire the lock in FIFO order
 typedef struct Spinlock{
-	volatile uint8_t acquirable;
+	union{
+		volatile uint32_t ticket;
+		struct{
+			volatile uint16_t nowServing;
+			volatile uint16_t nextTicket;
+		};
+	};
 	volatile uint8_t interruptFlag;
+	uint8_t isNull;
+	// contention statistics; updated by the owner
+	uint32_t acquireCount;
+	uint32_t contendedCount;
+	uint32_t spinCount;
 }Spinlock;
 
-#define INITIAL_SPINLOCK {acquirable: 1, interruptFlag: 0}
+#define INITIAL_SPINLOCK {ticket: 0, interruptFlag: 0, isNull: 0, acquireCount: 0, contendedCount: 0, spinCount: 0}
 extern const Spinlock initialSpinlock;
-#define NULL_SPINLOCK {acquirable: 2, interruptFlag: 0}
+#define NULL_SPINLOCK {ticket: 0, interruptFlag: 0, isNull: 1, acquireCount: 0, contendedCount: 0, spinCount: 0}
 extern const Spinlock nullSpinlock;
 
 int isAcquirable(Spinlock *spinlock);
+// return number of spins
 int acquireLock(Spinlock *spinlock);
 void releaseLock(Spinlock *spinlock);
 
+// list the lock in the lockstat debug file
+// name is not copied
+void addNamedSpinlock(Spinlock *spinlock, const char *name);
+// return length of the string
+int printSpinlockStatistics(char *buffer, uintptr_t bufferSize);
+
 // barrier
 
 typedef struct Barrier{
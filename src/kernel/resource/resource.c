@@ -230,6 +230,8 @@ int createAddResource(ResourceType rt, const FileEnumeration *fe){
 	initWaitable(r, fe);
 	int ok = addWaitable(r, resourceList + rt);
 	EXPECT(ok);
+	// see finishBootTrace
+	traceBootEvent(fe->name, fe->nameLength);
 	return 1;
 
 	ON_ERROR;
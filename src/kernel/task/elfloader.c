@@ -5,6 +5,7 @@
 #include"file.h"
 #include"io.h"
 #include"task/task.h"
+#include"multiprocessor/spinlock.h"
 #include"multiprocessor/processorlocal.h"
 
 typedef struct{
@@ -112,15 +113,256 @@ static int checkAllocateProgramHeader32(
 	return  *programBegin < *programEnd;
 }
 
+// the pages loaded from file: [FLOOR(memoryAddress), CEIL(memoryAddress + fileSize))
+static void getFilePageRange(const ProgramHeader32 *ph, uintptr_t *begin, uintptr_t *end){
+	*begin = FLOOR(ph->memoryAddress, PAGE_SIZE);
+	*end = (ph->fileSize == 0? *begin: CEIL(ph->memoryAddress + ph->fileSize, PAGE_SIZE));
+}
+
+// memory image of the loadable segments of an ELF file
+// the tasks running the same file share the read-only pages and copy the writable pages on write
+typedef struct ELFImage{
+	struct ELFImage *next;
+	int referenceCount;
+	// see FILE_PARAM_VERSION; 0 if the file system does not support it
+	uint64_t version;
+	uint64_t fileSize;
+	uintptr_t entry;
+	int programHeaderLength;
+	ProgramHeader32 *programHeader;
+	uintptr_t programBegin, programEnd;
+	// file pages of all segments in kernel linear memory; content[0] is at contentBegin
+	// the bss in these pages is never written, so it remains zero
+	uintptr_t contentBegin, contentEnd;
+	uint8_t *content;
+	uintptr_t nameLength;
+	char name[];
+}ELFImage;
+
+// the least recently used image is released when the cache is full
+// the running tasks are not affected because they hold the references of the physical pages
+#define ELF_IMAGE_CACHE_LENGTH (8)
+static struct{
+	Spinlock lock;
+	int length;
+	ELFImage *head;
+}elfImageCache = {INITIAL_SPINLOCK, 0, NULL};
+
+static int isSameMemory(const void *m1, const void *m2, size_t size){
+	size_t i;
+	for(i = 0; i < size; i++){
+		if(((const uint8_t*)m1)[i] != ((const uint8_t*)m2)[i])
+			return 0;
+	}
+	return 1;
+}
+
+static int isSameELFName(const ELFImage *i1, const ELFImage *i2){
+	return isStringEqual(i1->name, i1->nameLength, i2->name, i2->nameLength);
+}
+
+static int isSameELFImage(const ELFImage *i1, const ELFImage *i2){
+	return isSameELFName(i1, i2) && i1->version == i2->version &&
+		i1->fileSize == i2->fileSize && i1->entry == i2->entry &&
+		i1->programHeaderLength == i2->programHeaderLength &&
+		isSameMemory(i1->programHeader, i2->programHeader, i1->programHeaderLength * sizeof(ProgramHeader32));
+}
+
+static void deleteELFImage(ELFImage *image){
+	if(image->content != NULL){
+		checkAndReleaseKernelPages(image->content);
+	}
+	DELETE(image->programHeader);
+	DELETE(image);
+}
+
+static void releaseELFImage(ELFImage *image){
+	acquireLock(&elfImageCache.lock);
+	image->referenceCount--;
+	const int r = image->referenceCount;
+	releaseLock(&elfImageCache.lock);
+	if(r == 0){
+		deleteELFImage(image);
+	}
+}
+
+// read the headers but not the segments
+static ELFImage *createELFImage(uintptr_t file, const char *name, uintptr_t nameLength, const ELFHeader32 *elfHeader){
+	ELFImage *image = allocateKernelMemory(sizeof(*image) + nameLength * sizeof(*name));
+	EXPECT(image != NULL);
+	image->next = NULL;
+	image->referenceCount = 0;
+	image->entry = elfHeader->entry;
+	image->content = NULL;
+	image->nameLength = nameLength;
+	strncpy(image->name, name, nameLength);
+	const size_t programHeaderSize = elfHeader->programHeaderLength * sizeof(ProgramHeader32);
+	image->programHeaderLength = elfHeader->programHeaderLength;
+	image->programHeader = allocateKernelMemory(programHeaderSize);
+	EXPECT(image->programHeader != NULL);
+	uintptr_t readCount = programHeaderSize;
+	uintptr_t request = syncSeekReadFile(file, image->programHeader, elfHeader->programHeaderOffset, &readCount);
+	EXPECT(request != IO_REQUEST_FAILURE && readCount == programHeaderSize);
+	// check address overflow
+	EXPECT(checkAllocateProgramHeader32(
+		image->programHeader, image->programHeaderLength, &image->programBegin, &image->programEnd));
+	EXPECT(syncSizeOfFile(file, &image->fileSize) != IO_REQUEST_FAILURE);
+	if(syncGetFileParameter(file, FILE_PARAM_VERSION, &image->version) == IO_REQUEST_FAILURE){
+		image->version = 0;
+	}
+	return image;
+	ON_ERROR;
+	ON_ERROR;
+	ON_ERROR;
+	DELETE(image->programHeader);
+	ON_ERROR;
+	DELETE(image);
+	ON_ERROR;
+	return NULL;
+}
+
+// the pages are committed by the file system when reading; see mapBufferToKernel
+static int loadELFImage(uintptr_t file, ELFImage *image){
+	int i;
+	image->contentBegin = image->programEnd;
+	image->contentEnd = image->programBegin;
+	for(i = 0; i < image->programHeaderLength; i++){
+		const ProgramHeader32 *ph = image->programHeader + i;
+		uintptr_t fileBegin, fileEnd;
+		getFilePageRange(ph, &fileBegin, &fileEnd);
+		if(ph->segmentType != 1 || fileBegin == fileEnd)
+			continue;
+		image->contentBegin = MIN(image->contentBegin, fileBegin);
+		image->contentEnd = MAX(image->contentEnd, fileEnd);
+	}
+	if(image->contentBegin >= image->contentEnd){ // bss only
+		return 1;
+	}
+	image->content = reservePages(kernelLinear, image->contentEnd - image->contentBegin, KERNEL_PAGE);
+	EXPECT(image->content != NULL);
+	for(i = 0; i < image->programHeaderLength; i++){
+		const ProgramHeader32 *ph = image->programHeader + i;
+		if(ph->segmentType != 1 || ph->fileSize == 0)
+			continue;
+		uintptr_t readCount = ph->fileSize;
+		uint8_t *buffer = image->content + (ph->memoryAddress - image->contentBegin);
+		if(syncSeekReadFile(file, buffer, ph->offset, &readCount) == IO_REQUEST_FAILURE)
+			break;
+		if(readCount != ph->fileSize)
+			break;
+	}
+	EXPECT(i >= image->programHeaderLength);
+	return 1;
+	// see deleteELFImage
+	ON_ERROR;
+	ON_ERROR;
+	return 0;
+}
+
+// the images of older versions of the file are removed from the cache
+static ELFImage *findCachedELFImage(const ELFImage *key){
+	ELFImage *outdated = NULL, *found = NULL;
+	acquireLock(&elfImageCache.lock);
+	ELFImage **prev = &elfImageCache.head, *image;
+	while((image = *prev) != NULL){
+		if(found == NULL && isSameELFImage(image, key)){
+			found = image;
+			found->referenceCount++;
+			prev = &image->next;
+		}
+		else if(isSameELFName(image, key)){
+			*prev = image->next;
+			elfImageCache.length--;
+			image->next = outdated;
+			outdated = image;
+		}
+		else{
+			prev = &image->next;
+		}
+	}
+	if(found != NULL){
+		// move to head
+		for(prev = &elfImageCache.head; *prev != found; prev = &(*prev)->next);
+		*prev = found->next;
+		found->next = elfImageCache.head;
+		elfImageCache.head = found;
+	}
+	releaseLock(&elfImageCache.lock);
+	while(outdated != NULL){
+		image = outdated;
+		outdated = image->next;
+		releaseELFImage(image);
+	}
+	return found;
+}
+
+static void cacheELFImage(ELFImage *image){
+	ELFImage *evicted = NULL;
+	acquireLock(&elfImageCache.lock);
+	// one reference for the cache
+	image->referenceCount++;
+	image->next = elfImageCache.head;
+	elfImageCache.head = image;
+	elfImageCache.length++;
+	if(elfImageCache.length > ELF_IMAGE_CACHE_LENGTH){
+		ELFImage **prev = &elfImageCache.head;
+		while((*prev)->next != NULL){
+			prev = &(*prev)->next;
+		}
+		evicted = *prev;
+		*prev = NULL;
+		elfImageCache.length--;
+	}
+	releaseLock(&elfImageCache.lock);
+	if(evicted != NULL){
+		releaseELFImage(evicted);
+	}
+}
+
+// return an image with one reference; call releaseELFImage to release it
+static ELFImage *acquireELFImage(uintptr_t file, const char *name, uintptr_t nameLength, const ELFHeader32 *elfHeader){
+	ELFImage *image = createELFImage(file, name, nameLength, elfHeader);
+	EXPECT(image != NULL);
+	ELFImage *cachedImage = findCachedELFImage(image);
+	if(cachedImage != NULL){
+		deleteELFImage(image);
+		return cachedImage;
+	}
+	EXPECT(loadELFImage(file, image));
+	image->referenceCount = 1;
+	cacheELFImage(image);
+	return image;
+	ON_ERROR;
+	deleteELFImage(image);
+	ON_ERROR;
+	return NULL;
+}
+
+static int mapELFImagePage(LinearMemoryManager *taskMemory, const ELFImage *image, uintptr_t address, PageAttribute attribute){
+	PhysicalAddress p = checkAndReservePage(kernelLinear, image->content + (address - image->contentBegin), 0);
+	if(p.value == INVALID_PAGE_ADDRESS){
+		return 0;
+	}
+	int ok;
+	if(attribute & WRITABLE_PAGE_FLAG){
+		ok = _mapCopyOnWritePage_LP(taskMemory->page, taskMemory->physical, (void*)address, p, PAGE_SIZE, attribute);
+	}
+	else{
+		ok = _mapPage_LP(taskMemory->page, taskMemory->physical, (void*)address, p, PAGE_SIZE, attribute);
+	}
+	releaseReservedPage(kernelLinear, p);
+	return ok;
+}
+
+// file pages are shared with the image; the other pages are demand-zero
 // no matter ok or not, the pages in range will wither be mapped or released
-static int mapAllocateProgramHeader32(
-	const ProgramHeader32 *programHeaderArray, int programHeaderCount,
-	uintptr_t programBegin, uintptr_t programEnd
-){
+static int mapELFImage(const ELFImage *image){
 	int ok = 1;
 	LinearMemoryManager *taskMemory = getTaskLinearMemory(processorLocalTask());
+	const ProgramHeader32 *programHeaderArray = image->programHeader;
+	const int programHeaderCount = image->programHeaderLength;
 	uintptr_t address;
-	for(address = programBegin; address < programEnd; address += PAGE_SIZE){
+	for(address = image->programBegin; address < image->programEnd; address += PAGE_SIZE){
 		// is address in range?
 		int j;
 		for(j = 0; j < programHeaderCount; j++){
@@ -134,8 +376,16 @@ static int mapAllocateProgramHeader32(
 		}
 		// not failed and in range
 		if(ok && j < programHeaderCount){
-			ok = _mapPage_L(taskMemory->page, taskMemory->physical, (void*)address, PAGE_SIZE,
-				programHeaderToPageAttribute(programHeaderArray + j));
+			const ProgramHeader32 *ph = programHeaderArray + j;
+			const PageAttribute attribute = programHeaderToPageAttribute(ph);
+			uintptr_t fileBegin, fileEnd;
+			getFilePageRange(ph, &fileBegin, &fileEnd);
+			if(address >= fileBegin && address < fileEnd){
+				ok = mapELFImagePage(taskMemory, image, address, attribute);
+			}
+			else{
+				ok = _reservePage_L(taskMemory->page, taskMemory->physical, (void*)address, PAGE_SIZE, attribute);
+			}
 			if(ok)
 				continue;
 		}
@@ -145,54 +395,15 @@ static int mapAllocateProgramHeader32(
 	return ok;
 }
 
-static int setAllocateProgramHeader32(
-	uintptr_t file, const ProgramHeader32 *programHeaderArray, int programHeaderCount
-){
-	int i;
-	for(i = 0; i < programHeaderCount; i++){
-		const ProgramHeader32 *ph = programHeaderArray + i;
-		if(ph->segmentType != 1)
-			continue;
-		uintptr_t readCount = ph->fileSize;
-		if(syncSeekReadFile(file, (void*)ph->memoryAddress, ph->offset, &readCount) == IO_REQUEST_FAILURE)
-			break;
-		if(readCount != ph->fileSize)
-			break;
-		memset((void*)(ph->memoryAddress + ph->fileSize), 0, ph->memorySize - ph->fileSize);
-	}
-	return i >= programHeaderCount;
-}
-
-static int loadProgramHeader32(uintptr_t file, uintptr_t programHeaderOffset, int programHeaderLength){
-	int ok = 0;
-	const size_t programHeaderSize = programHeaderLength * sizeof(ProgramHeader32);
-	ProgramHeader32 *programHeader32 = allocateKernelMemory(programHeaderSize);
-	EXPECT(programHeader32 != NULL);
-	uintptr_t readCount = programHeaderSize;
-	uintptr_t request = syncSeekReadFile(file, programHeader32, programHeaderOffset, &readCount);
-	EXPECT(request != IO_REQUEST_FAILURE && readCount == programHeaderSize);
-	uintptr_t programBegin;
-	uintptr_t programEnd;
-	ok = checkAllocateProgramHeader32(
-		programHeader32, programHeaderLength, &programBegin, &programEnd);
-	// check address overflow
-	EXPECT(ok);
-	ok = initUserLinearBlockManager(programBegin, programEnd);
+static int loadProgramHeader32(const ELFImage *image){
+	int ok = initUserLinearBlockManager(image->programBegin, image->programEnd);
 	EXPECT(ok);
 	// TaskMemoryManager
-	ok = mapAllocateProgramHeader32(programHeader32, programHeaderLength, programBegin, programEnd);
-	EXPECT(ok);
-	// fill in memory
-	ok = setAllocateProgramHeader32(file, programHeader32, programHeaderLength);
+	ok = mapELFImage(image);
 	EXPECT(ok);
 	// ok = 1;
 	ON_ERROR;
 	ON_ERROR;
-	ON_ERROR;
-	ON_ERROR;
-	ON_ERROR;
-	DELETE(programHeader32);
-	ON_ERROR;
 	return ok;
 }
 
@@ -213,14 +424,16 @@ static void elfLoader(void *arg){
 	request = syncSeekReadFile(file, &elfHeader32, 0, &readCount);
 	EXPECT(request != IO_REQUEST_FAILURE && readCount == sizeof(elfHeader32) &&
 		checkELFHeader32(&elfHeader32));
-
 	// ProgramHeader32
-	int ok = loadProgramHeader32(file, elfHeader32.programHeaderOffset, elfHeader32.programHeaderLength);
-	EXPECT(ok);
-	ok = syncCloseFile(file);
+	ELFImage *image = acquireELFImage(file, p->fileName, p->nameLength, &elfHeader32);
+	EXPECT(image != NULL);
+	int ok = syncCloseFile(file);
 	if(!ok)
 		printk("warnging: cannot close ELF file\n");
 	file = IO_REQUEST_FAILURE;
+	ok = loadProgramHeader32(image);
+	releaseELFImage(image);
+	EXPECT(ok);
 	//printk("elf ok\n\n");
 	//((void(*)(void))elfHeader32.entry)();
 	ok = switchToUserMode(elfHeader32.entry, DEFAULT_USER_STACK_SIZE);
@@ -229,6 +442,7 @@ static void elfLoader(void *arg){
 	ON_ERROR;
 	ON_ERROR;
 	ON_ERROR;
+	ON_ERROR;
 	if(file != IO_REQUEST_FAILURE){
 		syncCloseFile(file);
 	}
@@ -248,3 +462,47 @@ Task *createUserTaskFromELF(const char *fileName, uintptr_t nameLength, int prio
 	releaseKernelMemory(p);
 	return t;
 }
+
+#ifndef NDEBUG
+#include"io/ioservice.h"
+
+// the second acquire only reads the headers and returns the cached image
+void testELFImage(void){
+	const char *fileName = "fat:C/ECHO1.ELF";
+	uintptr_t file = IO_REQUEST_FAILURE, r;
+	OpenFileMode m = OPEN_FILE_MODE_0;
+	m.writable = 1;
+	int a;
+	for(a = 3; a > 0 && file == IO_REQUEST_FAILURE; a--){
+		sleep(1000);
+		file = syncOpenFileN(fileName, strlen(fileName), m);
+	}
+	assert(file != IO_REQUEST_FAILURE);
+	ELFHeader32 elfHeader32;
+	uintptr_t readCount = sizeof(elfHeader32);
+	r = syncSeekReadFile(file, &elfHeader32, 0, &readCount);
+	assert(r == file && readCount == sizeof(elfHeader32) && checkELFHeader32(&elfHeader32));
+	const uint64_t t0 = getClockNanosecond();
+	ELFImage *image1 = acquireELFImage(file, fileName, strlen(fileName), &elfHeader32);
+	const uint64_t t1 = getClockNanosecond();
+	ELFImage *image2 = acquireELFImage(file, fileName, strlen(fileName), &elfHeader32);
+	const uint64_t t2 = getClockNanosecond();
+	assert(image1 != NULL && image1 == image2);
+	printk("elf image: %u pages, first load %u us, cached load %u us\n",
+		(image1->contentEnd - image1->contentBegin) / PAGE_SIZE,
+		(uint32_t)((t1 - t0) / 1000), (uint32_t)((t2 - t1) / 1000));
+	// rewriting the file with the same content still invalidates the cached image
+	uintptr_t writeCount = sizeof(elfHeader32);
+	r = syncSeekWriteFile(file, &elfHeader32, 0, &writeCount);
+	assert(r == file && writeCount == sizeof(elfHeader32));
+	ELFImage *image3 = acquireELFImage(file, fileName, strlen(fileName), &elfHeader32);
+	assert(image3 != NULL && image3 != image1);
+	releaseELFImage(image3);
+	releaseELFImage(image2);
+	releaseELFImage(image1);
+	r = syncCloseFile(file);
+	assert(r == file);
+	printk("test elf image ok\n");
+	systemCall_terminate();
+}
+#endif
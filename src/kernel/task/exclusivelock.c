@@ -11,23 +11,29 @@ typedef struct ExclusiveLock{
 	void *instance;
 	Spinlock lock;
 	void (*pushLockQueue)(void *, Task*);
+	// instance or the argument of _acquireExLock
+	void *pushLockArgument;
 }ExclusiveLock;
 
 static void initExclusiveLock(struct ExclusiveLock *exLock, void *instance){
 	exLock->instance = instance;
 	exLock->lock = initialSpinlock;
 	exLock->pushLockQueue = NULL;
+	exLock->pushLockArgument = NULL;
 }
 
 static void afterExLock(Task *t, uintptr_t exLockPtr){
 	ExclusiveLock *exLock = (ExclusiveLock*)exLockPtr;
 	assert(exLock->pushLockQueue != NULL);
-	exLock->pushLockQueue(exLock->instance, t);
+	exLock->pushLockQueue(exLock->pushLockArgument, t);
 	exLock->pushLockQueue = NULL;
+	exLock->pushLockArgument = NULL;
 	releaseLock(&exLock->lock);
 }
 
-static int acquireExLock(ExclusiveLock *e, int (*acquire)(void*), void (*pushLockQueue)(void*, Task *), int doBlock){
+// arg is passed to acquire and pushLockQueue instead of e->instance
+static int _acquireExLock(ExclusiveLock *e, void *arg,
+	int (*acquire)(void*), void (*pushLockQueue)(void*, Task *), int doBlock){
 	// cannot block when interrupt is off
 	assert(getEFlags().bit.interrupt != 0);
 	int interruptEnabled = getEFlags().bit.interrupt;
@@ -38,7 +44,7 @@ static int acquireExLock(ExclusiveLock *e, int (*acquire)(void*), void (*pushLoc
 	acquireLock(&e->lock);
 	assert(e->pushLockQueue == NULL);
 	int acquired;
-	if(acquire(e->instance)){
+	if(acquire(arg)){
 		releaseLock(&e->lock);
 		acquired = 1;
 	}
@@ -48,6 +54,7 @@ static int acquireExLock(ExclusiveLock *e, int (*acquire)(void*), void (*pushLoc
 	}
 	else{
 		e->pushLockQueue = pushLockQueue;
+		e->pushLockArgument = arg;
 		taskSwitch(afterExLock, (uintptr_t)e);
 		acquired = 1;
 	}
@@ -57,18 +64,30 @@ static int acquireExLock(ExclusiveLock *e, int (*acquire)(void*), void (*pushLoc
 	return acquired;
 }
 
-static void releaseExLock(ExclusiveLock *e, void (*release)(void*, TaskQueue*)){
+static int acquireExLock(ExclusiveLock *e, int (*acquire)(void*), void (*pushLockQueue)(void*, Task *), int doBlock){
+	return _acquireExLock(e, e->instance, acquire, pushLockQueue, doBlock);
+}
+
+// return number of resumed tasks
+static int _releaseExLock(ExclusiveLock *e, void *arg, void (*release)(void*, TaskQueue*)){
 	TaskQueue q = INITIAL_TASK_QUEUE;
 	acquireLock(&e->lock);
-	release(e->instance, &q);
+	release(arg, &q);
 	releaseLock(&e->lock);
+	int resumeCount = 0;
 	while(1){
 		Task *t = popQueue(&q);
 		if(t == NULL){
 			break;
 		}
 		resume(t);
+		resumeCount++;
 	}
+	return resumeCount;
+}
+
+static void releaseExLock(ExclusiveLock *e, void (*release)(void*, TaskQueue*)){
+	_releaseExLock(e, e->instance, release);
 }
 
 // Semaphore
@@ -247,6 +266,143 @@ void releaseReaderWriterLock(ReaderWriterLock *rwl){
 	releaseExLock(&rwl->exLock, _releaseReaderWriterLock);
 }
 
+// wait on address
+
+// the linear address does not change when a copy-on-write page is copied, but the physical address does
+typedef struct{
+	LinearMemoryManager *memory;
+	uintptr_t address;
+}AddressWaitKey;
+
+typedef struct AddressWaiter{
+	AddressWaitKey key;
+	Task *task;
+	struct AddressWaiter **prev, *next;
+}AddressWaiter;
+
+typedef struct{
+	AddressWaiter *waiterList;
+	ExclusiveLock exLock;
+}AddressWaitBucket;
+
+#define ADDRESS_WAIT_BUCKET_COUNT (64)
+static AddressWaitBucket addressWaitBucket[ADDRESS_WAIT_BUCKET_COUNT];
+
+static AddressWaitKey getAddressWaitKey(uintptr_t address){
+	// kernel linear memory is shared by all tasks
+	AddressWaitKey key = {
+		(isKernelLinearAddress(address)? kernelLinear: getTaskLinearMemory(processorLocalTask())),
+		address
+	};
+	return key;
+}
+
+static int isAddressWaitKeyEqual(AddressWaitKey k1, AddressWaitKey k2){
+	return k1.memory == k2.memory && k1.address == k2.address;
+}
+
+static AddressWaitBucket *getAddressWaitBucket(AddressWaitKey key){
+	const uintptr_t v = key.address ^ (((uintptr_t)key.memory) >> 4);
+	return addressWaitBucket + ((v >> 2) ^ (v >> 12)) % ADDRESS_WAIT_BUCKET_COUNT;
+}
+
+typedef struct{
+	AddressWaitBucket *bucket;
+	volatile const uint32_t *value;
+	uint32_t expectedValue;
+	AddressWaiter waiter;
+}WaitAddressArgument;
+
+static int _checkAddressValue(void *inst){
+	WaitAddressArgument *a = inst;
+	// do not block if changed
+	return *(a->value) != a->expectedValue;
+}
+
+static void _pushAddressWaiter(void *inst, Task *t){
+	WaitAddressArgument *a = inst;
+	a->waiter.task = t;
+	ADD_TO_DQUEUE(&a->waiter, &a->bucket->waiterList);
+}
+
+typedef struct{
+	AddressWaitKey key;
+	uint32_t wakeCount;
+}WakeAddressArgument;
+
+static void _wakeAddressWaiter(void *inst, TaskQueue *q){
+	WakeAddressArgument *a = inst;
+	AddressWaiter **prev = &getAddressWaitBucket(a->key)->waiterList;
+	while(*prev != NULL && a->wakeCount > 0){
+		AddressWaiter *w = *prev;
+		if(isAddressWaitKeyEqual(w->key, a->key) == 0){
+			prev = &w->next;
+			continue;
+		}
+		REMOVE_FROM_DQUEUE(w);
+		pushQueue(q, w->task);
+		a->wakeCount--;
+	}
+}
+
+// return 1 if woken up; return 0 if *address != expectedValue or address is invalid
+static int waitAddress(uintptr_t address, uint32_t expectedValue){
+	LinearMemoryManager *lm = getTaskLinearMemory(processorLocalTask());
+	EXPECT(address % sizeof(uint32_t) == 0);
+	// the value is read through address with interrupt disabled, so keep the page present until checked
+	PhysicalAddress reservedPage = checkAndReservePage(lm, (void*)FLOOR(address, PAGE_SIZE), 0);
+	EXPECT(reservedPage.value != INVALID_PAGE_ADDRESS);
+	WaitAddressArgument a;
+	a.waiter.key = getAddressWaitKey(address);
+	a.waiter.task = NULL;
+	a.waiter.prev = NULL;
+	a.waiter.next = NULL;
+	a.bucket = getAddressWaitBucket(a.waiter.key);
+	a.value = (volatile const uint32_t*)address;
+	a.expectedValue = expectedValue;
+	_acquireExLock(&a.bucket->exLock, &a, _checkAddressValue, _pushAddressWaiter, 1);
+	// see _pushAddressWaiter
+	const int blocked = (a.waiter.task != NULL);
+	releaseReservedPage(lm, reservedPage);
+	return blocked;
+	ON_ERROR;
+	ON_ERROR;
+	return 0;
+}
+
+// return number of woken tasks
+static int wakeAddress(uintptr_t address, uint32_t wakeCount){
+	EXPECT(address % sizeof(uint32_t) == 0 && wakeCount > 0);
+	WakeAddressArgument a;
+	a.key = getAddressWaitKey(address);
+	a.wakeCount = wakeCount;
+	return _releaseExLock(&getAddressWaitBucket(a.key)->exLock, &a, _wakeAddressWaiter);
+	ON_ERROR;
+	return 0;
+}
+
+static void waitAddressHandler(InterruptParam *p){
+	sti();
+	SYSTEM_CALL_RETURN_VALUE_0(p) = waitAddress(SYSTEM_CALL_ARGUMENT_0(p), SYSTEM_CALL_ARGUMENT_1(p));
+}
+
+static void wakeAddressHandler(InterruptParam *p){
+	sti();
+	SYSTEM_CALL_RETURN_VALUE_0(p) = wakeAddress(SYSTEM_CALL_ARGUMENT_0(p), SYSTEM_CALL_ARGUMENT_1(p));
+}
+
+void initWaitAddress(SystemCallTable *s){
+	int i;
+	for(i = 0; i < ADDRESS_WAIT_BUCKET_COUNT; i++){
+		addressWaitBucket[i].waiterList = NULL;
+		initExclusiveLock(&addressWaitBucket[i].exLock, addressWaitBucket + i);
+	}
+	registerSystemCall(s, SYSCALL_WAIT_ADDRESS, waitAddressHandler, 0);
+	registerSystemCall(s, SYSCALL_WAKE_ADDRESS, wakeAddressHandler, 0);
+}
+
+#undef ADDRESS_WAIT_BUCKET_COUNT
+
 #ifndef NDEBUG
 #include"io.h"
 
@@ -315,4 +471,61 @@ void testRWLock(void){
 	printk("test rwlock ok\n");
 	systemCall_terminate();
 }
+#include"sync.h"
+
+#define TEST_TASK_COUNT (4)
+#define TEST_LOOP_COUNT (100000)
+
+typedef struct{
+	Mutex mutex;
+	ConditionVariable allDone;
+	uint32_t value;
+	int doneCount;
+}UserMutexTest;
+
+static void testUserMutex_increase(void *arg){
+	UserMutexTest *t = *(UserMutexTest**)arg;
+	int i;
+	for(i = 0; i < TEST_LOOP_COUNT; i++){
+		acquireMutex(&t->mutex);
+		t->value++;
+		releaseMutex(&t->mutex);
+	}
+	acquireMutex(&t->mutex);
+	t->doneCount++;
+	signalConditionVariable(&t->allDone);
+	releaseMutex(&t->mutex);
+	systemCall_terminate();
+}
+
+void testUserMutex(void){
+	UserMutexTest *NEW(t);
+	assert(t != NULL);
+	initMutex(&t->mutex);
+	initConditionVariable(&t->allDone);
+	t->value = 0;
+	t->doneCount = 0;
+	// not blocked if the value is changed
+	assert(systemCall_waitAddress(&t->mutex.state, 1) == 0);
+	assert(systemCall_wakeAddress(&t->mutex.state, 1) == 0);
+	int i;
+	for(i = 0; i < TEST_TASK_COUNT; i++){
+		Task *task = createSharedMemoryTask(testUserMutex_increase, &t, sizeof(t), processorLocalTask());
+		assert(task != NULL);
+		resume(task);
+	}
+	acquireMutex(&t->mutex);
+	while(t->doneCount < TEST_TASK_COUNT){
+		waitConditionVariable(&t->allDone, &t->mutex);
+	}
+	releaseMutex(&t->mutex);
+	assert(t->value == TEST_TASK_COUNT * TEST_LOOP_COUNT);
+	printk("test user mutex ok\n");
+	DELETE(t);
+	systemCall_terminate();
+}
+
+#undef TEST_LOOP_COUNT
+#undef TEST_TASK_COUNT
 #endif
+
@@ -26,3 +26,41 @@ void deleteReaderWriterLock(ReaderWriterLock *rwl);
 void acquireReaderLock(ReaderWriterLock *rwl);
 void acquireWriterLock(ReaderWriterLock *rwl);
 void releaseReaderWriterLock(ReaderWriterLock *rwl);
+
+// rcu.c
+// read-copy-update for read-mostly lists
+// readers take no lock but must not block; a task switch means that the processor left all read sections
+// writers serialize themselves with a lock and call synchronizeRCU before freeing removed elements
+int beginRCURead(void);
+void endRCURead(int interruptFlag);
+// return after all read sections that began before the call have ended
+void synchronizeRCU(void);
+void testRCU(void);
+
+#define RCU_BARRIER() __asm__ volatile("":::"memory")
+// initialize E before publishing it
+#define RCU_ADD_TO_DQUEUE(E, P) do{\
+	(E)->prev = (P);\
+	(E)->next = *(P);\
+	if((E)->next != NULL){\
+		(E)->next->prev = &((E)->next);\
+	}\
+	RCU_BARRIER();\
+	*((E)->prev) = (E);\
+}while(0)
+// readers may still follow E->next until synchronizeRCU returns
+#define RCU_REMOVE_FROM_DQUEUE(E) do{\
+	*((E)->prev) = (E)->next;\
+	if((E)->next != NULL){\
+		(E)->next->prev = (E)->prev; \
+	}\
+	(E)->prev = NULL;\
+}while(0)
+#define RCU_READ(V) (*(volatile __typeof__(V)*)&(V))
+
+// SYSCALL_WAIT_ADDRESS and SYSCALL_WAKE_ADDRESS
+// waiting tasks are keyed by linear memory manager and linear address, so copy-on-write does not change the key
+// the address cannot be in user memory shared by different linear memory managers
+typedef struct SystemCallTable SystemCallTable;
+void initWaitAddress(SystemCallTable *s);
+void testUserMutex(void);
@@ -0,0 +1,321 @@
+#include"task.h"
+#include"exclusivelock.h"
+#include"common.h"
+#include"kernel.h"
+#include"io/ioservice.h"
+#include"memory/memory.h"
+#include"memory/memory_private.h"
+#include"multiprocessor/spinlock.h"
+#include"multiprocessor/processorlocal.h"
+
+struct IORing{
+	Spinlock lock;
+	// released for every posted completion
+	Semaphore *completionCount;
+	// submitted and not posted
+	uint32_t pendingCount;
+	// kernel copy of page->completionTail
+	uint32_t completionTail;
+	// completed and not accepted, linked by IORequest.next
+	IORequest *completedHead, **completedTail;
+	IORingPage *page;
+	IORingPage *userPage;
+};
+
+static_assert(sizeof(IORingPage) <= PAGE_SIZE);
+
+static void postCompletion(IORing *r, uintptr_t userData, const uintptr_t *returnValues, int returnCount){
+	assert(returnCount <= SYSTEM_CALL_MAX_RETURN_COUNT);
+	acquireLock(&r->lock);
+	volatile IORingCompletion *c = r->page->completion + r->completionTail % IO_RING_ENTRY_COUNT;
+	c->userData = userData;
+	int i;
+	for(i = 0; i < SYSTEM_CALL_MAX_RETURN_COUNT; i++){
+		c->returnValues[i] = (i < returnCount? returnValues[i]: 0);
+	}
+	r->completionTail++;
+	r->page->completionTail = r->completionTail;
+	assert(r->pendingCount > 0);
+	r->pendingCount--;
+	releaseLock(&r->lock);
+}
+
+// called by the task owning r
+static void acceptIORingRequest(IORequest *ior){
+	IORing *r = ior->ring;
+	const uintptr_t userData = ior->ringUserData;
+	uintptr_t rv[SYSTEM_CALL_MAX_RETURN_COUNT];
+	rv[0] = (uintptr_t)ior;
+	// ior is deleted in accept
+	int returnCount = ior->accept(ior->instance, rv + 1);
+	postCompletion(r, userData, rv, returnCount + 1);
+}
+
+// completeIO may run in interrupt handlers, where accept cannot release memory
+// so the request is queued and accepted in acceptIORingRequests
+void postIORingCompletion(IORequest *ior){
+	IORing *r = ior->ring;
+	acquireLock(&r->lock);
+	ior->next = NULL;
+	*r->completedTail = ior;
+	r->completedTail = &ior->next;
+	// deleteIORing may run after releaseLock
+	releaseSemaphore(r->completionCount);
+	releaseLock(&r->lock);
+}
+
+static void acceptIORingRequests(IORing *r){
+	while(1){
+		acquireLock(&r->lock);
+		IORequest *ior = r->completedHead;
+		if(ior != NULL){
+			r->completedHead = ior->next;
+			if(r->completedHead == NULL){
+				r->completedTail = &r->completedHead;
+			}
+			ior->next = NULL;
+		}
+		releaseLock(&r->lock);
+		if(ior == NULL){
+			break;
+		}
+		acceptIORingRequest(ior);
+	}
+}
+
+void cancelIORingRequest(IORing *r){
+	acquireLock(&r->lock);
+	assert(r->pendingCount > 0);
+	r->pendingCount--;
+	releaseLock(&r->lock);
+}
+
+void waitIORingCompletion(IORing *r){
+	acquireSemaphore(r->completionCount);
+}
+
+// assume this is the only function acquiring completionCount other than deleteIORing
+static void waitIORing(IORing *r, uintptr_t waitCount){
+	int v = getSemaphoreValue(r->completionCount);
+	while(v > 0){
+		acquireSemaphore(r->completionCount);
+		v--;
+	}
+	while(1){
+		acceptIORingRequests(r);
+		acquireLock(&r->lock);
+		const uintptr_t readyCount = r->completionTail - r->page->completionHead;
+		const int done = (readyCount >= waitCount || r->pendingCount == 0);
+		releaseLock(&r->lock);
+		if(done){
+			break;
+		}
+		acquireSemaphore(r->completionCount);
+	}
+}
+
+// the requests are accepted by the submitting task. see postIORingCompletion
+static int isIORingSystemCall(const IORingSubmission *s){
+	switch(s->systemCall){
+	case SYSCALL_READ_FILE:
+	case SYSCALL_WRITE_FILE:
+	case SYSCALL_SEEK_READ_FILE:
+	case SYSCALL_SEEK_WRITE_FILE:
+	case SYSCALL_GET_FILE_PARAMETER:
+	case SYSCALL_SET_FILE_PARAMETER:
+		return 1;
+	case SYSCALL_SET_ALARM:
+		// periodic events are accepted repeatedly
+		return s->argument[2] == 0;
+	default:
+		return 0;
+	}
+}
+
+static void submitIORingRequest(IORing *r, SystemCallTable *systemCallTable, const IORingSubmission *s){
+	acquireLock(&r->lock);
+	r->pendingCount++;
+	releaseLock(&r->lock);
+	IORequest *ior = (IORequest*)IO_REQUEST_FAILURE;
+	if(isIORingSystemCall(s)){
+		InterruptParam p;
+		MEMSET0(&p);
+		SYSTEM_CALL_NUMBER(&p) = s->systemCall;
+		SYSTEM_CALL_ARGUMENT_0(&p) = s->argument[0];
+		SYSTEM_CALL_ARGUMENT_1(&p) = s->argument[1];
+		SYSTEM_CALL_ARGUMENT_2(&p) = s->argument[2];
+		SYSTEM_CALL_ARGUMENT_3(&p) = s->argument[3];
+		SYSTEM_CALL_ARGUMENT_4(&p) = s->argument[4];
+		if(invokeSystemCall(systemCallTable, &p)){
+			ior = (IORequest*)SYSTEM_CALL_RETURN_VALUE_0(&p);
+		}
+	}
+	if((uintptr_t)ior == IO_REQUEST_FAILURE){
+		const uintptr_t rv = IO_REQUEST_FAILURE;
+		postCompletion(r, s->userData, &rv, 1);
+		return;
+	}
+	if(attachIORing(ior, r, s->userData) == 0){
+		acceptIORingRequest(ior);
+	}
+}
+
+// return number of submitted requests
+static uintptr_t submitIORing(IORing *r, SystemCallTable *systemCallTable){
+	IORingPage *page = r->page;
+	uintptr_t submitCount = 0;
+	while(page->submissionHead != page->submissionTail){
+		// reserve a completion entry for each request
+		acquireLock(&r->lock);
+		const uint32_t usedCount = (r->completionTail - page->completionHead) + r->pendingCount;
+		releaseLock(&r->lock);
+		if(usedCount >= IO_RING_ENTRY_COUNT){
+			break;
+		}
+		const uint32_t head = page->submissionHead;
+		IORingSubmission s = page->submission[head % IO_RING_ENTRY_COUNT];
+		page->submissionHead = head + 1;
+		submitIORingRequest(r, systemCallTable, &s);
+		submitCount++;
+	}
+	return submitCount;
+}
+
+static int isKernelTask(Task *t){
+	return getTaskLinearMemory(t)->page == kernelLinear->page;
+}
+
+static IORing *createIORing(Task *t){
+	IORing *NEW(r);
+	EXPECT(r != NULL);
+	r->completionCount = createSemaphore(0);
+	EXPECT(r->completionCount != NULL);
+	r->page = allocateZeroedKernelPages(PAGE_SIZE, KERNEL_PAGE);
+	EXPECT(r->page != NULL);
+	if(isKernelTask(t)){
+		r->userPage = r->page;
+	}
+	else{
+		r->userPage = checkAndMapExistingPages(getTaskLinearMemory(t), kernelLinear,
+			(uintptr_t)r->page, PAGE_SIZE, (PageAttribute)(USER_WRITABLE_PAGE | NOT_CLONED_PAGE_FLAG), 0);
+	}
+	EXPECT(r->userPage != NULL);
+	r->lock = initialSpinlock;
+	r->pendingCount = 0;
+	r->completionTail = 0;
+	r->completedHead = NULL;
+	r->completedTail = &r->completedHead;
+	return r;
+	ON_ERROR;
+	checkAndReleaseKernelPages(r->page);
+	ON_ERROR;
+	deleteSemaphore(r->completionCount);
+	ON_ERROR;
+	DELETE(r);
+	ON_ERROR;
+	return NULL;
+}
+
+void deleteIORing(IORing *r){
+	while(1){
+		acceptIORingRequests(r);
+		acquireLock(&r->lock);
+		const uint32_t pendingCount = r->pendingCount;
+		releaseLock(&r->lock);
+		if(pendingCount == 0){
+			break;
+		}
+		acquireSemaphore(r->completionCount);
+	}
+	if(r->userPage != r->page){
+		if(checkAndUnmapPages(getTaskLinearMemory(processorLocalTask()), r->userPage) == 0){
+			// the user program released the rings?
+			printk("warning: fail to unmap IORing %x\n", r->userPage);
+		}
+	}
+	checkAndReleaseKernelPages(r->page);
+	deleteSemaphore(r->completionCount);
+	DELETE(r);
+}
+
+static void setupIORingHandler(InterruptParam *p){
+	sti();
+	Task *t = processorLocalTask();
+	IORing *r = getIORing(t);
+	if(r == NULL){
+		r = createIORing(t);
+		if(r != NULL){
+			setIORing(t, r);
+		}
+	}
+	SYSTEM_CALL_RETURN_VALUE_0(p) = (r == NULL? (uintptr_t)NULL: (uintptr_t)r->userPage);
+}
+
+static void enterIORingHandler(InterruptParam *p){
+	sti();
+	SystemCallTable *systemCallTable = (SystemCallTable*)p->argument;
+	const uintptr_t waitCount = SYSTEM_CALL_ARGUMENT_0(p);
+	IORing *r = getIORing(processorLocalTask());
+	if(r == NULL){
+		SYSTEM_CALL_RETURN_VALUE_0(p) = 0;
+		return;
+	}
+	const uintptr_t submitCount = submitIORing(r, systemCallTable);
+	if(waitCount > 0){
+		waitIORing(r, waitCount);
+	}
+	else{
+		acceptIORingRequests(r);
+	}
+	SYSTEM_CALL_RETURN_VALUE_0(p) = submitCount;
+}
+
+void initIORing(SystemCallTable *s){
+	registerSystemCall(s, SYSCALL_SETUP_IO_RING, setupIORingHandler, 0);
+	registerSystemCall(s, SYSCALL_ENTER_IO_RING, enterIORingHandler, (uintptr_t)s);
+}
+
+#ifndef NDEBUG
+
+#define TEST_ALARM_COUNT (48)
+
+void testIORing(void){
+	IORingPage *r = systemCall_setupIORing();
+	assert(r != NULL && r == systemCall_setupIORing());
+	int i;
+	for(i = 0; i < TEST_ALARM_COUNT; i++){
+		int ok = ioRingSetAlarm(r, i, (i % 8) * 20);
+		assert(ok);
+	}
+	// invalid file handle
+	int ok = ioRingReadFile(r, TEST_ALARM_COUNT, 0, NULL, 0);
+	assert(ok);
+	uintptr_t submitCount = systemCall_enterIORing(0);
+	assert(submitCount == TEST_ALARM_COUNT + 1);
+	int reapCount = 0, enterCount = 1;
+	uint64_t reapedMask = 0;
+	while(reapCount < TEST_ALARM_COUNT + 1){
+		IORingCompletion c;
+		if(reapIORing(r, &c) == 0){
+			systemCall_enterIORing(1);
+			enterCount++;
+			continue;
+		}
+		reapCount++;
+		assert(c.userData <= TEST_ALARM_COUNT);
+		assert((reapedMask & (((uint64_t)1) << c.userData)) == 0);
+		reapedMask |= (((uint64_t)1) << c.userData);
+		assert((c.returnValues[0] == IO_REQUEST_FAILURE) == (c.userData == TEST_ALARM_COUNT));
+	}
+	printk("IORing test: %d completions in %d system calls\n", reapCount, enterCount);
+	// cancelled by terminateCurrentTask
+	ok = ioRingSetAlarm(r, 0, 100000);
+	assert(ok);
+	submitCount = systemCall_enterIORing(0);
+	assert(submitCount == 1);
+	systemCall_terminate();
+}
+
+#undef TEST_ALARM_COUNT
+
+#endif
@@ -0,0 +1,126 @@
+#include"task.h"
+#include"exclusivelock.h"
+#include"common.h"
+#include"kernel.h"
+#include"memory/memory.h"
+#include"io.h"
+#include"assembly/assembly.h"
+
+// readers disable interrupts, so a processor cannot switch task inside a read section
+
+int beginRCURead(void){
+	const int interruptFlag = getEFlags().bit.interrupt;
+	cli();
+	return interruptFlag;
+}
+
+void endRCURead(int interruptFlag){
+	RCU_BARRIER();
+	if(interruptFlag){
+		sti();
+	}
+}
+
+void synchronizeRCU(void){
+	uint32_t switchCount[MAX_PROCESSOR_COUNT];
+	const uint32_t processorCount = getProcessorCount();
+	uint32_t i;
+	RCU_BARRIER();
+	for(i = 0; i < processorCount; i++){
+		switchCount[i] = getTaskSwitchCount(i);
+	}
+	for(i = 0; i < processorCount; i++){
+		while(isQuiescentSince(i, switchCount[i]) == 0){
+			sleep(1);
+		}
+	}
+}
+
+#ifndef NDEBUG
+
+#include"multiprocessor/processorlocal.h"
+
+#define TEST_READER_COUNT (4)
+#define TEST_UPDATE_COUNT (100)
+
+typedef struct TestRCUElement{
+	volatile int value;
+	struct TestRCUElement **prev, *next;
+}TestRCUElement;
+
+typedef struct{
+	Spinlock writerLock;
+	TestRCUElement *head;
+	volatile int stop;
+	Semaphore *done;
+}TestRCUList;
+
+static void testRCUReader(void *arg){
+	TestRCUList *l = *(TestRCUList**)arg;
+	uint32_t readCount = 0;
+	while(l->stop == 0){
+		int interruptFlag = beginRCURead();
+		TestRCUElement *e;
+		for(e = RCU_READ(l->head); e != NULL; e = RCU_READ(e->next)){
+			// deleted elements are set to -1
+			assert(e->value >= 0);
+		}
+		endRCURead(interruptFlag);
+		readCount++;
+	}
+	printk("RCU reader: %u reads\n", readCount);
+	releaseSemaphore(l->done);
+	systemCall_terminate();
+}
+
+// readers walk the list while the writer replaces its elements
+void testRCU(void){
+	TestRCUList *NEW(l);
+	assert(l != NULL);
+	l->writerLock = initialSpinlock;
+	l->head = NULL;
+	l->stop = 0;
+	l->done = createSemaphore(0);
+	assert(l->done != NULL);
+	int i;
+	for(i = 0; i < TEST_READER_COUNT; i++){
+		Task *t = createSharedMemoryTask(testRCUReader, &l, sizeof(l), processorLocalTask());
+		assert(t != NULL);
+		resume(t);
+	}
+	for(i = 0; i < TEST_UPDATE_COUNT; i++){
+		TestRCUElement *NEW(e);
+		assert(e != NULL);
+		e->value = i;
+		acquireLock(&l->writerLock);
+		RCU_ADD_TO_DQUEUE(e, &l->head);
+		TestRCUElement *old = (e->next != NULL && i % 2 == 0? e->next: NULL);
+		if(old != NULL){
+			RCU_REMOVE_FROM_DQUEUE(old);
+		}
+		releaseLock(&l->writerLock);
+		if(old != NULL){
+			synchronizeRCU();
+			old->value = -1;
+			DELETE(old);
+		}
+	}
+	l->stop = 1;
+	for(i = 0; i < TEST_READER_COUNT; i++){
+		acquireSemaphore(l->done);
+	}
+	while(l->head != NULL){
+		TestRCUElement *e = l->head;
+		REMOVE_FROM_DQUEUE(e);
+		DELETE(e);
+	}
+	deleteSemaphore(l->done);
+	DELETE(l);
+	printk("test RCU ok\n");
+	systemCall_terminate();
+}
+
+#undef TEST_UPDATE_COUNT
+#undef TEST_READER_COUNT
+
+#endif
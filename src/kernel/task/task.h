@@ -16,8 +16,42 @@ void schedule(void);
 Task *currentTask(TaskManager *tm);
 LinearMemoryManager *getTaskLinearMemory(Task *t);
 OpenFileManager *getOpenFileManager(Task *t);
+typedef struct IORing IORing;
+IORing *getIORing(Task *t);
+void setIORing(Task *t, IORing *r);
+
+// priority 0 and 1 always run before the others in FIFO order, usually for interrupt bottom halves
+// tasks of FAIR_SHARE_PRIORITY share the processor time in proportion to their weights
+// priority 3 runs only if no other task is ready
+#define FAIR_SHARE_PRIORITY (2)
+#define DEFAULT_TASK_WEIGHT (1024)
+#define MIN_TASK_WEIGHT (16)
+#define MAX_TASK_WEIGHT (65536)
+// return 0 if the weight is out of range
+int setTaskWeight(Task *t, uint32_t weight);
+// bit i of affinity allows the task to run on the (i+1)th processor initialized
+// return 0 if the affinity allows no processor
+// a running task moves to an allowed processor at the next timer interrupt
+#define MAX_PROCESSOR_COUNT (32)
+#define ANY_PROCESSOR_AFFINITY ((uint32_t)0xffffffff)
+int setTaskAffinity(Task *t, uint32_t affinity);
+uint32_t getTaskAffinity(Task *t);
+// see synchronizeRCU
+uint32_t getProcessorCount(void);
+// assume interrupt disabled
+// return -1 if the task manager of this processor is not created
+int getProcessorIndex(void);
+uint32_t getTaskSwitchCount(uint32_t processorIndex);
+// whether the processor has switched task since getTaskSwitchCount, or is running its idle task
+int isQuiescentSince(uint32_t processorIndex, uint32_t switchCount);
+void testTaskAffinity(void);
+// nanoseconds. the running time slice is included only for the current task
+uint64_t getTaskProcessorTime(Task *t);
+void testFairScheduler(void);
 
 void resume(/*TaskManager *tm, */Task *t);
+// whether any task other than idle tasks is waiting for processor
+int hasReadyTask(void);
 
 TaskManager *createTaskManager(SegmentTable *gdt);
 void initTaskManagement(SystemCallTable *systemCallTable);
@@ -37,6 +71,7 @@ Task *createTaskWithoutLoader(void (*eip0)(void), int priority);
 // create new page table and preallocated linear memory
 // elfloader.c
 Task *createUserTaskFromELF(const char *fileName, uintptr_t nameLength, int priority);
+void testELFImage(void);
 // apply a custom loader to a task
 Task *createTaskAndMemorySpace(void (*loader)(void*), void *arg, size_t argSize, int priority);
 // the loader function is responsible to initialize LinearBlockManager
@@ -44,6 +79,22 @@ Task *createTaskAndMemorySpace(void (*loader)(void*), void *arg, size_t argSize,
 int initUserLinearBlockManager(uintptr_t beginAddr, uintptr_t initEndAddr);
 
 Task *createSharedMemoryTask(void (*entry)(void*), void *arg, uintptr_t argSize, Task *sharedMemoryTask);
+
+// workerpool.c
+// persistent tasks sharing memory with sharedMemoryTask run the submitted works in order
+// the tasks are created on demand, up to maxWorkerCount
+typedef struct WorkerPool WorkerPool;
+WorkerPool *createWorkerPool(int maxWorkerCount, Task *sharedMemoryTask);
+typedef struct WorkItem{
+	void (*run)(void*);
+	void *arg;
+	struct WorkItem *next;
+}WorkItem;
+// the WorkItem is usually a member of arg and should be valid until run(arg) begins
+void initWorkItem(WorkItem *w, void (*run)(void*), void *arg);
+// run() should return instead of calling systemCall_terminate
+int submitWork(WorkerPool *p, WorkItem *w);
+void testWorkerPool(void);
 // always succeed and do not return
 void terminateCurrentTask(void);
 
@@ -11,6 +11,7 @@
 #include"interrupt/systemcalltable.h"
 #include"multiprocessor/spinlock.h"
 #include"multiprocessor/processorlocal.h"
+#include"multiprocessor/perfcounter.h"
 #include"io/ioservice.h"
 #include"file/fileservice.h"
 
@@ -76,6 +77,16 @@ typedef struct Task{
 	// scheduling
 	enum TaskState state;
 	int priority;
+	int isIdle;
+	// FAIR_SHARE_PRIORITY only
+	uint32_t weight;
+	uint64_t virtualRuntime;
+	// accounting, in nanoseconds
+	uint64_t processorTime;
+	uint64_t switchInTime;
+	// bit i = processor index i
+	uint32_t affinity;
+	int lastProcessor;
 
 	// system call
 	SystemCallFunction taskDefinedSystemCall;
@@ -85,6 +96,8 @@ typedef struct Task{
 	Spinlock ioListLock;
 	Semaphore *ioSemaphore; // length of completedIOList
 	IORequest *pendingIOList, *completedIOList;
+	// NULL until SYSCALL_SETUP_IO_RING
+	IORing *ioRing;
 
 	struct Task *next, *prev;
 }Task;
@@ -96,17 +109,38 @@ static void setCurrentUserStackBottom(uintptr_t stack){
 }
 
 #define NUMBER_OF_PRIORITIES (4)
+static_assert(FAIR_SHARE_PRIORITY < NUMBER_OF_PRIORITIES);
+// woken tasks are placed slightly before the running ones
+#define WAKEUP_VIRTUAL_RUNTIME_CREDIT (((uint64_t)1000000000) / TIMER_FREQUENCY)
 
 typedef struct TaskPriorityQueue{
 	Spinlock lock;
+	// number of tasks in the queue, excluding idle tasks
+	volatile uint32_t readyCount;
+	// taskQueue[FAIR_SHARE_PRIORITY] is sorted by virtualRuntime
 	TaskQueue taskQueue[NUMBER_OF_PRIORITIES];
+	// the largest virtualRuntime ever popped
+	uint64_t minVirtualRuntime;
+	// the processor is running its idle task
+	volatile int isIdle;
+	// see synchronizeRCU
+	volatile uint32_t switchCount;
 }TaskPriorityQueue;
 
-static TaskPriorityQueue *globalQueue = NULL;
+// each processor has a ready queue, indexed in the order of createTaskManager
+static TaskPriorityQueue *processorQueue[MAX_PROCESSOR_COUNT];
+static volatile uint32_t processorCount = 0;
+static Spinlock processorQueueLock = INITIAL_SPINLOCK;
+
+// pull tasks from busy processors every BALANCE_INTERVAL schedule()
+#define BALANCE_INTERVAL (4)
 
 struct TaskManager{
 	Task *current;
 	SegmentTable *gdt;
+	int processorIndex;
+	TaskPriorityQueue *readyQueue;
+	uint32_t scheduleCount;
 
 	Task *oldTask; // see switchCurrent()
 	void (*afterTaskSwitchFunc)(Task*, uintptr_t);
@@ -149,8 +183,50 @@ Task *popQueue(TaskQueue *q){
 	return t;
 }
 
+static void removeFromQueue(TaskQueue *q, Task *t){
+	if(t->next == t){
+		assert(q->head == t && t->prev == t);
+		q->head = NULL;
+	}
+	else{
+		if(q->head == t){
+			q->head = t->next;
+		}
+		t->next->prev = t->prev;
+		t->prev->next = t->next;
+	}
+	t->next = t->prev = NULL;
+}
+
+// insert before the first task of larger virtualRuntime
+static void pushFairQueue(TaskQueue *q, Task *t){
+	Task *i = q->head;
+	if(i == NULL || i->virtualRuntime > t->virtualRuntime){
+		pushQueue(q, t);
+		q->head = t;
+		return;
+	}
+	for(i = i->next; i != q->head; i = i->next){
+		if(i->virtualRuntime > t->virtualRuntime){
+			break;
+		}
+	}
+	t->next = i;
+	t->prev = i->prev;
+	t->next->prev = t;
+	t->prev->next = t;
+}
+
 static void pushPriorityQueue(TaskPriorityQueue *q, Task *t){
-	pushQueue(q->taskQueue + t->priority, t);
+	if(t->priority == FAIR_SHARE_PRIORITY){
+		pushFairQueue(q->taskQueue + t->priority, t);
+	}
+	else{
+		pushQueue(q->taskQueue + t->priority, t);
+	}
+	if(t->isIdle == 0){
+		q->readyCount++;
+	}
 }
 
 static Task *popPriorityQueue(TaskPriorityQueue *q){
@@ -158,16 +234,146 @@ static Task *popPriorityQueue(TaskPriorityQueue *q){
 	for(p = 0; 1; p++){
 		assert(p < NUMBER_OF_PRIORITIES);
 		Task *t = popQueue(q->taskQueue + p);
-		if(t != NULL)
+		if(t != NULL){
+			if(t->isIdle == 0){
+				q->readyCount--;
+			}
+			if(p == FAIR_SHARE_PRIORITY){
+				q->minVirtualRuntime = MAX(q->minVirtualRuntime, t->virtualRuntime);
+			}
 			return t;
+		}
+	}
+}
+
+static int isAllowedProcessor(Task *t, int processorIndex){
+	return (t->affinity >> processorIndex) & 1;
+}
+
+// the most recently queued task allowed to run on processorIndex
+static Task *removeMigratableTask(TaskPriorityQueue *q, int processorIndex){
+	int p;
+	for(p = 0; p < NUMBER_OF_PRIORITIES; p++){
+		Task *head = q->taskQueue[p].head;
+		if(head == NULL){
+			continue;
+		}
+		Task *t = head->prev;
+		while(1){
+			if(t->isIdle == 0 && isAllowedProcessor(t, processorIndex)){
+				removeFromQueue(q->taskQueue + p, t);
+				q->readyCount--;
+				return t;
+			}
+			if(t == head){
+				break;
+			}
+			t = t->prev;
+		}
+	}
+	return NULL;
+}
+
+static uint32_t getProcessorLoad(TaskPriorityQueue *q){
+	return q->readyCount + (q->isIdle? 0: 1);
+}
+
+// keep the distance to minVirtualRuntime when moving to another queue
+typedef struct{
+	int isBehind;
+	uint64_t distance;
+}VirtualRuntimeLag;
+
+static VirtualRuntimeLag getVirtualRuntimeLag(Task *t, TaskPriorityQueue *q){
+	VirtualRuntimeLag lag;
+	lag.isBehind = (t->virtualRuntime < q->minVirtualRuntime);
+	lag.distance = (lag.isBehind?
+		q->minVirtualRuntime - t->virtualRuntime: t->virtualRuntime - q->minVirtualRuntime);
+	return lag;
+}
+
+static void setVirtualRuntimeLag(Task *t, TaskPriorityQueue *q, VirtualRuntimeLag lag){
+	if(lag.isBehind == 0){
+		t->virtualRuntime = q->minVirtualRuntime + lag.distance;
+	}
+	else{
+		t->virtualRuntime = (q->minVirtualRuntime > lag.distance? q->minVirtualRuntime - lag.distance: 0);
+	}
+}
+
+int hasReadyTask(void){
+	TaskManager *tm = processorLocalTaskManager();
+	if(tm->readyQueue->readyCount != 0){
+		return 1;
+	}
+	// see balanceLoad
+	const int count = processorCount;
+	int i;
+	for(i = 0; i < count; i++){
+		if(processorQueue[i]->readyCount != 0){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// assume interrupt disabled
+// pull a task if another processor has more waiting tasks than the running and waiting tasks here
+static void balanceLoad(TaskManager *tm){
+	TaskPriorityQueue *local = tm->readyQueue;
+	const uint32_t localLoad = local->readyCount + (tm->current->isIdle? 0: 1);
+	const int count = processorCount;
+	int i, busiest = -1;
+	uint32_t busiestCount = localLoad;
+	for(i = 0; i < count; i++){
+		if(i != tm->processorIndex && processorQueue[i]->readyCount > busiestCount){
+			busiest = i;
+			busiestCount = processorQueue[i]->readyCount;
+		}
+	}
+	if(busiest < 0){
+		return;
+	}
+	// do not hold 2 queue locks at the same time
+	TaskPriorityQueue *remote = processorQueue[busiest];
+	acquireLock(&remote->lock);
+	Task *t = removeMigratableTask(remote, tm->processorIndex);
+	if(t == NULL){
+		releaseLock(&remote->lock);
+		return;
+	}
+	const VirtualRuntimeLag lag = getVirtualRuntimeLag(t, remote);
+	releaseLock(&remote->lock);
+	acquireLock(&local->lock);
+	setVirtualRuntimeLag(t, local, lag);
+	pushPriorityQueue(local, t);
+	releaseLock(&local->lock);
+}
+
+static uint64_t readSchedulerClock(void){
+	const TimePage *tp = getKernelTimePage();
+	// the clock is not initialized until initLocalTimer
+	return (tp == NULL? 0: readTimePage(tp));
+}
+
+// assume interrupt disabled
+// the running task has to be charged before returning to the queue
+static void chargeProcessorTime(Task *t, uint64_t now){
+	if(now <= t->switchInTime){
+		return;
+	}
+	const uint64_t runtime = now - t->switchInTime;
+	t->processorTime += runtime;
+	if(t->priority == FAIR_SHARE_PRIORITY){
+		t->virtualRuntime += runtime * DEFAULT_TASK_WEIGHT / t->weight;
 	}
 }
 
 void contextSwitch(uint32_t *oldTaskESP0, uint32_t newTaskESP0, uint32_t newCR3);
 
 static void callAfterTaskSwitchFunc(void){
-	releaseLock(&globalQueue->lock); // see taskSwitch()
 	TaskManager *tm = processorLocalTaskManager();
+	releaseLock(&tm->readyQueue->lock); // see taskSwitch()
 
 	if(tm->afterTaskSwitchFunc != NULL){
 		tm->afterTaskSwitchFunc(tm->oldTask, tm->afterTaskSwitchArg);
@@ -183,18 +389,27 @@ void taskSwitch(void (*func)(Task*, uintptr_t), uintptr_t arg){
 	tm->afterTaskSwitchFunc = func;
 	tm->afterTaskSwitchArg = arg;
 	tm->oldTask = tm->current;
-	acquireLock(&globalQueue->lock);
+	TaskPriorityQueue *q = tm->readyQueue;
+	acquireLock(&q->lock);
+	const uint64_t now = readSchedulerClock();
+	chargeProcessorTime(tm->oldTask, now);
 	if(func == NULL){
-		pushPriorityQueue(globalQueue, tm->oldTask);
+		pushPriorityQueue(q, tm->oldTask);
 	}
 	else{
 		tm->oldTask->state = SUSPENDED;
 	}
-	tm->current = popPriorityQueue(globalQueue);
+	tm->current = popPriorityQueue(q);
+	tm->current->switchInTime = now;
+	tm->current->lastProcessor = tm->processorIndex;
+	q->isIdle = tm->current->isIdle;
+	q->switchCount++;
 	// if releaseLock() before contextSwitch(), the stack sometimes becomes corrupted
 	//releaseLock(&readyQueue->lock);
 	setTSSKernelStack(tm->gdt, tm->current->espInterrupt);
 	if(tm->current != tm->oldTask){// otherwise, esp0 will be wrong value
+		addCounter(COUNTER_TASK_SWITCH, 1);
+		TRACE(TRACE_TASK_SWITCH, tm->oldTask, tm->current);
 		contextSwitch(&tm->oldTask->esp0, tm->current->esp0, toCR3(tm->current->taskMemory->manager.page));
 		// may go to startTask or return here
 	}
@@ -207,7 +422,21 @@ void startTask(void){
 	sti();
 }
 
+static void resumeOnAllowedProcessor(Task *oldTask, __attribute__((__unused__)) uintptr_t arg){
+	resume(oldTask);
+}
+
 void schedule(){
+	TaskManager *tm = processorLocalTaskManager();
+	// see setTaskAffinity
+	if(isAllowedProcessor(tm->current, tm->processorIndex) == 0){
+		taskSwitch(resumeOnAllowedProcessor, 0);
+		return;
+	}
+	tm->scheduleCount++;
+	if(tm->current->isIdle || tm->scheduleCount % BALANCE_INTERVAL == 0){
+		balanceLoad(tm);
+	}
 	taskSwitch(NULL, 0);
 }
 
@@ -287,7 +516,7 @@ static void initUserRegisters(InterruptParam *p, uint32_t eip, uint32_t esp){
 }
 
 int switchToUserMode(uintptr_t eip, size_t stackSize){
-	void *stack = allocatePages(getTaskLinearMemory(processorLocalTask()), stackSize, USER_WRITABLE_PAGE);
+	void *stack = reservePages(getTaskLinearMemory(processorLocalTask()), stackSize, USER_WRITABLE_PAGE);
 	EXPECT(stack != NULL);
 	setCurrentUserStackBottom((uintptr_t)stack); // see terminateCurrentTask
 	InterruptParam p;
@@ -321,12 +550,20 @@ static Task *createTask(
 	t->ioListLock = initialSpinlock;
 	t->pendingIOList = NULL;
 	t->completedIOList = NULL;
+	t->ioRing = NULL;
 	t->taskMemory = taskMemory;
 	addTaskMemoryReference(taskMemory, 1);
 	t->openFileManager = openFileManager;
 	addOpenFileManagerReference(openFileManager, 1);
 	t->state = SUSPENDED;
 	t->priority = priority;
+	t->isIdle = 0;
+	t->weight = DEFAULT_TASK_WEIGHT;
+	t->virtualRuntime = 0;
+	t->processorTime = 0;
+	t->switchInTime = 0;
+	t->affinity = ANY_PROCESSOR_AFFINITY;
+	t->lastProcessor = -1;
 	t->taskDefinedSystemCall = undefinedSystemCall;
 	t->taskDefinedArgument = 0;
 	t->next =
@@ -374,7 +611,8 @@ static Task *createKernelTask(void *eip0, const void *arg, size_t argSize,
 
 #define USER_LINEAR_BLOCK_MANAGER_ADDRESS (FLOOR(USER_LINEAR_END - maxLinearBlockManagerSize, PAGE_SIZE))
 #define USER_PAGE_TABLE_SET_ADDRESS (USER_LINEAR_BLOCK_MANAGER_ADDRESS - sizeOfPageTableSet)
-#define HEAP_END USER_PAGE_TABLE_SET_ADDRESS
+#define USER_TIME_PAGE_ADDRESS (USER_PAGE_TABLE_SET_ADDRESS - PAGE_SIZE)
+#define HEAP_END USER_TIME_PAGE_ADDRESS
 
 int initUserLinearBlockManager(uintptr_t beginAddr, uintptr_t initEndAddr){
 	if(beginAddr % MIN_BLOCK_SIZE != 0 || beginAddr >= HEAP_END ||
@@ -419,12 +657,16 @@ static void noLoader(void *voidParam){
 
 	if(initUserLinearBlockManager(PAGE_SIZE, PAGE_SIZE) != 0){
 		p->eip();
-		printk("warning: task did not terminate by systemCall_teminate()\n");
+		printk("warning: task did not terminate by systemCall_terminate()\n");
 	}
 	terminateCurrentTask();
 }
 
-Task *createTaskAndMemorySpace(void (*loader)(void*), void *arg, size_t argSize, int priority){
+// if cloneSource != NULL, share its user space with the new task
+static Task *_createTaskAndMemorySpace(
+	void (*loader)(void*), void *arg, size_t argSize, int priority,
+	LinearMemoryManager *cloneSource
+){
 	const uintptr_t targetLinearBlockManager = USER_LINEAR_BLOCK_MANAGER_ADDRESS;
 	const uintptr_t targetPageTable = USER_PAGE_TABLE_SET_ADDRESS;
 	// 1. task PageManager
@@ -432,10 +674,14 @@ Task *createTaskAndMemorySpace(void (*loader)(void*), void *arg, size_t argSize,
 	PageManager *pageManager = createAndMapUserPageTable(
 		targetPageTable, targetLinearBlockManager, targetPageTable);
 	EXPECT(pageManager != NULL);
-	// 2. taskMemory.linear will be initialized in noLoader
+	// 2. copy-on-write pages
+	EXPECT(cloneSource == NULL || cloneLinearBlocks(pageManager, cloneSource));
+	// 3. read-only time page
+	EXPECT(mapTimePage(pageManager, USER_TIME_PAGE_ADDRESS));
+	// 4. taskMemory.linear will be initialized in noLoader or cloneLoader
 	TaskMemoryManager *tm = createTaskMemory(kernelLinear->physical, pageManager, NULL);
 	EXPECT(tm != NULL);
-	// 3. openFileManager
+	// 5. openFileManager
 	OpenFileManager *ofm = createOpenFileManager();
 	EXPECT(ofm != NULL);
 	Task *t = createKernelTask(loader, arg, argSize, priority, tm, ofm);
@@ -451,20 +697,26 @@ Task *createTaskAndMemorySpace(void (*loader)(void*), void *arg, size_t argSize,
 	ON_ERROR;
 	deleteTaskMemory(tm);
 	ON_ERROR;
+	unmapTimePage(pageManager, USER_TIME_PAGE_ADDRESS);
+	ON_ERROR;
+	if(cloneSource != NULL){
+		_releaseClonedPages(pageManager, kernelLinear->physical);
+	}
+	ON_ERROR;
 	releasePageTable(pageManager);
 	ON_ERROR;
 	return NULL;
 }
 
+Task *createTaskAndMemorySpace(void (*loader)(void*), void *arg, size_t argSize, int priority){
+	return _createTaskAndMemorySpace(loader, arg, argSize, priority, NULL);
+}
+
 Task * createTaskWithoutLoader(void (*eip0)(void), int priority){
 	struct NoLoaderParam p = {eip0};
 	return createTaskAndMemorySpace(noLoader, &p, sizeof(p), priority);
 }
 
-#undef USER_LINEAR_BLOCK_MANAGER_ADDRESS
-#undef USER_PAGE_TABLE_SET_ADDRESS
-#undef HEAP_END
-
 struct UserThreadParam{
 	uintptr_t entry, stackSize;
 };
@@ -491,6 +743,37 @@ static void createUserThreadHandler(InterruptParam *p){
 	SYSTEM_CALL_RETURN_VALUE_0(p) = (uintptr_t)newTask;
 }
 
+static void initClonedLinearMemory(void){
+	LinearMemoryManager *lmm = &(processorLocalTask()->taskMemory->manager);
+	assert(lmm->linear == NULL);
+	// see cloneLinearBlocks
+	lmm->linear = (LinearMemoryBlockManager*)USER_LINEAR_BLOCK_MANAGER_ADDRESS;
+	resetClonedLinearBlockManager(lmm->linear);
+}
+
+static void cloneLoader(void *voidParam){
+	initClonedLinearMemory();
+	userThreadEntry(voidParam);
+}
+
+static void cloneUserSpaceHandler(InterruptParam *p){
+	sti();
+	uintptr_t entry = SYSTEM_CALL_ARGUMENT_0(p);
+	uintptr_t stackSize = SYSTEM_CALL_ARGUMENT_1(p);
+	Task *current = processorLocalTask();
+	LinearMemoryManager *lmm = &current->taskMemory->manager;
+	Task *newTask = NULL;
+	// kernel tasks do not have user space
+	if(lmm->linear != NULL){
+		struct UserThreadParam param = {entry, stackSize};
+		newTask = _createTaskAndMemorySpace(cloneLoader, &param, sizeof(param), current->priority, lmm);
+	}
+	if(newTask != NULL){
+		resume(newTask);
+	}
+	SYSTEM_CALL_RETURN_VALUE_0(p) = (uintptr_t)newTask;
+}
+
 // TODO: how to check if sharedMemoryTask is valid?
 Task *createSharedMemoryTask(void (*entry)(void*), void *arg, uintptr_t argSize, Task *sharedMemoryTask){
 	return createKernelTask(entry, arg, argSize,
@@ -507,8 +790,18 @@ static void cancelAllIORequests(void){
 		if(ior == NULL)
 			break;
 		assert(ior->task == t);
-		if(tryCancelIO(ior))
+		IORing *ring = ior->ring;
+		if(tryCancelIO(ior)){
+			if(ring != NULL){
+				cancelIORingRequest(ring);
+			}
+			continue;
+		}
+		if(ring != NULL){
+			// accepted in deleteIORing
+			waitIORingCompletion(ring);
 			continue;
+		}
 		waitIO(ior);
 		uintptr_t returnValues[SYSTEM_CALL_MAX_RETURN_COUNT - 1];
 		ior->accept(ior->instance, returnValues);
@@ -551,6 +844,10 @@ void terminateCurrentTask(void){
 	clearTerminateQueue(&terminateQueue);
 	cancelAllIORequests();
 	Task *t = processorLocalTask();
+	if(t->ioRing != NULL){
+		deleteIORing(t->ioRing);
+		t->ioRing = NULL;
+	}
 	int fileRefCnt = addOpenFileManagerReference(t->openFileManager, -1);
 	if(fileRefCnt == 0){
 		closeAllOpenFileRequest(t->openFileManager);
@@ -577,6 +874,7 @@ void terminateCurrentTask(void){
 		if(tmm->manager.linear != NULL){
 			destroyUserLinearBlockManager(&tmm->manager);
 		}
+		unmapTimePage(p, USER_TIME_PAGE_ADDRESS);
 		// delete page
 		cli();
 		// temporary page manager
@@ -598,6 +896,17 @@ void terminateCurrentTask(void){
 	assert(0); // never return
 }
 
+static void getTimePageHandler(InterruptParam *p){
+	Task *t = processorLocalTask();
+	SYSTEM_CALL_RETURN_VALUE_0(p) = (t->taskMemory == kernelTaskMemory?
+		(uintptr_t)getKernelTimePage(): USER_TIME_PAGE_ADDRESS);
+}
+
+#undef USER_LINEAR_BLOCK_MANAGER_ADDRESS
+#undef USER_PAGE_TABLE_SET_ADDRESS
+#undef USER_TIME_PAGE_ADDRESS
+#undef HEAP_END
+
 static void terminateHandler(__attribute__((__unused__)) InterruptParam *p){
 	sti();
 	terminateCurrentTask();
@@ -608,12 +917,48 @@ void setTaskSystemCall(Task *t, SystemCallFunction f, uintptr_t a){
 	t->taskDefinedArgument = a;
 }
 
+static int chooseProcessor(Task *t){
+	const int current = processorLocalTaskManager()->processorIndex;
+	// interrupt bottom halves run on the processor handling the interrupt
+	if(t->priority < FAIR_SHARE_PRIORITY && isAllowedProcessor(t, current)){
+		return current;
+	}
+	const int count = processorCount;
+	int i, best = -1;
+	for(i = 0; i < count; i++){
+		if(isAllowedProcessor(t, i) &&
+		(best < 0 || getProcessorLoad(processorQueue[i]) < getProcessorLoad(processorQueue[best]))){
+			best = i;
+		}
+	}
+	if(best < 0){
+		return current;
+	}
+	// prefer the cache of the last processor
+	const int last = t->lastProcessor;
+	if(last >= 0 && last < count && isAllowedProcessor(t, last) &&
+	getProcessorLoad(processorQueue[last]) <= getProcessorLoad(processorQueue[best])){
+		return last;
+	}
+	return best;
+}
+
 void resume(/*TaskManager *tm, */Task *t){
 	assert(t->state == SUSPENDED);
 	t->state = READY;
-	acquireLock(&globalQueue->lock);
-	pushPriorityQueue(globalQueue, t);
-	releaseLock(&globalQueue->lock);
+	const int p = chooseProcessor(t);
+	TaskPriorityQueue *q = processorQueue[p];
+	acquireLock(&q->lock);
+	// do not let a long sleeping task monopolize the processor
+	if(q->minVirtualRuntime > WAKEUP_VIRTUAL_RUNTIME_CREDIT){
+		t->virtualRuntime = MAX(t->virtualRuntime, q->minVirtualRuntime - WAKEUP_VIRTUAL_RUNTIME_CREDIT);
+	}
+	pushPriorityQueue(q, t);
+	const int isIdle = q->isIdle;
+	releaseLock(&q->lock);
+	if(isIdle && p != processorLocalTaskManager()->processorIndex){
+		wakeupIdleProcessor(p);
+	}
 }
 
 Task *currentTask(TaskManager *tm){
@@ -628,6 +973,86 @@ OpenFileManager *getOpenFileManager(Task *t){
 	return t->openFileManager;
 }
 
+IORing *getIORing(Task *t){
+	return t->ioRing;
+}
+
+void setIORing(Task *t, IORing *r){
+	assert(t->ioRing == NULL);
+	t->ioRing = r;
+}
+
+int setTaskWeight(Task *t, uint32_t weight){
+	if(weight < MIN_TASK_WEIGHT || weight > MAX_TASK_WEIGHT){
+		return 0;
+	}
+	// read in chargeProcessorTime
+	t->weight = weight;
+	return 1;
+}
+
+uint64_t getTaskProcessorTime(Task *t){
+	EFlags eflags = getEFlags();
+	cli();
+	uint64_t r;
+	if(t == processorLocalTask()){
+		r = t->processorTime;
+		const uint64_t now = readSchedulerClock();
+		if(now > t->switchInTime){
+			r += now - t->switchInTime;
+		}
+	}
+	else{
+		// t may be charged on another processor
+		uint64_t r2 = t->processorTime;
+		do{
+			r = r2;
+			r2 = t->processorTime;
+		}while(r != r2);
+	}
+	if(eflags.bit.interrupt){
+		sti();
+	}
+	return r;
+}
+
+int setTaskAffinity(Task *t, uint32_t affinity){
+	const uint32_t count = processorCount;
+	const uint32_t existingMask = (count >= MAX_PROCESSOR_COUNT? 0xffffffff: (((uint32_t)1) << count) - 1);
+	if((affinity & existingMask) == 0 || t->isIdle){
+		return 0;
+	}
+	t->affinity = affinity;
+	// a running task moves in the next schedule()
+	return 1;
+}
+
+uint32_t getTaskAffinity(Task *t){
+	return t->affinity;
+}
+
+int getProcessorIndex(void){
+	// processorLocalMemory returns NULL before setProcessorLocal
+	if(processorLocalMemory() == NULL){
+		return -1;
+	}
+	TaskManager *tm = processorLocalTaskManager();
+	return (tm == NULL? -1: tm->processorIndex);
+}
+
+uint32_t getProcessorCount(void){
+	return processorCount;
+}
+
+uint32_t getTaskSwitchCount(uint32_t processorIndex){
+	return processorQueue[processorIndex]->switchCount;
+}
+
+int isQuiescentSince(uint32_t processorIndex, uint32_t switchCount){
+	TaskPriorityQueue *q = processorQueue[processorIndex];
+	return q->switchCount != switchCount || q->isIdle;
+}
+
 static void taskDefinedHandler(InterruptParam *p){
 	uintptr_t oldArgument = p->argument;
 	Task *t = processorLocalTask();
@@ -637,8 +1062,24 @@ static void taskDefinedHandler(InterruptParam *p){
 	// schedule(p->processorLocal->taskManager);
 }
 
+static TaskPriorityQueue *createTaskPriorityQueue(void){
+	TaskPriorityQueue *NEW(q);
+	if(q == NULL){
+		return NULL;
+	}
+	int p;
+	q->lock = initialSpinlock;
+	q->readyCount = 0;
+	for(p = 0; p < NUMBER_OF_PRIORITIES; p++){
+		q->taskQueue[p] = initialTaskQueue;
+	}
+	q->minVirtualRuntime = 0;
+	q->isIdle = 1;
+	q->switchCount = 0;
+	return q;
+}
+
 TaskManager *createTaskManager(SegmentTable *gdt){
-	assert(globalQueue != NULL);
 	assert(kernelTaskMemory != NULL && kernelOpenFileManager != NULL);
 	// each processor needs an idle task
 	// create a task for current running bootstrap task. not need to initialize eip and esp
@@ -646,6 +1087,20 @@ TaskManager *createTaskManager(SegmentTable *gdt){
 	if(tm == NULL){
 		panic("cannot initialize task manager");
 	}
+	tm->readyQueue = createTaskPriorityQueue();
+	if(tm->readyQueue == NULL){
+		panic("cannot initialize task queue");
+	}
+	addNamedSpinlock(&tm->readyQueue->lock, "task queue");
+	acquireLock(&processorQueueLock);
+	tm->processorIndex = processorCount;
+	if(tm->processorIndex >= MAX_PROCESSOR_COUNT){
+		panic("too many processors");
+	}
+	processorQueue[tm->processorIndex] = tm->readyQueue;
+	processorCount++;
+	releaseLock(&processorQueueLock);
+	tm->scheduleCount = 0;
 	tm->current = createTask(/*esp0*/0, /*espInterrupt*/0, /*stackBottom*/0,
 		kernelTaskMemory, kernelOpenFileManager, NUMBER_OF_PRIORITIES - 1);
 	if(tm->current == NULL){
@@ -653,6 +1108,9 @@ TaskManager *createTaskManager(SegmentTable *gdt){
 	}
 	// do not put into the queue because the task is running
 	tm->current->state = READY;
+	tm->current->isIdle = 1;
+	tm->current->affinity = (((uint32_t)1) << tm->processorIndex);
+	tm->current->lastProcessor = tm->processorIndex;
 	tm->gdt = gdt;
 	tm->oldTask = NULL;
 	tm->afterTaskSwitchFunc = NULL;
@@ -672,13 +1130,23 @@ void pendIO(IORequest *ior/*, int cancellable*/){
 
 void completeIO(IORequest *ior){
 	Task *t = ior->task;
+	addCounter(COUNTER_IO_COMPLETION, 1);
+	TRACE(TRACE_IO_COMPLETION, ior, 0);
 	acquireLock(&t->ioListLock);
 	assert(IS_IN_DQUEUE(ior) != 0);
 	REMOVE_FROM_DQUEUE(ior); // t->pendingIOList
-	ADD_TO_DQUEUE(ior, &(t->completedIOList));
 	ior->cancellable = 0;
+	IORing *ring = ior->ring;
+	if(ring == NULL){
+		ADD_TO_DQUEUE(ior, &(t->completedIOList));
+	}
 	releaseLock(&t->ioListLock);
-	releaseSemaphore(t->ioSemaphore);
+	if(ring == NULL){
+		releaseSemaphore(t->ioSemaphore);
+	}
+	else{
+		postIORingCompletion(ior);
+	}
 }
 
 // IORequest may not be valid
@@ -693,6 +1161,20 @@ static int searchIOList_noLock(IORequest *listHead, IORequest *ior){
 	return 0;
 }
 
+int attachIORing(IORequest *ior, IORing *r, uintptr_t userData){
+	Task *t = ior->task;
+	acquireLock(&t->ioListLock);
+	assert(IS_IN_DQUEUE(ior) != 0);
+	ior->ring = r;
+	ior->ringUserData = userData;
+	int isPending = searchIOList_noLock(t->pendingIOList, ior);
+	if(isPending == 0){
+		REMOVE_FROM_DQUEUE(ior); // t->completedIOList
+	}
+	releaseLock(&t->ioListLock);
+	return isPending;
+}
+
 static IORequest *_waitIO(Task *t, IORequest *expected){
 	// assume this is the only function acquiring ioSemaphore
 	int v = getSemaphoreValue(t->ioSemaphore);
@@ -736,6 +1218,10 @@ static void waitIOHandler(InterruptParam *p){
 		Task *t = processorLocalTask();
 		acquireLock(&t->ioListLock);
 		int ok = (searchIOList_noLock(t->pendingIOList, ior) || searchIOList_noLock(t->completedIOList, ior));
+		if(ok){
+			// see attachIORing
+			ok = (ior->ring == NULL);
+		}
 		releaseLock(&t->ioListLock);
 		if(ok == 0){
 			SYSTEM_CALL_RETURN_VALUE_0(p) = IO_REQUEST_FAILURE;
@@ -772,7 +1258,7 @@ static void cacnelIOHandler(InterruptParam *p){
 	acquireLock(&t->ioListLock);
 	int ok = searchIOList_noLock(t->pendingIOList, ior);
 	if(ok){
-		ok = ior->cancellable;
+		ok = (ior->cancellable && ior->ring == NULL);
 	}
 	if(ok){
 		REMOVE_FROM_DQUEUE(ior);
@@ -823,6 +1309,8 @@ void initIORequest(
 	ior->cancel = cancelIO;
 	ior->cancellable = 0; // not support cancellation by default
 	ior->accept = acceptIO;
+	ior->ring = NULL;
+	ior->ringUserData = 0;
 }
 
 static void allocateHeapHandler(InterruptParam *p){
@@ -830,7 +1318,7 @@ static void allocateHeapHandler(InterruptParam *p){
 	uintptr_t size = SYSTEM_CALL_ARGUMENT_0(p);
 	PageAttribute attribute = SYSTEM_CALL_ARGUMENT_1(p);
 	size = CEIL(size, PAGE_SIZE);
-	void *ret = allocatePages(&processorLocalTask()->taskMemory->manager, size, attribute);
+	void *ret = reservePages(&processorLocalTask()->taskMemory->manager, size, attribute);
 	SYSTEM_CALL_RETURN_VALUE_0(p) = (uintptr_t)ret;
 }
 
@@ -842,6 +1330,41 @@ static void releaseHeapHandler(InterruptParam *p){
 	SYSTEM_CALL_RETURN_VALUE_0(p) = ret;
 }
 
+static void setTaskWeightHandler(InterruptParam *p){
+	Task *t = processorLocalTask();
+	const uint32_t oldWeight = t->weight;
+	const uint32_t weight = SYSTEM_CALL_ARGUMENT_0(p);
+	// user mode callers may only lower their weight
+	const int isUserCaller = (p->eflags.bit.virtual8086 || (p->cs & 3) != 0);
+	if(isUserCaller && weight > oldWeight){
+		SYSTEM_CALL_RETURN_VALUE_0(p) = 0;
+		return;
+	}
+	SYSTEM_CALL_RETURN_VALUE_0(p) = (setTaskWeight(t, weight)? oldWeight: 0);
+}
+
+static void setTaskAffinityHandler(InterruptParam *p){
+	TaskManager *tm = processorLocalTaskManager();
+	Task *t = tm->current;
+	const uint32_t oldAffinity = t->affinity;
+	const uint32_t affinity = SYSTEM_CALL_ARGUMENT_0(p);
+	if(setTaskAffinity(t, affinity) == 0){
+		SYSTEM_CALL_RETURN_VALUE_0(p) = 0;
+		return;
+	}
+	SYSTEM_CALL_RETURN_VALUE_0(p) = oldAffinity;
+	// move to an allowed processor before returning
+	if(isAllowedProcessor(t, tm->processorIndex) == 0){
+		schedule();
+	}
+}
+
+static void getTaskTimeHandler(InterruptParam *p){
+	const uint64_t r = getTaskProcessorTime(processorLocalTask());
+	SYSTEM_CALL_RETURN_VALUE_0(p) = LOW64(r);
+	SYSTEM_CALL_RETURN_VALUE_1(p) = HIGH64(r);
+}
+
 static void translatePageHandler(InterruptParam *p){
 	uintptr_t address = SYSTEM_CALL_ARGUMENT_0(p);
 	PhysicalAddress ret = checkAndTranslatePage(
@@ -850,15 +1373,6 @@ static void translatePageHandler(InterruptParam *p){
 }
 
 void initTaskManagement(SystemCallTable *systemCallTable){
-	NEW(globalQueue);
-	if(globalQueue == NULL){
-		panic("cannot initialize task management");
-	}
-	int p;
-	globalQueue->lock = initialSpinlock;
-	for(p = 0; p < NUMBER_OF_PRIORITIES; p++){
-		globalQueue->taskQueue[p] = initialTaskQueue;
-	}
 	kernelTaskMemory = createTaskMemory(kernelLinear->physical, kernelLinear->page, kernelLinear->linear);
 	if(kernelTaskMemory == NULL){
 		panic("cannot create kernel task memory");
@@ -874,8 +1388,14 @@ void initTaskManagement(SystemCallTable *systemCallTable){
 	registerSystemCall(systemCallTable, SYSCALL_RELEASE_HEAP, releaseHeapHandler, 0);
 	registerSystemCall(systemCallTable, SYSCALL_TRANSLATE_PAGE, translatePageHandler, 0);
 	registerSystemCall(systemCallTable, SYSCALL_CREATE_USER_THREAD, createUserThreadHandler, 0);
+	registerSystemCall(systemCallTable, SYSCALL_CLONE_USER_SPACE, cloneUserSpaceHandler, 0);
 	registerSystemCall(systemCallTable, SYSCALL_TERMINATE, terminateHandler, 0);
+	registerSystemCall(systemCallTable, SYSCALL_GET_TIME_PAGE, getTimePageHandler, 0);
+	registerSystemCall(systemCallTable, SYSCALL_SET_TASK_WEIGHT, setTaskWeightHandler, 0);
+	registerSystemCall(systemCallTable, SYSCALL_GET_TASK_TIME, getTaskTimeHandler, 0);
+	registerSystemCall(systemCallTable, SYSCALL_SET_TASK_AFFINITY, setTaskAffinityHandler, 0);
 	//initSemaphore(systemCallTable);
+	initWaitAddress(systemCallTable);
 }
 
 #ifndef NDEBUG
@@ -933,4 +1453,158 @@ void testCreateThread(void *arg){
 	threadEntry();
 }
 
+#include"interrupt/controller/pic.h"
+
+#define MAX_SPIN_TASK_COUNT (16)
+#define LATENCY_LOOP_COUNT (100)
+#define LATENCY_SLEEP_MS (10)
+
+typedef struct{
+	Semaphore *done;
+	volatile int stop;
+	uint64_t processorTime[MAX_SPIN_TASK_COUNT];
+	uint32_t totalLatency, maxLatency;
+}FairSchedulerTest;
+
+typedef struct{
+	FairSchedulerTest *test;
+	int index;
+}SpinTaskArgument;
+
+// odd tasks have double weight
+static void fairSpinTask(void *voidArg){
+	SpinTaskArgument *arg = voidArg;
+	FairSchedulerTest *t = arg->test;
+	const uint32_t weight = ((arg->index % 2) + 1) * DEFAULT_TASK_WEIGHT;
+	uint32_t oldWeight = systemCall_setTaskWeight(weight);
+	assert(oldWeight == DEFAULT_TASK_WEIGHT);
+	while(t->stop == 0);
+	t->processorTime[arg->index] = systemCall_getTaskTime();
+	releaseSemaphore(t->done);
+	systemCall_terminate();
+}
+
+static void fairLatencyTask(void *voidArg){
+	FairSchedulerTest *t = *(FairSchedulerTest**)voidArg;
+	int i;
+	t->totalLatency = 0;
+	t->maxLatency = 0;
+	for(i = 0; i < LATENCY_LOOP_COUNT; i++){
+		const uint64_t t0 = getClockNanosecond();
+		sleep(LATENCY_SLEEP_MS);
+		const uint64_t t1 = getClockNanosecond();
+		const uint64_t expected = ((uint64_t)LATENCY_SLEEP_MS) * 1000000;
+		const uint32_t latency = (uint32_t)((t1 - t0 > expected? t1 - t0 - expected: 0) / 1000);
+		t->totalLatency += latency;
+		t->maxLatency = MAX(t->maxLatency, latency);
+	}
+	t->stop = 1;
+	releaseSemaphore(t->done);
+	systemCall_terminate();
+}
+
+static void runLatencyTask(FairSchedulerTest *t, int spinTaskCount){
+	Task *current = processorLocalTask();
+	SpinTaskArgument arg = {t, 0};
+	t->stop = 0;
+	for(arg.index = 0; arg.index < spinTaskCount; arg.index++){
+		Task *task = createKernelTask(fairSpinTask, &arg, sizeof(arg),
+			FAIR_SHARE_PRIORITY, current->taskMemory, current->openFileManager);
+		assert(task != NULL);
+		resume(task);
+	}
+	Task *task = createKernelTask(fairLatencyTask, &t, sizeof(t),
+		FAIR_SHARE_PRIORITY, current->taskMemory, current->openFileManager);
+	assert(task != NULL);
+	resume(task);
+	int i;
+	for(i = 0; i < spinTaskCount + 1; i++){
+		acquireSemaphore(t->done);
+	}
+	printk("%d spinning tasks: wakeup latency avg %u us, max %u us\n",
+		spinTaskCount, t->totalLatency / LATENCY_LOOP_COUNT, t->maxLatency);
+}
+
+// a sleeping task competes with CPU-bound tasks of weight 1 and 2
+void testFairScheduler(void){
+	FairSchedulerTest *NEW(t);
+	assert(t != NULL);
+	t->done = createSemaphore(0);
+	assert(t->done != NULL);
+	const int spinTaskCount = MIN(processorLocalPIC()->numberOfProcessors * 2, MAX_SPIN_TASK_COUNT);
+	runLatencyTask(t, 0);
+	runLatencyTask(t, spinTaskCount);
+	uint64_t weightedTime[2] = {0, 0};
+	int i;
+	for(i = 0; i < spinTaskCount; i++){
+		weightedTime[i % 2] += t->processorTime[i];
+	}
+	printk("processor time of weight 1: %u ms, weight 2: %u ms\n",
+		(uint32_t)(weightedTime[0] / 1000000), (uint32_t)(weightedTime[1] / 1000000));
+	deleteSemaphore(t->done);
+	DELETE(t);
+	systemCall_terminate();
+}
+
+#undef LATENCY_SLEEP_MS
+#undef LATENCY_LOOP_COUNT
+#undef MAX_SPIN_TASK_COUNT
+
+// the current task visits every processor
+void testTaskAffinity(void){
+	const int count = processorCount;
+	int i;
+	for(i = 0; i < count; i++){
+		uint32_t oldAffinity = systemCall_setTaskAffinity(((uint32_t)1) << i);
+		assert(oldAffinity != 0);
+		assert(processorLocalTaskManager()->processorIndex == i);
+	}
+	assert(systemCall_setTaskAffinity(0) == 0);
+	systemCall_setTaskAffinity(ANY_PROCESSOR_AFFINITY);
+	printk("task affinity test: %d processors\n", count);
+	systemCall_terminate();
+}
+
+typedef struct{
+	IORingPage *ring;
+	Semaphore *done;
+}CloneIORingTest;
+
+static void cloneIORingTask(void *voidArg){
+	CloneIORingTest *arg = voidArg;
+	initClonedLinearMemory();
+	// the ring page is replaced with a zeroed page
+	assert(arg->ring->submissionTail == 0 && arg->ring->completionTail == 0);
+	arg->ring->submissionTail = 1;
+	releaseSemaphore(arg->done);
+	systemCall_terminate();
+}
+
+// the rings keep working in the task whose user space is cloned
+void testCloneIORing(void){
+	IORingPage *r = systemCall_setupIORing();
+	assert(r != NULL);
+	IORingCompletion c;
+	int ok = ioRingSetAlarm(r, 0, 10);
+	assert(ok);
+	uintptr_t submitCount = systemCall_enterIORing(1);
+	assert(submitCount == 1 && reapIORing(r, &c) && c.userData == 0);
+	Task *current = processorLocalTask();
+	CloneIORingTest arg = {r, createSemaphore(0)};
+	assert(arg.done != NULL);
+	Task *t = _createTaskAndMemorySpace(cloneIORingTask, &arg, sizeof(arg), current->priority,
+		&current->taskMemory->manager);
+	assert(t != NULL);
+	resume(t);
+	acquireSemaphore(arg.done);
+	assert(r->submissionTail == 1);
+	ok = ioRingSetAlarm(r, 1, 10);
+	assert(ok);
+	submitCount = systemCall_enterIORing(1);
+	assert(submitCount == 1 && reapIORing(r, &c) && c.userData == 1);
+	deleteSemaphore(arg.done);
+	printk("clone IORing test ok\n");
+	systemCall_terminate();
+}
+
 #endif
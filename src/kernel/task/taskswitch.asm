@@ -8,6 +8,7 @@ initTaskStack:
 	mov eax, [esp + 12] ; esp0
 	mov edx, [esp + 8] ; eip
 	mov ecx, [esp + 4] ; eFlags
+	and ecx, ~0x400 ; clear DF before startTask
 	mov [eax - 4], edx
 	mov DWORD [eax - 8], startTask
 	mov [eax - 12], ecx
@@ -0,0 +1,154 @@
+#include"task.h"
+#include"exclusivelock.h"
+#include"common.h"
+#include"kernel.h"
+#include"memory/memory.h"
+#include"multiprocessor/spinlock.h"
+#include"multiprocessor/processorlocal.h"
+
+struct WorkerPool{
+	Spinlock lock;
+	Semaphore *workCount;
+	WorkItem *head, **tail;
+	int queueLength;
+	int idleWorkerCount;
+	int workerCount;
+	int maxWorkerCount;
+	Task *sharedMemoryTask;
+};
+
+void initWorkItem(WorkItem *w, void (*run)(void*), void *arg){
+	w->run = run;
+	w->arg = arg;
+	w->next = NULL;
+}
+
+static void workerTask(void *arg){
+	WorkerPool *p = *(WorkerPool**)arg;
+	while(1){
+		acquireLock(&p->lock);
+		p->idleWorkerCount++;
+		releaseLock(&p->lock);
+		acquireSemaphore(p->workCount);
+		acquireLock(&p->lock);
+		p->idleWorkerCount--;
+		WorkItem *w = p->head;
+		assert(w != NULL);
+		p->head = w->next;
+		if(p->head == NULL){
+			p->tail = &p->head;
+		}
+		p->queueLength--;
+		releaseLock(&p->lock);
+		w->run(w->arg);
+	}
+}
+
+int submitWork(WorkerPool *p, WorkItem *w){
+	// create a worker if every idle worker will get a queued work
+	acquireLock(&p->lock);
+	int needWorker = (p->queueLength >= p->idleWorkerCount && p->workerCount < p->maxWorkerCount);
+	if(needWorker){
+		p->workerCount++;
+	}
+	releaseLock(&p->lock);
+	if(needWorker){
+		Task *t = createSharedMemoryTask(workerTask, &p, sizeof(p), p->sharedMemoryTask);
+		if(t != NULL){
+			resume(t);
+		}
+		else{
+			acquireLock(&p->lock);
+			p->workerCount--;
+			int noWorker = (p->workerCount == 0);
+			releaseLock(&p->lock);
+			if(noWorker){
+				return 0;
+			}
+		}
+	}
+	w->next = NULL;
+	acquireLock(&p->lock);
+	*(p->tail) = w;
+	p->tail = &w->next;
+	p->queueLength++;
+	releaseLock(&p->lock);
+	releaseSemaphore(p->workCount);
+	return 1;
+}
+
+WorkerPool *createWorkerPool(int maxWorkerCount, Task *sharedMemoryTask){
+	assert(maxWorkerCount > 0);
+	WorkerPool *NEW(p);
+	EXPECT(p != NULL);
+	p->workCount = createSemaphore(0);
+	EXPECT(p->workCount != NULL);
+	p->lock = initialSpinlock;
+	p->head = NULL;
+	p->tail = &p->head;
+	p->queueLength = 0;
+	p->idleWorkerCount = 0;
+	p->workerCount = 0;
+	p->maxWorkerCount = maxWorkerCount;
+	p->sharedMemoryTask = sharedMemoryTask;
+	return p;
+	//deleteSemaphore(p->workCount);
+	ON_ERROR;
+	DELETE(p);
+	ON_ERROR;
+	return NULL;
+}
+
+#ifndef NDEBUG
+
+#include"io/ioservice.h"
+
+#define TEST_WORK_COUNT (1000)
+
+typedef struct{
+	WorkItem work;
+	Semaphore *done;
+}TestWork;
+
+static void testWorkFunction(void *arg){
+	TestWork *w = arg;
+	releaseSemaphore(w->done);
+}
+
+static void testTaskFunction(void *arg){
+	TestWork *w = *(TestWork**)arg;
+	releaseSemaphore(w->done);
+	systemCall_terminate();
+}
+
+// compare the latency of a task per request and a worker pool
+void testWorkerPool(void){
+	WorkerPool *p = createWorkerPool(4, processorLocalTask());
+	TestWork *NEW(w);
+	assert(p != NULL && w != NULL);
+	w->done = createSemaphore(0);
+	assert(w->done != NULL);
+	int i;
+	uint64_t t0 = getClockNanosecond();
+	for(i = 0; i < TEST_WORK_COUNT; i++){
+		Task *t = createSharedMemoryTask(testTaskFunction, &w, sizeof(w), processorLocalTask());
+		assert(t != NULL);
+		resume(t);
+		acquireSemaphore(w->done);
+	}
+	uint64_t t1 = getClockNanosecond();
+	for(i = 0; i < TEST_WORK_COUNT; i++){
+		initWorkItem(&w->work, testWorkFunction, w);
+		int ok = submitWork(p, &w->work);
+		assert(ok);
+		acquireSemaphore(w->done);
+	}
+	uint64_t t2 = getClockNanosecond();
+	printk("%d requests: task per request %u us, worker pool %u us\n",
+		TEST_WORK_COUNT, (uint32_t)((t1 - t0) / 1000), (uint32_t)((t2 - t1) / 1000));
+	systemCall_terminate();
+}
+
+#undef TEST_WORK_COUNT
+
+#endif
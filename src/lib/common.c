@@ -12,29 +12,147 @@ static_assert(sizeof(uintptr_t) == sizeof(void*));
 
 static_assert(sizeof(unsigned char) == 1);
 
-#define MEMSET(D, I, V, SIZE) \
-size_t (I);\
-for((I) = 0; (I) < (SIZE); (I)++){\
-	((unsigned char*)(D))[(I)] = (V);\
-}\
-return (D)
+// string instructions are chosen by CPUID at the first call
+// SSE is not used because task switches do not save the FPU registers
+enum MemoryMethod{
+	UNKNOWN_MEMORY_METHOD,
+	// align the destination and move 4 bytes at a time
+	REP_MOVSD_METHOD,
+	// enhanced REP MOVSB/STOSB handles alignment in microcode
+	REP_MOVSB_METHOD
+};
+
+static enum MemoryMethod memoryMethod = UNKNOWN_MEMORY_METHOD;
+
+// below this size, the setup of string instructions costs more than a loop
+#define SMALL_MEMORY_SIZE (16)
+
+static int isCPUIDSupported(void){
+	uint32_t before, after;
+	__asm__ volatile(
+	"pushfl\n"
+	"pushfl\n"
+	"popl %0\n"
+	"movl %0, %1\n"
+	"xorl $0x200000, %1\n"
+	"pushl %1\n"
+	"popfl\n"
+	"pushfl\n"
+	"popl %1\n"
+	"popfl\n"
+	:"=&r"(before), "=&r"(after)
+	:
+	:"cc"
+	);
+	return ((before ^ after) & 0x200000) != 0;
+}
+
+static void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx){
+	__asm__ volatile(
+	"cpuid\n"
+	:"=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+	:"a"(leaf), "c"(0)
+	);
+}
+
+static enum MemoryMethod getMemoryMethod(void){
+	if(memoryMethod != UNKNOWN_MEMORY_METHOD){
+		return memoryMethod;
+	}
+	enum MemoryMethod m = REP_MOVSD_METHOD;
+	if(isCPUIDSupported()){
+		uint32_t maxLeaf, ebx, ecx, edx;
+		cpuid(0, &maxLeaf, &ebx, &ecx, &edx);
+		if(maxLeaf >= 7){
+			uint32_t eax;
+			cpuid(7, &eax, &ebx, &ecx, &edx);
+			// ERMS
+			if(ebx & (1 << 9)){
+				m = REP_MOVSB_METHOD;
+			}
+		}
+	}
+	memoryMethod = m;
+	return m;
+}
+
+static void repMovsb(void *dst, const void *src, size_t count){
+	__asm__ volatile("rep movsb\n":"+D"(dst), "+S"(src), "+c"(count)::"memory");
+}
+
+static void repMovsd(void *dst, const void *src, size_t count){
+	__asm__ volatile("rep movsl\n":"+D"(dst), "+S"(src), "+c"(count)::"memory");
+}
+
+static void repStosb(void *dst, uint8_t value, size_t count){
+	__asm__ volatile("rep stosb\n":"+D"(dst), "+c"(count):"a"(value):"memory");
+}
+
+static void repStosd(void *dst, uint32_t value, size_t count){
+	__asm__ volatile("rep stosl\n":"+D"(dst), "+c"(count):"a"(value):"memory");
+}
+
+static void copyMemory(uint8_t *dst, const uint8_t *src, size_t size){
+	if(size < SMALL_MEMORY_SIZE){
+		size_t i;
+		for(i = 0; i < size; i++){
+			dst[i] = src[i];
+		}
+		return;
+	}
+	if(getMemoryMethod() == REP_MOVSB_METHOD){
+		repMovsb(dst, src, size);
+		return;
+	}
+	const size_t head = ((-(uintptr_t)dst) & 3);
+	repMovsb(dst, src, head);
+	const size_t middle = ((size - head) & ~(size_t)3);
+	repMovsd(dst + head, src + head, middle / 4);
+	repMovsb(dst + head + middle, src + head + middle, size - head - middle);
+}
+
+static void setMemory(uint8_t *dst, uint8_t value, size_t size){
+	if(size < SMALL_MEMORY_SIZE){
+		size_t i;
+		for(i = 0; i < size; i++){
+			dst[i] = value;
+		}
+		return;
+	}
+	if(getMemoryMethod() == REP_MOVSB_METHOD){
+		repStosb(dst, value, size);
+		return;
+	}
+	const size_t head = ((-(uintptr_t)dst) & 3);
+	repStosb(dst, value, head);
+	const size_t middle = ((size - head) & ~(size_t)3);
+	repStosd(dst + head, value * 0x01010101u, middle / 4);
+	repStosb(dst + head + middle, value, size - head - middle);
+}
+
+#undef SMALL_MEMORY_SIZE
+
+// the volatile versions are for DMA buffers; the string instructions do not skip any access
 
 void *memset(void *ptr, unsigned char value, size_t size){
-	MEMSET(ptr, i, value, size);
+	setMemory(ptr, value, size);
+	return ptr;
 }
 
 volatile void *memset_volatile(volatile void *ptr, unsigned char value, size_t size){
-	MEMSET(ptr, i, value, size);
+	setMemory((uint8_t*)ptr, value, size);
+	return ptr;
 }
 
 void *memcpy(void *dst, const void *src, size_t size){
-	MEMSET(dst, i, ((unsigned char*)src)[i], size);
+	copyMemory(dst, src, size);
+	return dst;
 }
 
 volatile void *memcpy_volatile(volatile void *dst, volatile const void *src, size_t size){
-	MEMSET(dst, i, ((volatile unsigned char*)src)[i], size);
+	copyMemory((uint8_t*)dst, (const uint8_t*)src, size);
+	return dst;
 }
-#undef MEMSET
 
 int strlen(const char *s){
 	int len;
@@ -90,11 +90,47 @@ uintptr_t syncSeekReadFile(uintptr_t handle, void *buffer, uint64_t position, ui
 	return handle;
 }
 
-uintptr_t systemCall_seekWriteFile(uintptr_t handle, void *buffer, uint64_t position, uintptr_t bufferSize){
-	return systemCall6(SYSCALL_SEEK_READ_FILE, handle, (uintptr_t)buffer, bufferSize,
+uintptr_t systemCall_seekWriteFile(uintptr_t handle, const void *buffer, uint64_t position, uintptr_t bufferSize){
+	return systemCall6(SYSCALL_SEEK_WRITE_FILE, handle, (uintptr_t)buffer, bufferSize,
 		LOW64(position), HIGH64(position));
 }
 
+uintptr_t syncSeekWriteFile(uintptr_t handle, const void *buffer, uint64_t position, uintptr_t *bufferSize){
+	uintptr_t r;
+	r = systemCall_seekWriteFile(handle, buffer, position, *bufferSize);
+	if(r == IO_REQUEST_FAILURE)
+		return r;
+	if(r != systemCall_waitIOReturn(r, 1, bufferSize))
+		return IO_REQUEST_FAILURE;
+	return handle;
+}
+
+uintptr_t systemCall_mapFile(uintptr_t handle, uint64_t position, uintptr_t size){
+	return systemCall5(SYSCALL_MAP_FILE, handle, size, LOW64(position), HIGH64(position));
+}
+
+uintptr_t syncMapFile(uintptr_t handle, uint64_t position, void **address, uintptr_t *size){
+	uintptr_t r, mappedAddress;
+	r = systemCall_mapFile(handle, position, *size);
+	if(r == IO_REQUEST_FAILURE)
+		return r;
+	if(r != systemCall_waitIOReturn(r, 2, &mappedAddress, size))
+		return IO_REQUEST_FAILURE;
+	if(mappedAddress == UINTPTR_NULL)
+		return IO_REQUEST_FAILURE;
+	*address = (void*)mappedAddress;
+	return handle;
+}
+
+// see acceptMapFileIO in kernel/file/file.c
+#define MAPPED_FILE_PAGE_SIZE (4096)
+
+int unmapFile(const void *address){
+	return systemCall_releaseHeap((void*)FLOOR((uintptr_t)address, MAPPED_FILE_PAGE_SIZE));
+}
+
+#undef MAPPED_FILE_PAGE_SIZE
+
 uintptr_t systemCall_getFileParameter(uintptr_t handle, enum FileParameter parameterCode){
 	return systemCall3(SYSCALL_GET_FILE_PARAMETER, handle, parameterCode);
 }
@@ -145,3 +181,7 @@ uintptr_t syncSetFileParameter(uintptr_t handle, enum FileParameter paramCode, u
 		return IO_REQUEST_FAILURE;
 	return handle;
 }
+
+uintptr_t systemCall_spliceFile(uintptr_t dstHandle, uintptr_t srcHandle, uintptr_t size){
+	return systemCall4(SYSCALL_SPLICE_FILE, dstHandle, srcHandle, size);
+}
@@ -9,7 +9,11 @@ typedef union{
 	uintptr_t value;
 	struct{
 		uintptr_t enumeration: 1;
-		// uintptr_t noWrite: 1;
+		uintptr_t writable: 1;
+		// create the file if it does not exist; requires writable
+		uintptr_t createFile: 1;
+		// set the file size to 0; requires writable
+		uintptr_t truncate: 1;
 		// uintptr_t noRead: 1;
 	};
 }OpenFileMode;
@@ -31,7 +35,13 @@ enum FileParameter{
 	FILE_PARAM_DESTINATION_PORT = 0x33,
 	FILE_PARAM_TRANSMIT_ETHERTYPE = 0x36,
 	//FILE_PARAM_RECEIVE_ETHERTYPE = 37
-	FILE_PARAM_FILE_INSTANCE = 0x50
+	FILE_PARAM_FILE_INSTANCE = 0x50,
+	FILE_PARAM_NON_BLOCKING_WRITE = 0x51,
+	// write cached data to the device and wait until done; the value is ignored
+	FILE_PARAM_SYNC = 0x52,
+	// changes whenever the content of the file may have changed
+	// files that cannot be modified do not have to support it
+	FILE_PARAM_VERSION = 0x53
 };
 
 // enumerate
@@ -86,7 +96,15 @@ uintptr_t syncWriteFile(uintptr_t handle, const void *buffer, uintptr_t *bufferS
 uintptr_t systemCall_seekReadFile(uintptr_t handle, void *buffer, uint64_t position, uintptr_t bufferSize);
 uintptr_t syncSeekReadFile(uintptr_t handle, void *buffer, uint64_t position, uintptr_t *bufferSize);
 
-uintptr_t systemCall_seekWriteFile(uintptr_t handle, void *buffer, uint64_t position, uintptr_t bufferSize);
+uintptr_t systemCall_seekWriteFile(uintptr_t handle, const void *buffer, uint64_t position, uintptr_t bufferSize);
+uintptr_t syncSeekWriteFile(uintptr_t handle, const void *buffer, uint64_t position, uintptr_t *bufferSize);
+
+// the file is mapped read-only to the caller
+// the address is not page-aligned if position is not; release the pages with unmapFile
+uintptr_t systemCall_mapFile(uintptr_t handle, uint64_t position, uintptr_t size);
+// size is input & output; the mapped size is less than the input if the file ends early
+uintptr_t syncMapFile(uintptr_t handle, uint64_t position, void **address, uintptr_t *size);
+int unmapFile(const void *address);
 
 uintptr_t systemCall_getFileParameter(uintptr_t handle, enum FileParameter parameterCode);
 uintptr_t syncGetFileParameter(uintptr_t handle, enum FileParameter paramCode, uint64_t *value);
@@ -97,6 +115,10 @@ uintptr_t syncMinReadSizeOfFile(uintptr_t handle, uintptr_t *size);
 uintptr_t systemCall_setFileParameter(uintptr_t handle, enum FileParameter parameterCode, uint64_t value);
 uintptr_t syncSetFileParameter(uintptr_t handle, enum FileParameter parameterCode, uint64_t value);
 
+// move at most size bytes from the source to the destination in kernel, starting at the offset of each file
+// wait until done and return the number of bytes moved
+uintptr_t systemCall_spliceFile(uintptr_t dstHandle, uintptr_t srcHandle, uintptr_t size);
+
 uintptr_t systemCall_closeFile(uintptr_t handle);
 uintptr_t syncCloseFile(uintptr_t handle);
 
@@ -62,8 +62,116 @@ int sleep(uint64_t millisecond){
 	return 1;
 }
 
+const TimePage *systemCall_getTimePage(void){
+	return (const TimePage*)systemCall1(SYSCALL_GET_TIME_PAGE);
+}
+
+static uint64_t readTSC(void){
+	uint32_t edx, eax;
+	__asm__ volatile(
+	"rdtsc\n"
+	:"=d"(edx),"=a"(eax)
+	:
+	);
+	return COMBINE64(edx, eax);
+}
+
+uint64_t readTimePage(const TimePage *tp){
+	return tscToNanosecond(tp, readTSC());
+}
+
+uint64_t tscToNanosecond(const TimePage *tp, uint64_t tsc){
+	const uint64_t d = tsc - tp->baseTSC;
+	// avoid 64-bit multiplication overflow
+	const uint64_t low = ((uint64_t)(uint32_t)LOW64(d) * tp->multiplier) >> tp->shift;
+	const uint64_t high = ((uint64_t)(uint32_t)HIGH64(d) * tp->multiplier) << (32 - tp->shift);
+	return low + high;
+}
+
+uint64_t getMonotonicNanosecond(void){
+	// this file is also linked into the kernel, where getClockNanosecond should be used instead
+	// the cache is only for user space, in which every task maps the page at the same address
+	uint16_t cs;
+	__asm__("mov %%cs, %0\n":"=r"(cs));
+	if((cs & 3) == 0){
+		return readTimePage(systemCall_getTimePage());
+	}
+	static const TimePage *timePage = NULL;
+	if(timePage == NULL){
+		timePage = systemCall_getTimePage();
+	}
+	return readTimePage(timePage);
+}
+
 uint64_t systemCall_getTime(void){
 	uintptr_t v[5];
 	v[0] = systemCall6Return(SYSCALL_GET_TIME, v + 1, v + 2, v + 3, v + 4, v + 5);
 	return COMBINE64(v[1], v[0]);
 }
+
+IORingPage *systemCall_setupIORing(void){
+	return (IORingPage*)systemCall1(SYSCALL_SETUP_IO_RING);
+}
+
+uintptr_t systemCall_enterIORing(uintptr_t waitCount){
+	return systemCall2(SYSCALL_ENTER_IO_RING, waitCount);
+}
+
+static int pushIORingSubmission(
+	IORingPage *r, uintptr_t userData, enum SystemCall systemCall,
+	uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t arg4
+){
+	const uint32_t tail = r->submissionTail;
+	if(tail - r->submissionHead >= IO_RING_ENTRY_COUNT){
+		return 0;
+	}
+	volatile IORingSubmission *s = r->submission + tail % IO_RING_ENTRY_COUNT;
+	s->userData = userData;
+	s->systemCall = systemCall;
+	s->argument[0] = arg0;
+	s->argument[1] = arg1;
+	s->argument[2] = arg2;
+	s->argument[3] = arg3;
+	s->argument[4] = arg4;
+	r->submissionTail = tail + 1;
+	return 1;
+}
+
+int ioRingReadFile(IORingPage *r, uintptr_t userData, uintptr_t handle, void *buffer, uintptr_t bufferSize){
+	return pushIORingSubmission(r, userData, SYSCALL_READ_FILE, handle, (uintptr_t)buffer, bufferSize, 0, 0);
+}
+
+int ioRingWriteFile(IORingPage *r, uintptr_t userData, uintptr_t handle, const void *buffer, uintptr_t bufferSize){
+	return pushIORingSubmission(r, userData, SYSCALL_WRITE_FILE, handle, (uintptr_t)buffer, bufferSize, 0, 0);
+}
+
+int ioRingSeekReadFile(IORingPage *r, uintptr_t userData,
+	uintptr_t handle, void *buffer, uint64_t position, uintptr_t bufferSize){
+	return pushIORingSubmission(r, userData, SYSCALL_SEEK_READ_FILE, handle, (uintptr_t)buffer, bufferSize,
+		LOW64(position), HIGH64(position));
+}
+
+int ioRingSeekWriteFile(IORingPage *r, uintptr_t userData,
+	uintptr_t handle, const void *buffer, uint64_t position, uintptr_t bufferSize){
+	return pushIORingSubmission(r, userData, SYSCALL_SEEK_WRITE_FILE, handle, (uintptr_t)buffer, bufferSize,
+		LOW64(position), HIGH64(position));
+}
+
+int ioRingSetAlarm(IORingPage *r, uintptr_t userData, uint64_t millisecond){
+	return pushIORingSubmission(r, userData, SYSCALL_SET_ALARM, LOW64(millisecond), HIGH64(millisecond), 0, 0, 0);
+}
+
+int reapIORing(IORingPage *r, IORingCompletion *c){
+	const uint32_t head = r->completionHead;
+	if(head == r->completionTail){
+		return 0;
+	}
+	const volatile IORingCompletion *rc = r->completion + head % IO_RING_ENTRY_COUNT;
+	c->userData = rc->userData;
+	int i;
+	for(i = 0; i < SYSTEM_CALL_MAX_RETURN_COUNT; i++){
+		c->returnValues[i] = rc->returnValues[i];
+	}
+	r->completionHead = head + 1;
+	return 1;
+}
@@ -1,6 +1,8 @@
 #ifndef IO_H_INCLUDED
 #define IO_H_INCLUDED
 
+#include"systemcall.h"
+
 #define IO_REQUEST_FAILURE ((uintptr_t)0)
 
 uintptr_t systemCall_setAlarm(uint64_t millisecond, int isPeriodic);
@@ -13,4 +15,70 @@ uintptr_t systemCall_waitIOReturn(uintptr_t ioNumber, int returnCount, ...);
 int systemCall_cancelIO(uintptr_t io);
 int cancelOrWaitIO(uintptr_t io);
 
+// read-only page mapped in every user space
+// nanosecond = ((rdtsc - baseTSC) * multiplier) >> shift
+typedef struct TimePage{
+	uint64_t baseTSC;
+	uint64_t tscFrequency;
+	uint32_t multiplier;
+	uint32_t shift;
+}TimePage;
+
+const TimePage *systemCall_getTimePage(void);
+
+// records read from debug:profile
+typedef struct ProfileSample{
+	uint32_t eip, cs;
+	uint32_t task;
+	uint32_t processorIndex;
+}ProfileSample;
+uint64_t readTimePage(const TimePage *tp);
+// convert a recorded TSC value to nanoseconds since boot
+uint64_t tscToNanosecond(const TimePage *tp, uint64_t tsc);
+// nanoseconds since boot; only the first call is a system call
+uint64_t getMonotonicNanosecond(void);
+
+// per-task submission and completion rings shared with kernel
+// user writes submissionTail and completionHead; kernel writes submissionHead and completionTail
+// only read, write, seek read, seek write, get/set parameter and one-shot alarm are accepted
+#define IO_RING_ENTRY_COUNT (64)
+
+typedef struct IORingSubmission{
+	uintptr_t userData;
+	uintptr_t systemCall;
+	uintptr_t argument[SYSTEM_CALL_MAX_ARGUMENT_COUNT];
+}IORingSubmission;
+
+typedef struct IORingCompletion{
+	uintptr_t userData;
+	// returnValues[0] is the I/O number or IO_REQUEST_FAILURE, as returned by systemCall_waitIOReturn
+	uintptr_t returnValues[SYSTEM_CALL_MAX_RETURN_COUNT];
+}IORingCompletion;
+
+typedef struct IORingPage{
+	volatile uint32_t submissionTail;
+	volatile uint32_t completionHead;
+	volatile uint32_t submissionHead;
+	volatile uint32_t completionTail;
+	volatile IORingSubmission submission[IO_RING_ENTRY_COUNT];
+	volatile IORingCompletion completion[IO_RING_ENTRY_COUNT];
+}IORingPage;
+
+// return NULL if failed; the rings are created at the first call
+IORingPage *systemCall_setupIORing(void);
+// submit all queued requests and wait until waitCount completions are ready or nothing is pending
+// completions are written to the ring only in this call
+// return the number of submitted requests
+uintptr_t systemCall_enterIORing(uintptr_t waitCount);
+// return 0 if the submission ring is full
+int ioRingReadFile(IORingPage *r, uintptr_t userData, uintptr_t handle, void *buffer, uintptr_t bufferSize);
+int ioRingWriteFile(IORingPage *r, uintptr_t userData, uintptr_t handle, const void *buffer, uintptr_t bufferSize);
+int ioRingSeekReadFile(IORingPage *r, uintptr_t userData,
+	uintptr_t handle, void *buffer, uint64_t position, uintptr_t bufferSize);
+int ioRingSeekWriteFile(IORingPage *r, uintptr_t userData,
+	uintptr_t handle, const void *buffer, uint64_t position, uintptr_t bufferSize);
+int ioRingSetAlarm(IORingPage *r, uintptr_t userData, uint64_t millisecond);
+// return 0 if no completion is ready; does not enter kernel
+int reapIORing(IORingPage *r, IORingCompletion *c);
+
 #endif
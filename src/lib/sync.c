@@ -0,0 +1,156 @@
+#include"systemcall.h"
+#include"sync.h"
+
+int systemCall_waitAddress(volatile uint32_t *address, uint32_t expectedValue){
+	return (int)systemCall3(SYSCALL_WAIT_ADDRESS, (uintptr_t)address, expectedValue);
+}
+
+int systemCall_wakeAddress(volatile uint32_t *address, uint32_t wakeCount){
+	return (int)systemCall3(SYSCALL_WAKE_ADDRESS, (uintptr_t)address, wakeCount);
+}
+
+static uint32_t compareExchange(volatile uint32_t *a, uint32_t cmp, uint32_t v){
+	__asm__ volatile(
+	"lock cmpxchg %2, %1\n"
+	:"+a"(cmp), "+m"(*a)
+	:"r"(v)
+	:"memory"
+	);
+	return cmp;
+}
+
+static uint32_t exchange(volatile uint32_t *a, uint32_t v){
+	__asm__ volatile(
+	"xchg %0, %1\n"
+	:"+r"(v), "+m"(*a)
+	:
+	:"memory"
+	);
+	return v;
+}
+
+static uint32_t fetchAndAdd(volatile uint32_t *a, uint32_t v){
+	__asm__ volatile(
+	"lock xadd %0, %1\n"
+	:"+r"(v), "+m"(*a)
+	:
+	:"memory"
+	);
+	return v;
+}
+
+// Mutex
+
+void initMutex(Mutex *m){
+	m->state = 0;
+}
+
+int tryAcquireMutex(Mutex *m){
+	return compareExchange(&m->state, 0, 1) == 0;
+}
+
+void acquireMutex(Mutex *m){
+	uint32_t s = compareExchange(&m->state, 0, 1);
+	if(s == 0){
+		return;
+	}
+	// mark contended before sleeping so that the owner wakes someone
+	if(s != 2){
+		s = exchange(&m->state, 2);
+	}
+	while(s != 0){
+		systemCall_waitAddress(&m->state, 2);
+		s = exchange(&m->state, 2);
+	}
+}
+
+void releaseMutex(Mutex *m){
+	if(fetchAndAdd(&m->state, (uint32_t)-1) != 1){
+		m->state = 0;
+		systemCall_wakeAddress(&m->state, 1);
+	}
+}
+
+// ConditionVariable
+
+void initConditionVariable(ConditionVariable *c){
+	c->sequence = 0;
+	c->waiterCount = 0;
+}
+
+void waitConditionVariable(ConditionVariable *c, Mutex *m){
+	const uint32_t s = c->sequence;
+	fetchAndAdd(&c->waiterCount, 1);
+	releaseMutex(m);
+	systemCall_waitAddress(&c->sequence, s);
+	fetchAndAdd(&c->waiterCount, (uint32_t)-1);
+	// other waiters may be woken by broadcast
+	while(exchange(&m->state, 2) != 0){
+		systemCall_waitAddress(&m->state, 2);
+	}
+}
+
+static void wakeConditionVariable(ConditionVariable *c, uint32_t wakeCount){
+	fetchAndAdd(&c->sequence, 1);
+	if(c->waiterCount != 0){
+		systemCall_wakeAddress(&c->sequence, wakeCount);
+	}
+}
+
+void signalConditionVariable(ConditionVariable *c){
+	wakeConditionVariable(c, 1);
+}
+
+void broadcastConditionVariable(ConditionVariable *c){
+	wakeConditionVariable(c, 0xffffffff);
+}
+
+// ReadWriteMutex
+
+void initReadWriteMutex(ReadWriteMutex *rw){
+	initMutex(&rw->mutex);
+	initConditionVariable(&rw->readerCondition);
+	initConditionVariable(&rw->writerCondition);
+	rw->readerCount = 0;
+	rw->writerCount = 0;
+	rw->waitingWriterCount = 0;
+}
+
+void acquireReadMutex(ReadWriteMutex *rw){
+	acquireMutex(&rw->mutex);
+	while(rw->writerCount != 0 || rw->waitingWriterCount != 0){
+		waitConditionVariable(&rw->readerCondition, &rw->mutex);
+	}
+	rw->readerCount++;
+	releaseMutex(&rw->mutex);
+}
+
+void acquireWriteMutex(ReadWriteMutex *rw){
+	acquireMutex(&rw->mutex);
+	rw->waitingWriterCount++;
+	while(rw->writerCount != 0 || rw->readerCount != 0){
+		waitConditionVariable(&rw->writerCondition, &rw->mutex);
+	}
+	rw->waitingWriterCount--;
+	rw->writerCount++;
+	releaseMutex(&rw->mutex);
+}
+
+void releaseReadWriteMutex(ReadWriteMutex *rw){
+	acquireMutex(&rw->mutex);
+	if(rw->writerCount != 0){
+		rw->writerCount--;
+	}
+	else{
+		rw->readerCount--;
+	}
+	if(rw->readerCount == 0 && rw->writerCount == 0){
+		if(rw->waitingWriterCount != 0){
+			signalConditionVariable(&rw->writerCondition);
+		}
+		else{
+			broadcastConditionVariable(&rw->readerCondition);
+		}
+	}
+	releaseMutex(&rw->mutex);
+}
@@ -0,0 +1,51 @@
+#ifndef SYNC_H_INCLUDED
+#define SYNC_H_INCLUDED
+
+#include"std.h"
+
+// block if *address == expectedValue
+// return 1 if woken up; return 0 if *address != expectedValue
+int systemCall_waitAddress(volatile uint32_t *address, uint32_t expectedValue);
+// return number of woken tasks
+int systemCall_wakeAddress(volatile uint32_t *address, uint32_t wakeCount);
+
+// the following locks enter kernel only if they are contended
+// they can be placed in memory shared by user spaces
+
+typedef struct Mutex{
+	// 0 = unlocked, 1 = locked, 2 = locked and may have waiters
+	volatile uint32_t state;
+}Mutex;
+
+#define INITIAL_MUTEX {0}
+void initMutex(Mutex *m);
+int tryAcquireMutex(Mutex *m);
+void acquireMutex(Mutex *m);
+void releaseMutex(Mutex *m);
+
+typedef struct ConditionVariable{
+	volatile uint32_t sequence;
+	volatile uint32_t waiterCount;
+}ConditionVariable;
+
+#define INITIAL_CONDITION_VARIABLE {0, 0}
+void initConditionVariable(ConditionVariable *c);
+// m is released while waiting and acquired before return
+void waitConditionVariable(ConditionVariable *c, Mutex *m);
+void signalConditionVariable(ConditionVariable *c);
+void broadcastConditionVariable(ConditionVariable *c);
+
+// writers go first if any is waiting
+typedef struct ReadWriteMutex{
+	Mutex mutex;
+	ConditionVariable readerCondition, writerCondition;
+	uint32_t readerCount, writerCount, waitingWriterCount;
+}ReadWriteMutex;
+
+#define INITIAL_READ_WRITE_MUTEX {INITIAL_MUTEX, INITIAL_CONDITION_VARIABLE, INITIAL_CONDITION_VARIABLE, 0, 0, 0}
+void initReadWriteMutex(ReadWriteMutex *rw);
+void acquireReadMutex(ReadWriteMutex *rw);
+void acquireWriteMutex(ReadWriteMutex *rw);
+void releaseReadWriteMutex(ReadWriteMutex *rw);
+
+#endif
@@ -96,6 +96,24 @@ void systemCall_terminate(void){
 	systemCall1(SYSCALL_TERMINATE);
 }
 
+uint32_t systemCall_setTaskWeight(uint32_t weight){
+	return systemCall2(SYSCALL_SET_TASK_WEIGHT, weight);
+}
+
+uint32_t systemCall_setTaskAffinity(uint32_t affinity){
+	return systemCall2(SYSCALL_SET_TASK_AFFINITY, affinity);
+}
+
+uint64_t systemCall_getTaskTime(void){
+	uintptr_t v[5];
+	v[0] = systemCall6Return(SYSCALL_GET_TASK_TIME, v + 1, v + 2, v + 3, v + 4, v + 5);
+	return COMBINE64(v[1], v[0]);
+}
+
 uintptr_t systemCall_createUserThread(void(*entry)(void), uintptr_t stackSize){
 	return systemCall3(SYSCALL_CREATE_USER_THREAD, (uintptr_t)entry, stackSize);
 }
+
+uintptr_t systemCall_cloneUserSpace(void(*entry)(void), uintptr_t stackSize){
+	return systemCall3(SYSCALL_CLONE_USER_SPACE, (uintptr_t)entry, stackSize);
+}
@@ -11,31 +11,39 @@ enum SystemCall{
 	SYSCALL_TASK_DEFINED = 1,
 	SYSCALL_ACQUIRE_SEMAPHORE = 2,
 	SYSCALL_RELEASE_SEMAPHORE = 3,
-	//SYSCALL_REGISTER_SERVICE = 4,
+	SYSCALL_SET_TASK_WEIGHT = 4,
 	SYSCALL_QUERY_SERVICE = 5,
 	SYSCALL_WAIT_IO = 6,
 	SYSCALL_CANCEL_IO = 7,
 	SYSCALL_ALLOCATE_HEAP = 8,
 	SYSCALL_RELEASE_HEAP = 9,
 	SYSCALL_TRANSLATE_PAGE = 10,
-	//SYSCALL_REGISTER_RESOURCE = 11,
+	SYSCALL_GET_TASK_TIME = 11,
 	SYSCALL_DISCOVER_RESOURCE = 12,
-	//SYSCALL_CREATE_USER_SPACE = 13, CREATE_PROCESS
+	SYSCALL_CLONE_USER_SPACE = 13,
 	SYSCALL_CREATE_USER_THREAD = 14,
 	SYSCALL_TERMINATE = 15,
 	SYSCALL_SET_ALARM = 16,
 	SYSCALL_GET_TIME = 17,
+	SYSCALL_GET_TIME_PAGE = 18,
+	SYSCALL_SETUP_IO_RING = 19,
+	SYSCALL_ENTER_IO_RING = 21,
+	SYSCALL_WAIT_ADDRESS = 22,
+	SYSCALL_WAKE_ADDRESS = 23,
 	// file
 	SYSCALL_OPEN_FILE = 20,
 	SYSCALL_CLOSE_FILE = 24,
 	SYSCALL_READ_FILE = 25,
 	SYSCALL_WRITE_FILE = 26,
+	SYSCALL_MAP_FILE = 27,
 	SYSCALL_SEEK_READ_FILE = 28,
 	SYSCALL_SEEK_WRITE_FILE = 29,
 	SYSCALL_GET_FILE_PARAMETER = 30,
 	SYSCALL_SET_FILE_PARAMETER = 31,
+	SYSCALL_SET_TASK_AFFINITY = 32,
+	SYSCALL_SPLICE_FILE = 33,
 	// runtime registration
-	NUMBER_OF_RESERVED_SYSTEM_CALLS = 32,
+	NUMBER_OF_RESERVED_SYSTEM_CALLS = 40,
 	NUMBER_OF_SYSTEM_CALLS = 64
 };
 #define SYSCALL_SERVICE_BEGIN ((int)NUMBER_OF_RESERVED_SYSTEM_CALLS)
@@ -83,6 +91,16 @@ uint64_t systemCall_getTime(void);
 // return task id if succeeded
 // task id is an address in kernel space. we haven't defined the usage yet
 uintptr_t systemCall_createUserThread(void (*entry)(void), uintptr_t stackSize);
+// same as above, but the new thread runs in a copy-on-write clone of the current user space
+// opened files are not shared
+uintptr_t systemCall_cloneUserSpace(void (*entry)(void), uintptr_t stackSize);
 void systemCall_terminate(void);
+// weight of the current task. user tasks may only lower it
+// return the old weight, or 0 if failed
+uint32_t systemCall_setTaskWeight(uint32_t weight);
+// pin the current task to the processors in the bit mask. return the old mask, or 0 if failed
+uint32_t systemCall_setTaskAffinity(uint32_t affinity);
+// processor time of the current task in nanoseconds
+uint64_t systemCall_getTaskTime(void);
 
 #endif
@@ -0,0 +1,214 @@
+#include"systemcall.h"
+#include"file.h"
+#include"io.h"
+#include"common.h"
+
+// read debug:profile for a few seconds and count the kernel samples by function
+// enable sampling with the console command "profile"
+// symbols are read from the linked kernel (kernel.o) copied to the disk
+
+#define KERNEL_SYMBOL_FILE "fat:C/KERNEL.ELF"
+#define MAX_SAMPLE_COUNT (4096)
+#define READ_ROUND_COUNT (50)
+#define READ_INTERVAL (100)
+#define PRINT_FUNCTION_COUNT (16)
+
+typedef struct{
+	uint8_t identifier[16];
+	uint16_t type, machine;
+	uint32_t version, entry, programHeaderOffset, sectionHeaderOffset, flags;
+	uint16_t headerSize, programHeaderSize, programHeaderCount;
+	uint16_t sectionHeaderSize, sectionHeaderCount, sectionNameIndex;
+}__attribute__((__packed__)) ELFHeader32;
+
+#define SECTION_SYMBOL_TABLE (2)
+
+typedef struct{
+	uint32_t name, type, flags, address, offset, size, link, info, align, entrySize;
+}__attribute__((__packed__)) SectionHeader32;
+
+#define SYMBOL_FUNCTION (2)
+
+typedef struct{
+	uint32_t name, value, size;
+	uint8_t info, other;
+	uint16_t sectionIndex;
+}__attribute__((__packed__)) Symbol32;
+
+typedef struct{
+	uintptr_t symbolCount;
+	Symbol32 *symbol;
+	uintptr_t stringSize;
+	char *string;
+}SymbolTable;
+
+static uintptr_t console = IO_REQUEST_FAILURE;
+
+static void printString(const char *s){
+	uintptr_t writeSize = strlen(s);
+	syncWriteFile(console, s, &writeSize);
+}
+
+static void printUnsigned(uint32_t value, uint32_t base){
+	char buffer[12];
+	int i = LENGTH_OF(buffer) - 1;
+	buffer[i] = '\0';
+	do{
+		i--;
+		buffer[i] = "0123456789abcdef"[value % base];
+		value /= base;
+	}while(value != 0);
+	printString(buffer + i);
+}
+
+static int seekReadFully(uintptr_t handle, void *buffer, uint64_t position, uintptr_t size){
+	uintptr_t offset = 0;
+	while(offset < size){
+		uintptr_t readSize = size - offset;
+		uintptr_t r = syncSeekReadFile(handle, ((uint8_t*)buffer) + offset, position + offset, &readSize);
+		if(r == IO_REQUEST_FAILURE || readSize == 0){
+			return 0;
+		}
+		offset += readSize;
+	}
+	return 1;
+}
+
+static void *allocateAndRead(uintptr_t handle, uint64_t position, uintptr_t size){
+	void *buffer = systemCall_allocateHeap(CEIL(MAX(size, 1), 4096), USER_WRITABLE_PAGE);
+	EXPECT(buffer != NULL);
+	EXPECT(seekReadFully(handle, buffer, position, size));
+	return buffer;
+	ON_ERROR;
+	systemCall_releaseHeap(buffer);
+	ON_ERROR;
+	return NULL;
+}
+
+// read the first symbol table section
+static int loadSymbolTable(SymbolTable *st, const char *fileName){
+	uintptr_t f = syncOpenFileN(fileName, strlen(fileName), OPEN_FILE_MODE_0);
+	EXPECT(f != IO_REQUEST_FAILURE);
+	ELFHeader32 h;
+	EXPECT(seekReadFully(f, &h, 0, sizeof(h)));
+	EXPECT(h.identifier[0] == 0x7f && h.identifier[1] == 'E' && h.identifier[2] == 'L' && h.identifier[3] == 'F' &&
+		h.sectionHeaderSize == sizeof(SectionHeader32));
+	SectionHeader32 *section = allocateAndRead(f, h.sectionHeaderOffset, h.sectionHeaderCount * sizeof(*section));
+	EXPECT(section != NULL);
+	uintptr_t i;
+	for(i = 0; i < h.sectionHeaderCount && section[i].type != SECTION_SYMBOL_TABLE; i++);
+	EXPECT(i < h.sectionHeaderCount && section[i].link < h.sectionHeaderCount);
+	const SectionHeader32 *stringSection = section + section[i].link;
+	st->symbolCount = section[i].size / sizeof(Symbol32);
+	st->symbol = allocateAndRead(f, section[i].offset, st->symbolCount * sizeof(Symbol32));
+	EXPECT(st->symbol != NULL);
+	st->stringSize = stringSection->size;
+	st->string = allocateAndRead(f, stringSection->offset, st->stringSize);
+	EXPECT(st->string != NULL);
+	systemCall_releaseHeap(section);
+	syncCloseFile(f);
+	return 1;
+	// systemCall_releaseHeap(st->string);
+	ON_ERROR;
+	systemCall_releaseHeap(st->symbol);
+	ON_ERROR;
+	ON_ERROR;
+	systemCall_releaseHeap(section);
+	ON_ERROR;
+	ON_ERROR;
+	ON_ERROR;
+	syncCloseFile(f);
+	ON_ERROR;
+	st->symbolCount = 0;
+	return 0;
+}
+
+static uintptr_t findFunction(const SymbolTable *st, uint32_t address){
+	uintptr_t i;
+	for(i = 0; i < st->symbolCount; i++){
+		const Symbol32 *s = st->symbol + i;
+		if((s->info & 0xf) == SYMBOL_FUNCTION && address - s->value < s->size && s->name < st->stringSize){
+			break;
+		}
+	}
+	return i;
+}
+
+static uintptr_t readSamples(ProfileSample *sample){
+	uintptr_t sampleCount = 0;
+	int round;
+	for(round = 0; round < READ_ROUND_COUNT && sampleCount < MAX_SAMPLE_COUNT; round++){
+		uintptr_t f = syncOpenFileN("debug:profile", strlen("debug:profile"), OPEN_FILE_MODE_0);
+		if(f == IO_REQUEST_FAILURE){
+			break;
+		}
+		uintptr_t readSize = (MAX_SAMPLE_COUNT - sampleCount) * sizeof(*sample);
+		uintptr_t r = syncReadFile(f, sample + sampleCount, &readSize);
+		if(r != IO_REQUEST_FAILURE){
+			sampleCount += readSize / sizeof(*sample);
+		}
+		syncCloseFile(f);
+		sleep(READ_INTERVAL);
+	}
+	return sampleCount;
+}
+
+int main(int argc, char *argv[]){
+	console = syncOpenFileN("console:", strlen("console:"), OPEN_FILE_MODE_0);
+	EXPECT(console != IO_REQUEST_FAILURE);
+	ProfileSample *sample = systemCall_allocateHeap(MAX_SAMPLE_COUNT * sizeof(*sample), USER_WRITABLE_PAGE);
+	EXPECT(sample != NULL);
+	const uintptr_t sampleCount = readSamples(sample);
+	if(sampleCount == 0){
+		printString("no samples; enable the profiler with the console command \"profile\"\n");
+	}
+	SymbolTable st = {0, NULL, 0, NULL};
+	if(loadSymbolTable(&st, KERNEL_SYMBOL_FILE) == 0){
+		printString("cannot read symbols from " KERNEL_SYMBOL_FILE "\n");
+	}
+	// the last entry counts the kernel samples not in any function
+	uint32_t *hit = systemCall_allocateHeap(CEIL((st.symbolCount + 1) * sizeof(*hit), 4096), USER_WRITABLE_PAGE);
+	EXPECT(hit != NULL);
+	memset(hit, 0, (st.symbolCount + 1) * sizeof(*hit));
+	uintptr_t userCount = 0, i;
+	for(i = 0; i < sampleCount; i++){
+		if((sample[i].cs & 3) != 0){
+			userCount++;
+			continue;
+		}
+		hit[findFunction(&st, sample[i].eip)]++;
+	}
+	printUnsigned(sampleCount, 10);
+	printString(" samples, ");
+	printUnsigned(userCount, 10);
+	printString(" in user space, ");
+	printUnsigned(hit[st.symbolCount], 10);
+	printString(" in unknown kernel code\n");
+	int p;
+	for(p = 0; p < PRINT_FUNCTION_COUNT; p++){
+		uintptr_t maxIndex = 0;
+		for(i = 1; i < st.symbolCount; i++){
+			if(hit[i] > hit[maxIndex]){
+				maxIndex = i;
+			}
+		}
+		if(st.symbolCount == 0 || hit[maxIndex] == 0){
+			break;
+		}
+		printUnsigned(hit[maxIndex], 10);
+		printString(" ");
+		printString(st.string + st.symbol[maxIndex].name);
+		printString(" ");
+		printUnsigned(st.symbol[maxIndex].value, 16);
+		printString("\n");
+		hit[maxIndex] = 0;
+	}
+	systemCall_releaseHeap(hit);
+	ON_ERROR;
+	systemCall_releaseHeap(sample);
+	ON_ERROR;
+	syncCloseFile(console);
+	ON_ERROR;
+	systemCall_terminate();
+	return 0;
+}